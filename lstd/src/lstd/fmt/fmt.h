@@ -123,6 +123,33 @@ struct formatter<stack_array<T, N>> {
     void format(const stack_array<T, N> &src, fmt_context *f) { format_list(f).entries(src.Data, src.Count)->finish(); }
 };
 
+// Formats allocator stats in the following way:
+//     allocator_stats { AllocationCount: 10, FreeCount: 4, FailedCount: 0, LiveBytes: 320, PeakBytes: 512, AllocatedBytes: 800, SizeHistogram: [32..63: 6, 64..127: 4] }
+// Only non-empty buckets of the histogram are printed.
+template <>
+struct formatter<allocator_stats> {
+    void format(const allocator_stats &src, fmt_context *f) {
+        auto *old = f->Specs;
+        f->Specs = null;
+
+        fmt_to_writer(f, "allocator_stats {{ AllocationCount: {}, FreeCount: {}, FailedCount: {}, LiveBytes: {}, PeakBytes: {}, AllocatedBytes: {}, SizeHistogram: [",
+                      src.AllocationCount, src.FreeCount, src.FailedCount, src.LiveBytes, src.PeakBytes, src.AllocatedBytes);
+
+        bool first = true;
+        For(range(ALLOCATOR_STATS_SIZE_CLASSES)) {
+            if (!src.SizeHistogram[it]) continue;
+
+            if (!first) write_no_specs(f, ", ");
+            first = false;
+
+            fmt_to_writer(f, "{}..{}: {}", 1ll << it, (2ll << it) - 1, src.SizeHistogram[it]);
+        }
+        write_no_specs(f, "] }");
+
+        f->Specs = old;
+    }
+};
+
 template <>
 struct formatter<thread::id> {
     void format(thread::id src, fmt_context *f) { write(f, src.Value); }
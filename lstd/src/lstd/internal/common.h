@@ -2,11 +2,13 @@
 
 /// A header which provides type definitions as well as other helper macros
 
-#include <intrin.h>
-
 #include "../types.h"
 #include "debug_break.h"
 
+#if COMPILER == MSVC
+#include <intrin.h>
+#endif
+
 //
 // Provides replacements for the math functions found in virtually all standard libraries.
 // Also provides functions for extended precision arithmetic, statistical functions, physics, astronomy, etc.
@@ -399,6 +401,13 @@ constexpr void *const_copy_memory(void *dst, const void *src, u64 size) {
 
 extern void *(*fill_memory)(void *dst, char value, u64 size);
 constexpr void *const_fill_memory(void *dst, char value, u64 size) {
+    if (is_constant_evaluated()) {
+        // The word-sized stores below reinterpret the pointer, which isn't allowed at compile time
+        auto *b = (char *) dst;
+        while (size--) *b++ = value;
+        return dst;
+    }
+
     u64 uValue     = (u64) value;
     u64 largeValue = uValue << 56 | uValue << 48 | uValue << 40 | uValue << 32 | uValue << 24 | uValue << 16 | uValue << 8 | uValue;
 
@@ -473,6 +482,13 @@ constexpr always_inline s32 msb(T x) {
                 unsigned long r = 0;
                 return _BitScanReverse(&r, x) ? ((s32) r) : -1;
             }
+#else
+            if (!x) return -1;
+            if constexpr (sizeof(T) == 8) {
+                return 63 - __builtin_clzll(x);
+            } else {
+                return 31 - __builtin_clz(x);
+            }
 #endif
         }
     }
@@ -502,6 +518,13 @@ constexpr always_inline s32 lsb(types::is_unsigned_integral auto x) {
                 unsigned long r = 0;
                 return _BitScanForward(&r, x) ? ((s32) r) : -1;
             }
+#else
+            if (!x) return -1;
+            if constexpr (sizeof(x) == 8) {
+                return __builtin_ctzll(x);
+            } else {
+                return __builtin_ctz(x);
+            }
 #endif
         }
     }
@@ -648,10 +671,39 @@ always_inline constexpr T atomic_compare_and_swap(T *ptr, T exchange, T comperan
     if constexpr (sizeof(T) == 4) return (T) _InterlockedCompareExchange((volatile long *) ptr, exchange, comperand);
     if constexpr (sizeof(T) == 8) return (T) _InterlockedCompareExchange64((volatile long long *) ptr, exchange, comperand);
 }
+
+// Reads a value which other threads write atomically, without a locked instruction (unlike atomic_compare_and_swap(&value, 0, 0)),
+// so many threads can read the same cache line without fighting over it.
+// MSVC's volatile loads have acquire semantics on x86/x64 (/volatile:ms): no later load is moved before this one.
+template <appropriate_for_atomic T>
+always_inline T atomic_load(const T *ptr) {
+    return *(const volatile T *) ptr;
+}
 #else
-#define atomic_inc(ptr) __sync_add_and_fetch((ptr), 1)
-#define atomic_inc_64(ptr) __sync_add_and_fetch((ptr), 1)
-#error Some atomic operations not implemented
+// GCC and Clang builtins, with the same semantics as the MSVC intrinsics above (sequentially consistent, full barriers).
+
+// Returns the incremented value (like _InterlockedIncrement)
+template <appropriate_for_atomic T>
+always_inline T atomic_inc(T *ptr) { return __atomic_add_fetch(ptr, 1, __ATOMIC_SEQ_CST); }
+
+// Returns the initial value in _ptr_
+template <appropriate_for_atomic T>
+always_inline T atomic_add(T *ptr, T value) { return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST); }
+
+// Returns the old value in _ptr_
+template <appropriate_for_atomic T>
+always_inline T atomic_swap(T *ptr, T value) { return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST); }
+
+// Returns the old value in _ptr_, exchanges values only if the old value is equal to comperand.
+template <appropriate_for_atomic T>
+always_inline T atomic_compare_and_swap(T *ptr, T exchange, T comperand) {
+    __atomic_compare_exchange_n(ptr, &comperand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comperand;  // Holds the old value whether the exchange happened or not
+}
+
+// Reads a value which other threads write atomically, without a locked instruction (see the MSVC version above)
+template <appropriate_for_atomic T>
+always_inline T atomic_load(const T *ptr) { return __atomic_load_n(ptr, __ATOMIC_ACQUIRE); }
 #endif
 
 // Function for swapping endianness. You can check for the endianness by using #if ENDIAN = LITTLE_ENDIAN, etc.
@@ -33,7 +33,7 @@ struct context {
     // :TemporaryAllocator: Take a look at the docs of this allocator in "allocator.h"
     // (or the allocator module if you are living in the future).
     //
-    // We store a arena allocator in the Context that is meant to be used as temporary storage.
+    // We store an arena allocator in the Context that is meant to be used as temporary storage.
     // It can be used to allocate memory that is not meant to last long (e.g. returning arrays or strings from functions
     // that don't need to last long and you shouldn't worry about freeing it - e.g. converting utf8 to utf16 to pass to a windows call).
     //
@@ -44,11 +44,8 @@ struct context {
     //
     // This gets initialized the first time it gets used in a thread.
     // Each thread gets a unique temporary allocator to prevent data races and to remain fast.
-    // Default size is 8 KiB but you can increase that by adding a pool with allocator_add_pool().
-    // When out of memory, it allocates and adds a new bigger pool.
-    //
-    // We print warnings when allocating new pools. Use that as a guide to see where you need to pay more attention
-    // - perhaps increase the pool size or call free_all() more often.
+    // It reserves a large range of address space and commits memory as it's used (see virtual_arena_allocator),
+    // so it doesn't have a fixed size. Call free_all() often anyway, so the memory gets reused while it's hot in the cache.
     //
     allocator TempAlloc;
 
@@ -72,8 +69,8 @@ struct context {
     // then threads that were not created with this library would not get the same allocator.
     //
     // *** Caveat: For libraries that call malloc/free directly (we override just new/delete) we can't force to use our allocator.
-    // It might be possible to do linker hacks and provide a drop-out replacement version of malloc/free in the future, but for
-    // now we DON'T do that. @TODO @Robustness @Platform
+    // On Linux we replace the malloc family (see posix_malloc.cpp), so these at least go to a thread-caching TLSF allocator
+    // instead of the C library's heap - but not to the Context's allocator. On Windows we DON'T do that yet. @TODO @Robustness @Platform
     //
     ///////////////////////////////////////////////////////////////////////////////////////
 
@@ -100,6 +97,12 @@ struct context {
     // e.g. using the LEAK flag, you can mark the allocations done in a whole scope as leaks (don't get reported when calling DEBUG_memory->report_leaks()).
     u64 AllocOptions = 0;
 
+    // Allocations at least this many bytes large (0 means never) which would go to _Alloc_ get their own pages from the OS
+    // instead, see os_allocator. Reallocating such a block to a larger size remaps the pages instead of copying them (on Linux).
+    // Allocators passed explicitly, _TempAlloc_ and anything that may implement FREE_ALL (arenas, pools, the buddy allocator,
+    // your own allocators) are never bypassed (free_all() wouldn't free those blocks), only tlsf, thread_cache and thread_heap are.
+    s64 LargeAllocThreshold = 0;
+
     bool LogAllAllocations = false;  // Used for debugging. Every time an allocation is made, logs info about it.
 
     // Gets called when the program encounters an unhandled expection.
@@ -141,12 +144,18 @@ struct context {
 // even though you may not want that ... the author of the library may still be able to do that maliciously
 // with a const cast but he can also do 1000 different things that completely break your program so...
 // at least this way we are sure it's not a bug).
-inline const thread_local context Context;
+inline const thread_local context Context{};
 
 // We store this outside the context because having a member point to another member in the struct is dangerous.
 // It is invalidated the moment when the Context is copied. One of our points in the type policy says that
 // stuff should work if it is copied byte by byte.
-inline const thread_local arena_allocator_data __TempAllocData;
+inline const thread_local virtual_arena_allocator_data __TempAllocData{};
+
+// Savepoints for the temporary allocator of the current thread, see virtual_arena_allocator_rollback().
+// These let nested code use temporary memory without calling free_all and wiping the caller's allocations.
+// Usually you want the PUSH_TEMP_SAVEPOINT macro below.
+inline s64 temp_get_savepoint() { return virtual_arena_allocator_get_savepoint((virtual_arena_allocator_data *) &__TempAllocData); }
+inline void temp_rollback(s64 savepoint) { virtual_arena_allocator_rollback((virtual_arena_allocator_data *) &__TempAllocData, savepoint); }
 
 
 // This is a helper macro to safely modify a variable in the implicit context in a block of code.
@@ -190,6 +199,33 @@ inline const thread_local arena_allocator_data __TempAllocData;
     LINE_NAME(newContext).Alloc = newAlloc;               \
     PUSH_CONTEXT(LINE_NAME(newContext))
 
+// Frees everything allocated with the temporary allocator inside the block at the end of the block.
+// Allocations made before the block are left untouched.
+// Usage:
+//    PUSH_TEMP_SAVEPOINT() {
+//        auto *scratch = allocate_array<byte>(1_KiB, {.Alloc = Context.TempAlloc});
+//        ...
+//    }
+//
+#define PUSH_TEMP_SAVEPOINT()                                                  \
+    auto LINE_NAME(savepoint) = LSTD_NAMESPACE::temp_get_savepoint();          \
+    auto LINE_NAME(rolledBack) = false;                                        \
+    defer({                                                                    \
+        if (!LINE_NAME(rolledBack)) {                                          \
+            LSTD_NAMESPACE::temp_rollback(LINE_NAME(savepoint));               \
+        }                                                                      \
+    });                                                                        \
+    if (true) {                                                                \
+        goto LINE_NAME(body);                                                  \
+    } else                                                                     \
+        while (true)                                                           \
+            if (true) {                                                        \
+                LSTD_NAMESPACE::temp_rollback(LINE_NAME(savepoint));           \
+                LINE_NAME(rolledBack) = true;                                  \
+                break;                                                         \
+            } else                                                             \
+                LINE_NAME(body) :
+
 //
 // These were moved from allocator.h where they made sense to be, but we need to access Context.Alloc here.
 // In the future we hopefully find a way to structure the library so these problems are avoided.
@@ -201,7 +237,6 @@ concept non_void = !types::is_same<T, void>;
 
 LSTD_END_NAMESPACE
 
-using size_t = u64; // We don't support 32 bits, do we?
 using align_val_t = size_t;
 
 // :AvoidSTDs:
@@ -258,8 +293,7 @@ requires(!types::is_const<T>) T *lstd_reallocate_array_impl(T *block, s64 newCou
     // so we leave that up to the call site.
     assert(newCount != 0);
 
-    auto *header = (allocation_header *) block - 1;
-    s64 oldCount = header->Size / sizeof(T);
+    s64 oldCount = allocation_get_size(block) / sizeof(T);
 
     if constexpr (!types::is_scalar<T>) {
         if (newCount < oldCount) {
@@ -301,21 +335,25 @@ requires(!types::is_const<T>) T *lstd_reallocate_array_impl(T *block, s64 newCou
 // Both are far from optimal, so let's introduce another way (haha)!
 // Note: We override the default operator new/delete to call our version.
 //       When we don't link with the CRT, malloc is undefined, we provide a replacement.
-//       When we link with the CRT, we do it dynamically, so we can redirect calls to malloc to our replacement. @TODO: We don't do that yet..
+//       When we link with the CRT, we do it dynamically, so we can redirect calls to malloc to our replacement.
+//       On Linux we do (posix_malloc.cpp), on Windows @TODO: We don't do that yet..
 //
 // The following functions are defined:
 //  allocate,
 //  allocate_array,
 //  reallocate_array
 //  free
+//  allocate_batch
+//  free_batch
 //
-// All work as expected.
+// All work as expected. The batch versions allocate/free many objects of the same type with a single request
+// to the allocator (see allocator_batch in allocator.h), useful when building large graphs or loading assets.
 //
 // Note: allocate and allocate_array call constructors on non-scalar values, free calls destructors (make sure you pass the right pointer type to free!)
 //
 // We allocate a bit of space before the block to store a header with information (the size of the allocation, the alignment,
 // the allocator with which it was allocated, and debugging info if DEBUG_MEMORY is defined - see comments in allocator.h).
-//              (* this overhead should become smaller, right now we haven't bothered yet! @TODO)
+// For most allocations that's 8 bytes (16 for allocations larger than 64 KiB), see allocation_header_kind.
 //
 // There is one big assumption we make:
 //   Your types are "trivially copyable" which means that they can be copied byte by byte to another place and still work.
@@ -378,6 +416,45 @@ T *reallocate_array(T *block, s64 newCount, s64 reallocateOptions = 0, source_lo
     return lstd_reallocate_array_impl<T>(block, newCount, reallocateOptions, loc);
 }
 
+// Allocates _count_ separate objects (each one can be freed on its own) and stores the pointers in _results_.
+// T is used to initialize the resulting memory (uses placement new to call the constructor).
+// Returns how many were allocated, when out of memory the rest of _results_ are null (see general_allocate_batch()).
+template <non_void T>
+s64 allocate_batch(T **results, s64 count, allocate_options options = {}, source_location loc = source_location::current()) {
+    allocator alloc = options.Alloc;
+    if (!alloc) alloc = Context.Alloc;
+    assert(alloc && "Context allocator was null. The programmer should set it before calling allocate functions.");
+
+    s64 allocated = general_allocate_batch(alloc, (void **) results, count, sizeof(T), options.Alignment, options.Options, loc);
+
+    if constexpr (!types::is_scalar<T>) {
+        For(range(count)) {
+            if (results[it]) new (results[it]) T;
+        }
+    }
+    return allocated;
+}
+
+// Frees _count_ objects, e.g. ones allocated with allocate_batch(). Null pointers are skipped.
+// If T is non-scalar we call the destructors (like free()).
+template <non_void T>
+requires(!types::is_const<T>) void free_batch(T **blocks, s64 count, u64 options = 0) {
+    if constexpr (!types::is_scalar<T>) {
+        For(range(count)) {
+            if (!blocks[it]) continue;
+
+            auto *p = blocks[it];
+            s64 n = allocation_get_size(p) / sizeof(T);
+            while (n--) {
+                p->~T();
+                ++p;
+            }
+        }
+    }
+
+    general_free_batch((void **) blocks, count, options);
+}
+
 // If T is non-scalar we call the destructors on the objects in the memory block (determined by T, so make sure you pass a correct pointer type)
 template <typename T>
 requires(!types::is_const<T>) void free(T *block, u64 options = 0) {
@@ -388,8 +465,7 @@ requires(!types::is_const<T>) void free(T *block, u64 options = 0) {
         sizeT = sizeof(T);
     }
 
-    auto *header = (allocation_header *) block - 1;
-    s64 count = header->Size / sizeT;
+    s64 count = allocation_get_size(block) / sizeT;
 
     if constexpr (!types::is_same<T, void> && !types::is_scalar<T>) {
         auto *p = block;
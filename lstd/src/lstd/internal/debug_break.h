@@ -43,7 +43,7 @@ __inline__ static void trap_instruction(void) { __asm__ volatile("int $0x03"); }
 #elif defined(__thumb__)
 #define DEBUG_BREAK_IMPL DEBUG_BREAK_USE_TRAP_INSTRUCTION
 /* FIXME: handle __THUMB_INTERWORK__ */
-__attribute__((gnu_inline, always_inline)) __inline__ static void trap_instruction(void) {
+__attribute__((gnu_inline, __always_inline__)) __inline__ static void trap_instruction(void) {
     /* See 'arm-linux-tdep.c' in GDB source.
      * Both instruction sequences below work. */
 #if 1
@@ -73,7 +73,7 @@ __attribute__((gnu_inline, always_inline)) __inline__ static void trap_instructi
 }
 #elif defined(__arm__) && !defined(__thumb__)
 #define DEBUG_BREAK_IMPL DEBUG_BREAK_USE_TRAP_INSTRUCTION
-__attribute__((gnu_inline, always_inline)) __inline__ static void trap_instruction(void) {
+__attribute__((gnu_inline, __always_inline__)) __inline__ static void trap_instruction(void) {
     /* See 'arm-linux-tdep.c' in GDB source,
      * 'eabi_linux_arm_le_breakpoint' */
     __asm__ volatile(".inst 0xe7f001f0");
@@ -84,7 +84,7 @@ __attribute__((gnu_inline, always_inline)) __inline__ static void trap_instructi
 #define DEBUG_BREAK_IMPL DEBUG_BREAK_USE_BULTIN_TRAP
 #elif defined(__aarch64__)
 #define DEBUG_BREAK_IMPL DEBUG_BREAK_USE_TRAP_INSTRUCTION
-__attribute__((gnu_inline, always_inline)) __inline__ static void trap_instruction(void) {
+__attribute__((gnu_inline, __always_inline__)) __inline__ static void trap_instruction(void) {
     /* See 'aarch64-tdep.c' in GDB source,
      * 'aarch64_default_breakpoint' */
     __asm__ volatile(".inst 0xd4200000");
@@ -92,7 +92,7 @@ __attribute__((gnu_inline, always_inline)) __inline__ static void trap_instructi
 #elif defined(__powerpc__)
 /* PPC 32 or 64-bit, big or little endian */
 #define DEBUG_BREAK_IMPL DEBUG_BREAK_USE_TRAP_INSTRUCTION
-__attribute__((gnu_inline, always_inline)) __inline__ static void trap_instruction(void) {
+__attribute__((gnu_inline, __always_inline__)) __inline__ static void trap_instruction(void) {
     /* See 'rs6000-tdep.c' in GDB source,
      * 'rs6000_breakpoint' */
     __asm__ volatile(".4byte 0x7d821008");
@@ -111,12 +111,12 @@ __attribute__((gnu_inline, always_inline)) __inline__ static void trap_instructi
 #ifndef DEBUG_BREAK_IMPL
 #error "debug_break.h is not supported on this target"
 #elif DEBUG_BREAK_IMPL == DEBUG_BREAK_USE_TRAP_INSTRUCTION
-__attribute__((gnu_inline, always_inline)) __inline__ static void debug_break(void) { trap_instruction(); }
+__attribute__((gnu_inline, __always_inline__)) __inline__ static void debug_break(void) { trap_instruction(); }
 #elif DEBUG_BREAK_IMPL == DEBUG_BREAK_USE_BULTIN_TRAP
-__attribute__((gnu_inline, always_inline)) __inline__ static void debug_break(void) { __builtin_trap(); }
+__attribute__((gnu_inline, __always_inline__)) __inline__ static void debug_break(void) { __builtin_trap(); }
 #elif DEBUG_BREAK_IMPL == DEBUG_BREAK_USE_SIGTRAP
 #include <signal.h>
-__attribute__((gnu_inline, always_inline)) __inline__ static void debug_break(void) { raise(SIGTRAP); }
+__attribute__((gnu_inline, __always_inline__)) __inline__ static void debug_break(void) { raise(SIGTRAP); }
 #endif
 }
 
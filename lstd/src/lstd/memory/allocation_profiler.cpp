@@ -0,0 +1,241 @@
+#include "allocation_profiler.h"
+
+#include "../internal/os_function_call.h"
+#include "../io/string_writer.h"
+#include "array.h"
+#include "hasher.h"
+#include "stack_array.h"
+
+import fmt;
+import os;
+import path;
+
+LSTD_BEGIN_NAMESPACE
+
+// Set while we are inside the profiler on this thread, the tables allocate memory and we don't want to sample that.
+file_scope thread_local bool InProfiler;
+
+file_scope thread_local bool SamplingStarted;
+file_scope thread_local u64 RandomState;
+
+// @Platform Capturing and resolving call stacks is only implemented on Windows so far (os.win64.common).
+// Elsewhere every sample gets an empty call stack, so the profiler still counts bytes but reports a single call site.
+file_scope s64 capture_call_stack(void **frames, s64 maxFrames, s64 skip) {
+#if OS == WINDOWS
+    return os_capture_call_stack(frames, maxFrames, skip + 1);  // + 1 to skip this function
+#else
+    return 0;
+#endif
+}
+
+file_scope u64 next_random() {
+    if (!RandomState) RandomState = (u64) &RandomState ^ 0x9E3779B97F4A7C15ull;
+
+    // xorshift64
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 7;
+    RandomState ^= RandomState << 17;
+    return RandomState;
+}
+
+// We jitter the interval (uniformly between 1 and 2 * _SampleInterval_ bytes) so a program which
+// allocates in a regular pattern doesn't always get the same allocation sampled.
+file_scope s64 pick_bytes_until_sample(s64 interval) {
+    return 1 + (s64) (next_random() % (u64) (2 * interval));
+}
+
+void allocation_profiler_start(s64 sampleInterval) {
+    assert(sampleInterval > 0);
+
+    if (!AllocationProfiler) {
+        // @Leak This is ok
+        auto *profiler = allocate<allocation_profiler>({.Alloc = internal::platform_get_persistent_allocator(), .Options = LEAK});
+        if (atomic_compare_and_swap((s64 *) &AllocationProfiler, (s64) profiler, 0ll) != 0) free(profiler);  // Another thread beat us
+    }
+
+    AllocationProfiler->SampleInterval = sampleInterval;
+    AllocationProfiler->Enabled = true;
+}
+
+void allocation_profiler_stop() {
+    if (AllocationProfiler) AllocationProfiler->Enabled = false;
+}
+
+void allocation_profiler_reset() {
+    if (!AllocationProfiler) return;
+
+    auto *p = AllocationProfiler;
+
+    InProfiler = true;
+    p->Lock.lock();
+    free(p->Sites);
+    free(p->Samples);
+    p->Lock.unlock();
+    InProfiler = false;
+}
+
+void allocation_profiler_sample(void *ptr, s64 size) {
+    auto *p = AllocationProfiler;
+
+    s64 interval = p->SampleInterval;
+    AllocationProfilerBytesUntilSample = pick_bytes_until_sample(interval);
+
+    // The first time we get here on a thread we just start the countdown, otherwise the first allocation on every thread would be sampled
+    if (!SamplingStarted) {
+        SamplingStarted = true;
+        return;
+    }
+
+    if (InProfiler) return;
+
+    InProfiler = true;
+    defer(InProfiler = false);
+
+    allocation_site site;
+    site.FramesCount = capture_call_stack(site.Frames, ALLOCATION_PROFILER_MAX_FRAMES, 2);  // Skip this function and general_(re)allocate
+
+    hasher h(0);
+    h.add((const char *) site.Frames, site.FramesCount * sizeof(void *));
+    u64 hash = h.hash();
+
+    // Each sample stands for _interval_ bytes on average, an allocation larger than that stands for itself
+    s64 weight = size > interval ? size : interval;
+
+    p->Lock.lock();
+    PUSH_ALLOC(internal::platform_get_persistent_allocator()) {
+        auto [_, found] = find_prehashed(p->Sites, hash, hash);
+        if (!found) found = add_prehashed(p->Sites, hash, hash, site).Value;
+
+        ++found->SampledCount;
+        found->AllocatedBytes += weight;
+        found->LiveBytes += weight;
+
+        set(p->Samples, ptr, {hash, weight});
+    }
+    p->Lock.unlock();
+
+    allocation_set_sampled(ptr, true);
+}
+
+void allocation_profiler_record_free(void *ptr) {
+    auto *p = AllocationProfiler;
+    if (!p) return;
+
+    p->Lock.lock();
+    auto [_, sample] = find(p->Samples, ptr);
+    if (sample) {
+        auto [__, site] = find_prehashed(p->Sites, sample->Site, sample->Site);
+        if (site) site->LiveBytes -= sample->Weight;
+
+        remove(p->Samples, ptr);
+    }
+    p->Lock.unlock();
+}
+
+// Copies the sites out of the table so we don't hold the lock while resolving symbols (which allocates)
+file_scope array<allocation_site> get_sites_sorted_by(bool byLiveBytes) {
+    array<allocation_site> result;
+
+    auto *p = AllocationProfiler;
+    if (!p) return result;
+
+    p->Lock.lock();
+    array_reserve(result, p->Sites.Count);
+    for (auto [k, v] : p->Sites) array_append(result, *v);
+    p->Lock.unlock();
+
+    auto byLive = [](const allocation_site *a, const allocation_site *b) -> s32 {
+        if (a->LiveBytes != b->LiveBytes) return a->LiveBytes > b->LiveBytes ? -1 : 1;
+        return 0;
+    };
+    auto byAllocated = [](const allocation_site *a, const allocation_site *b) -> s32 {
+        if (a->AllocatedBytes != b->AllocatedBytes) return a->AllocatedBytes > b->AllocatedBytes ? -1 : 1;
+        return 0;
+    };
+    quick_sort(result.Data, result.Data + result.Count, byLiveBytes ? (quick_sort_comparison_func<allocation_site>) byLive : byAllocated);
+
+    return result;
+}
+
+file_scope void write_frames(writer *out, const allocation_site &site, const string &separator) {
+    if (!site.FramesCount) {
+        write(out, "<unknown call stack>");
+        return;
+    }
+
+#if OS == WINDOWS
+    os_function_call calls[ALLOCATION_PROFILER_MAX_FRAMES];
+    os_resolve_call_stack(calls, (void **) site.Frames, site.FramesCount);
+
+    For(range(site.FramesCount)) {
+        if (it) write(out, separator);
+        fmt_to_writer(out, "{} ({}:{})", calls[it].Name, calls[it].File, calls[it].LineNumber);
+
+        free(calls[it].Name);
+        free(calls[it].File);
+    }
+#endif
+}
+
+file_scope void write_top_sites(writer *out, bool byLiveBytes, s64 maxSites) {
+    auto sites = get_sites_sorted_by(byLiveBytes);
+    defer(free(sites));
+
+    fmt_to_writer(out, "Top call sites by {}:\n", byLiveBytes ? "live bytes" : "allocated bytes");
+
+    For(range(min(maxSites, sites.Count))) {
+        auto &site = sites[it];
+        fmt_to_writer(out, "  #{}: live {} bytes, allocated {} bytes ({} samples)\n", it + 1, site.LiveBytes, site.AllocatedBytes, site.SampledCount);
+
+        write(out, "      ");
+        write_frames(out, site, "\n      ");
+        write(out, "\n");
+    }
+}
+
+string allocation_profiler_report(s64 maxSites) {
+    InProfiler = true;
+    defer(InProfiler = false);
+
+    string_builder_writer out;
+    defer(free(out));
+
+    if (AllocationProfiler) {
+        fmt_to_writer(&out, "Allocation profile (one sample every ~{} bytes, numbers are estimates)\n\n", AllocationProfiler->SampleInterval);
+        write_top_sites(&out, true, maxSites);
+        write(&out, "\n");
+        write_top_sites(&out, false, maxSites);
+    } else {
+        write(&out, "The allocation profiler was never started\n");
+    }
+
+    return string_builder_combine(out.Builder);
+}
+
+bool allocation_profiler_export(const string &path) {
+    InProfiler = true;
+    defer(InProfiler = false);
+
+    string_builder_writer out;
+    defer(free(out));
+
+    auto sites = get_sites_sorted_by(true);
+    defer(free(sites));
+
+    For(sites) {
+        fmt_to_writer(&out, "{}\t{}\t{}\t", it.LiveBytes, it.AllocatedBytes, it.SampledCount);
+        write_frames(&out, it, " <- ");
+        write(&out, "\n");
+    }
+
+    string contents = string_builder_combine(out.Builder);
+    defer(free(contents));
+
+#if OS == WINDOWS
+    return path_write_to_file(path, contents, path_write_mode::Overwrite_Entire);
+#else
+    return false;  // @Platform path.posix can't write files yet
+#endif
+}
+
+LSTD_END_NAMESPACE
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "../internal/context.h"
+#include "hash_table.h"
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// Sampling allocation profiler.
+//
+// DEBUG_MEMORY tells you where an allocation came from (file and line), but that's too expensive to leave on
+// in release-like builds and it doesn't tell you which code paths allocate the most. This profiler records the call stack
+// of roughly one allocation every _SampleInterval_ bytes allocated (on each thread) and aggregates the samples per call site
+// (identical call stacks) in a side table. Nothing is stored in the allocation header except one bit which marks sampled allocations,
+// so when they are freed we know to subtract them from the live bytes of their call site.
+//
+// Each sample stands for about _SampleInterval_ bytes (or its own size if it's larger), so the numbers we report are estimates.
+// Allocations which weren't sampled cost a thread local subtraction and a compare.
+//
+// Usage:
+//     allocation_profiler_start();
+//     ... run the code you are interested in ...
+//     allocation_profiler_stop();
+//
+//     string report = allocation_profiler_report();
+//     print("{}", report);
+//     free(report);
+//
+//     allocation_profiler_export("allocations.tsv");
+//
+
+constexpr s64 ALLOCATION_PROFILER_MAX_FRAMES = 16;
+
+struct allocation_site {
+    void *Frames[ALLOCATION_PROFILER_MAX_FRAMES];  // Innermost first
+    s64 FramesCount = 0;
+
+    s64 SampledCount = 0;    // Number of samples taken at this call site
+    s64 AllocatedBytes = 0;  // Estimated total bytes allocated at this call site
+    s64 LiveBytes = 0;       // Estimated bytes allocated at this call site which haven't been freed yet
+};
+
+struct allocation_sample {
+    u64 Site;  // Key in _Sites_
+    s64 Weight;
+};
+
+struct allocation_profiler {
+    // On average we sample once every this many bytes allocated
+    s64 SampleInterval = 512_KiB;
+
+    bool Enabled = false;
+
+    // Guards the tables below. Only taken when sampling or freeing a sampled allocation, which is rare.
+    thread::fast_mutex Lock;
+
+    hash_table<u64, allocation_site> Sites;        // Keyed by the hash of the call stack
+    hash_table<void *, allocation_sample> Samples;  // Sampled allocations which haven't been freed yet
+};
+
+// null until allocation_profiler_start() is called for the first time.
+inline allocation_profiler *AllocationProfiler;
+
+// Starts sampling allocations on all threads. Data from previous runs is kept, call allocation_profiler_reset() to throw it away.
+void allocation_profiler_start(s64 sampleInterval = 512_KiB);
+
+// Stops sampling. Sampled allocations which get freed after this still update the live bytes.
+void allocation_profiler_stop();
+
+// Throws away all collected data.
+void allocation_profiler_reset();
+
+// Returns a human readable report of the _maxSites_ call sites with the most live bytes (and the most allocated bytes).
+// Resolves symbols, so this is slow. The caller is responsible for freeing the returned string.
+[[nodiscard("Leak")]] string allocation_profiler_report(s64 maxSites = 10);
+
+// Writes every call site to a file, one per line, tab separated:
+//     live bytes, allocated bytes, samples, frames (innermost first, "function (file:line)" separated by " <- ")
+// Sorted by live bytes. Resolves symbols, so this is slow. Returns false if the file couldn't be written.
+bool allocation_profiler_export(const string &path);
+
+//
+// These are called by general_allocate, general_reallocate and general_free.
+//
+
+// Bytes left until the next sample on this thread
+inline thread_local s64 AllocationProfilerBytesUntilSample;
+
+// Slow path, takes a sample and picks when to take the next one.
+void allocation_profiler_sample(void *ptr, s64 size);
+
+inline void allocation_profiler_maybe_sample(void *ptr, s64 size) {
+    if (!AllocationProfiler || !AllocationProfiler->Enabled) return;
+
+    AllocationProfilerBytesUntilSample -= size;
+    if (AllocationProfilerBytesUntilSample > 0) return;
+
+    allocation_profiler_sample(ptr, size);
+}
+
+// Removes a sampled allocation (allocation_is_sampled() returned true) from the live bytes of its call site.
+void allocation_profiler_record_free(void *ptr);
+
+LSTD_END_NAMESPACE
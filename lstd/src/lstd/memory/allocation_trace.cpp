@@ -0,0 +1,182 @@
+#include "allocation_trace.h"
+
+#include "array.h"
+
+import os;
+import path;
+
+LSTD_BEGIN_NAMESPACE
+
+file_scope const char TRACE_MAGIC[] = "LSTRACE1";
+constexpr s64 TRACE_MAGIC_SIZE = sizeof(TRACE_MAGIC) - 1;
+
+// Set while we are inside the recorder on this thread, the trace's own arrays allocate memory and we don't want to record that.
+file_scope thread_local bool InTrace;
+
+file_scope byte *encode_varint(byte *p, u64 value) {
+    while (value >= 0x80) {
+        *p++ = (byte) (value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (byte) value;
+    return p;
+}
+
+// Returns null if the varint runs past _end_ (a truncated trace)
+file_scope const byte *decode_varint(const byte *p, const byte *end, u64 *value) {
+    *value = 0;
+
+    s32 shift = 0;
+    while (p != end && shift < 64) {
+        byte b = *p++;
+        *value |= (u64) (b & 0x7F) << shift;
+        if (!(b & 0x80)) return p;
+        shift += 7;
+    }
+    return null;
+}
+
+void allocation_trace_start() {
+    if (!AllocationTrace) {
+        // @Leak This is ok
+        auto *trace = allocate<allocation_trace>({.Alloc = internal::platform_get_persistent_allocator(), .Options = LEAK});
+        if (atomic_compare_and_swap((s64 *) &AllocationTrace, (s64) trace, 0ll) != 0) free(trace);  // Another thread beat us
+    }
+    AllocationTrace->Enabled = true;
+}
+
+void allocation_trace_stop() {
+    if (AllocationTrace) AllocationTrace->Enabled = false;
+}
+
+void allocation_trace_reset() {
+    if (!AllocationTrace) return;
+
+    auto *t = AllocationTrace;
+
+    InTrace = true;
+    t->Lock.lock();
+    free(t->Data);
+    free(t->Live);
+    t->AllocatedCount = 0;
+    t->EventsCount = 0;
+    t->Lock.unlock();
+    InTrace = false;
+}
+
+void allocation_trace_record(allocation_trace_op op, void *ptr, void *newPtr, s64 size, u32 alignment) {
+    if (InTrace) return;
+
+    InTrace = true;
+    defer(InTrace = false);
+
+    auto *t = AllocationTrace;
+
+    byte event[1 + 2 * 10 + 1];  // The op, two varints (at most 10 bytes each) and the alignment
+    byte *p = event;
+    *p++ = (byte) op;
+
+    t->Lock.lock();
+    defer(t->Lock.unlock());
+
+    PUSH_ALLOC(internal::platform_get_persistent_allocator()) {
+        if (op == allocation_trace_op::ALLOCATE) {
+            p = encode_varint(p, (u64) size);
+            *p++ = (byte) msb(alignment);
+
+            set(t->Live, ptr, t->AllocatedCount++);
+        } else {
+            auto [_, id] = find(t->Live, ptr);
+            if (!id) return;  // Allocated before we started recording
+
+            p = encode_varint(p, (u64) (t->AllocatedCount - *id));
+
+            if (op == allocation_trace_op::RESIZE) {
+                p = encode_varint(p, (u64) size);
+
+                if (newPtr != ptr) {
+                    s64 blockID = *id;
+                    remove(t->Live, ptr);
+                    set(t->Live, newPtr, blockID);
+                }
+            } else {
+                remove(t->Live, ptr);
+            }
+        }
+
+        array_append(t->Data, event, p - event);
+        ++t->EventsCount;
+    }
+}
+
+bool allocation_trace_save(const string &path) {
+    if (!AllocationTrace) return false;
+
+    auto *t = AllocationTrace;
+
+    InTrace = true;
+    defer(InTrace = false);
+
+    array<byte> contents;
+    defer(free(contents));
+
+    t->Lock.lock();
+    array_reserve(contents, TRACE_MAGIC_SIZE + t->Data.Count);
+    array_append(contents, (const byte *) TRACE_MAGIC, TRACE_MAGIC_SIZE);
+    array_append(contents, t->Data.Data, t->Data.Count);
+    t->Lock.unlock();
+
+    return path_write_to_file(path, string(contents.Data, contents.Count), path_write_mode::Overwrite_Entire);
+}
+
+bool allocation_trace_decode(array<allocation_trace_event> *events, const byte *data, s64 size) {
+    if (size < TRACE_MAGIC_SIZE || compare_memory(data, TRACE_MAGIC, TRACE_MAGIC_SIZE) != -1) return false;
+
+    const byte *p = data + TRACE_MAGIC_SIZE;
+    const byte *end = data + size;
+
+    s64 allocatedCount = 0;
+    while (p != end) {
+        allocation_trace_event e;
+        e.Op = (allocation_trace_op) *p++;
+
+        u64 value;
+        if (e.Op == allocation_trace_op::ALLOCATE) {
+            p = decode_varint(p, end, &value);
+            if (!p || p == end) return false;
+
+            // general_allocate doesn't allow alignments over 32768 (2^15), so anything larger is a corrupted trace
+            if (*p > 15) return false;
+
+            e.Size = (s64) value;
+            e.Alignment = 1u << *p++;
+            e.ID = allocatedCount++;
+        } else if (e.Op == allocation_trace_op::RESIZE || e.Op == allocation_trace_op::FREE) {
+            p = decode_varint(p, end, &value);
+            if (!p || value == 0 || (s64) value > allocatedCount) return false;
+
+            e.ID = allocatedCount - (s64) value;
+
+            if (e.Op == allocation_trace_op::RESIZE) {
+                p = decode_varint(p, end, &value);
+                if (!p) return false;
+                e.Size = (s64) value;
+            }
+        } else {
+            return false;
+        }
+
+        array_append(*events, e);
+    }
+    return true;
+}
+
+bool allocation_trace_load(array<allocation_trace_event> *events, const string &path) {
+    auto [content, success] = path_read_entire_file(path);
+    defer(free(content));
+
+    if (!success) return false;
+    return allocation_trace_decode(events, content.Data, content.Count);
+}
+
+LSTD_END_NAMESPACE
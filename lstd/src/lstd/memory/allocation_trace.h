@@ -0,0 +1,92 @@
+#pragma once
+
+#include "../internal/context.h"
+#include "hash_table.h"
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// Allocation trace recorder.
+//
+// Context.LogAllAllocations prints where allocations are made, which is good for reading but not for measuring.
+// This records every allocate, reallocate and free which goes through the general allocation functions
+// (on all threads) in a compact binary form. A trace can be saved, loaded and replayed against any allocator,
+// so allocator changes can be judged on the allocation patterns of a real program instead of synthetic loops.
+// The test suite has a replay tool: run it with "--replay <trace file>".
+//
+// Blocks are identified by the order in which they were allocated (the first allocation in the trace has ID 0),
+// so a trace doesn't depend on the addresses the allocator returned. Blocks allocated before recording started are ignored.
+//
+// Format: the magic "LSTRACE1" followed by the events. Each event is one byte (the op), then:
+//     ALLOCATE: size (varint), log2 of the alignment (one byte)
+//     RESIZE:   ID distance (varint), new size (varint)
+//     FREE:     ID distance (varint)
+// The ID distance is (number of blocks allocated so far - ID), usually a small number since most blocks die young.
+// Varints are LEB128 (7 bits per byte, the high bit means more bytes follow), most events end up 3 to 5 bytes.
+//
+// Usage:
+//     allocation_trace_start();
+//     ... run the code you are interested in ...
+//     allocation_trace_stop();
+//
+//     allocation_trace_save("load_level.trace");
+//
+
+enum class allocation_trace_op : u8 { ALLOCATE = 0,
+                                      RESIZE,
+                                      FREE };
+
+struct allocation_trace_event {
+    allocation_trace_op Op;
+    u32 Alignment = 0;  // Only for ALLOCATE
+    s64 ID = 0;
+    s64 Size = 0;  // The user size (not including our header), 0 for FREE
+};
+
+struct allocation_trace {
+    bool Enabled = false;
+
+    // Guards everything below. Taken for every allocation while recording, so recording is not free.
+    thread::fast_mutex Lock;
+
+    array<byte> Data;               // Encoded events (without the magic)
+    hash_table<void *, s64> Live;  // Blocks allocated while recording which haven't been freed yet -> their ID
+
+    s64 AllocatedCount = 0;  // The next ID
+    s64 EventsCount = 0;
+};
+
+// null until allocation_trace_start() is called for the first time.
+inline allocation_trace *AllocationTrace;
+
+// Starts recording on all threads. Events from previous runs are kept, call allocation_trace_reset() to throw them away.
+void allocation_trace_start();
+
+// Stops recording.
+void allocation_trace_stop();
+
+// Throws away all recorded events.
+void allocation_trace_reset();
+
+// Writes the recorded events to a file. Returns false if the file couldn't be written.
+bool allocation_trace_save(const string &path);
+
+// Decodes a trace (the contents of a file written by allocation_trace_save()). Returns false if it isn't a valid trace.
+bool allocation_trace_decode(array<allocation_trace_event> *events, const byte *data, s64 size);
+
+// Reads and decodes a trace file. Returns false if the file couldn't be read or isn't a valid trace.
+bool allocation_trace_load(array<allocation_trace_event> *events, const string &path);
+
+//
+// Called by general_allocate, general_reallocate and general_free (and the batch versions).
+//
+
+// Slow path. For RESIZE _ptr_ is the old pointer and _newPtr_ the new one.
+void allocation_trace_record(allocation_trace_op op, void *ptr, void *newPtr, s64 size, u32 alignment);
+
+inline void allocation_trace_maybe_record(allocation_trace_op op, void *ptr, void *newPtr, s64 size, u32 alignment) {
+    if (!AllocationTrace || !AllocationTrace->Enabled) return;
+    allocation_trace_record(op, ptr, newPtr, size, alignment);
+}
+
+LSTD_END_NAMESPACE
@@ -1,5 +1,8 @@
 #include "allocator.h"
 
+#include "allocation_profiler.h"
+#include "allocation_trace.h"
+
 #include "../internal/context.h"
 #include "../io.h"
 #include "../math.h"
@@ -19,11 +22,14 @@ import os;
 LSTD_BEGIN_NAMESPACE
 
 #if defined DEBUG_MEMORY
-void debug_memory::unlink_header(allocation_header *h) {
-    assert(Head);
+file_scope void shard_unlink(debug_memory_shard *shard, allocation_header *h) {
+    assert(shard->Head);
     assert(h);
     assert(h->DEBUG_Previous);
 
+    if (shard->VerifyCursor == h) shard->VerifyCursor = h->DEBUG_Next;
+
+    auto *&Head = shard->Head;
     if (h->DEBUG_Previous == h) {
         Head = null;
     } else if (Head == h) {
@@ -39,7 +45,10 @@ void debug_memory::unlink_header(allocation_header *h) {
     }
 }
 
-void debug_memory::add_header(allocation_header *h) {
+file_scope void shard_add(debug_memory_shard *shard, allocation_header *h) {
+    auto *&Head = shard->Head;
+
+    h->DEBUG_Shard = shard;
     h->DEBUG_Next = Head;
     if (Head) {
         h->DEBUG_Previous = Head->DEBUG_Previous;
@@ -50,30 +59,122 @@ void debug_memory::add_header(allocation_header *h) {
     Head = h;
 }
 
+// Each module gets its own copy of this, that's fine since DEBUG_memory (which owns the shards) may be shared.
+file_scope thread_local debug_memory_shard *ThreadShard;
+
+debug_memory_shard *debug_memory::get_thread_shard() {
+    if (ThreadShard) return ThreadShard;
+
+    // Try to adopt a shard released by a thread which has exited
+    auto *it = Shards;
+    while (it) {
+        if (atomic_compare_and_swap(&it->InUse, 1, 0) == 0) {
+            ThreadShard = it;
+            return it;
+        }
+        it = it->Next;
+    }
+
+    // We can't use general_allocate here since it calls us
+    auto *shard = (debug_memory_shard *) os_allocate_block(sizeof(debug_memory_shard));  // @Leak This is ok
+    new (shard) debug_memory_shard;
+    shard->InUse = 1;
+    shard->Index = atomic_inc(&ShardsCount) - 1;  // atomic_inc returns the incremented value
+
+    // Lock-free push to the front of the list
+    while (true) {
+        auto head = atomic_load((s64 *) &Shards);
+        shard->Next = (debug_memory_shard *) head;
+        if (atomic_compare_and_swap((s64 *) &Shards, (s64) shard, head) == head) break;
+    }
+
+    ThreadShard = shard;
+    return shard;
+}
+
+void debug_memory::release_thread_shard() {
+    if (!ThreadShard) return;
+
+    atomic_swap(&ThreadShard->InUse, 0);
+    ThreadShard = null;
+}
+
+// Checks that _h_ is the header of a live allocation before we follow _DEBUG_Shard_ and lock it.
+// A double free (the header is filled with DEAD_LAND_FILL) or a pointer we never allocated would otherwise crash there instead of asserting.
+file_scope debug_memory_shard *get_header_shard(debug_memory_shard *shards, allocation_header *h) {
+    char freedHeader[sizeof(allocation_header)];
+    fill_memory(freedHeader, DEAD_LAND_FILL, sizeof(allocation_header));
+    if (compare_memory(h, freedHeader, sizeof(allocation_header)) == -1) {
+        assert(false && "Trying to access freed memory!");
+    }
+
+    assert(h->DEBUG_Pointer == h + 1 && "Debug pointer doesn't match. The header is corrupted or the pointer wasn't returned by general_allocate.");
+
+    // Shards are never freed, so walking the list without a lock is fine
+    auto *shard = shards;
+    while (shard && shard != h->DEBUG_Shard) shard = shard->Next;
+    assert(shard && "The header's shard isn't one of ours. Definitely corrupted.");
+
+    return shard;
+}
+
+void debug_memory::unlink_header(allocation_header *h) {
+    // This is the cross-thread free path when _h_ was allocated by another thread
+    auto *shard = get_header_shard(Shards, h);
+
+    shard->Lock.lock();
+    shard_unlink(shard, h);
+    shard->Lock.unlock();
+}
+
+void debug_memory::add_header(allocation_header *h) {
+    auto *shard = get_thread_shard();
+
+    shard->Lock.lock();
+    shard_add(shard, h);
+    shard->Lock.unlock();
+}
+
 void debug_memory::swap_header(allocation_header *o, allocation_header *n) {
-    assert(Head);
     assert(o);
     assert(n);
 
-    if (Head == o) {
-        Head = n;
-        n->DEBUG_Next = o->DEBUG_Next;
+    // The old header may be in another thread's shard, the new one goes to ours
+    unlink_header(o);
+    add_header(n);
+}
 
-        if (!o->DEBUG_Next) {
-            n->DEBUG_Previous = n;
-        } else {
-            n->DEBUG_Previous = o->DEBUG_Previous;
-            n->DEBUG_Next->DEBUG_Previous = n;
+void debug_memory::unlink_headers_in_range(void *begin, void *end) {
+    auto *shard = Shards;
+    while (shard) {
+        shard->Lock.lock();
+
+        auto *h = shard->Head;
+        while (h) {
+            auto *next = h->DEBUG_Next;
+            if ((void *) h >= begin && (void *) h < end) shard_unlink(shard, h);
+            h = next;
         }
-    } else {
-        n->DEBUG_Next = o->DEBUG_Next;
-        n->DEBUG_Previous = o->DEBUG_Previous;
-        n->DEBUG_Previous->DEBUG_Next = n;
-        if (!o->DEBUG_Next) {
-            Head->DEBUG_Previous = n;
-        } else {
-            n->DEBUG_Next->DEBUG_Previous = n;
+
+        shard->Lock.unlock();
+        shard = shard->Next;
+    }
+}
+
+void debug_memory::unlink_headers_with_allocator(allocator alloc) {
+    auto *shard = Shards;
+    while (shard) {
+        shard->Lock.lock();
+
+        auto *h = shard->Head;
+        while (h) {
+            auto *next = h->DEBUG_Next;
+            if (h->Alloc == alloc) shard_unlink(shard, h);
+            h = next;
         }
+
+        shard->Lock.unlock();
+        shard = shard->Next;
     }
 }
 
@@ -105,10 +206,8 @@ constexpr string get_short_file_name(const string &str) {
 }
 
 void debug_memory::report_leaks() {
-    thread::scoped_lock<thread::mutex> _(&Mutex);
-
     // First we check their integrity of the heap
-    maybe_verify_heap();
+    verify_heap();
 
     allocation_header **leaks;
     // We want to ignore the allocation below since it's not the user's fault and we shouldn't count it as a leak
@@ -116,10 +215,17 @@ void debug_memory::report_leaks() {
 
     s64 leaksCount = 0;
     {
-        auto *it = Head;
-        while (it) {
-            if (!it->MarkedAsLeak) ++leaksCount;
-            it = it->DEBUG_Next;
+        auto *shard = Shards;
+        while (shard) {
+            shard->Lock.lock();
+            auto *it = shard->Head;
+            while (it) {
+                if (!it->MarkedAsLeak) ++leaksCount;
+                it = it->DEBUG_Next;
+            }
+            shard->Lock.unlock();
+
+            shard = shard->Next;
         }
     }
 
@@ -129,17 +235,27 @@ void debug_memory::report_leaks() {
 
     leaksID = ((allocation_header *) leaks - 1)->ID;
 
+    // Other threads may still be allocating, so we don't take more than we counted above
+    s64 found = 0;
     {
-        auto *p = leaks;
-        auto *it = Head;
-        while (it) {
-            if (!it->MarkedAsLeak && it->ID != leaksID) *p++ = it;
-            it = it->DEBUG_Next;
+        auto *shard = Shards;
+        while (shard) {
+            shard->Lock.lock();
+            auto *it = shard->Head;
+            while (it && found < leaksCount) {
+                if (!it->MarkedAsLeak && it->ID != leaksID) leaks[found++] = it;
+                it = it->DEBUG_Next;
+            }
+            shard->Lock.unlock();
+
+            shard = shard->Next;
         }
     }
+    leaksCount = found;
 
     if (leaksCount) {
-        print(">>> Warning: The module {!YELLOW}\"{}\"{!} terminated but it still had {!YELLOW}{}{!} allocations which were unfreed. Here they are:\n", os_get_current_module(), leaksCount);
+        print(">>> Warning: The module {!YELLOW}\"{}\"{!} terminated but it still had {!YELLOW}{}{!} allocations (out of {}) which were unfreed. Here they are:\n",
+              os_get_current_module(), leaksCount, get_allocation_count());
     }
 
     For_as(i, range(leaksCount)) {
@@ -158,9 +274,20 @@ void debug_memory::report_leaks() {
     }
 }
 
-file_scope void verify_header_unlocked(allocation_header *header) {
+// Calls DEBUG_memory->CorruptionHandler if there is one, otherwise stops in the debugger. Returns false so checks can return it.
+file_scope bool report_corruption(allocation_header *header, const char *message) {
+    if (DEBUG_memory->CorruptionHandler) {
+        DEBUG_memory->CorruptionHandler(header, message);
+    } else {
+        assert(false && message);
+    }
+    return false;
+}
+
+// Returns false if _header_ is corrupted (after reporting it), the rest of the checks are skipped then.
+file_scope bool verify_header_unlocked(allocation_header *header) {
     // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-    // If an assert fires here it means that memory was messed up in some way.
+    // If an assert fires here (or DEBUG_memory->CorruptionHandler gets called) it means that memory was messed up in some way.
     //
     // We check for several problems here:
     //   * Accessing headers which were freed. Note: This doesn't mean that the user code attempted to modify/access
@@ -180,72 +307,261 @@ file_scope void verify_header_unlocked(allocation_header *header) {
     char freedHeader[sizeof(allocation_header)];
     fill_memory(freedHeader, DEAD_LAND_FILL, sizeof(allocation_header));
     if (compare_memory(header, freedHeader, sizeof(allocation_header)) == -1) {
-        assert(false && "Trying to access freed memory!");
+        return report_corruption(header, "Trying to access freed memory!");
     }
 
-    assert(header->Alignment && "Stored alignment is zero. Definitely corrupted.");
-    assert(header->Alignment >= POINTER_SIZE && "Stored alignment smaller than pointer size (8 bytes). Definitely corrupted.");
-    assert(is_pow_of_2(header->Alignment) && "Stored alignment not a power of 2. Definitely corrupted.");
+    if (!header->Alignment) return report_corruption(header, "Stored alignment is zero. Definitely corrupted.");
+    if (header->Alignment < POINTER_SIZE) return report_corruption(header, "Stored alignment smaller than pointer size (8 bytes). Definitely corrupted.");
+    if (!is_pow_of_2(header->Alignment)) return report_corruption(header, "Stored alignment not a power of 2. Definitely corrupted.");
 
-    assert(header->DEBUG_Pointer == header + 1 && "Debug pointer doesn't match. They should always match.");
+    if (header->DEBUG_Pointer != header + 1) return report_corruption(header, "Debug pointer doesn't match. They should always match.");
 
     auto *user = (char *) header + sizeof(allocation_header);
 
     char noMansLand[NO_MANS_LAND_SIZE];
     fill_memory(noMansLand, NO_MANS_LAND_FILL, NO_MANS_LAND_SIZE);
-    assert(compare_memory((char *) user - NO_MANS_LAND_SIZE, noMansLand, NO_MANS_LAND_SIZE) == -1 &&
-           "No man's land was modified. This means that you wrote before the allocated block.");
+    if (compare_memory((char *) user - NO_MANS_LAND_SIZE, noMansLand, NO_MANS_LAND_SIZE) != -1) {
+        return report_corruption(header, "No man's land was modified. This means that you wrote before the allocated block.");
+    }
 
-    assert(compare_memory((char *) header->DEBUG_Pointer + header->Size, noMansLand, NO_MANS_LAND_SIZE) == -1 &&
-           "No man's land was modified. This means that you wrote after the allocated block.");
+    if (compare_memory((char *) header->DEBUG_Pointer + header->Size, noMansLand, NO_MANS_LAND_SIZE) != -1) {
+        return report_corruption(header, "No man's land was modified. This means that you wrote after the allocated block.");
+    }
 
     //
     // If one of these asserts was triggered in _maybe_verify_heap()_, this can also mean that the linked list is messed up
     // (possibly by modifying the prev/next pointers in the header).
     //
+    return true;
 }
 
 void debug_memory::verify_header(allocation_header *header) {
     // We need to lock here because another thread can free a header while we are reading from it.
-    thread::scoped_lock<thread::mutex> _(&Mutex);
+    auto *shard = get_header_shard(Shards, header);
+
+    shard->Lock.lock();
     verify_header_unlocked(header);
+    shard->Lock.unlock();
+}
+
+void debug_memory::verify_heap() {
+    // We need to lock each shard because another thread can free a header while we are reading from it.
+    auto *shard = Shards;
+    while (shard) {
+        shard->Lock.lock();
+        auto *it = shard->Head;
+        while (it) {
+            verify_header_unlocked(it);
+            it = it->DEBUG_Next;
+        }
+        shard->Lock.unlock();
+
+        shard = shard->Next;
+    }
+}
+
+s64 debug_memory::get_allocation_count() {
+    s64 result = 0;
+
+    // Shards are never freed, so walking the list without a lock is fine
+    auto *shard = Shards;
+    while (shard) {
+        result += atomic_load(&shard->AllocationCount);
+        shard = shard->Next;
+    }
+    return result;
 }
 
 void debug_memory::maybe_verify_heap() {
-    // We need to lock here because another thread can free a header while we are reading from it.
-    if (AllocationCount % MemoryVerifyHeapFrequency) return;
+    // Counted per thread, so each thread checks every _MemoryVerifyHeapFrequency_ of its own allocations
+    // (a thread which hasn't allocated yet has no shard, that's a count of 0)
+    if (ThreadShard && ThreadShard->AllocationCount % MemoryVerifyHeapFrequency) return;
 
-    auto *it = Head;
-    while (it) {
-        verify_header_unlocked(it);
-        it = it->DEBUG_Next;
+    if (VerifyHeapBudget <= 0) {
+        verify_heap();
+        return;
     }
+
+    s64 budget = VerifyHeapBudget;
+
+    // Another thread may be doing this at the same time, that's fine, we just may check some headers twice.
+    auto *shard = VerifyShard ? VerifyShard : Shards;
+
+    // Stop after going around all shards once, otherwise we would spin forever when there are no allocations
+    s64 hops = 0;
+    while (shard && budget) {
+        shard->Lock.lock();
+        auto *it = shard->VerifyCursor ? shard->VerifyCursor : shard->Head;
+        while (it && budget) {
+            verify_header_unlocked(it);
+            it = it->DEBUG_Next;
+            --budget;
+        }
+        shard->VerifyCursor = it;  // When we reach the end this becomes null and the next pass starts from _Head_ again
+        shard->Lock.unlock();
+
+        if (!it) {
+            if (++hops > ShardsCount) break;
+            shard = shard->Next ? shard->Next : Shards;
+        }
+    }
+
+    VerifyShard = shard;
+}
+
+void debug_memory::verify_header_and_neighbours(allocation_header *header) {
+    auto *shard = get_header_shard(Shards, header);
+
+    shard->Lock.lock();
+    verify_header_unlocked(header);
+
+    // _DEBUG_Previous_ of the head points to the tail, checking that one is fine too
+    if (header->DEBUG_Previous && header->DEBUG_Previous != header) verify_header_unlocked(header->DEBUG_Previous);
+    if (header->DEBUG_Next) verify_header_unlocked(header->DEBUG_Next);
+    shard->Lock.unlock();
 }
 #endif
 
-file_scope void *encode_header(void *p, s64 userSize, u32 align, allocator alloc, u64 flags) {
-    u32 padding = calculate_padding_for_pointer_with_header(p, align, sizeof(allocation_header));
-    u32 alignmentPadding = padding - sizeof(allocation_header);
+file_scope s64 registry_start_index(allocator alloc) {
+    u64 hash = (u64) alloc.Function ^ ((u64) alloc.Context * 0x9E3779B97F4A7C15ull);
+    return (s64) ((hash ^ (hash >> 32)) & (MAX_REGISTERED_ALLOCATORS - 1));
+}
 
-    auto *result = (allocation_header *) ((char *) p + alignmentPadding);
+s64 allocator_registry_get_index(allocator alloc) {
+    s64 start = registry_start_index(alloc);
 
-#if defined DEBUG_MEMORY
-    result->DEBUG_Next = null;
-    result->DEBUG_Previous = null;
+    while (true) {
+        // No entry is further than _MaxProbe_ from where its probe sequence starts,
+        // so we can stop looking after that many (and don't scan the whole table when it's full).
+        s64 maxProbe = atomic_load(&AllocatorRegistry->MaxProbe);
+        bool full = atomic_load(&AllocatorRegistry->Count) == MAX_REGISTERED_ALLOCATORS;
 
-    if (DEBUG_memory) {
-        result->ID = (u32) DEBUG_memory->AllocationCount;
-        atomic_inc(&DEBUG_memory->AllocationCount);
+        s64 freeIndex = -1, freeProbe = 0;
+        s32 freeState = ALLOCATOR_REGISTRY_EMPTY;
+
+        For(range(MAX_REGISTERED_ALLOCATORS)) {
+            s64 index = (start + it) & (MAX_REGISTERED_ALLOCATORS - 1);
+            auto *e = AllocatorRegistry->Entries + index;
+
+            // Plain loads, every general_allocate() comes here, so we don't want to write to the shared cache line
+            s32 state = atomic_load(&e->State);
+            while (state == ALLOCATOR_REGISTRY_WRITING) state = atomic_load(&e->State);  // It won't take long
+
+            if (state == ALLOCATOR_REGISTRY_READY && e->Alloc == alloc) return index;
+
+            if (state != ALLOCATOR_REGISTRY_READY && freeIndex == -1) {
+                freeIndex = index;
+                freeState = state;
+                freeProbe = it;
+            }
+
+            if (state == ALLOCATOR_REGISTRY_EMPTY) break;  // The end of the probe sequence
+            if (it >= maxProbe && (freeIndex != -1 || full)) break;
+        }
+
+        if (freeIndex == -1) return -1;  // Full
+
+        // Claim the first free entry (an empty one or one which was released). If another thread got it first, look again.
+        auto *e = AllocatorRegistry->Entries + freeIndex;
+        if (atomic_compare_and_swap(&e->State, ALLOCATOR_REGISTRY_WRITING, freeState) != freeState) continue;
+
+        e->Alloc = alloc;
+        atomic_swap(&e->State, ALLOCATOR_REGISTRY_READY);
+        atomic_inc(&AllocatorRegistry->Count);
+
+        while (true) {
+            s64 old = atomic_load(&AllocatorRegistry->MaxProbe);
+            if (freeProbe <= old || atomic_compare_and_swap(&AllocatorRegistry->MaxProbe, freeProbe, old) == old) break;
+        }
+        return freeIndex;
     }
+}
+
+void allocator_registry_release(void *context) {
+    For(range(MAX_REGISTERED_ALLOCATORS)) {
+        auto *e = AllocatorRegistry->Entries + it;
+        if (atomic_load(&e->State) != ALLOCATOR_REGISTRY_READY || e->Alloc.Context != context) continue;
+
+        // Released entries don't end probe sequences (entries after them stay reachable), the next registration reuses them
+        if (atomic_compare_and_swap(&e->State, ALLOCATOR_REGISTRY_RELEASED, ALLOCATOR_REGISTRY_READY) == ALLOCATOR_REGISTRY_READY) {
+            atomic_add(&AllocatorRegistry->Count, (s64) -1);
+        }
+    }
+}
+
+file_scope allocation_header_kind choose_header_kind(s64 userSize, u32 alignment, s64 allocatorIndex) {
+#if defined DEBUG_MEMORY
+    return allocation_header_kind::FULL;
+#else
+    if (allocatorIndex == -1) return allocation_header_kind::FULL;
+    if (userSize <= SMALL_HEADER_MAX_SIZE && alignment <= SMALL_HEADER_MAX_ALIGNMENT) return allocation_header_kind::SMALL;
+    return allocation_header_kind::MEDIUM;
+#endif
+}
+
+file_scope u32 get_header_size(allocation_header_kind kind) {
+    if (kind == allocation_header_kind::SMALL) return sizeof(allocation_header_small);
+    if (kind == allocation_header_kind::MEDIUM) return sizeof(allocation_header_medium);
+    return sizeof(allocation_header);
+}
+
+// The size of the block we request from the allocator. The padding we add in encode_header() is always less than
+// _headerSize_ + _alignment_ (see calculate_padding_for_pointer_with_header()).
+//
+// @Volatile: This must be computed the same way when allocating, reallocating and freeing,
+// since allocators (e.g. thread_cache_allocator) may rely on _oldSize_ matching the size they were called with.
+file_scope s64 get_block_size(s64 userSize, u32 alignment, u32 headerSize) {
+    s64 result = userSize + headerSize + alignment;
+#if defined DEBUG_MEMORY
+    result += NO_MANS_LAND_SIZE;  // This is for the bytes after the requested block
+#endif
+    return result;
+}
+
+file_scope void *encode_header(void *p, s64 userSize, u32 align, allocator alloc, s64 allocatorIndex, allocation_header_kind kind, u64 flags) {
+    u32 headerSize = get_header_size(kind);
+
+    u32 padding = calculate_padding_for_pointer_with_header(p, align, headerSize);
+    u32 alignmentPadding = padding - headerSize;
+
+    void *header = (char *) p + alignmentPadding;
+
+    u64 alignmentLog2 = msb(align);
+
+    if (kind == allocation_header_kind::SMALL) {
+        auto *result = (allocation_header_small *) header;
+        result->Bits = (u64) userSize | (u64) alignmentPadding << 16 | alignmentLog2 << 24 | (u64) allocatorIndex << 28 | (u64) kind << 62;
+    } else if (kind == allocation_header_kind::MEDIUM) {
+        auto *result = (allocation_header_medium *) header;
+        result->Size = userSize;
+        result->Bits = (u64) alignmentPadding | alignmentLog2 << 16 | (u64) allocatorIndex << 20 | (u64) kind << 62;
+    } else {
+        auto *result = (allocation_header *) header;
+
+#if defined DEBUG_MEMORY
+        result->DEBUG_Next = null;
+        result->DEBUG_Previous = null;
 
-    result->RID = 0;
+        if (DEBUG_memory) {
+            // Each thread counts in its own shard, so allocating doesn't write to a cache line shared by all threads
+            auto *shard = DEBUG_memory->get_thread_shard();
+            result->ID = (shard->Index << DEBUG_MEMORY_SHARD_ID_SHIFT) + shard->AllocationCount++;
+        }
+
+        result->RID = 0;
 #endif
 
-    result->Alloc = alloc;
-    result->Size = userSize;
+        result->Alloc = alloc;
+        result->Size = userSize;
+
+        result->Alignment = align;
+        result->AlignmentPadding = alignmentPadding;
+        result->Sampled = false;
 
-    result->Alignment = align;
-    result->AlignmentPadding = alignmentPadding;
+#if not defined DEBUG_MEMORY
+        result->Kind = (u8) kind << 6;
+#endif
+    }
 
     //
     // This is now safe since we handle alignment here (and not in general_(re)allocate).
@@ -267,7 +583,7 @@ file_scope void *encode_header(void *p, s64 userSize, u32 align, allocator alloc
     // This moves handling reallocation entirely on our side, which, again is even cleaner.
     //                                                                              - 18.05.2020
     //
-    p = result + 1;
+    p = (char *) p + padding;
     assert((((u64) p & ~((s64) align - 1)) == (u64) p) && "Pointer wasn't properly aligned.");
 
 #if defined DEBUG_MEMORY
@@ -276,7 +592,8 @@ file_scope void *encode_header(void *p, s64 userSize, u32 align, allocator alloc
     fill_memory((char *) p - NO_MANS_LAND_SIZE, NO_MANS_LAND_FILL, NO_MANS_LAND_SIZE);
     fill_memory((char *) p + userSize, NO_MANS_LAND_FILL, NO_MANS_LAND_SIZE);
 
-    result->DEBUG_Pointer = result + 1;
+    auto *result = (allocation_header *) p - 1;
+    result->DEBUG_Pointer = p;
 
     result->MarkedAsLeak = flags & LEAK;
 #endif
@@ -304,9 +621,31 @@ file_scope void log_file_and_line(source_location loc) {
     write(Context.Log, (const byte *) numberP + 1, numberSize);
 }
 
+// Whether _alloc_ is one of our general purpose allocators, which don't implement FREE_ALL.
+// We can't ask an allocator if it supports FREE_ALL without freeing everything in it, so anything we don't know
+// (arenas, pools, the buddy allocator or the user's own allocators) is treated as if it may.
+file_scope bool allocator_never_frees_all(allocator alloc) {
+    if (alloc.Function == stats_allocator) return allocator_never_frees_all(((stats_allocator_data *) alloc.Context)->Parent);
+    return alloc.Function == tlsf_allocator || alloc.Function == thread_cache_allocator || alloc.Function == thread_heap_allocator;
+}
+
+// See Context.LargeAllocThreshold.
+// Only allocations going to the context's general purpose allocator are moved to their own pages. Memory from an
+// allocator which implements FREE_ALL (or a savepoint rollback of the temporary allocator) is released all at once,
+// which wouldn't see blocks we sent to the OS, so those leak. An allocator passed explicitly is also respected, the caller chose it.
+file_scope bool is_large_allocation(allocator alloc, s64 userSize) {
+    s64 threshold = Context.LargeAllocThreshold;
+    if (!threshold || userSize < threshold) return false;
+
+    if (alloc != Context.Alloc || alloc == Context.TempAlloc) return false;
+    return allocator_never_frees_all(alloc);
+}
+
 void *general_allocate(allocator alloc, s64 userSize, u32 alignment, u64 options, source_location loc) {
     options |= Context.AllocOptions;
 
+    if (is_large_allocation(alloc, userSize)) alloc = {os_allocator, null};
+
     if (alignment == 0) {
         auto contextAlignment = Context.AllocAlignment;
         assert(is_pow_of_2(contextAlignment));
@@ -317,11 +656,10 @@ void *general_allocate(allocator alloc, s64 userSize, u32 alignment, u64 options
     s64 id = -1;
 
     if (DEBUG_memory) {
-        thread::scoped_lock<thread::mutex> _(&DEBUG_memory->Mutex);
-
         DEBUG_memory->maybe_verify_heap();
 
-        id = DEBUG_memory->AllocationCount;
+        auto *shard = DEBUG_memory->get_thread_shard();
+        id = (shard->Index << DEBUG_MEMORY_SHARD_ID_SHIFT) + shard->AllocationCount;
     }
 
     if (id == 75) {
@@ -342,16 +680,22 @@ void *general_allocate(allocator alloc, s64 userSize, u32 alignment, u64 options
 
     alignment = alignment < POINTER_SIZE ? POINTER_SIZE : alignment;
     assert(is_pow_of_2(alignment));
+    assert(alignment <= 32768 && "Alignment too large");
 
-    s64 required = userSize + alignment + sizeof(allocation_header) + (sizeof(allocation_header) % alignment);
 #if defined DEBUG_MEMORY
-    required += NO_MANS_LAND_SIZE;  // This is for the bytes after the requested block
+    s64 allocatorIndex = -1;  // We always use the FULL header anyway
+#else
+    s64 allocatorIndex = allocator_registry_get_index(alloc);
 #endif
 
+    auto kind = choose_header_kind(userSize, alignment, allocatorIndex);
+
+    s64 required = get_block_size(userSize, alignment, get_header_size(kind));
+
     void *block = alloc.Function(allocator_mode::ALLOCATE, alloc.Context, required, null, 0, options);
     assert(block);
 
-    auto *result = encode_header(block, userSize, alignment, alloc, options);
+    auto *result = encode_header(block, userSize, alignment, alloc, allocatorIndex, kind, options);
 
 #if defined DEBUG_MEMORY
     auto *header = (allocation_header *) result - 1;
@@ -360,30 +704,31 @@ void *general_allocate(allocator alloc, s64 userSize, u32 alignment, u64 options
     header->FileLine = loc.Line;
 
     if (DEBUG_memory) {
-        thread::scoped_lock<thread::mutex> _(&DEBUG_memory->Mutex);
-
         DEBUG_memory->add_header(header);
     }
 #endif
 
+    allocation_profiler_maybe_sample(result, userSize);
+    allocation_trace_maybe_record(allocation_trace_op::ALLOCATE, result, null, userSize, alignment);
+
     return result;
 }
 
 void *general_reallocate(void *ptr, s64 newUserSize, u64 options, source_location loc) {
     options |= Context.AllocOptions;
 
-    auto *header = (allocation_header *) ptr - 1;
-
-    if (header->Size == newUserSize) return ptr;
+    auto info = allocation_get_info(ptr);
+    if (info.Size == newUserSize) return ptr;
 
 #if defined DEBUG_MEMORY
     if (DEBUG_memory) {
-        thread::scoped_lock<thread::mutex> _(&DEBUG_memory->Mutex);
-
         DEBUG_memory->maybe_verify_heap();
     }
 
+    auto *header = (allocation_header *) ptr - 1;
     auto id = header->ID;
+
+    if (DEBUG_memory) DEBUG_memory->verify_header_and_neighbours(header);
 #endif
 
     if (Context.LogAllAllocations && !Context._LoggingAnAllocation) {
@@ -397,137 +742,317 @@ void *general_reallocate(void *ptr, s64 newUserSize, u64 options, source_locatio
         }
     }
 
-    // The header stores the size of the requested allocation
-    // (so the user code can look at the header and not be confused with garbage)
-    s64 extra = sizeof(allocation_header) + header->Alignment + (sizeof(allocation_header) % header->Alignment);
-
-    s64 oldUserSize = header->Size;
+    // The sample is for the old size, we (maybe) sample the new allocation below
+    if (allocation_is_sampled(ptr)) allocation_profiler_record_free(ptr);
 
-    s64 oldSize = oldUserSize + extra;
-    s64 newSize = newUserSize + extra;
+    auto alloc = info.Alloc;
+    s64 allocatorIndex = info.AllocatorIndex;
 
-#if defined DEBUG_MEMORY
-    oldSize += NO_MANS_LAND_SIZE;
-    newSize += NO_MANS_LAND_SIZE;
+    // A block which grows over the threshold moves to its own pages, from then on growing it remaps them
+    if (alloc.Function != os_allocator && is_large_allocation(alloc, newUserSize)) {
+        alloc = {os_allocator, null};
+#if not defined DEBUG_MEMORY
+        allocatorIndex = allocator_registry_get_index(alloc);
 #endif
+    }
 
-    auto alloc = header->Alloc;
+    s64 oldUserSize = info.Size;
+    s64 oldSize = get_block_size(oldUserSize, info.Alignment, info.HeaderSize);
 
-    void *block = (char *) header - header->AlignmentPadding;
+    // The new size may need a different kind of header (e.g. a small allocation growing over 64 KiB).
+    // In that case the header has a different size, so the block must be moved.
+    auto newKind = choose_header_kind(newUserSize, info.Alignment, allocatorIndex);
+    s64 newSize = get_block_size(newUserSize, info.Alignment, get_header_size(newKind));
+
+    void *block = (char *) ptr - info.HeaderSize - info.AlignmentPadding;
+    void *from = ptr;  // Where the contents are, the block may get moved by the allocator before we move it ourselves
     void *p;
 
     // Try to resize the block, this returns null if the block can't be resized and we need to move it.
-    void *newBlock = alloc.Function(allocator_mode::RESIZE, alloc.Context, newSize, block, oldSize, options);
+    void *newBlock = null;
+    if (alloc == info.Alloc && newKind == info.Kind) {
+#if defined DEBUG_MEMORY
+        // The allocator may move the block (and the header with it), so it can't stay linked while that happens
+        if (DEBUG_memory) DEBUG_memory->unlink_header(header);
+#endif
+        newBlock = alloc.Function(allocator_mode::RESIZE, alloc.Context, newSize, block, oldSize, options);
+#if defined DEBUG_MEMORY
+        if (DEBUG_memory && !newBlock) DEBUG_memory->add_header(header);  // The move below swaps it with the new header
+#endif
+
+        if (newBlock && ((u64) newBlock - (u64) block) % info.Alignment) {
+            // The allocator moved the block but kept a smaller alignment than ours (os_allocator remaps pages, which only
+            // keeps the offset from a page boundary). The contents came along, so move them once more from their new
+            // place to a properly aligned block, as if the resize had failed.
+            from = (char *) newBlock + ((char *) ptr - (char *) block);
+            block = newBlock;
+            oldSize = newSize;
+            newBlock = null;
+#if defined DEBUG_MEMORY
+            header = (allocation_header *) from - 1;
+            header->DEBUG_Pointer = from;
+            if (DEBUG_memory) DEBUG_memory->add_header(header);
+#endif
+        }
+    }
+
     if (!newBlock) {
         // Memory needs to be moved
         void *newBlock = alloc.Function(allocator_mode::ALLOCATE, alloc.Context, newSize, null, 0, options);
         assert(newBlock);
 
-        auto *newPointer = encode_header(newBlock, newUserSize, header->Alignment, alloc, options);
+        p = encode_header(newBlock, newUserSize, info.Alignment, alloc, allocatorIndex, newKind, options);
 
-        auto *newHeader = (allocation_header *) newPointer - 1;
-
-        copy_memory(newPointer, ptr, header->Size);
+        copy_memory(p, from, oldUserSize < newUserSize ? oldUserSize : newUserSize);
 
 #if defined DEBUG_MEMORY
+        auto *newHeader = (allocation_header *) p - 1;
+
         newHeader->ID = id;
         newHeader->RID = header->RID + 1;
 
         if (DEBUG_memory) {
-            thread::scoped_lock<thread::mutex> _(&DEBUG_memory->Mutex);
-
             DEBUG_memory->swap_header(header, newHeader);
         }
 
-        fill_memory(block, DEAD_LAND_FILL, oldSize);
-
         newHeader->FileName = loc.File;
         newHeader->FileLine = loc.Line;
 
         newHeader->MarkedAsLeak = header->MarkedAsLeak;
-#endif
-        alloc.Function(allocator_mode::FREE, alloc.Context, 0, block, oldSize, options);
 
-        p = (void *) (newHeader + 1);
+        fill_memory(block, DEAD_LAND_FILL, oldSize);
+#endif
+        info.Alloc.Function(allocator_mode::FREE, info.Alloc.Context, 0, block, oldSize, options);
     } else {
-        // The block was resized sucessfully and it doesn't need moving
-        assert(block == newBlock);  // Sanity
+        // The block was resized sucessfully. Usually in place, but the allocator may have moved it
+        // together with its contents (see the note about RESIZE in allocator.h), the padding stays the same.
+        p = (char *) newBlock + ((char *) ptr - (char *) block);
+
+        // Same kind of header, so only the size changes
+        if (info.Kind == allocation_header_kind::SMALL) {
+            auto *h = (allocation_header_small *) p - 1;
+            h->Bits = (h->Bits & ~0xFFFFull) | (u64) newUserSize;
+        } else if (info.Kind == allocation_header_kind::MEDIUM) {
+            ((allocation_header_medium *) p - 1)->Size = newUserSize;
+        } else {
+            ((allocation_header *) p - 1)->Size = newUserSize;
+        }
+        allocation_set_sampled(p, false);
 
 #if defined DEBUG_MEMORY
+        header = (allocation_header *) p - 1;
+        header->DEBUG_Pointer = p;
+        if (DEBUG_memory) DEBUG_memory->add_header(header);
+
         ++header->RID;
 
         header->FileName = loc.File;
         header->FileLine = loc.Line;
-#endif
-        header->Size = newUserSize;
 
-        p = (void *) (header + 1);
+        // If we are shrinking the memory, fill the old stuff with DEAD_LAND_FILL
+        if (newUserSize < oldUserSize) fill_memory((char *) p + newUserSize, DEAD_LAND_FILL, oldUserSize - newUserSize);
+#endif
     }
 
 #if defined DEBUG_MEMORY
-    if (oldSize < newSize) {
-        // If we are expanding the memory, fill the new stuff with CLEAN_LAND_FILL
-        fill_memory((char *) p + oldUserSize, CLEAN_LAND_FILL, newSize - oldSize);
-    } else {
-        // If we are shrinking the memory, fill the old stuff with DEAD_LAND_FILL
-        fill_memory((char *) header + oldSize, DEAD_LAND_FILL, oldSize - newSize);
-    }
+    // If we are expanding the memory, fill the new stuff with CLEAN_LAND_FILL
+    if (oldUserSize < newUserSize) fill_memory((char *) p + oldUserSize, CLEAN_LAND_FILL, newUserSize - oldUserSize);
 
     // Fill the no mans land fill and check the heap for corruption
     fill_memory((char *) p + newUserSize, NO_MANS_LAND_FILL, NO_MANS_LAND_SIZE);
 #endif
 
+    allocation_profiler_maybe_sample(p, newUserSize);
+    allocation_trace_maybe_record(allocation_trace_op::RESIZE, ptr, p, newUserSize, 0);
+
     return p;
 }
 
-void general_free(void *ptr, u64 options) {
-    if (!ptr) return;
+s64 general_allocate_batch(allocator alloc, void **results, s64 count, s64 userSize, u32 alignment, u64 options, source_location loc) {
+    if (count <= 0) return 0;
 
     options |= Context.AllocOptions;
 
-    auto *header = (allocation_header *) ptr - 1;
+    if (alignment == 0) {
+        auto contextAlignment = Context.AllocAlignment;
+        assert(is_pow_of_2(contextAlignment));
+        alignment = contextAlignment;
+    }
+
+#if defined DEBUG_MEMORY
+    if (DEBUG_memory) {
+        DEBUG_memory->maybe_verify_heap();
+    }
+#endif
+
+    if (Context.LogAllAllocations && !Context._LoggingAnAllocation) {
+        auto newContext = Context;
+        newContext._LoggingAnAllocation = true;
+
+        PUSH_CONTEXT(newContext) {
+            write(Context.Log, ">>> Batch allocation made at: ");
+            log_file_and_line(loc);
+            write(Context.Log, "\n");
+        }
+    }
 
-    auto alloc = header->Alloc;
-    void *block = (char *) header - header->AlignmentPadding;
+    alignment = alignment < POINTER_SIZE ? POINTER_SIZE : alignment;
+    assert(is_pow_of_2(alignment));
+    assert(alignment <= 32768 && "Alignment too large");
 
-    s64 extra = header->Alignment + sizeof(allocation_header) + (sizeof(allocation_header) % header->Alignment);
-    s64 size = header->Size + extra;
+    if (is_large_allocation(alloc, userSize)) alloc = {os_allocator, null};
 
 #if defined DEBUG_MEMORY
-    if (DEBUG_memory) {
-        thread::scoped_lock<thread::mutex> _(&DEBUG_memory->Mutex);
+    s64 allocatorIndex = -1;  // We always use the FULL header anyway
+#else
+    s64 allocatorIndex = allocator_registry_get_index(alloc);
+#endif
 
-        DEBUG_memory->maybe_verify_heap();
+    auto kind = choose_header_kind(userSize, alignment, allocatorIndex);
+
+    s64 required = get_block_size(userSize, alignment, get_header_size(kind));
+
+    allocator_batch batch = {results, count};
+
+    void *result = alloc.Function(allocator_mode::ALLOCATE_BATCH, alloc.Context, required, &batch, 0, options);
+    if (result == (void *) -1) {
+        // The allocator doesn't support batches. After the first failure we don't bother asking again, the rest are null.
+        For(range(count)) {
+            results[it] = alloc.Function(allocator_mode::ALLOCATE, alloc.Context, required, null, 0, options);
+            if (!results[it]) {
+                For_as(rest, range(it + 1, count)) results[rest] = null;
+                break;
+            }
+        }
     }
 
-    auto id = header->ID;
+    s64 allocated = 0;
+    For(range(count)) {
+        void *block = results[it];
+        if (!block) continue;  // Out of memory, the allocator left this one null
+
+        ++allocated;
+
+        auto *p = encode_header(block, userSize, alignment, alloc, allocatorIndex, kind, options);
+
+#if defined DEBUG_MEMORY
+        auto *header = (allocation_header *) p - 1;
+
+        header->FileName = loc.File;
+        header->FileLine = loc.Line;
 
-    size += NO_MANS_LAND_SIZE;
+        if (DEBUG_memory) {
+            DEBUG_memory->add_header(header);
+        }
+#endif
+
+        allocation_profiler_maybe_sample(p, userSize);
+        allocation_trace_maybe_record(allocation_trace_op::ALLOCATE, p, null, userSize, alignment);
+
+        results[it] = p;
+    }
+    return allocated;
+}
 
+// Everything we do when freeing before giving the block back to the allocator. Returns the block.
+file_scope void *prepare_free(void *ptr, const allocation_info &info, s64 size) {
+    void *block = (char *) ptr - info.HeaderSize - info.AlignmentPadding;
+
+    if (allocation_is_sampled(ptr)) allocation_profiler_record_free(ptr);
+    allocation_trace_maybe_record(allocation_trace_op::FREE, ptr, null, 0, 0);
+
+#if defined DEBUG_MEMORY
     if (DEBUG_memory) {
-        thread::scoped_lock<thread::mutex> _(&DEBUG_memory->Mutex);
+        DEBUG_memory->maybe_verify_heap();
+    }
+
+    auto *header = (allocation_header *) ptr - 1;
 
+    if (DEBUG_memory) {
+        DEBUG_memory->verify_header_and_neighbours(header);
         DEBUG_memory->unlink_header(header);
     }
 
     fill_memory(block, DEAD_LAND_FILL, size);
 #endif
 
+    return block;
+}
+
+void general_free(void *ptr, u64 options) {
+    if (!ptr) return;
+
+    options |= Context.AllocOptions;
+
+    auto info = allocation_get_info(ptr);
+
+    auto alloc = info.Alloc;
+    s64 size = get_block_size(info.Size, info.Alignment, info.HeaderSize);
+
+    void *block = prepare_free(ptr, info, size);
     alloc.Function(allocator_mode::FREE, alloc.Context, 0, block, size, options);
 }
 
+void general_free_batch(void **ptrs, s64 count, u64 options) {
+    options |= Context.AllocOptions;
+
+    // Consecutive blocks with the same allocator and size are collected here and freed with one FREE_BATCH request
+    void *blocks[64];
+    s64 blocksCount = 0;
+
+    allocator alloc;
+    s64 size = 0;
+
+    auto flush = [&]() {
+        if (!blocksCount) return;
+
+        allocator_batch batch = {blocks, blocksCount};
+
+        void *result = alloc.Function(allocator_mode::FREE_BATCH, alloc.Context, 0, &batch, size, options);
+        if (result == (void *) -1) {
+            // The allocator doesn't support batches
+            For(range(blocksCount)) alloc.Function(allocator_mode::FREE, alloc.Context, 0, blocks[it], size, options);
+        }
+        blocksCount = 0;
+    };
+
+    For(range(count)) {
+        void *ptr = ptrs[it];
+        if (!ptr) continue;
+
+        auto info = allocation_get_info(ptr);
+        s64 blockSize = get_block_size(info.Size, info.Alignment, info.HeaderSize);
+
+        if (blocksCount == (s64) (sizeof(blocks) / sizeof(blocks[0])) || info.Alloc != alloc || blockSize != size) {
+            flush();
+            alloc = info.Alloc;
+            size = blockSize;
+        }
+
+        blocks[blocksCount++] = prepare_free(ptr, info, blockSize);
+    }
+    flush();
+}
+
+s64 general_get_required_size(allocator alloc, s64 userSize, u32 alignment) {
+    if (alignment == 0) alignment = Context.AllocAlignment;
+    alignment = alignment < POINTER_SIZE ? POINTER_SIZE : alignment;
+
+#if defined DEBUG_MEMORY
+    s64 allocatorIndex = -1;
+#else
+    s64 allocatorIndex = allocator_registry_get_index(alloc);
+#endif
+
+    auto kind = choose_header_kind(userSize, alignment, allocatorIndex);
+    return get_block_size(userSize, alignment, get_header_size(kind));
+}
+
 void free_all(allocator alloc, u64 options) {
 #if defined DEBUG_MEMORY
     if (DEBUG_memory) {
-        thread::scoped_lock<thread::mutex> _(&DEBUG_memory->Mutex);
-
-        // Remove allocations made with the allocator from the the linked list so we don't corrupt the heap
-        auto *h = DEBUG_memory->Head;
-        while (h) {
-            auto *tmp = h->DEBUG_Next;
-            DEBUG_memory->unlink_header(h);
-            h = tmp;
-        }
+        // Remove allocations made with the allocator from the the linked lists so we don't corrupt the heap
+        DEBUG_memory->unlink_headers_with_allocator(alloc);
     }
 #endif
 
@@ -37,7 +37,15 @@ enum class allocator_mode { ADD_POOL = 0,
                             ALLOCATE,
                             RESIZE,
                             FREE,
-                            FREE_ALL };
+                            FREE_ALL,
+                            ALLOCATE_BATCH,
+                            FREE_BATCH };
+
+// Passed in _oldMemory_ with ALLOCATE_BATCH and FREE_BATCH, see the notes below.
+struct allocator_batch {
+    void **Blocks;
+    s64 Count;
+};
 
 // This is an option when allocating.
 // Allocations marked explicitly as leaks don't get reported with DEBUG_memory->report_leaks().
@@ -72,6 +80,19 @@ constexpr u64 LEAK = 1ull << 63;
 //     or null - memory can't be resized and needs to be moved.
 //     In the second case we allocate a new block and copy the old data there (in general_reallocate).
 //
+//     The one exception: an allocator which can move a block without copying (e.g. os_allocator remapping pages)
+//     may return a different pointer, as long as the contents come along. If the new block doesn't have the
+//     alignment of the old one (e.g. remapped pages keep only page alignment) we move the contents once more
+//     to a properly aligned block, so only do this if moving is cheaper than our copy.
+//
+// !!! ALLOCATE_BATCH and FREE_BATCH are optional. They let an allocator hand out (or take back) many blocks of the same size
+//     in one call, so the dispatch and locking (e.g. thread_cache_allocator) is paid once per batch instead of once per block.
+//     _oldMemory_ points to an allocator_batch. With ALLOCATE_BATCH _size_ is the size of each block and the allocator
+//     fills _Blocks_ with _Count_ blocks, returning _oldMemory_ on success or null when out of memory (the blocks which
+//     were allocated stay in the array, the rest are null). With FREE_BATCH _oldSize_ is the size of each block and null means success.
+//     Like FREE_ALL, return (void*) -1 if you don't implement them - general_allocate_batch/general_free_batch then fall back
+//     to ALLOCATE/FREE for each block.
+//
 // !!! Alignment is handled internally. Allocator implementations needn't pay attention to it.
 //     When an aligned allocation is being made, we send a request at least _alignment_ bytes larger,
 //     so when the allocator function returns an unaligned pointer we can freely bump it.
@@ -129,15 +150,61 @@ inline constexpr u8 CLEAN_LAND_FILL = 0xCD;
 #endif
 
 //
-// Each allocation contains this header before the returned pointer.
+// Each allocation contains a header before the returned pointer.
 // The returned pointer is guaranteed to be aligned to the specified alignment,
-// we do that by padding this structure. Info about that is saved in the header itself.
-// Right now this uses 32 bytes when DEBUG_MEMORY is not defined, 96 bytes when storing debug info.
+// we do that by padding the header. Info about that is saved in the header itself.
+//
+// We used to store the full allocation_header (below) for every allocation, that's 32 bytes (even more with DEBUG_MEMORY),
+// which is more than the allocation itself for most small objects. Now (when DEBUG_MEMORY is not defined)
+// we pick one of three layouts (similar to what https://nothings.org/stb/stb_malloc.h does):
+//
+//   SMALL  -  8 bytes, allocation_header_small,  for blocks smaller than 64 KiB with alignment <= 256
+//   MEDIUM - 16 bytes, allocation_header_medium, for everything else
+//   FULL   - 32 bytes, allocation_header,        when the allocator couldn't be registered (see below)
+//
+// The kind is stored in the top 2 bits of the last byte before the returned pointer, so we can always
+// decode the header by looking at ((u8 *) p)[-1] first.
 //
-// @TODO: This is way too bug of an overhead. We CAN make this smaller!
-//        We should be careful in aranging this header. We can split allocations into medium/large,
-//        etc. and use a smaller header for medium allocations to reduce overhead (like https://nothings.org/stb/stb_malloc.h).
+// The compact headers don't store the allocator (16 bytes), but an index into a global table of allocators.
+// An allocator gets registered the first time it's used in general_allocate(). The table has a fixed
+// capacity (MAX_REGISTERED_ALLOCATORS), after that allocations with new allocators fall back to FULL headers.
+// Entries of allocators which are done are released and reused, see allocator_registry_release().
 //
+// With DEBUG_MEMORY we always use the FULL header since we need space for the debug info anyway.
+//
+// Use the allocation_get_*() functions below instead of reading headers yourself.
+//
+enum class allocation_header_kind : u8 {
+    SMALL = 1,
+    MEDIUM = 2,
+    FULL = 3
+};
+
+inline constexpr s64 MAX_REGISTERED_ALLOCATORS = 1024;
+
+inline constexpr s64 SMALL_HEADER_MAX_SIZE = 0xFFFF;
+inline constexpr s64 SMALL_HEADER_MAX_ALIGNMENT = 256;
+
+// Set in the _Bits_ of compact headers when the allocation profiler sampled the allocation (see allocation_profiler.h).
+inline constexpr u64 ALLOCATION_HEADER_SAMPLED_BIT = 1ull << 61;
+
+// Bit layout (from lowest bits):
+//   Size - 16 bits, AlignmentPadding - 8 bits, log2(Alignment) - 4 bits, allocator index - 10 bits, unused, sampled - 1 bit, kind - 2 bits
+struct allocation_header_small {
+    u64 Bits;
+};
+
+// Bit layout of _Bits_ (from lowest bits):
+//   AlignmentPadding - 16 bits, log2(Alignment) - 4 bits, allocator index - 10 bits, unused, sampled - 1 bit, kind - 2 bits
+struct allocation_header_medium {
+    s64 Size;
+    u64 Bits;  // Last, so the kind ends up right before the returned pointer
+};
+
+#if defined DEBUG_MEMORY
+struct debug_memory_shard;
+#endif
+
 struct allocation_header {
 #if defined DEBUG_MEMORY
     // We store a linked list of all allocations made, in order to look for leaks and check integrity of all allocations at once.
@@ -147,10 +214,15 @@ struct allocation_header {
     //
     allocation_header *DEBUG_Next, *DEBUG_Previous;
 
+    // The shard (one per thread) whose list this header is in, see debug_memory_shard.
+    debug_memory_shard *DEBUG_Shard;
+
     // Useful for debugging (you can set a breakpoint with the ID in general_allocate() in allocator.cpp).
-    // Every allocation has an unique ID == to the ID of the previous allocation + 1.
-    // This is useful for debugging bugs related to allocations because (assuming your program isn't multithreaded)
-    // each time you run your program the ID of each allocation is easily reproducible (assuming no randomness from the user side).
+    // Every allocation has an unique ID == to the ID of the previous allocation on the same thread + 1.
+    // Each thread numbers its allocations in its own range (the index of its debug_memory_shard is in the upper bits,
+    // see DEBUG_MEMORY_SHARD_ID_SHIFT), so threads don't fight over one counter, and the main thread's IDs start at 0.
+    // This is useful for debugging bugs related to allocations because each time you run your program the ID of
+    // each allocation is easily reproducible (assuming no randomness from the user side and that threads get their shards in the same order).
     //
     // In the future we will have a more sophisticated way to debug allocations. See comment above.
     s64 ID;
@@ -170,11 +242,10 @@ struct allocation_header {
 #endif
 
     // The allocator used when allocating the memory. We read this when resizing/freeing to call the right allocator procedure.
-    // By design, we can't get rid of this.
+    // Compact headers store an index into the allocator registry instead.
     allocator Alloc;
 
     // The size of the allocation (NOT including the size of the header and padding).
-    // By design, we can't get rid of this (but we can make this smaller for medium sized allocations by packing a different header).
     s64 Size;
 
 #if defined DEBUG_MEMORY
@@ -187,7 +258,7 @@ struct allocation_header {
     // aligned. The structure of an allocation is basically this:
     //
     // User requests allocation of _size_. The underlying allocator is called with
-    //     _size_ + sizeof(allocation_header) + (sizeof(allocation_header) % alignment)
+    //     _size_ + header size + alignment (see get_block_size() in allocator.cpp)
     //
     // The result:
     //   ...[..Alignment padding..][............Header..................]............
@@ -196,6 +267,13 @@ struct allocation_header {
     u16 Alignment;         // We allow a maximum of 65535 bit (8191 byte) alignment
     u16 AlignmentPadding;  // Offset from the block that needs to be there in order for the result to be aligned
 
+    bool Sampled;  // Set when the allocation profiler sampled the allocation (see allocation_profiler.h)
+
+#if not defined DEBUG_MEMORY
+    u8 Reserved[2];
+    u8 Kind;  // (u8) allocation_header_kind::FULL << 6, must be the last byte in the header
+#endif
+
 #if defined DEBUG_MEMORY
     // When allocating we can mark the next allocation as a leak.
     // That means that it's irrelevant if we don't free it before the end of the program (since the OS claims back the memory anyway).
@@ -213,8 +291,134 @@ struct allocation_header {
 #endif
 };
 
-// 32, 96
-// constexpr s64 a = sizeof(allocation_header);
+// 8, 16, 32 (104 with DEBUG_MEMORY)
+static_assert(sizeof(allocation_header_small) == 8);
+static_assert(sizeof(allocation_header_medium) == 16);
+
+// States of an allocator_registry_entry
+constexpr s32 ALLOCATOR_REGISTRY_EMPTY = 0;
+constexpr s32 ALLOCATOR_REGISTRY_WRITING = 1;
+constexpr s32 ALLOCATOR_REGISTRY_READY = 2;
+constexpr s32 ALLOCATOR_REGISTRY_RELEASED = 3;  // Free to reuse, but doesn't end probe sequences like an empty one
+
+struct allocator_registry_entry {
+    allocator Alloc;
+    s32 State;
+};
+
+struct allocator_registry {
+    // Indexed with the allocator index stored in compact headers (open addressing, linear probing)
+    allocator_registry_entry Entries[MAX_REGISTERED_ALLOCATORS];
+
+    s64 Count;     // Entries which are ready
+    s64 MaxProbe;  // The longest distance of an entry from where its probe sequence starts, lookups stop after that
+};
+
+// :GlobalStateNoConstructors: Zero-initialized, no constructor needs to run.
+//
+// This is a pointer so modules which share memory can point it to the host's registry (see lstd_init_global in windows_common.cpp).
+inline allocator_registry AllocatorRegistryStorage;
+inline allocator_registry *AllocatorRegistry = &AllocatorRegistryStorage;
+
+// Returns the index of _alloc_ in the allocator registry, registers it if it's not already there.
+// Returns -1 if the registry is full. Thread-safe and lock-free, looking up a registered allocator doesn't write to shared memory.
+s64 allocator_registry_get_index(allocator alloc);
+
+// Releases the registry entries of all allocators with this context, so the entries can be reused by other allocators.
+// Only call this when no block allocated with them is live anymore (their compact headers store the index).
+//
+// Allocators which know when they are empty call this themselves (arena and pool allocators when their last pool is removed,
+// virtual_arena_allocator_release(), thread_heap_allocator_release()). If you create short-lived allocators of your own
+// (a lot of them, the registry holds MAX_REGISTERED_ALLOCATORS), call this when you are done with each one.
+void allocator_registry_release(void *context);
+
+// Everything stored in the header of an allocation, decoded.
+struct allocation_info {
+    allocator Alloc;
+    s64 AllocatorIndex;  // -1 for FULL headers
+
+    s64 Size;  // The size of the allocation (NOT including the size of the header and padding)
+    u32 Alignment;
+    u32 AlignmentPadding;
+
+    allocation_header_kind Kind;
+    u32 HeaderSize;
+};
+
+inline allocation_header_kind allocation_get_header_kind(void *ptr) {
+#if defined DEBUG_MEMORY
+    return allocation_header_kind::FULL;
+#else
+    return (allocation_header_kind) (((u8 *) ptr)[-1] >> 6);
+#endif
+}
+
+// _ptr_ must be a pointer returned by general_allocate/general_reallocate
+inline allocation_info allocation_get_info(void *ptr) {
+    allocation_info info;
+    info.Kind = allocation_get_header_kind(ptr);
+
+    if (info.Kind == allocation_header_kind::SMALL) {
+        u64 bits = ((allocation_header_small *) ptr - 1)->Bits;
+
+        info.Size = bits & 0xFFFF;
+        info.AlignmentPadding = (bits >> 16) & 0xFF;
+        info.Alignment = 1u << ((bits >> 24) & 0xF);
+        info.AllocatorIndex = (bits >> 28) & 0x3FF;
+        info.Alloc = AllocatorRegistry->Entries[info.AllocatorIndex].Alloc;
+        info.HeaderSize = sizeof(allocation_header_small);
+    } else if (info.Kind == allocation_header_kind::MEDIUM) {
+        auto *header = (allocation_header_medium *) ptr - 1;
+        u64 bits = header->Bits;
+
+        info.Size = header->Size;
+        info.AlignmentPadding = bits & 0xFFFF;
+        info.Alignment = 1u << ((bits >> 16) & 0xF);
+        info.AllocatorIndex = (bits >> 20) & 0x3FF;
+        info.Alloc = AllocatorRegistry->Entries[info.AllocatorIndex].Alloc;
+        info.HeaderSize = sizeof(allocation_header_medium);
+    } else {
+        assert(info.Kind == allocation_header_kind::FULL && "Invalid allocation header. Definitely corrupted.");
+
+        auto *header = (allocation_header *) ptr - 1;
+
+        info.Size = header->Size;
+        info.AlignmentPadding = header->AlignmentPadding;
+        info.Alignment = header->Alignment;
+        info.AllocatorIndex = -1;
+        info.Alloc = header->Alloc;
+        info.HeaderSize = sizeof(allocation_header);
+    }
+    return info;
+}
+
+// The size of the allocation (as requested, NOT including the size of the header and padding)
+inline s64 allocation_get_size(void *ptr) {
+    auto kind = allocation_get_header_kind(ptr);
+    if (kind == allocation_header_kind::SMALL) return ((allocation_header_small *) ptr - 1)->Bits & 0xFFFF;
+    if (kind == allocation_header_kind::MEDIUM) return ((allocation_header_medium *) ptr - 1)->Size;
+    return ((allocation_header *) ptr - 1)->Size;
+}
+
+inline u32 allocation_get_alignment(void *ptr) { return allocation_get_info(ptr).Alignment; }
+
+inline bool allocation_is_sampled(void *ptr) {
+    auto kind = allocation_get_header_kind(ptr);
+    if (kind == allocation_header_kind::FULL) return ((allocation_header *) ptr - 1)->Sampled;
+    return ((allocation_header_small *) ptr - 1)->Bits & ALLOCATION_HEADER_SAMPLED_BIT;  // _Bits_ is last in both compact headers
+}
+
+inline void allocation_set_sampled(void *ptr, bool sampled) {
+    auto kind = allocation_get_header_kind(ptr);
+    if (kind == allocation_header_kind::FULL) {
+        ((allocation_header *) ptr - 1)->Sampled = sampled;
+    } else {
+        auto *bits = &((allocation_header_small *) ptr - 1)->Bits;
+        *bits = sampled ? (*bits | ALLOCATION_HEADER_SAMPLED_BIT) : (*bits & ~ALLOCATION_HEADER_SAMPLED_BIT);
+    }
+}
+
+inline allocator allocation_get_allocator(void *ptr) { return allocation_get_info(ptr).Alloc; }
 
 // Calculates the required padding in bytes which needs to be added to _ptr_ in order to be aligned
 inline u16 calculate_padding_for_pointer(void *ptr, s32 alignment) {
@@ -238,35 +442,81 @@ inline u16 calculate_padding_for_pointer_with_header(void *ptr, s32 alignment, u
 
 // #if'd so programs don't compile when debug info shouldn't be used.
 #if defined DEBUG_MEMORY
-struct debug_memory {
-    s64 AllocationCount = 0;
-
-    // We keep a linked list of all allocations. You can use this list to visualize them.
-    // _Head_ is the last allocation done.
+// Each thread links its allocations into its own shard, so threads don't fight over one global lock when allocating.
+// Shards are never freed. When a thread exits its shard is released and the next new thread adopts it
+// (together with any allocations still in it).
+// Allocation IDs are (shard index << DEBUG_MEMORY_SHARD_ID_SHIFT) + the number of allocations made before in that shard.
+constexpr s64 DEBUG_MEMORY_SHARD_ID_SHIFT = 40;
+
+struct debug_memory_shard {
+    // _Head_ is the last allocation done by the thread that owns this shard.
     allocation_header *Head = null;
 
-    // Currently this mutex should be released in the OS implementations (e.g. windows_common.cpp).
-    // We need to lock it before modifying the linked list for example.
-    //
-    // @TODO: @Speed: Lock-free linked list!
-    thread::mutex Mutex;
+    // The owner thread takes this when linking/unlinking its own allocations, which is uncontended.
+    // Other threads take it only when freeing a block allocated by the owner (the cross-thread free path),
+    // when verifying the heap and when reporting leaks.
+    thread::fast_mutex Lock;
+
+    debug_memory_shard *Next = null;  // The global list of shards, see debug_memory::Shards
+    s32 InUse = 0;                    // 1 while a thread owns this shard
+
+    s64 Index = 0;            // The order in which shards were created, the first one (usually the main thread's) is 0
+    s64 AllocationCount = 0;  // Allocations made in this shard so far, only the owner thread writes it (no atomics)
+
+    // Where incremental heap verification continues from in this shard's list (null means start from _Head_).
+    // Unlinking the header the cursor points to moves the cursor to the next one.
+    allocation_header *VerifyCursor = null;
+};
+
+struct debug_memory {
+    // We keep a linked list of all allocations (one per thread, see debug_memory_shard). You can use these to visualize them.
+    // New shards are pushed to the front lock-free, we never remove shards, so walking this list doesn't need a lock.
+    debug_memory_shard *Shards = null;
+    s64 ShardsCount = 0;
+
+    // The shard incremental heap verification is currently going through. Shards are never freed so any value here is safe to use.
+    debug_memory_shard *VerifyShard = null;
 
     // After every allocation we check the heap for corruption.
-    // The problem is that this involves iterating over a (possibly) large linked list of every allocation made.
-    // We use the frequency variable below to specify how often we perform that expensive operation.
+    // Checking every allocation each time makes allocating O(n) in the number of live allocations,
+    // so each check looks at a slice of at most _VerifyHeapBudget_ headers and the next check continues where the last
+    // one stopped (wrapping around at the end). When freeing or resizing a block we also check it and its neighbours in the list.
+    //
+    // We use the frequency variable below to specify how often we perform a check.
     // By default we check the heap every 255 allocations, but if a problem is found you may want to decrease
     // this to 1 so you catch the corruption at just the right time.
     u8 MemoryVerifyHeapFrequency = 255;
 
+    // Maximum number of headers verified per check. Set this to 0 to verify the entire heap every time (very slow!).
+    s64 VerifyHeapBudget = 64;
+
+    // Called when verification finds a corrupted header, instead of stopping in the debugger.
+    // Useful for logging the corruption and continuing, and for testing that corruption gets caught.
+    // It's called while the lock of the header's shard is held, so it must not allocate or free.
+    void (*CorruptionHandler)(allocation_header *header, const char *message) = null;
+
     // Set this to true to print a list of unfreed memory blocks when the library uninitializes.
     // Yes, the OS claims back all the memory the program has allocated anyway, and we are not promoting C++ style RAII
     // which make EVEN program termination slow, we are just providing this information to the programmer because they might
     // want to debug crashes/bugs related to memory. (I had to debug a bug with loading/unloading DLLs during runtime).
     bool CheckForLeaksAtTermination = false;
 
-    void unlink_header(allocation_header *header);                                 // Removes a header from the list
-    void add_header(allocation_header *header);                                    // This adds the header to the front - making it the new head
-    void swap_header(allocation_header *oldHeader, allocation_header *newHeader);  // Replaces _oldHeader_ with _newHeader_ in the list
+    // Returns the shard of the calling thread, adopts a released one or creates a new one the first time it's called in a thread.
+    debug_memory_shard *get_thread_shard();
+
+    // Called when a thread exits (our thread wrapper does that), lets another thread adopt the shard.
+    void release_thread_shard();
+
+    void unlink_header(allocation_header *header);                                 // Removes a header from the shard it's in (may belong to another thread)
+    void add_header(allocation_header *header);                                    // Adds the header to the front of the calling thread's shard
+    void swap_header(allocation_header *oldHeader, allocation_header *newHeader);  // Replaces _oldHeader_ with _newHeader_
+
+    // Removes all headers located in [begin, end) from all shards. Used when an allocator frees many blocks
+    // at once without going through general_free (e.g. arena_allocator_rollback).
+    void unlink_headers_in_range(void *begin, void *end);
+
+    // Removes all headers of allocations made with _alloc_ from all shards (used by free_all).
+    void unlink_headers_with_allocator(allocator alloc);
 
     // Assuming that the heap is not corrupted, this reports any unfreed allocations.
     // Yes, the OS claims back all the memory the program has allocated anyway, and we are not promoting C++ style RAII
@@ -274,17 +524,23 @@ struct debug_memory {
     // want to debug crashes/bugs related to memory. (I had to debug a bug with loading/unloading DLLs during runtime).
     void report_leaks();
 
+    // Number of allocations made so far by all threads (sums the counters of the shards).
+    s64 get_allocation_count();
+
     // Verifies the integrity of headers in all allocations (only if DEBUG_MEMORY is on).
-    //
-    // We call this function when a new allocation is made.
-    // The problem is that it involves iterating over a linked list of every allocation made.
-    // We use the frequency variable in the _Context_ to specify how often we perform that expensive operation.
-    // By default we check the heap every 255 allocations, but if a problem is found you may want to decrease it to 1 so
-    // your program runs way slower but you catch the corruption at just the right time.
+    // This walks every allocation in every shard.
+    void verify_heap();
+
+    // Verifies the next slice of at most _VerifyHeapBudget_ headers (see comment above _MemoryVerifyHeapFrequency_).
+    // We call this function when an allocation is made, resized or freed.
     void maybe_verify_heap();
 
     // Verifies the integrity of a single header (only if DEBUG_MEMORY is on).
     void verify_header(allocation_header *header);
+
+    // Verifies _header_ and the headers before and after it in its list.
+    // We call this on blocks which are being freed or resized.
+    void verify_header_and_neighbours(allocation_header *header);
 };
 
 inline debug_memory *DEBUG_memory;
@@ -302,9 +558,24 @@ void *general_reallocate(void *ptr, s64 newSize, u64 options = 0, source_locatio
 // display all that information in a visual way. This will help the programmer see what the program is doing with memory exactly.
 void general_free(void *ptr, u64 options = 0);
 
+// Allocates _count_ blocks of _userSize_ bytes, each with its own header (so each one can be reallocated and freed on its own).
+// The allocator gets one ALLOCATE_BATCH request instead of _count_ ALLOCATE requests, see allocator_batch.
+// Returns how many blocks were allocated. If the allocator runs out of memory, the blocks it couldn't allocate are null
+// (the others are valid, pass the whole array to general_free_batch(), it skips the nulls).
+s64 general_allocate_batch(allocator alloc, void **results, s64 count, s64 userSize, u32 alignment, u64 options = 0, source_location loc = {});
+
+// Frees _count_ blocks (null pointers are skipped). Consecutive blocks with the same allocator and size go in one FREE_BATCH request,
+// so free blocks in the order you allocated them with general_allocate_batch().
+void general_free_batch(void **ptrs, s64 count, u64 options = 0);
+
 // Note: Not all allocators must support this.
 void free_all(allocator alloc, u64 options = 0);
 
+// Returns the size of the block general_allocate() requests from _alloc_ for an allocation of _userSize_ bytes
+// (that includes the header and the worst case alignment padding). If _alignment_ is 0 we use Context.AllocAlignment.
+// Useful for allocators which hand out fixed-size blocks, see pool_allocator.
+s64 general_get_required_size(allocator alloc, s64 userSize, u32 alignment = 0);
+
 //
 // Allocators don't allocate with os_allocate_block() but instead should require the programmer to have already passed
 // a block of memory (a pool) which they divide into smaller allocations. The pool may be allocated by another allocator
@@ -464,6 +735,91 @@ struct tlsf_allocator_data {
 //
 void *tlsf_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options);
 
+struct thread_cache_allocator_data {
+    tlsf_allocator_data Shared;  // The shared TLSF state. Only touched while holding _Lock_.
+    thread::fast_mutex Lock;     // Held only when refilling/spilling a cache or when adding/removing pools.
+};
+
+//
+// Thread-caching front end for the TLSF allocator (in the spirit of tcmalloc/mimalloc).
+//
+// A tlsf_allocator shared between threads needs a lock around every call, so threads which allocate a lot
+// end up serializing on that lock. This allocator keeps per-thread free lists for small size classes
+// (up to THREAD_CACHE_MAX_BLOCK_SIZE bytes, that includes our allocation header). Allocating and freeing
+// small blocks just pops/pushes a free list that only the current thread touches - no lock, no atomics.
+//
+// When a thread's free list for a size class is empty we lock once and grab a whole batch of blocks from the
+// shared TLSF state. When a free list grows too long we lock once and give a batch back. Blocks larger
+// than the biggest size class go directly to TLSF (under the lock).
+//
+// Every cached block is a normal TLSF block, so a block allocated on one thread may be freed on another
+// (it simply ends up in the other thread's cache). Blocks don't migrate back on their own, call
+// thread_cache_allocator_flush() before a thread exits (our thread wrapper does that for the platform allocators).
+//
+// Note: This relies on _oldSize_ being passed when freeing (general_free does that) in order to find the size class.
+//       Calling FREE with _oldSize_ == 0 bypasses the cache and frees the block directly in TLSF.
+//
+// Note: Before removing a pool with REMOVE_POOL make sure no thread has cached blocks from it (flush all threads).
+//
+// Usage: exactly like tlsf_allocator, add a pool with allocator_add_pool() and use {thread_cache_allocator, &data}.
+//
+void *thread_cache_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options);
+
+// Returns all blocks cached by the calling thread for this allocator back to the shared TLSF state.
+void thread_cache_allocator_flush(thread_cache_allocator_data *data);
+
+// Heaps of a thread_heap_allocator get address space in segments of this size.
+// A request larger than a segment gets a run of consecutive segments.
+constexpr s64 THREAD_HEAP_SEGMENT_SIZE = 4_MiB;
+
+struct thread_heap;
+
+struct thread_heap_allocator_data {
+    s64 Reserved = 64_GiB;  // Address space shared by all heaps, reserved on the first allocation. Change before that if you need more (or less).
+
+    byte *Base = null;
+    thread_heap **SegmentOwners = null;  // The heap each segment belongs to (lives at the start of the reserved range)
+    s64 SegmentsCount = 0;
+    s64 SegmentsUsed = 0;  // Segments are handed out in order and never given back (until thread_heap_allocator_release()), except when committing them fails
+
+    thread_heap *Heaps = null;  // Every heap ever created, heaps of threads which have exited get adopted by new threads
+    s64 Generation = 0;         // Changes every time the range is reserved, threads check it to notice their heap was released
+    thread::fast_mutex Lock;    // Held only when publishing the reserved range and when a thread gets or gives up its heap (never across system calls)
+};
+
+//
+// Thread-owned heaps with lock-free remote frees (in the spirit of mimalloc).
+//
+// Each thread gets its own TLSF heap the first time it allocates, so allocating never takes a lock.
+// Freeing a block on the thread which owns it is a plain TLSF free. Freeing a block on another thread pushes it on
+// the owner's remote free list (a lock-free stack, one compare and swap), the owner takes the whole list back
+// with a single atomic swap on its next allocation. So producer/consumer pipelines, where one thread allocates
+// and another frees, don't serialize on a lock (unlike a mutex guarded allocator).
+//
+// * Blocks are found to belong to a heap by their segment (a table lookup), so there is no per-block overhead
+// * Resizing works in place only on the owning thread, otherwise the block is moved to the current thread's heap
+// * A thread which exits should call thread_heap_allocator_abandon() (our thread wrapper does that), its heap is then
+//   adopted (with all its blocks, and the remote frees pushed in the meantime) by the next thread which needs one
+//
+// There are no pools (ADD_POOL and REMOVE_POOL fail), memory comes from a range reserved with os_reserve_memory().
+//
+// Usage:
+//     thread_heap_allocator_data data;
+//     allocator alloc = {thread_heap_allocator, &data};
+//
+//     auto *job = allocate<job_data>({.Alloc = alloc});  // On the producer thread
+//     ...
+//     free(job);                                         // On a consumer thread, goes back to the producer's heap
+//
+void *thread_heap_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options);
+
+// Gives up the calling thread's heaps (of all thread_heap_allocators) so other threads can adopt them.
+void thread_heap_allocator_abandon();
+
+// Releases the reserved range. Only call this when no thread uses the allocator anymore.
+// Threads which used it notice the next time they touch it (or abandon their heaps), the data can be used again after this.
+void thread_heap_allocator_release(thread_heap_allocator_data *data);
+
 //
 // General purpose allocator.
 //
@@ -476,6 +832,7 @@ void *tlsf_allocator(allocator_mode mode, void *context, s64 size, void *oldMemo
 struct arena_allocator_data {
     allocator_pool *Base = null;  // Linked list of pools, see arena_allocator.cpp for example usage of the helper routines we provide to manage this.
                                   // Of course, you can implement an entirely different way to store pools in your custom allocator!
+    allocator_pool *Current = null;  // The pool we are bumping, allocations never go to pools before it (until FREE_ALL)
     s64 PoolsCount = 0;
     s64 TotalUsed = 0;
 };
@@ -492,29 +849,209 @@ struct arena_allocator_data {
 // When out of memory, you should add another pool (with allocator_add_pool()) or provide a larger starting pool.
 // See :BigPhilosophyTime: a bit higher up in this file.
 //
-// You should avoid adding many pools with this allocator because when we searh for empty
-// space we walk the entire linked list (we stop at the first pool which has empty space).
-// This is the simplest but not the best behaviour in some cases.
-// Be wary that if you have many pools performance will not be optimal. In that case I suggest
-// writing a specialized allocator (by taking arena_allocator as an example - implemented in arena_allocator.cpp).
+// We remember the pool we are currently bumping, so allocating is O(1). When it runs out of space we move on to the
+// next pool in the list and never go back (until FREE_ALL), so the space left at the end of a pool is wasted.
+//
+// RESIZE works in place for the most recent allocation (when it is at the top of the current pool), so appending
+// to a single array or string in a loop doesn't copy on every reserve. Other blocks can't be resized and get moved.
 void *arena_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options);
 
+// Remembers the state of an arena so everything allocated after can be thrown away at once
+// without touching allocations made before (unlike FREE_ALL).
+struct arena_allocator_savepoint {
+    allocator_pool *Pool;  // The current pool at the time (null if no pools had been added yet)
+    s64 Used;              // The used offset in that pool
+    s64 TotalUsed;
+};
+
+arena_allocator_savepoint arena_allocator_get_savepoint(arena_allocator_data *data);
+
+// Frees every allocation made after _savepoint_ was taken. O(1) unless allocations since then spilled into later pools.
+// Savepoints must be rolled back in LIFO order, and calling FREE_ALL invalidates all savepoints.
+void arena_allocator_rollback(arena_allocator_data *data, arena_allocator_savepoint savepoint);
+
+struct virtual_arena_allocator_data {
+    byte *Base = null;  // Start of the reserved range, reserved on the first allocation
+
+    s64 Reserved = 64_GiB;      // Size of the range to reserve. Change before the first allocation if you need more (or less).
+    s64 Committed = 0;          // Bytes from _Base_ which are backed by memory
+    s64 KeepCommitted = 1_MiB;  // FREE_ALL gives back the committed memory above this mark
+    s64 TotalUsed = 0;          // The bump offset from _Base_
+};
+
+// We commit in chunks of this many bytes, so growing the arena doesn't call the OS for every page
+constexpr s64 VIRTUAL_ARENA_COMMIT_GRANULARITY = 64_KiB;
+
+//
+// Virtual memory arena allocator.
+//
+// Like the arena allocator, but instead of a chain of pools we reserve one large range of address space up front
+// (64 GiB by default, which costs no memory) and commit pages as the bump pointer advances. So:
+//
+// * It never runs out of space (until the reservation is used up) and never needs another pool
+// * Allocations are contiguous and never move, ALLOCATE is a bump and a compare
+// * RESIZE of the most recent allocation always succeeds in place
+// * FREE_ALL decommits everything above _KeepCommitted_, so a spike in usage doesn't stay resident forever
+//
+// There are no pools, ADD_POOL and REMOVE_POOL fail. Call virtual_arena_allocator_release() to give back the address space.
+//
+void *virtual_arena_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options);
+
+// A savepoint is just the bump offset. Same rules as arena_allocator_rollback().
+inline s64 virtual_arena_allocator_get_savepoint(virtual_arena_allocator_data *data) { return data->TotalUsed; }
+
+// Frees every allocation made after _savepoint_ was taken. O(1), doesn't decommit anything.
+void virtual_arena_allocator_rollback(virtual_arena_allocator_data *data, s64 savepoint);
+
+// Releases the reserved range. The next allocation reserves a new one.
+void virtual_arena_allocator_release(virtual_arena_allocator_data *data);
+
+struct pool_allocator_data {
+    // The size of each slot. Must be set before adding pools. Requests larger than this fail.
+    // Note that this is the size of the block we request from the allocator (including our header),
+    // use general_get_required_size() to calculate it for a given object size.
+    s64 ElementSize = 0;
+
+    allocator_pool *Base = null;     // Linked list of pools
+    allocator_pool *Current = null;  // The pool we are carving new slots from, the ones before it are full
+
+    void *FreeList = null;  // Intrusive linked list of freed slots (the link is stored in the slot itself)
+    s64 PoolsCount = 0;
+};
+
+//
+// Pool allocator.
+//
+// Hands out fixed-size slots (_ElementSize_ bytes) from the pools added with allocator_add_pool().
+// Useful when you have many objects of the same type, e.g. AST nodes, particles, buckets of a bucket_array.
+//
+// * O(1) allocate and free - we pop/push an intrusive free list, or carve the next slot from the current pool
+// * FREE_ALL is O(number of pools) - we reset each pool and forget the free list
+// * New slots are carved in order, so objects allocated together end up next to each other in memory
+//
+// Example:
+//     pool_allocator_data data;
+//     allocator nodeAlloc = {pool_allocator, &data};
+//     data.ElementSize = general_get_required_size(nodeAlloc, sizeof(ast_node));
+//     allocator_add_pool(nodeAlloc, os_allocate_block(64_KiB), 64_KiB);
+//
+//     auto *node = allocate<ast_node>({.Alloc = nodeAlloc});
+//
+// Note: REMOVE_POOL walks the entire free list to drop slots which belong to the removed pool.
+//
+void *pool_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options);
+
+// Blocks handed out by the buddy allocator are powers of 2 starting from this (so a free block can hold its free list links)
+constexpr s64 BUDDY_MIN_BLOCK_SIZE = 32;
+constexpr s64 BUDDY_MAX_ORDERS = 48;
+
+struct buddy_pool;
+
+struct buddy_allocator_data {
+    buddy_pool *Base = null;  // Linked list of pools, each one has its own free lists (see buddy_allocator.cpp)
+    s64 PoolsCount = 0;
+};
+
+//
+// Binary buddy allocator.
+//
+// Every block is a power of 2 in size (at least BUDDY_MIN_BLOCK_SIZE). A block of size 2^k splits into two "buddies" of
+// size 2^(k-1), and when both buddies are free they merge back. So:
+//
+// * O(log n) allocate and free - we split the smallest free block which is large enough, on free we merge with the buddy repeatedly
+// * Free blocks coalesce immediately, so large blocks become available again as soon as everything in them is freed
+// * RESIZE works in place when shrinking (we give back the upper halves) and when growing into free buddies, so large
+//   dynamic buffers (e.g. an array<byte> staging area) often grow without being copied
+// * Internal fragmentation: a block is rounded up to the next power of 2, so on average about 25% of each block is unused
+//
+// Compared to tlsf_allocator (see the buddy_allocator test for numbers): TLSF wastes less memory per block and is faster
+// on average, but it can only grow a block in place if the block right after it happens to be free.
+// The buddy allocator is the better fit for a few large buffers which grow and shrink a lot.
+//
+// Each pool keeps a small bitmap at its start (one bit per BUDDY_MIN_BLOCK_SIZE bytes). Pools don't need to be a power of 2 in size.
+//
+// Note: This relies on _oldSize_ being passed when freeing and resizing (the general functions do that) in order to find the block's size.
+//
+void *buddy_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options);
+
+//
+// OS allocator.
+//
+// Every block is its own allocation from the OS (os_allocate_block()), so freeing gives the pages back immediately.
+// Too slow for small objects, but for large ones it avoids fragmenting other allocators' pools.
+//
+// RESIZE may move the block (see the note about RESIZE at the top of this file): on Linux the pages are remapped
+// with mremap, so growing a large buffer never copies its contents.
+//
+// There are no pools and no FREE_ALL. This is what allocations at least Context.LargeAllocThreshold bytes large go to.
+//
+void *os_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options);
+
+// Size classes of the histogram in allocator_stats: bucket i counts blocks with size in [2^i, 2^(i+1)).
+constexpr s64 ALLOCATOR_STATS_SIZE_CLASSES = 48;
+
+// A copy of the counters of a stats_allocator at some point in time, see stats_allocator_get_snapshot().
+// All sizes are of the blocks requested from the wrapped allocator (they include our allocation header and padding).
+struct allocator_stats {
+    s64 AllocationCount = 0;  // Number of ALLOCATE requests (moving RESIZEs count as allocations too, since general_reallocate does ALLOCATE + FREE)
+    s64 FreeCount = 0;
+    s64 FailedCount = 0;  // Number of ALLOCATE requests the wrapped allocator returned null for
+
+    s64 LiveBytes = 0;
+    s64 PeakBytes = 0;       // Highest _LiveBytes_ since the start (or the last stats_allocator_reset_peak())
+    s64 AllocatedBytes = 0;  // Total bytes ever allocated
+
+    s64 SizeHistogram[ALLOCATOR_STATS_SIZE_CLASSES] = {};
+};
+
+struct stats_allocator_data {
+    allocator Parent;  // The allocator which does the actual work
+
+    // Updated atomically, read with stats_allocator_get_snapshot()
+    allocator_stats Stats;
+};
+
+//
+// Statistics wrapper.
+//
+// Forwards every request to _Parent_ and counts allocations, frees, live and peak bytes, and keeps a log2 histogram
+// of the requested sizes. This is opt-in: wrap the allocator you are interested in and use the wrapper instead.
+// Counters are updated with atomic operations, so the wrapper is as thread-safe as _Parent_ (no locks are added).
+//
+// Useful for sizing pools from real data, e.g. the persistent storage (PLATFORM_PERSISTENT_STORAGE_STARTING_SIZE)
+// or the temporary allocator, instead of relying on the warnings printed when pools overflow.
+//
+// Example:
+//     stats_allocator_data data;
+//     data.Parent = Context.TempAlloc;
+//
+//     PUSH_ALLOC((allocator{stats_allocator, &data})) {
+//         ... run a frame ...
+//     }
+//     print("{}\n", stats_allocator_get_snapshot(&data));
+//
+// Note: FREE_ALL sets the live bytes to 0 if _Parent_ supports it.
+//
+void *stats_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options);
+
+// Returns a copy of the counters. Cheap - no locks, just reads. The fields are read one at a time,
+// so if other threads are allocating at the same time the snapshot may be slightly inconsistent.
+allocator_stats stats_allocator_get_snapshot(stats_allocator_data *data);
+
+// Sets the peak to the current live bytes, e.g. to measure the peak of each frame separately.
+void stats_allocator_reset_peak(stats_allocator_data *data);
+
 //
 // :TemporaryAllocator: See context.h
 //
-// This is an extension to the arena allocator, things that are different:
-// * This allocator is not initialized by default, but the first allocation you do with it adds a starting pool (of size 8_KiB).
-//   You can initialize it yourself in a given thread by calling allocator_add_pool() yourself.
-// * When you try to allocate a block but there is no available space, this automatically adds another pool (and prints a warning to the console).
+// This is the virtual memory arena allocator (see above) with the default settings. Each thread reserves its own range
+// on the first allocation, only the memory that is actually used gets committed. It can't run out of space, so it never adds pools.
 //
 // One good example use case for the temporary allocator: if you are programming a game and you need to calculate
 //   some mesh stuff for a given frame, using this allocator means having the freedom of dynamically allocating
 //   without compromising performance. At the end of the frame when the memory is no longer used you FREE_ALL and
 //   start the next frame.
 //
-// We print warnings when allocating new pools. Use that as a guide to see where you need to pay more attention 
-// - perhaps increase the pool size or call free_all() more often.
-//
 void *default_temp_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options);
 
 LSTD_END_NAMESPACE
@@ -2,8 +2,6 @@
 #include "allocator.h"
 #include "string.h"
 
-import os;
-
 LSTD_BEGIN_NAMESPACE
 
 #if COMPILER == MSVC
@@ -21,6 +19,7 @@ void *arena_allocator(allocator_mode mode, void *context, s64 size, void *oldMem
 
             if (!allocator_pool_initialize(pool, size)) return null;
             allocator_pool_add_to_linked_list(&data->Base, pool);
+            if (!data->Current) data->Current = pool;
             if (pool) {
                 ++data->PoolsCount;
                 return pool;
@@ -34,18 +33,24 @@ void *arena_allocator(allocator_mode mode, void *context, s64 size, void *oldMem
             if (result) {
                 --data->PoolsCount;
                 assert(data->PoolsCount >= 0);
+
+                // Start from the beginning, ALLOCATE skips full pools
+                if (data->Current == pool) data->Current = data->Base;
+
+                // No pools, no live blocks. Short-lived arenas shouldn't keep an allocator registry entry forever.
+                if (!data->PoolsCount) allocator_registry_release(data);
                 return result;
             }
             return null;
         }
         case allocator_mode::ALLOCATE: {
-            auto *p = data->Base;
-            while (p->Next) {
-                if (p->Used + size < p->Size) break;
-                p = p->Next;
-            }
+            // We only bump _Current_. If it doesn't have enough space we move on to the next pool
+            // and the space left in the previous one is wasted until FREE_ALL.
+            auto *p = data->Current;
+            while (p && p->Used + size > p->Size) p = p->Next;
 
-            if (p->Used + size >= p->Size) return null;  // Not enough space
+            if (!p) return null;  // Not enough space
+            data->Current = p;
 
             void *usableBlock = p + 1;
             void *result = (byte *) usableBlock + p->Used;
@@ -56,14 +61,21 @@ void *arena_allocator(allocator_mode mode, void *context, s64 size, void *oldMem
             return result;
         }
         case allocator_mode::RESIZE: {
-            // Implementing a fast RESIZE requires finding in which block the memory is in.
-            // We might store a header which tells us that but right now I don't think it's worth it.
-            // We simply return null and let the reallocate function allocate a new block and copy the contents.
-            //
-            // If you are dealing with very very large blocks and copying is expensive, you should
-            // implement a specialized allocator. If you are dealing with appending to strings
-            // (which causes string to try to reallocate), we provide a string_builder utility which will help with that.
-            return null;
+            // We can resize in place only the most recent allocation (the one at the top of the current pool),
+            // which is the common case when appending to an array or a string in a loop.
+            // Otherwise we return null and let the reallocate function allocate a new block and copy the contents.
+            auto *p = data->Current;
+            if (!p) return null;
+
+            void *top = (byte *) (p + 1) + p->Used;
+            if ((byte *) oldMemory + oldSize != top) return null;
+
+            if (p->Used - oldSize + size > p->Size) return null;  // Not enough space
+
+            p->Used += size - oldSize;
+            data->TotalUsed += size - oldSize;
+
+            return oldMemory;
         }
         case allocator_mode::FREE: {
             // We don't free individual allocations in the arena allocator
@@ -77,6 +89,7 @@ void *arena_allocator(allocator_mode mode, void *context, s64 size, void *oldMem
                 p->Used = 0;
                 p = p->Next;
             }
+            data->Current = data->Base;
 
             data->TotalUsed = 0;
 
@@ -84,43 +97,46 @@ void *arena_allocator(allocator_mode mode, void *context, s64 size, void *oldMem
             // (void *) -1 means that the allocator doesn't support FREE_ALL (by design)
             return null;
         }
+        case allocator_mode::ALLOCATE_BATCH:
+            // (void *) -1 means that the allocator doesn't support batches, we get one request per block instead
+            return (void *) -1;
+        case allocator_mode::FREE_BATCH:
+            // Like FREE, nothing to do
+            return null;
         default:
             assert(false);
     }
     return null;
 }
 
-void *default_temp_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options) {
-    auto *data = (arena_allocator_data *) context;
-
-    if (!data->Base) {
-        s64 startingPoolSize = 8_KiB;
-
-        // Make sure the starting pool has enough space for the allocation we are about to do
-        if (mode == allocator_mode::ALLOCATE) {
-            if (startingPoolSize < size) startingPoolSize = ceil_pow_of_2(size * 2);
-        } else if (mode != allocator_mode::ADD_POOL) {  // If we called with ADD_POOL, don't add the starting pool.
-            allocator_add_pool({arena_allocator, data}, os_allocate_block(startingPoolSize), startingPoolSize);
-        }
-    }
-
-    auto *result = arena_allocator(mode, context, size, oldMemory, oldSize, options);
-    if (mode == allocator_mode::ALLOCATE && !result) {
-        // If we tried to allocate a block but didn't have enough space, we make a new, larger pool and print a warning.
-        // This is default behaviour which you can override by providing your own custom allocator extension.
-        //
-        // You can avoid this by freeing all periodically or by manually adding a large enough pool at the beginning of your program.
-        internal::platform_report_warning("Not enough space in temporary allocator; adding a pool");
+arena_allocator_savepoint arena_allocator_get_savepoint(arena_allocator_data *data) {
+    auto *p = data->Current;
+    return {p, p ? p->Used : 0, data->TotalUsed};
+}
 
-        s64 poolSize = 8_KiB;
-        if (poolSize < size) poolSize = ceil_pow_of_2(size * 2);
+void arena_allocator_rollback(arena_allocator_data *data, arena_allocator_savepoint savepoint) {
+    auto *p = savepoint.Pool ? savepoint.Pool : data->Base;
+    if (!p) return;
 
-        allocator_add_pool({arena_allocator, data}, os_allocate_block(poolSize), poolSize);
+    s64 used = savepoint.Pool ? savepoint.Used : 0;
+    assert(p->Used >= used && "Rolling back to a savepoint which is no longer valid (out of order or after free_all?)");
 
-        result = arena_allocator(allocator_mode::ALLOCATE, context, size, null, 0, options);
+    // Allocations made after the savepoint live at the top of its pool and in the pools up to (and including) the current one.
+    auto *end = data->Current ? data->Current->Next : null;
+    while (p != end) {
+#if defined DEBUG_MEMORY
+        if (DEBUG_memory) {
+            auto *usable = (byte *) (p + 1);
+            DEBUG_memory->unlink_headers_in_range(usable + used, usable + p->Used);
+        }
+#endif
+        p->Used = used;
+        used = 0;
+        p = p->Next;
     }
 
-    return result;
+    data->Current = savepoint.Pool ? savepoint.Pool : data->Base;
+    data->TotalUsed = savepoint.TotalUsed;
 }
 
 #if COMPILER == MSVC
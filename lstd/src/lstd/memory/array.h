@@ -41,9 +41,9 @@ struct array {
     constexpr array() {}
     constexpr array(T *data, s64 count) : Data(data), Count(count), Allocated(0) {}
     constexpr array(const initializer_list<T> &items) {
-        static_assert(false, "This bug bit me hard... Don't create arrays which are views into initializer lists (they get optimized in Release).");
-        static_assert(false, "You may want to reserve a dynamic array with those values. In that case make an empty array and use append_list().");
-        static_assert(false, "Or you can store them in an array on the stack - e.g. use to_stack_array(1, 2, 3...)");
+        static_assert(types::always_false<T>, "This bug bit me hard... Don't create arrays which are views into initializer lists (they get optimized in Release).");
+        static_assert(types::always_false<T>, "You may want to reserve a dynamic array with those values. In that case make an empty array and use append_list().");
+        static_assert(types::always_false<T>, "Or you can store them in an array on the stack - e.g. use to_stack_array(1, 2, 3...)");
     }
 
     //
@@ -209,8 +209,7 @@ template <typename T>
 auto *array_insert_at(T &arr, s64 index, T &arr2) { return array_insert_at(arr, index, arr2.Data, arr2.Count); }
 
 // Removes element at specified index and moves following elements back
-template <typename T>
-void array_remove_at(array<T> &arr, s64 index) {
+void array_remove_at(is_array auto &arr, s64 index) {
     // If the array is a view, we don't want to modify the original!
     if (!arr.Allocated) array_reserve(arr, 0);
 
@@ -241,7 +240,7 @@ void array_remove(T &arr, const array_data_t<T> &element) {
 
     assert(index != -1 && "Element not in list");
 
-    string_remove_at(arr, index);
+    array_remove_at(arr, index);
 }
 
 // Removes element at specified index and moves the last element to the empty slot.
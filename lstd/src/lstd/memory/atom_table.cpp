@@ -0,0 +1,127 @@
+#include "atom_table.h"
+
+#include "hash_table.h"
+
+LSTD_BEGIN_NAMESPACE
+
+constexpr s64 ATOM_TABLE_MINIMUM_INDEX_SIZE = 64;
+
+file_scope u64 *get_slots(atom_table_index *index) { return (u64 *) (index + 1); }
+
+file_scope u64 make_slot(u64 hash, u32 id) { return (hash & 0xFFFFFFFF00000000ull) | id; }
+
+// Bump allocates from one of the table's arenas. Sizes are rounded to 8 bytes so everything stays 8 byte aligned
+// (the arena starts at a page boundary). We call the allocator directly because the blocks never get freed one by one.
+file_scope void *arena_bump(virtual_arena_allocator_data *arena, s64 size) {
+    void *result = virtual_arena_allocator(allocator_mode::ALLOCATE, arena, (size + 7) & ~7ll, null, 0, 0);
+    assert(result && "Atom table ran out of address space");
+    return result;
+}
+
+// Returns the atom, 0 if the string is not in _index_
+file_scope u32 find_in_index(const atom_table *table, atom_table_index *index, const byte *data, s64 count, u64 hash) {
+    u64 *slots = get_slots(index);
+    s64 mask = index->Allocated - 1;
+
+    u64 tag = make_slot(hash, 0);
+
+    s64 i = (s64) hash_table_mix(hash) & mask;
+    while (true) {
+        u64 slot = atomic_load(slots + i);
+        if (!slot) return 0;
+
+        if ((slot & 0xFFFFFFFF00000000ull) == tag) {
+            u32 id = (u32) slot;
+
+            // The entry was written before the slot was published
+            auto *entry = ((atom_entry **) table->Entries.Base)[id];
+            if (entry->Hash == hash && entry->Count == count && compare_memory(entry + 1, data, count) == -1) return id;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+// Only the thread holding the write lock modifies the index.
+// The slot is written with a single atomic store, so readers see either an empty slot or a complete one.
+file_scope void insert_in_index(atom_table_index *index, u64 hash, u32 id) {
+    u64 *slots = get_slots(index);
+    s64 mask = index->Allocated - 1;
+
+    s64 i = (s64) hash_table_mix(hash) & mask;
+    while (slots[i]) i = (i + 1) & mask;
+
+    atomic_swap(slots + i, make_slot(hash, id));
+}
+
+// Builds a larger index to the side and then swaps it in. Readers still probing the old one see it unchanged.
+file_scope void grow_index(atom_table *table) {
+    s64 allocated = table->Index ? table->Index->Allocated * 2 : ATOM_TABLE_MINIMUM_INDEX_SIZE;
+
+    auto *index = (atom_table_index *) arena_bump(&table->Arena, sizeof(atom_table_index) + allocated * sizeof(u64));
+    index->Allocated = allocated;
+    zero_memory(get_slots(index), allocated * sizeof(u64));
+
+    auto **entries = (atom_entry **) table->Entries.Base;
+    For(range(1, table->Count + 1)) {
+        insert_in_index(index, entries[it]->Hash, (u32) it);
+    }
+
+    atomic_swap((s64 *) &table->Index, (s64) index);
+}
+
+atom atom_table_find_prehashed(const atom_table *table, const byte *data, s64 count, u64 hash) {
+    auto *index = (atom_table_index *) atomic_load((const s64 *) &table->Index);
+    if (!index) return {};
+
+    return {find_in_index(table, index, data, count, hash)};
+}
+
+atom atom_table_intern_prehashed(atom_table *table, const byte *data, s64 count, u64 hash) {
+    // Most strings are already interned, that doesn't need the lock
+    atom result = atom_table_find_prehashed(table, data, count, hash);
+    if (result) return result;
+
+    table->WriteLock.lock();
+    defer(table->WriteLock.unlock());
+
+    // Another thread may have added it while we were waiting on the lock (or the index grew after we loaded it)
+    if (table->Index) {
+        u32 id = find_in_index(table, table->Index, data, count, hash);
+        if (id) return {id};
+    }
+
+    assert(table->Count < U32_MAX && "Too many atoms");
+
+    if (!table->Index || (table->Count + 1) * 2 > table->Index->Allocated) grow_index(table);
+
+    // Entry pointer 0 is never used, 0 is the invalid atom
+    if (!table->Entries.Base) arena_bump(&table->Entries, sizeof(atom_entry *));
+    auto **entryPointer = (atom_entry **) arena_bump(&table->Entries, sizeof(atom_entry *));
+
+    auto *entry = (atom_entry *) arena_bump(&table->Arena, sizeof(atom_entry) + count + 1);
+    entry->Hash = hash;
+    entry->Count = count;
+    entry->Length = utf8_length((const utf8 *) data, count);
+    copy_memory(entry + 1, data, count);
+    ((byte *) (entry + 1))[count] = 0;
+
+    *entryPointer = entry;
+
+    // Count goes up before the atom is published, so atom_table_get_entry() never sees an atom larger than it
+    u32 id = (u32) (table->Count + 1);
+    assert(entryPointer == (atom_entry **) table->Entries.Base + id);
+    atomic_swap(&table->Count, (s64) id);
+
+    insert_in_index(table->Index, hash, id);
+    return {id};
+}
+
+void atom_table_release(atom_table *table) {
+    virtual_arena_allocator_release(&table->Arena);
+    virtual_arena_allocator_release(&table->Entries);
+
+    table->Index = null;
+    table->Count = 0;
+}
+
+LSTD_END_NAMESPACE
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "../thread.h"
+#include "allocator.h"
+#include "string.h"
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// String interning.
+//
+// An atom table stores each distinct string once and hands out a 32 bit atom for it. The same contents always give
+// the same atom, so comparing two interned strings is an integer compare and a hash table keyed by atoms never
+// hashes or compares bytes. Use it for identifiers which get compared and looked up over and over
+// (names of assets, entities, shader parameters, symbols in a parser).
+//
+// The bytes are stored in an arena (a virtual_arena_allocator with its own reserved range) and are never moved or freed
+// until the whole table is released, so the string for an atom stays valid as long as the table does.
+// Each string's hash (the same one get_hash() returns for a string or a bytes view) and its length in code points
+// are stored next to it, so neither is ever computed again.
+//
+// Looking up a string which is already interned doesn't take a lock - threads only serialize when they add new strings.
+// That's the common case for interning: a name is added once and then looked up for the rest of the program.
+// The hash index is an open addressing table of atom IDs. When it grows, the new one is built to the side and swapped in,
+// and the old one is left in the arena for readers which may still be probing it (so the old ones take at most
+// as much memory as the current one).
+//
+// Usage:
+//     atom_table names;
+//     defer(atom_table_release(&names));
+//
+//     atom a = atom_table_intern(&names, "player_spawn");
+//     atom b = atom_table_intern(&names, bytesFromAFile);    // Any array-like, the bytes are copied only the first time
+//     if (a == b) ...
+//
+//     string s = atom_table_get_string(&names, a);            // A view into the table
+//
+
+// 0 is not a valid atom, the first string gets 1
+struct atom {
+    u32 ID = 0;
+
+    explicit operator bool() const { return ID != 0; }
+};
+
+inline bool operator==(atom one, atom other) { return one.ID == other.ID; }
+inline bool operator!=(atom one, atom other) { return one.ID != other.ID; }
+
+// IDs are unique so they hash perfectly (hash tables mix the bits anyway).
+// This is not the hash of the string, see atom_table_get_hash() for that.
+inline u64 get_hash(atom value) { return value.ID; }
+
+// Stored in the arena right before the bytes of each string (which are followed by a null terminator)
+struct atom_entry {
+    u64 Hash;
+    s64 Count;   // In bytes
+    s64 Length;  // In code points
+};
+
+struct atom_table_index {
+    s64 Allocated;  // A power of 2, we grow at half full
+
+    // Followed by _Allocated_ slots. 0 is an empty slot, otherwise the top 32 bits of the string's hash and the
+    // bottom 32 bits are the atom, so most mismatches are rejected without looking at the entry.
+};
+
+struct atom_table {
+    // Holds the entries, the strings and the hash indices
+    virtual_arena_allocator_data Arena;
+
+    // A separate range just for the array of entry pointers (indexed by atom), so it grows in place and never moves
+    virtual_arena_allocator_data Entries;
+
+    atom_table_index *Index = null;
+
+    s64 Count = 0;  // The number of strings interned
+
+    thread::fast_mutex WriteLock;  // Held only while adding a string
+};
+
+// The bytes, their hash and their length in code points. _hash_ must be get_hash_bytes(data, count).
+atom atom_table_find_prehashed(const atom_table *table, const byte *data, s64 count, u64 hash);
+atom atom_table_intern_prehashed(atom_table *table, const byte *data, s64 count, u64 hash);
+
+// Returns the atom for a string which was already interned, or an invalid atom (0) if it wasn't. Never adds.
+inline atom atom_table_find(const atom_table *table, const byte *data, s64 count) {
+    return atom_table_find_prehashed(table, data, count, get_hash_bytes(data, count));
+}
+
+template <is_array_like T>
+atom atom_table_find(const atom_table *table, const T &str) {
+    return atom_table_find(table, (const byte *) str.Data, str.Count * sizeof(*str.Data));
+}
+
+inline atom atom_table_find(const atom_table *table, const utf8 *str) { return atom_table_find(table, (const byte *) str, c_string_length(str)); }
+
+// Returns the atom for the string, adding it to the table if it's not already there.
+inline atom atom_table_intern(atom_table *table, const byte *data, s64 count) {
+    return atom_table_intern_prehashed(table, data, count, get_hash_bytes(data, count));
+}
+
+template <is_array_like T>
+atom atom_table_intern(atom_table *table, const T &str) {
+    return atom_table_intern(table, (const byte *) str.Data, str.Count * sizeof(*str.Data));
+}
+
+inline atom atom_table_intern(atom_table *table, const utf8 *str) { return atom_table_intern(table, (const byte *) str, c_string_length(str)); }
+
+// Returns the entry for an atom of this table (asserts the atom is valid)
+inline const atom_entry *atom_table_get_entry(const atom_table *table, atom value) {
+    assert(value.ID && value.ID <= atomic_load(&table->Count) && "Atom is not from this table");
+    return ((atom_entry **) table->Entries.Base)[value.ID];
+}
+
+// Returns a view into the table (null-terminated), valid until the table is released
+inline string atom_table_get_string(const atom_table *table, atom value) {
+    auto *entry = atom_table_get_entry(table, value);
+
+    string result;
+    result.Data = (utf8 *) (entry + 1);
+    result.Count = entry->Count;
+    result.Length = entry->Length;
+    return result;
+}
+
+// Returns the hash of the atom's string (the same as get_hash() of the string), without hashing again
+inline u64 atom_table_get_hash(const atom_table *table, atom value) { return atom_table_get_entry(table, value)->Hash; }
+
+// Frees all strings, atoms from this table are no longer valid. Not safe to call while other threads are using the table.
+void atom_table_release(atom_table *table);
+
+// @Pedantic We want to make sure the user doesn't clone things that don't make sense.
+inline atom_table *clone(atom_table *dest, const atom_table &src) {
+    assert(false && "We don't deep copy atom tables, atoms from one table are meaningless in another");
+    return null;
+}
+
+LSTD_END_NAMESPACE
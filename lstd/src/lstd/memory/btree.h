@@ -0,0 +1,648 @@
+#pragma once
+
+#include "array.h"
+
+LSTD_BEGIN_NAMESPACE
+
+// Nodes are sized to about this many bytes by default (4 cache lines), see btree_default_fanout()
+constexpr s64 BTREE_NODE_SIZE = 256;
+
+// The number of keys a node holds when its leaves are about BTREE_NODE_SIZE bytes (at least 4)
+template <typename K, typename V>
+constexpr s64 btree_default_fanout() {
+    s64 fanout = (BTREE_NODE_SIZE - 3 * (s64) sizeof(void *)) / (s64) (sizeof(K) + sizeof(V));
+    return fanout < 4 ? 4 : fanout;
+}
+
+template <typename K, typename V>
+struct btree_key_value_pair {
+    K *Key;
+    V *Value;
+};
+
+// The value type of btree_set
+struct btree_no_value {};
+
+// An ordered map (a B+ tree).
+//
+// Use this instead of hash_table when you need the keys in order: sorted iteration, the smallest/largest key,
+// or every key in a range (see lower_bound(), upper_bound() and btree_range()). Lookups are O(log n) instead of O(1).
+//
+// Every node holds up to _Fanout_ keys in a sorted array, by default as many as fit a leaf in BTREE_NODE_SIZE bytes.
+// So the tree is very shallow (a million 8 byte keys are 5 levels deep with the default of 14) and a search reads a few
+// contiguous arrays instead of chasing a pointer for every comparison like a binary tree does.
+// A larger fanout means fewer levels but more keys to move on insert and remove.
+//
+// Keys and values live only in the leaves, the internal nodes hold copies of keys to pick the child to descend to.
+// The leaves are linked to each other, so iterating in order (and over a range) just walks the leaves.
+//
+// Nodes are allocated with the Context's allocator (like hash_table and array). Keys and values are copied byte by byte
+// when nodes are split and merged (same as arrays do, see :BigPhilosophyTime: in context.h), so pointers to
+// them are invalidated by adding and removing.
+//
+// Keys are compared with operator<.
+//
+// If you have the data up front, sort it and use bulk_load() - it fills the leaves completely and builds the tree
+// bottom up, which is much faster than adding the keys one by one.
+template <typename K_, typename V_, s64 Fanout = btree_default_fanout<K_, V_>()>
+struct btree {
+    using K = K_;
+    using V = V_;
+
+    static constexpr s64 FANOUT = Fanout;
+    static_assert(FANOUT >= 4, "A B-tree node needs to hold at least 4 keys");
+
+    // Nodes (except the root) never have less than these, otherwise they borrow from or get merged with a sibling
+    static constexpr s64 MIN_LEAF_COUNT = FANOUT / 2;
+    static constexpr s64 MIN_INTERNAL_COUNT = (FANOUT - 1) / 2;
+
+    struct leaf {
+        s64 Count = 0;
+        leaf *Prev = null;
+        leaf *Next = null;
+        K Keys[FANOUT];
+        V Values[FANOUT];
+    };
+
+    struct internal_node {
+        s64 Count = 0;  // The number of keys, there is one more child
+        K Keys[FANOUT];
+        void *Children[FANOUT + 1];
+    };
+
+    // A leaf if _Height_ is 0, otherwise an internal node
+    void *Root = null;
+
+    // The number of levels of internal nodes
+    s64 Height = 0;
+
+    // The number of keys in the tree
+    s64 Count = 0;
+
+    leaf *First = null;
+    leaf *Last = null;
+
+    btree() {}
+
+    // We don't use destructors for freeing memory anymore.
+    // ~btree() { free(); }
+
+    //
+    // Iterator:
+    //
+    struct iterator {
+        leaf *Leaf = null;  // null is the end
+        s64 Index = 0;
+
+        iterator() {}
+        iterator(leaf *l, s64 index) : Leaf(l), Index(index) {
+            // An index past the last key of a leaf means the first key of the next one
+            if (Leaf && Index == Leaf->Count) {
+                Leaf = Leaf->Next;
+                Index = 0;
+            }
+        }
+
+        iterator &operator++() {
+            ++Index;
+            if (Index == Leaf->Count) {
+                Leaf = Leaf->Next;
+                Index = 0;
+            }
+            return *this;
+        }
+
+        iterator operator++(s32) {
+            iterator pre = *this;
+            ++(*this);
+            return pre;
+        }
+
+        bool operator==(const iterator &other) const { return Leaf == other.Leaf && Index == other.Index; }
+        bool operator!=(const iterator &other) const { return !(*this == other); }
+
+        btree_key_value_pair<K, V> operator*() const { return {Leaf->Keys + Index, Leaf->Values + Index}; }
+    };
+
+    iterator begin() const { return iterator(Count ? First : null, 0); }
+    iterator end() const { return iterator(); }
+};
+
+// An ordered set, a B-tree without values
+template <typename K, s64 Fanout = btree_default_fanout<K, btree_no_value>()>
+using btree_set = btree<K, btree_no_value, Fanout>;
+
+template <typename T>
+struct is_btree : types::false_t {};
+
+template <typename K, typename V, s64 Fanout>
+struct is_btree<btree<K, V, Fanout>> : types::true_t {};
+
+template <typename T>
+concept any_btree = is_btree<T>::value;
+
+namespace internal {
+// The first index in _keys_ whose key is not less than _key_
+template <typename K>
+s64 btree_lower_bound_index(const K *keys, s64 count, const K &key) {
+    s64 first = 0;
+    while (count > 0) {
+        s64 half = count / 2;
+        if (keys[first + half] < key) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return first;
+}
+
+// The first index in _keys_ whose key is greater than _key_
+template <typename K>
+s64 btree_upper_bound_index(const K *keys, s64 count, const K &key) {
+    s64 first = 0;
+    while (count > 0) {
+        s64 half = count / 2;
+        if (!(key < keys[first + half])) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return first;
+}
+
+// Internal nodes hold the smallest key of every child but the first, equal keys are in the right child
+template <any_btree T>
+auto *btree_find_leaf(const T &tree, const typename T::K &key) {
+    using internal_node = typename T::internal_node;
+
+    void *node = tree.Root;
+    For(range(tree.Height)) {
+        auto *n = (internal_node *) node;
+        node = n->Children[btree_upper_bound_index(n->Keys, n->Count, key)];
+    }
+    return (typename T::leaf *) node;
+}
+
+// Moves _count_ elements of an array to the right (by _by_), we copy byte by byte (see the note about copying above btree)
+template <typename E>
+void btree_shift(E *items, s64 from, s64 count, s64 by) {
+    if (count > 0) copy_memory(items + from + by, items + from, count * sizeof(E));
+}
+
+template <typename E>
+void btree_move(E *dest, const E *src, s64 count) {
+    if (count > 0) copy_memory(dest, src, count * sizeof(E));
+}
+
+// Splits the full child _index_ of _parent_ (which is not full) in two
+template <any_btree T>
+void btree_split_child(T &tree, typename T::internal_node *parent, s64 index, bool childIsLeaf) {
+    using leaf = typename T::leaf;
+    using internal_node = typename T::internal_node;
+    using K = typename T::K;
+
+    K separator;
+    void *right;
+
+    if (childIsLeaf) {
+        auto *l = (leaf *) parent->Children[index];
+        auto *r = allocate<leaf>();
+
+        s64 keep = l->Count / 2;
+        r->Count = l->Count - keep;
+        btree_move(r->Keys, l->Keys + keep, r->Count);
+        btree_move(r->Values, l->Values + keep, r->Count);
+        l->Count = keep;
+
+        r->Prev = l;
+        r->Next = l->Next;
+        if (l->Next) {
+            l->Next->Prev = r;
+        } else {
+            tree.Last = r;
+        }
+        l->Next = r;
+
+        separator = r->Keys[0];
+        right = r;
+    } else {
+        auto *l = (internal_node *) parent->Children[index];
+        auto *r = allocate<internal_node>();
+
+        // The middle key goes up to the parent
+        s64 keep = l->Count / 2;
+        r->Count = l->Count - keep - 1;
+        btree_move(r->Keys, l->Keys + keep + 1, r->Count);
+        btree_move(r->Children, l->Children + keep + 1, r->Count + 1);
+        l->Count = keep;
+
+        separator = l->Keys[keep];
+        right = r;
+    }
+
+    btree_shift(parent->Keys, index, parent->Count - index, 1);
+    btree_shift(parent->Children, index + 1, parent->Count - index, 1);
+    copy_memory(parent->Keys + index, &separator, sizeof(K));
+    parent->Children[index + 1] = right;
+    ++parent->Count;
+}
+
+// Makes sure child _index_ of _parent_ has more than the minimum number of keys, so removing from it doesn't leave it too small.
+// Borrows a key from a sibling, or merges it with a sibling. Returns the index of the child to descend to (merging with the left sibling moves it).
+template <any_btree T>
+s64 btree_fill_child(T &tree, typename T::internal_node *parent, s64 index, bool childIsLeaf) {
+    using leaf = typename T::leaf;
+    using internal_node = typename T::internal_node;
+
+    if (childIsLeaf) {
+        auto *c = (leaf *) parent->Children[index];
+        if (c->Count > T::MIN_LEAF_COUNT) return index;
+
+        auto *left = index > 0 ? (leaf *) parent->Children[index - 1] : null;
+        auto *right = index < parent->Count ? (leaf *) parent->Children[index + 1] : null;
+
+        if (left && left->Count > T::MIN_LEAF_COUNT) {
+            btree_shift(c->Keys, 0, c->Count, 1);
+            btree_shift(c->Values, 0, c->Count, 1);
+            --left->Count;
+            btree_move(c->Keys, left->Keys + left->Count, 1);
+            btree_move(c->Values, left->Values + left->Count, 1);
+            ++c->Count;
+
+            btree_move(parent->Keys + index - 1, c->Keys, 1);
+            return index;
+        }
+
+        if (right && right->Count > T::MIN_LEAF_COUNT) {
+            btree_move(c->Keys + c->Count, right->Keys, 1);
+            btree_move(c->Values + c->Count, right->Values, 1);
+            ++c->Count;
+            --right->Count;
+            btree_move(right->Keys, right->Keys + 1, right->Count);
+            btree_move(right->Values, right->Values + 1, right->Count);
+
+            btree_move(parent->Keys + index, right->Keys, 1);
+            return index;
+        }
+
+        // Both siblings are at the minimum, merge with one of them. We always merge a leaf into the one on its left.
+        if (left) {
+            c = left;
+            --index;
+        }
+        auto *r = (leaf *) parent->Children[index + 1];
+
+        btree_move(c->Keys + c->Count, r->Keys, r->Count);
+        btree_move(c->Values + c->Count, r->Values, r->Count);
+        c->Count += r->Count;
+
+        c->Next = r->Next;
+        if (r->Next) {
+            r->Next->Prev = c;
+        } else {
+            tree.Last = c;
+        }
+        free(r);
+    } else {
+        auto *c = (internal_node *) parent->Children[index];
+        if (c->Count > T::MIN_INTERNAL_COUNT) return index;
+
+        auto *left = index > 0 ? (internal_node *) parent->Children[index - 1] : null;
+        auto *right = index < parent->Count ? (internal_node *) parent->Children[index + 1] : null;
+
+        // Rotate through the parent: the separator comes down, the sibling's key goes up
+        if (left && left->Count > T::MIN_INTERNAL_COUNT) {
+            btree_shift(c->Keys, 0, c->Count, 1);
+            btree_shift(c->Children, 0, c->Count + 1, 1);
+            btree_move(c->Keys, parent->Keys + index - 1, 1);
+            c->Children[0] = left->Children[left->Count];
+            ++c->Count;
+
+            --left->Count;
+            btree_move(parent->Keys + index - 1, left->Keys + left->Count, 1);
+            return index;
+        }
+
+        if (right && right->Count > T::MIN_INTERNAL_COUNT) {
+            btree_move(c->Keys + c->Count, parent->Keys + index, 1);
+            c->Children[c->Count + 1] = right->Children[0];
+            ++c->Count;
+
+            btree_move(parent->Keys + index, right->Keys, 1);
+            --right->Count;
+            btree_move(right->Keys, right->Keys + 1, right->Count);
+            btree_move(right->Children, right->Children + 1, right->Count + 1);
+            return index;
+        }
+
+        if (left) {
+            c = left;
+            --index;
+        }
+        auto *r = (internal_node *) parent->Children[index + 1];
+
+        btree_move(c->Keys + c->Count, parent->Keys + index, 1);
+        btree_move(c->Keys + c->Count + 1, r->Keys, r->Count);
+        btree_move(c->Children + c->Count + 1, r->Children, r->Count + 1);
+        c->Count += r->Count + 1;
+        free(r);
+    }
+
+    // The right one of the merged children is gone, and so is the separator between them
+    btree_move(parent->Keys + index, parent->Keys + index + 1, parent->Count - index - 1);
+    btree_move(parent->Children + index + 1, parent->Children + index + 2, parent->Count - index - 1);
+    --parent->Count;
+    return index;
+}
+
+template <typename Node>
+void btree_free_node(void *node, s64 height) {
+    if (height) {
+        auto *n = (Node *) node;
+        For(range(n->Count + 1)) btree_free_node<Node>(n->Children[it], height - 1);
+    }
+    free((byte *) node);
+}
+}  // namespace internal
+
+// Returns pointers to the key and value, or null pointers if the key is not in the tree
+template <any_btree T>
+auto find(const T &tree, const typename T::K &key) {
+    using result_t = btree_key_value_pair<typename T::K, typename T::V>;
+    if (!tree.Root) return result_t{null, null};
+
+    auto *l = internal::btree_find_leaf(tree, key);
+
+    s64 index = internal::btree_lower_bound_index(l->Keys, l->Count, key);
+    if (index == l->Count || key < l->Keys[index]) return result_t{null, null};
+    return result_t{l->Keys + index, l->Values + index};
+}
+
+// Returns true if the tree has the given key
+template <any_btree T>
+bool has(const T &tree, const typename T::K &key) { return find(tree, key).Key != null; }
+
+namespace internal {
+// Adds the key or finds it if it's already there. Returns the pointers and whether we added it.
+// Full nodes on the way down are split before we descend into them, so there is always room to add a key to the parent.
+template <any_btree T>
+auto btree_insert(T &tree, const typename T::K &key, const typename T::V &value, bool *added) {
+    using leaf = typename T::leaf;
+    using internal_node = typename T::internal_node;
+
+    if (!tree.Root) {
+        tree.Root = tree.First = tree.Last = allocate<leaf>();
+    }
+
+    // The root is full, the tree grows a level
+    bool rootIsFull = tree.Height ? ((internal_node *) tree.Root)->Count == T::FANOUT : ((leaf *) tree.Root)->Count == T::FANOUT;
+    if (rootIsFull) {
+        auto *root = allocate<internal_node>();
+        root->Children[0] = tree.Root;
+        btree_split_child(tree, root, 0, tree.Height == 0);
+
+        tree.Root = root;
+        ++tree.Height;
+    }
+
+    void *node = tree.Root;
+    For(range(tree.Height)) {
+        auto *n = (internal_node *) node;
+
+        s64 index = btree_upper_bound_index(n->Keys, n->Count, key);
+
+        bool childIsLeaf = it == tree.Height - 1;
+        bool childIsFull = childIsLeaf ? ((leaf *) n->Children[index])->Count == T::FANOUT : ((internal_node *) n->Children[index])->Count == T::FANOUT;
+        if (childIsFull) {
+            btree_split_child(tree, n, index, childIsLeaf);
+            if (!(key < n->Keys[index])) ++index;
+        }
+        node = n->Children[index];
+    }
+
+    auto *l = (leaf *) node;
+
+    s64 index = btree_lower_bound_index(l->Keys, l->Count, key);
+    if (index < l->Count && !(key < l->Keys[index])) {
+        *added = false;
+        return btree_key_value_pair<typename T::K, typename T::V>{l->Keys + index, l->Values + index};
+    }
+
+    btree_shift(l->Keys, index, l->Count - index, 1);
+    btree_shift(l->Values, index, l->Count - index, 1);
+    new (l->Keys + index) typename T::K(key);
+    new (l->Values + index) typename T::V(value);
+    ++l->Count;
+    ++tree.Count;
+
+    *added = true;
+    return btree_key_value_pair<typename T::K, typename T::V>{l->Keys + index, l->Values + index};
+}
+}  // namespace internal
+
+// Adds the key and value if the key is not in the tree yet. Returns true if it was added.
+// If the key was already there, its value is left as it is.
+template <any_btree T>
+bool add(T &tree, const typename T::K &key, const typename T::V &value = typename T::V()) {
+    bool added;
+    internal::btree_insert(tree, key, value, &added);
+    return added;
+}
+
+// Adds the key or overwrites its value if it's already in the tree. Returns pointers to the key and value in the tree.
+template <any_btree T>
+auto set(T &tree, const typename T::K &key, const typename T::V &value) {
+    bool added;
+    auto result = internal::btree_insert(tree, key, value, &added);
+    if (!added) *result.Value = value;
+    return result;
+}
+
+// Returns true if the key was found and removed.
+// Nodes on the way down which are at the minimum size borrow a key from a sibling or get merged with one
+// before we descend into them, so removing from the leaf never leaves it too small.
+template <any_btree T>
+bool remove(T &tree, const typename T::K &key) {
+    using leaf = typename T::leaf;
+    using internal_node = typename T::internal_node;
+    using K = typename T::K;
+    using V = typename T::V;
+
+    if (!has(tree, key)) return false;  // Don't restructure the tree on the way down for nothing
+
+    void *node = tree.Root;
+    for (s64 height = tree.Height; height; --height) {
+        auto *n = (internal_node *) node;
+
+        s64 index = internal::btree_upper_bound_index(n->Keys, n->Count, key);
+        index = internal::btree_fill_child(tree, n, index, height == 1);
+        node = n->Children[index];
+
+        // The root lost its last key in a merge, its only child becomes the root
+        if (n == tree.Root && n->Count == 0) {
+            tree.Root = node;
+            --tree.Height;
+            free(n);
+        }
+    }
+
+    auto *l = (leaf *) node;
+
+    s64 index = internal::btree_lower_bound_index(l->Keys, l->Count, key);
+    l->Keys[index].~K();
+    l->Values[index].~V();
+    internal::btree_move(l->Keys + index, l->Keys + index + 1, l->Count - index - 1);
+    internal::btree_move(l->Values + index, l->Values + index + 1, l->Count - index - 1);
+    --l->Count;
+    --tree.Count;
+
+    if (!tree.Count) {
+        free(l);
+        tree.Root = tree.First = tree.Last = null;
+    }
+    return true;
+}
+
+// Returns an iterator to the first key which is not less than _key_ (or the end)
+template <any_btree T>
+typename T::iterator lower_bound(const T &tree, const typename T::K &key) {
+    if (!tree.Root) return {};
+
+    auto *l = internal::btree_find_leaf(tree, key);
+    return typename T::iterator(l, internal::btree_lower_bound_index(l->Keys, l->Count, key));
+}
+
+// Returns an iterator to the first key which is greater than _key_ (or the end)
+template <any_btree T>
+typename T::iterator upper_bound(const T &tree, const typename T::K &key) {
+    if (!tree.Root) return {};
+
+    auto *l = internal::btree_find_leaf(tree, key);
+    return typename T::iterator(l, internal::btree_upper_bound_index(l->Keys, l->Count, key));
+}
+
+template <typename Iterator>
+struct btree_range_t {
+    Iterator Begin, End;
+
+    Iterator begin() const { return Begin; }
+    Iterator end() const { return End; }
+};
+
+// Iterates the keys in [from, to) in order.
+//
+//    For(btree_range(tree, 100, 200)) {
+//        print("{} -> {}\n", *it.Key, *it.Value);
+//    }
+template <any_btree T>
+auto btree_range(const T &tree, const typename T::K &from, const typename T::K &to) {
+    if (!(from < to)) return btree_range_t<typename T::iterator>{tree.end(), tree.end()};
+    return btree_range_t<typename T::iterator>{lower_bound(tree, from), lower_bound(tree, to)};
+}
+
+// Free any memory allocated by this object and reset count
+template <any_btree T>
+void free(T &tree) {
+    if (tree.Root) internal::btree_free_node<typename T::internal_node>(tree.Root, tree.Height);
+
+    tree.Root = tree.First = tree.Last = null;
+    tree.Height = tree.Count = 0;
+}
+
+// Builds the tree from keys (and values) which are sorted and unique, the tree must be empty.
+// Leaves are filled completely and the internal levels are built bottom up, so this is O(n) and doesn't compare keys.
+// _values_ may be null, then the values are default constructed.
+template <any_btree T>
+void bulk_load(T &tree, const typename T::K *keys, const typename T::V *values, s64 count) {
+    using leaf = typename T::leaf;
+    using internal_node = typename T::internal_node;
+    using K = typename T::K;
+    using V = typename T::V;
+
+    assert(!tree.Root && "Bulk loading into a tree which is not empty");
+    if (!count) return;
+
+    // The last two nodes of each level split what's left evenly, so neither has less than the minimum
+    auto nodeSize = [](s64 left, s64 full, s64 minimum) {
+        if (left <= full) return left;
+        if (left - full >= minimum) return full;
+        return left / 2;
+    };
+
+    // Build the leaves, we keep each node's smallest key next to it for building the level above
+    s64 nodes = 0;
+    array<void *> level;
+    array<K> firstKeys;
+
+    leaf *prev = null;
+    for (s64 i = 0; i < count;) {
+        s64 n = nodeSize(count - i, T::FANOUT, T::MIN_LEAF_COUNT);
+
+        auto *l = allocate<leaf>();
+        For(range(n)) {
+            new (l->Keys + it) K(keys[i + it]);
+            new (l->Values + it) V(values ? values[i + it] : V());
+        }
+        l->Count = n;
+
+        l->Prev = prev;
+        if (prev) {
+            prev->Next = l;
+        } else {
+            tree.First = l;
+        }
+        prev = l;
+
+        array_append(level, (void *) l);
+        array_append(firstKeys, keys[i]);
+        i += n;
+    }
+    tree.Last = prev;
+
+    // Each internal node takes up to FANOUT + 1 children of the level below.
+    // Its keys are the smallest keys of all children but the first, its own smallest key is the one of its first child.
+    while (level.Count > 1) {
+        array<void *> upper;
+        array<K> upperFirstKeys;
+
+        for (s64 i = 0; i < level.Count;) {
+            s64 n = nodeSize(level.Count - i, T::FANOUT + 1, T::MIN_INTERNAL_COUNT + 1);
+
+            auto *node = allocate<internal_node>();
+            For(range(n)) {
+                node->Children[it] = level[i + it];
+                if (it) new (node->Keys + it - 1) K(firstKeys[i + it]);
+            }
+            node->Count = n - 1;
+
+            array_append(upper, (void *) node);
+            array_append(upperFirstKeys, firstKeys[i]);
+            i += n;
+        }
+
+        free(level);
+        free(firstKeys);
+        level = upper;
+        firstKeys = upperFirstKeys;
+        ++tree.Height;
+    }
+
+    tree.Root = level[0];
+    tree.Count = count;
+
+    free(level);
+    free(firstKeys);
+}
+
+// @Pedantic We don't deep copy trees (yet), copying one byte by byte would share the nodes.
+template <typename K, typename V, s64 Fanout>
+btree<K, V, Fanout> *clone(btree<K, V, Fanout> *dest, const btree<K, V, Fanout> &src) {
+    assert(false && "We don't deep copy B-trees yet. Iterate the tree and bulk_load() the keys into another one.");
+    return null;
+}
+
+LSTD_END_NAMESPACE
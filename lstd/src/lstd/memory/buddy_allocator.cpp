@@ -0,0 +1,283 @@
+#include "allocator.h"
+
+LSTD_BEGIN_NAMESPACE
+
+constexpr s64 BUDDY_MIN_BLOCK_SIZE_LOG2 = 5;
+static_assert(BUDDY_MIN_BLOCK_SIZE == 1 << BUDDY_MIN_BLOCK_SIZE_LOG2);
+
+// Stored in free blocks, that's why the minimum block size is 32 bytes
+struct buddy_free_block {
+    buddy_free_block *Next, *Prev;
+    s64 Order;
+};
+
+// Stored at the beginning of each pool.
+//
+// Blocks are carved from _Region_. The region doesn't need to be a power of 2 in size, when adding a pool
+// we cover it with free blocks of decreasing orders (the largest first), so each block starts at an offset
+// which is a multiple of its size. A block's buddy is then always at (offset ^ size), the buddy of a block near
+// the end of a region which isn't a power of 2 may not exist - we check for that when merging.
+struct buddy_pool {
+    buddy_pool *Next;
+
+    byte *Region;
+    s64 RegionSize;  // A multiple of BUDDY_MIN_BLOCK_SIZE
+    s64 MaxOrder;
+
+    u64 *FreeBits;  // One bit for each BUDDY_MIN_BLOCK_SIZE bytes of the region, set if a free block starts there
+
+    buddy_free_block *FreeLists[BUDDY_MAX_ORDERS];  // Doubly-linked, so we can remove a buddy when merging in O(1)
+};
+
+file_scope s64 block_size(s64 order) { return BUDDY_MIN_BLOCK_SIZE << order; }
+
+file_scope s64 order_for_size(s64 size) {
+    if (size <= BUDDY_MIN_BLOCK_SIZE) return 0;
+    return msb((u64) (size - 1)) + 1 - BUDDY_MIN_BLOCK_SIZE_LOG2;
+}
+
+file_scope bool is_free_head(buddy_pool *pool, s64 offset) {
+    s64 index = offset >> BUDDY_MIN_BLOCK_SIZE_LOG2;
+    return pool->FreeBits[index / 64] & (1ull << (index % 64));
+}
+
+file_scope void set_free_head(buddy_pool *pool, s64 offset, bool value) {
+    s64 index = offset >> BUDDY_MIN_BLOCK_SIZE_LOG2;
+    if (value) {
+        pool->FreeBits[index / 64] |= 1ull << (index % 64);
+    } else {
+        pool->FreeBits[index / 64] &= ~(1ull << (index % 64));
+    }
+}
+
+file_scope void push_free(buddy_pool *pool, s64 offset, s64 order) {
+    auto *block = (buddy_free_block *) (pool->Region + offset);
+    block->Order = order;
+    block->Prev = null;
+    block->Next = pool->FreeLists[order];
+    if (block->Next) block->Next->Prev = block;
+    pool->FreeLists[order] = block;
+
+    set_free_head(pool, offset, true);
+}
+
+file_scope void remove_free(buddy_pool *pool, buddy_free_block *block) {
+    if (block->Prev) {
+        block->Prev->Next = block->Next;
+    } else {
+        pool->FreeLists[block->Order] = block->Next;
+    }
+    if (block->Next) block->Next->Prev = block->Prev;
+
+    set_free_head(pool, (byte *) block - pool->Region, false);
+}
+
+// Returns the buddy of the block at _offset_ if it's free and whole (not split into smaller blocks), otherwise null
+file_scope buddy_free_block *get_free_buddy(buddy_pool *pool, s64 offset, s64 order) {
+    s64 buddy = offset ^ block_size(order);
+    if (buddy + block_size(order) > pool->RegionSize) return null;  // Past the end of a region which isn't a power of 2
+    if (!is_free_head(pool, buddy)) return null;
+
+    auto *block = (buddy_free_block *) (pool->Region + buddy);
+    return block->Order == order ? block : null;
+}
+
+// Covers the region with the largest blocks which fit
+file_scope void reset_pool(buddy_pool *pool) {
+    zero_memory(pool->FreeBits, ((pool->RegionSize >> BUDDY_MIN_BLOCK_SIZE_LOG2) + 63) / 64 * sizeof(u64));
+    zero_memory(pool->FreeLists, sizeof(pool->FreeLists));
+
+    s64 offset = 0;
+    for (s64 order = pool->MaxOrder; order >= 0; --order) {
+        if (offset + block_size(order) <= pool->RegionSize) {
+            push_free(pool, offset, order);
+            offset += block_size(order);
+        }
+    }
+}
+
+file_scope buddy_pool *find_pool(buddy_allocator_data *data, void *p) {
+    auto *pool = data->Base;
+    while (pool) {
+        if (p >= pool->Region && p < pool->Region + pool->RegionSize) return pool;
+        pool = pool->Next;
+    }
+    return null;
+}
+
+file_scope void *allocate_from_pool(buddy_pool *pool, s64 order) {
+    s64 o = order;
+    while (o <= pool->MaxOrder && !pool->FreeLists[o]) ++o;
+    if (o > pool->MaxOrder) return null;
+
+    auto *block = pool->FreeLists[o];
+    remove_free(pool, block);
+
+    // Split until we get to the size we need, the upper halves go to the free lists
+    s64 offset = (byte *) block - pool->Region;
+    while (o > order) {
+        --o;
+        push_free(pool, offset + block_size(o), o);
+    }
+    return block;
+}
+
+file_scope void free_to_pool(buddy_pool *pool, s64 offset, s64 order) {
+    // Merge with the buddy while it's free, each merge gives a block twice as large
+    while (order < pool->MaxOrder) {
+        auto *buddy = get_free_buddy(pool, offset, order);
+        if (!buddy) break;
+
+        remove_free(pool, buddy);
+        offset &= ~block_size(order);
+        ++order;
+    }
+    push_free(pool, offset, order);
+}
+
+// Grows the block at _offset_ from _order_ to _newOrder_ if all the buddies it needs to swallow are free
+file_scope bool grow_in_place(buddy_pool *pool, s64 offset, s64 order, s64 newOrder) {
+    if (newOrder > pool->MaxOrder) return false;
+
+    // We can only grow to the right, so at every level we must be the lower buddy and the upper one must be free
+    for (s64 o = order; o < newOrder; ++o) {
+        if (offset & block_size(o)) return false;
+        if (!get_free_buddy(pool, offset, o)) return false;
+    }
+
+    for (s64 o = order; o < newOrder; ++o) {
+        remove_free(pool, get_free_buddy(pool, offset, o));
+    }
+    return true;
+}
+
+void *buddy_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options) {
+    auto *data = (buddy_allocator_data *) context;
+
+    switch (mode) {
+        case allocator_mode::ADD_POOL: {
+            auto *pool = (buddy_pool *) oldMemory;  // _oldMemory_ is the parameter which should contain the block to be added
+                                                    // the _size_ parameter contains the size of the block
+
+            // The bookkeeping (pool header + free bits) lives at the start of the block, the rest is the region
+            s64 available = size - (s64) sizeof(buddy_pool);
+            s64 bitsSize = ((available >> BUDDY_MIN_BLOCK_SIZE_LOG2) + 63) / 64 * sizeof(u64);
+
+            auto *region = (byte *) (pool + 1) + bitsSize;
+            region += calculate_padding_for_pointer(region, BUDDY_MIN_BLOCK_SIZE);
+
+            s64 regionSize = ((byte *) oldMemory + size - region) & ~(BUDDY_MIN_BLOCK_SIZE - 1);
+            if (regionSize < BUDDY_MIN_BLOCK_SIZE) {
+                assert(false && "Pool is too small");
+                return null;
+            }
+
+            pool->Next = null;
+            pool->Region = region;
+            pool->RegionSize = regionSize;
+            pool->MaxOrder = min((s64) msb((u64) (regionSize >> BUDDY_MIN_BLOCK_SIZE_LOG2)), BUDDY_MAX_ORDERS - 1);
+            pool->FreeBits = (u64 *) (pool + 1);
+            reset_pool(pool);
+
+            // Same as allocator_pool_add_to_linked_list
+            if (!data->Base) {
+                data->Base = pool;
+            } else {
+                auto *it = data->Base;
+                while (it->Next) it = it->Next;
+                it->Next = pool;
+            }
+
+            ++data->PoolsCount;
+            return pool;
+        }
+        case allocator_mode::REMOVE_POOL: {
+            auto *pool = (buddy_pool *) oldMemory;
+
+            buddy_pool *it = data->Base, *prev = null;
+            while (it && it != pool) {
+                prev = it;
+                it = it->Next;
+            }
+
+            if (!it) {
+                assert(false && "Pool with this address was not found in this allocator's pool list");
+                return null;
+            }
+
+            if (prev) {
+                prev->Next = it->Next;
+            } else {
+                data->Base = it->Next;
+            }
+
+            --data->PoolsCount;
+            assert(data->PoolsCount >= 0);
+
+            if (!data->PoolsCount) allocator_registry_release(data);  // No pools, no live blocks
+            return pool;
+        }
+        case allocator_mode::ALLOCATE: {
+            s64 order = order_for_size(size);
+            if (order >= BUDDY_MAX_ORDERS) return null;
+
+            auto *pool = data->Base;
+            while (pool) {
+                void *result = allocate_from_pool(pool, order);
+                if (result) return result;
+                pool = pool->Next;
+            }
+            return null;  // Not enough space
+        }
+        case allocator_mode::RESIZE: {
+            auto *pool = find_pool(data, oldMemory);
+            assert(pool && "Block doesn't belong to this allocator");
+
+            s64 offset = (byte *) oldMemory - pool->Region;
+            s64 order = order_for_size(oldSize);
+            s64 newOrder = order_for_size(size);
+
+            if (newOrder == order) return oldMemory;
+
+            if (newOrder < order) {
+                // Shrinking always works in place, give back the upper halves
+                while (order > newOrder) {
+                    --order;
+                    push_free(pool, offset + block_size(order), order);
+                }
+                return oldMemory;
+            }
+
+            return grow_in_place(pool, offset, order, newOrder) ? oldMemory : null;
+        }
+        case allocator_mode::FREE: {
+            auto *pool = find_pool(data, oldMemory);
+            assert(pool && "Block doesn't belong to this allocator");
+
+            free_to_pool(pool, (byte *) oldMemory - pool->Region, order_for_size(oldSize));
+
+            // null means success FREE
+            return null;
+        }
+        case allocator_mode::FREE_ALL: {
+            auto *pool = data->Base;
+            while (pool) {
+                reset_pool(pool);
+                pool = pool->Next;
+            }
+
+            // null means successful FREE_ALL
+            // (void *) -1 means that the allocator doesn't support FREE_ALL (by design)
+            return null;
+        }
+        case allocator_mode::ALLOCATE_BATCH:
+        case allocator_mode::FREE_BATCH:
+            // (void *) -1 means that the allocator doesn't support batches, we get one request per block instead
+            return (void *) -1;
+        default:
+            assert(false);
+    }
+    return null;
+}
+
+LSTD_END_NAMESPACE
@@ -0,0 +1,289 @@
+#pragma once
+
+#include "../thread.h"
+#include "hash_table.h"
+
+LSTD_BEGIN_NAMESPACE
+
+// A hash table which many threads can use at once.
+//
+// Keys are split between _ShardCount_ shards by their hash. Each shard is a normal hash_table with its own
+// reader-writer lock (lock striping). Lookups take one shard's lock in shared mode, so readers never wait on each other,
+// and a writer only blocks the threads which touch the same shard. With the default 64 shards threads working on
+// different keys rarely meet, so lookups scale with the number of threads instead of queueing on a single mutex.
+//
+// Another thread may remove or move an entry as soon as a shard's lock is released, so nothing here returns
+// pointers into the table. Values are copied out. Keys and values are copied in the same way hash_table copies them (shallow).
+//
+// The shards' arrays are allocated with _Alloc_, or with the Context's allocator of whichever thread grows a shard if that's null.
+// Set it if your threads use different allocators, otherwise a shard may get allocated with one that another thread can't free.
+template <typename K_, typename V_, s64 ShardCount = 64>
+struct concurrent_hash_table {
+    using K = K_;
+    using V = V_;
+
+    static_assert(is_pow_of_2(ShardCount), "The number of shards must be a power of 2");
+
+    static constexpr s64 SHARD_COUNT = ShardCount;
+    static constexpr s32 SHARD_BITS = msb((u64) ShardCount);
+
+    // Each shard gets its own cache line, so taking a lock doesn't slow down threads which use the neighbouring shards
+    struct alignas(64) shard {
+        thread::fast_shared_mutex Lock;
+        hash_table<K, V> Table;
+    };
+
+    shard Shards[SHARD_COUNT];
+
+    allocator Alloc;
+
+    concurrent_hash_table() {}
+
+    // We don't use destructors for freeing memory anymore.
+    // ~concurrent_hash_table() { free(); }
+};
+
+template <typename T>
+struct is_concurrent_hash_table : types::false_t {};
+
+template <typename K, typename V, s64 ShardCount>
+struct is_concurrent_hash_table<concurrent_hash_table<K, V, ShardCount>> : types::true_t {};
+
+template <typename T>
+concept any_concurrent_hash_table = is_concurrent_hash_table<T>::value;
+
+namespace internal {
+// The shard is picked with the top bits of the mixed hash, the shard's table uses the bottom ones (see hash_table_mix)
+template <any_concurrent_hash_table T>
+auto &concurrent_hash_table_shard(T &table, u64 hash) {
+    if constexpr (T::SHARD_BITS == 0) {
+        return table.Shards[0];
+    } else {
+        return table.Shards[hash_table_mix(hash) >> (64 - T::SHARD_BITS)];
+    }
+}
+
+// Makes room for _target_ more items in a locked shard, using the table's allocator
+template <typename Shard>
+void concurrent_hash_table_reserve_shard(Shard &shard, allocator alloc, s64 target) {
+    if (!alloc) {
+        reserve(shard.Table, target);
+        return;
+    }
+
+    // Skip pushing the context when the shard won't grow anyway
+    if (shard.Table.Allocated && (shard.Table.SlotsFilled + target) * 8 <= shard.Table.Allocated * 7) return;
+
+    PUSH_ALLOC(alloc) {
+        reserve(shard.Table, target);
+    }
+}
+}  // namespace internal
+
+// Makes sure the table can hold _target_ more items (spread evenly among the shards) without growing.
+template <any_concurrent_hash_table T>
+void reserve(T &table, s64 target) {
+    For(table.Shards) {
+        it.Lock.lock();
+        internal::concurrent_hash_table_reserve_shard(it, table.Alloc, (target + T::SHARD_COUNT - 1) / T::SHARD_COUNT);
+        it.Lock.unlock();
+    }
+}
+
+// Free any memory allocated by this object. Not safe to call while other threads are using the table.
+template <any_concurrent_hash_table T>
+void free(T &table) {
+    For(table.Shards) free(it.Table);
+}
+
+// Don't free the table, just destroy contents
+template <any_concurrent_hash_table T>
+void reset(T &table) {
+    For(table.Shards) {
+        it.Lock.lock();
+        reset(it.Table);
+        it.Lock.unlock();
+    }
+}
+
+// The number of items in the table. Other threads may be adding or removing items while we count, so this is only a snapshot.
+template <any_concurrent_hash_table T>
+s64 count(const T &table) {
+    s64 result = 0;
+    For(table.Shards) result += atomic_load(&it.Table.Count);
+    return result;
+}
+
+// Looks up _key_ with a given hash. If found, copies its value to _outValue_ (if not null) and returns true.
+// This method is useful if you have cached the hash.
+template <any_concurrent_hash_table T>
+bool find_prehashed(T &table, u64 hash, const typename T::K &key, typename T::V *outValue = null) {
+    auto &shard = internal::concurrent_hash_table_shard(table, hash);
+
+    shard.Lock.lock_shared();
+    defer(shard.Lock.unlock_shared());
+
+    auto [kp, vp] = find_prehashed(shard.Table, hash, key);
+    if (vp && outValue) *outValue = *vp;
+    return vp != null;
+}
+
+// Heterogeneous version, see hash_table_lookup_key
+template <any_concurrent_hash_table T, hash_table_lookup_key<typename T::K> Q>
+bool find_prehashed(T &table, u64 hash, const Q &key, typename T::V *outValue = null) {
+    auto &shard = internal::concurrent_hash_table_shard(table, hash);
+
+    shard.Lock.lock_shared();
+    defer(shard.Lock.unlock_shared());
+
+    auto [kp, vp] = find_prehashed(shard.Table, hash, key);
+    if (vp && outValue) *outValue = *vp;
+    return vp != null;
+}
+
+// If found, copies the value of _key_ to _outValue_ (if not null) and returns true.
+// We calculate the hash of the key using the global get_hash() specialized functions.
+template <any_concurrent_hash_table T>
+bool find(T &table, const typename T::K &key, typename T::V *outValue = null) {
+    return find_prehashed(table, get_hash(key), key, outValue);
+}
+
+// Heterogeneous version, see hash_table_lookup_key
+template <any_concurrent_hash_table T, hash_table_lookup_key<typename T::K> Q>
+bool find(T &table, const Q &key, typename T::V *outValue = null) {
+    return find_prehashed(table, get_hash(key), key, outValue);
+}
+
+// Returns true if the table has the given key.
+template <any_concurrent_hash_table T>
+bool has(T &table, const typename T::K &key) { return find(table, key); }
+
+// Heterogeneous version, see hash_table_lookup_key
+template <any_concurrent_hash_table T, hash_table_lookup_key<typename T::K> Q>
+bool has(T &table, const Q &key) { return find(table, key); }
+
+// Adds key and value without checking if the key is already there (same as hash_table's add).
+// Use add_if_absent() when two threads may add the same key.
+// This method is useful if you have cached the hash.
+template <any_concurrent_hash_table T>
+void add_prehashed(T &table, u64 hash, const typename T::K &key, const typename T::V &value) {
+    auto &shard = internal::concurrent_hash_table_shard(table, hash);
+
+    shard.Lock.lock();
+    defer(shard.Lock.unlock());
+
+    internal::concurrent_hash_table_reserve_shard(shard, table.Alloc, 1);
+    add_prehashed(shard.Table, hash, key, value);
+}
+
+// We calculate the hash of the key using the global get_hash() specialized functions.
+template <any_concurrent_hash_table T>
+void add(T &table, const typename T::K &key, const typename T::V &value) {
+    add_prehashed(table, get_hash(key), key, value);
+}
+
+// Adds the key and value only if the key isn't in the table yet. Checking and adding happen under the same lock,
+// so if several threads race to add the same key exactly one of them wins.
+//
+// Returns true if we added the pair. Otherwise the value which is already in the table is copied to _outExisting_ (if not null).
+// This method is useful if you have cached the hash.
+template <any_concurrent_hash_table T>
+bool add_if_absent_prehashed(T &table, u64 hash, const typename T::K &key, const typename T::V &value, typename T::V *outExisting = null) {
+    auto &shard = internal::concurrent_hash_table_shard(table, hash);
+
+    // Most calls for a cache find the key already there, check that without blocking other readers first
+    if (find_prehashed(table, hash, key, outExisting)) return false;
+
+    shard.Lock.lock();
+    defer(shard.Lock.unlock());
+
+    // Another thread may have added it between the two locks
+    auto [kp, vp] = find_prehashed(shard.Table, hash, key);
+    if (vp) {
+        if (outExisting) *outExisting = *vp;
+        return false;
+    }
+
+    internal::concurrent_hash_table_reserve_shard(shard, table.Alloc, 1);
+    add_prehashed(shard.Table, hash, key, value);
+    return true;
+}
+
+// We calculate the hash of the key using the global get_hash() specialized functions.
+template <any_concurrent_hash_table T>
+bool add_if_absent(T &table, const typename T::K &key, const typename T::V &value, typename T::V *outExisting = null) {
+    return add_if_absent_prehashed(table, get_hash(key), key, value, outExisting);
+}
+
+// Adds the key or overwrites its value if it's already in the table.
+// This method is useful if you have cached the hash.
+template <any_concurrent_hash_table T>
+void set_prehashed(T &table, u64 hash, const typename T::K &key, const typename T::V &value) {
+    auto &shard = internal::concurrent_hash_table_shard(table, hash);
+
+    shard.Lock.lock();
+    defer(shard.Lock.unlock());
+
+    internal::concurrent_hash_table_reserve_shard(shard, table.Alloc, 1);
+    set_prehashed(shard.Table, hash, key, value);
+}
+
+// We calculate the hash of the key using the global get_hash() specialized functions.
+template <any_concurrent_hash_table T>
+void set(T &table, const typename T::K &key, const typename T::V &value) {
+    set_prehashed(table, get_hash(key), key, value);
+}
+
+// Returns true if the key was found and removed. The removed value is copied to _outValue_ (if not null).
+// This method is useful if you have cached the hash.
+template <any_concurrent_hash_table T>
+bool remove_prehashed(T &table, u64 hash, const typename T::K &key, typename T::V *outValue = null) {
+    auto &shard = internal::concurrent_hash_table_shard(table, hash);
+
+    shard.Lock.lock();
+    defer(shard.Lock.unlock());
+
+    if (outValue) {
+        auto [kp, vp] = find_prehashed(shard.Table, hash, key);
+        if (!vp) return false;
+        *outValue = *vp;
+    }
+    return remove_prehashed(shard.Table, hash, key);
+}
+
+// Heterogeneous version, see hash_table_lookup_key
+template <any_concurrent_hash_table T, hash_table_lookup_key<typename T::K> Q>
+bool remove_prehashed(T &table, u64 hash, const Q &key, typename T::V *outValue = null) {
+    auto &shard = internal::concurrent_hash_table_shard(table, hash);
+
+    shard.Lock.lock();
+    defer(shard.Lock.unlock());
+
+    if (outValue) {
+        auto [kp, vp] = find_prehashed(shard.Table, hash, key);
+        if (!vp) return false;
+        *outValue = *vp;
+    }
+    return remove_prehashed(shard.Table, hash, key);
+}
+
+// We calculate the hash of the key using the global get_hash() specialized functions.
+template <any_concurrent_hash_table T>
+bool remove(T &table, const typename T::K &key, typename T::V *outValue = null) {
+    return remove_prehashed(table, get_hash(key), key, outValue);
+}
+
+// Heterogeneous version, see hash_table_lookup_key
+template <any_concurrent_hash_table T, hash_table_lookup_key<typename T::K> Q>
+bool remove(T &table, const Q &key, typename T::V *outValue = null) {
+    return remove_prehashed(table, get_hash(key), key, outValue);
+}
+
+// @Pedantic We want to make sure the user doesn't clone things that don't make sense.
+template <typename K, typename V, s64 ShardCount>
+concurrent_hash_table<K, V, ShardCount> *clone(concurrent_hash_table<K, V, ShardCount> *dest, const concurrent_hash_table<K, V, ShardCount> &src) {
+    assert(false && "We don't deep copy concurrent hash tables, lock and clone the shards you need instead");
+    return null;
+}
+
+LSTD_END_NAMESPACE
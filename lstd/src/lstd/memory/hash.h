@@ -1,5 +1,6 @@
 #pragma once
 
+#include "array_like.h"
 #include "hasher.h"
 
 //
@@ -28,13 +29,13 @@ constexpr u64 get_hash(const T &value) {
 
 // Partial specialization for pointers
 template <typename T>
-requires(types::is_pointer_v<T>) constexpr u64 get_hash(const T value) {
+requires(types::is_pointer<T>) constexpr u64 get_hash(const T value) {
     return (u64) value;
 }
 
 // Partial specialization for arrays of known size
 template <typename T>
-requires(types::is_array_v<T> &&types::is_array_of_known_bounds_v<T>) constexpr u64 get_hash(const T value) {
+requires(types::is_array<T> &&types::is_array_of_known_bounds_v<T>) constexpr u64 get_hash(const T value) {
     hasher h(0);
     h.add((const char *) value, sizeof(types::remove_extent_t<T>) * types::extent_v<T>);
     return h.hash();
@@ -60,6 +61,47 @@ TRIVIAL_HASH(bool);
 
 #undef TRIVIAL_HASH
 
-// @TODO: Have a macro that declares types with HASH_AS_ARRAY_LIKE which uses the hasher automatially. For now we don't even hash arrays.
+// Hash for a run of bytes (djb2).
+// Strings and all other array-likes hash their contents with this, so a string, a bytes view or an array<utf8>
+// with the same contents get the same hash. That's what lets hash tables with string keys be looked up with
+// views, without making a string (see hash_table_lookup_key in hash_table.h).
+inline u64 get_hash_bytes(const byte *data, s64 size) {
+    u64 hash = 5381;
+    For(range(size)) hash = ((hash << 5) + hash) + data[it];
+    return hash;
+}
+
+// Array-likes hash their contents (not the pointer and count).
+// Note: Elements are hashed byte by byte, so don't use this for elements with padding or which own memory.
+template <is_array_like T>
+u64 get_hash(const T &arr) {
+    return get_hash_bytes((const byte *) arr.Data, arr.Count * sizeof(*arr.Data));
+}
+
+// A key which carries its hash, computed once when the key is made.
+// get_hash() just returns the stored hash, so hash tables never hash the key again (e.g. long strings which
+// are looked up often), and keys with different hashes compare unequal without looking at the contents.
+//
+//    hashed<string> name = "player_spawn";    // Hashed here, once
+//    find(table, name);                       // Not hashed again
+//
+template <typename T>
+struct hashed {
+    T Key;
+    u64 Hash = 0;
+
+    hashed() {}
+    hashed(const T &key) : Key(key), Hash(get_hash(key)) {}
+    hashed(const T &key, u64 hash) : Key(key), Hash(hash) {}
+};
+
+template <typename T>
+u64 get_hash(const hashed<T> &value) { return value.Hash; }
+
+template <typename T>
+bool operator==(const hashed<T> &one, const hashed<T> &other) { return one.Hash == other.Hash && one.Key == other.Key; }
+
+template <typename T>
+bool operator!=(const hashed<T> &one, const hashed<T> &other) { return !(one == other); }
 
 LSTD_END_NAMESPACE
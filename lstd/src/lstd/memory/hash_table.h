@@ -1,5 +1,7 @@
 #pragma once
 
+#include <emmintrin.h>
+
 #include "../memory/allocator.h"
 #include "hash.h"
 
@@ -23,26 +25,59 @@ struct key_value_pair {
     value_t<T> *Value;
 };
 
+// Control bytes, one per slot. A full slot stores the low 7 bits of its (mixed) hash, so the high bit tells free from full.
+constexpr u8 HASH_TABLE_EMPTY = 0x80;
+constexpr u8 HASH_TABLE_DELETED = 0xFE;
+
+// We look at this many slots at once
+constexpr s64 HASH_TABLE_GROUP_WIDTH = 16;
+
+// A group of control bytes, matched against a byte with a single SSE2 compare.
+// The results are bit masks, bit i is set if slot i of the group matched.
+struct hash_table_group {
+    __m128i Control;
+
+    explicit hash_table_group(const u8 *control) : Control(_mm_loadu_si128((const __m128i *) control)) {}
+
+    u32 match(u8 h2) const { return (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char) h2), Control)); }
+    u32 match_empty() const { return match(HASH_TABLE_EMPTY); }
+
+    // Both empty and deleted have the high bit set, full slots don't
+    u32 match_empty_or_deleted() const { return (u32) _mm_movemask_epi8(Control); }
+};
+
+// Our hashes for integers and pointers are the values themselves, so we mix the bits before splitting the hash into
+// the position (H1) and the 7 bits stored in the control byte (H2). Otherwise consecutive keys all start probing
+// at the same slot.
+constexpr u64 hash_table_mix(u64 hash) {
+    hash *= 0x9E3779B97F4A7C15ull;
+    return hash ^ (hash >> 32);
+}
+
 // This hash table stores all entries in a contiguous array, for good performance when looking up things. Some tables
 // work by storing linked lists of entries, but that can lead to many more cache misses.
 //
-// We store 3 arrays, one for the values, one for the keys and one for the hashed keys.
+// The layout is that of Swiss tables (Google's flat_hash_map). We store 4 arrays: the control bytes, the hashes, the keys and the values.
 // Read the comment above reserve() for more information on how the arrays get allocated.
 //
-// When storing a value, we map its hash to a slot index and if that slot is free, we put the key and value there,
-// otherwise we keep incrementing the slot index until we find an empty slot. Because the hash table can never be full, we
-// are guaranteed to find a slot eventually.
+// Each slot has a control byte which says whether it's empty, deleted, or full - a full slot stores 7 bits of the key's hash (H2).
+// The rest of the hash (H1) picks the slot to start looking from. We then look at 16 control bytes at a time with SSE2:
+// one compare finds every slot in the group whose H2 matches, and only those get their full hash and key compared.
+// If the group has an empty slot the key isn't in the table, otherwise we move on to the next group (quadratic probing in groups).
+// So a lookup usually touches a single group of control bytes and compares one key.
 //
-// When looking up a value we perform the same process to find the correct slot.
+// A removed slot usually goes back to being empty. Only if it's in a crowded run of slots (where a probe could have gone past it)
+// it's marked as deleted (a tombstone), so lookups for keys placed after it don't stop there. Adding reuses deleted slots.
+// When the table fills up mostly with tombstones we drop them in place (no allocation) instead of growing, so tables with
+// lots of add/remove churn keep short probe sequences.
 //
-// We use hash values to indicate whether slots are empty of removed. A hash of 0 means that slot is not used, so new
-// values an be put there. A hash of 1 means that slot used to be valid, but has been removed. A hash of 2 or h igher
-// (FIRST_VALID_HASH) means this is a currently used slot.
+// Because misses stop at the first group with an empty slot, the table can be much fuller than with plain linear probing,
+// we grow when 7/8 of the slots are used (valid + deleted).
 //
-// Whether we hash a key, if the result is less than 2, we just add 2 to it to put it in the valid range.
-// This leads to possibly more collisions, but it's a small price to pay.
+// We keep the full hashes so growing doesn't need to hash the keys again (and so *_prehashed functions work with any hash you give them).
+// The first 16 control bytes are mirrored after the last slot, so a group can be loaded from any slot without wrapping around.
 //
-// The template parameter _BlockAlloc_ specifies whether the hashes, keys and values arrays are allocated
+// The template parameter _BlockAlloc_ specifies whether the control bytes, hashes, keys and values arrays are allocated
 // all contiguously or by seperate allocation calls. You want to allocate them next to each other because that's good for the cache,
 // but if the hash table is too large then the block won't fit in the cache anyways so you should consider setting this to false to reduce
 // the size of the allocation request.
@@ -53,17 +88,17 @@ struct hash_table {
     static constexpr bool BLOCK_ALLOC = BlockAlloc;
 
     static constexpr s64 MINIMUM_SIZE = 32;
-    static constexpr s64 FIRST_VALID_HASH = 2;
 
     // Number of valid items
     s64 Count = 0;
 
-    // Number of slots allocated
+    // Number of slots allocated (always a power of 2)
     s64 Allocated = 0;
 
-    // Number of slots that can't be used (valid + removed items)
+    // Number of slots that can't be used (valid + deleted items)
     s64 SlotsFilled = 0;
 
+    u8 *Control = null;  // _Allocated_ + HASH_TABLE_GROUP_WIDTH bytes, see the comment above
     u64 *Hashes = null;
     K *Keys = null;
     V *Values = null;
@@ -78,7 +113,7 @@ struct hash_table {
     //
     template <bool Const>
     struct iterator_ {
-        using hash_table_t = types::select_t<Const, const hash_table<K, V>, hash_table<K, V>>;
+        using hash_table_t = types::select_t<Const, const hash_table<K, V, BlockAlloc>, hash_table<K, V, BlockAlloc>>;
 
         hash_table_t *Parent;
         s64 Index;
@@ -112,7 +147,7 @@ struct hash_table {
        private:
         void skip_empty_slots() {
             for (; Index < Parent->Allocated; ++Index) {
-                if (Parent->Hashes[Index] < FIRST_VALID_HASH) continue;
+                if (Parent->Control[Index] & 0x80) continue;
                 break;
             }
         }
@@ -148,9 +183,142 @@ struct is_hash_table<hash_table<K, V, BlockAlloc>> : types::true_t {};
 template <typename T>
 concept any_hash_table = is_hash_table<T>::value;
 
-// Makes sure the hash table has reserved enough space for at least n elements.
+namespace internal {
+// Sets a control byte, and its mirror after the last slot if it's one of the first HASH_TABLE_GROUP_WIDTH slots
+template <any_hash_table T>
+void hash_table_set_control(T &table, s64 index, u8 control) {
+    table.Control[index] = control;
+    if (index < HASH_TABLE_GROUP_WIDTH) table.Control[table.Allocated + index] = control;
+}
+
+// Returns the first empty or deleted slot on the probe sequence of _hash_. The table must not be full.
+template <any_hash_table T>
+s64 hash_table_find_free_slot(const T &table, u64 mixed) {
+    s64 mask = table.Allocated - 1;
+
+    s64 pos = (s64) (mixed >> 7) & mask;
+    for (s64 step = HASH_TABLE_GROUP_WIDTH;; step += HASH_TABLE_GROUP_WIDTH) {
+        u32 available = hash_table_group(table.Control + pos).match_empty_or_deleted();
+        if (available) return (pos + lsb(available)) & mask;
+
+        pos = (pos + step) & mask;
+    }
+}
+
+// Allocates arrays for _allocated_ slots (all empty), doesn't touch the old ones
+template <any_hash_table T>
+void hash_table_allocate(T &table, s64 allocated, u32 alignment) {
+    using K = key_t<T>;
+    using V = value_t<T>;
+
+    s64 controlSize = allocated + HASH_TABLE_GROUP_WIDTH;
+
+    if constexpr (table.BLOCK_ALLOC) {
+        // Each array starts aligned to _alignment_ (or to what its type needs, if that's more)
+        auto alignUp = [](s64 offset, s64 a) { return (offset + a - 1) & -a; };
+
+        s64 keyAlignment = max((s64) alignment, (s64) alignof(K));
+        s64 valueAlignment = max((s64) alignment, (s64) alignof(V));
+
+        s64 hashesOffset = alignUp(controlSize, max((s64) alignment, (s64) alignof(u64)));
+        s64 keysOffset = alignUp(hashesOffset + allocated * sizeof(u64), keyAlignment);
+        s64 valuesOffset = alignUp(keysOffset + allocated * sizeof(K), valueAlignment);
+        s64 sizeInBytes = valuesOffset + allocated * sizeof(V);
+
+        byte *block = allocate_array<byte>(sizeInBytes, {.Alignment = (u32) max(keyAlignment, valueAlignment)});
+        table.Control = (u8 *) block;
+        table.Hashes = (u64 *) (block + hashesOffset);
+        table.Keys = (K *) (block + keysOffset);
+        table.Values = (V *) (block + valuesOffset);
+    } else {
+        table.Control = allocate_array<u8>(controlSize, {.Alignment = alignment});
+        table.Hashes = allocate_array<u64>(allocated, {.Alignment = alignment});
+        table.Keys = allocate_array<K>(allocated, {.Alignment = alignment});
+        table.Values = allocate_array<V>(allocated, {.Alignment = alignment});
+    }
+    fill_memory(table.Control, (char) HASH_TABLE_EMPTY, controlSize);
+
+    table.Allocated = allocated;
+    table.SlotsFilled = table.Count;
+}
+
+template <any_hash_table T>
+void hash_table_free_arrays(T &table, u8 *control, u64 *hashes, key_t<T> *keys, value_t<T> *values) {
+    free(control);
+    if constexpr (!table.BLOCK_ALLOC) {
+        free(hashes);
+        free(keys);
+        free(values);
+    }
+}
+
+// Gets rid of the deleted slots without allocating, by moving every element to where it would go in an empty table.
+// Used when the table is full mostly because of deleted slots (lots of add/remove churn) instead of growing.
+//
+// All full slots are marked as deleted (meaning "not placed yet") and all deleted ones as empty, then we walk the
+// slots and place each element at the first available slot of its probe sequence. If that slot holds another element
+// which hasn't been placed yet, we swap the two and keep going with the one we swapped in.
+template <any_hash_table T>
+void hash_table_drop_deleted_in_place(T &table) {
+    using K = key_t<T>;
+    using V = value_t<T>;
+
+    For(range(table.Allocated)) table.Control[it] = table.Control[it] == HASH_TABLE_DELETED ? HASH_TABLE_EMPTY : (table.Control[it] & 0x80 ? table.Control[it] : HASH_TABLE_DELETED);
+    copy_memory(table.Control + table.Allocated, table.Control, HASH_TABLE_GROUP_WIDTH);
+
+    s64 mask = table.Allocated - 1;
+
+    alignas(K) byte tempKey[sizeof(K)];
+    alignas(V) byte tempValue[sizeof(V)];
+
+    for (s64 index = 0; index < table.Allocated; ++index) {
+        if (table.Control[index] != HASH_TABLE_DELETED) continue;
+
+        u64 mixed = hash_table_mix(table.Hashes[index]);
+        u8 h2 = mixed & 0x7F;
+
+        s64 probeStart = (s64) (mixed >> 7) & mask;
+        s64 target = hash_table_find_free_slot(table, mixed);
+
+        // Already in the group it would be found in first, leave it there
+        auto probeGroup = [&](s64 slot) { return ((slot - probeStart) & mask) / HASH_TABLE_GROUP_WIDTH; };
+        if (probeGroup(index) == probeGroup(target)) {
+            hash_table_set_control(table, index, h2);
+            continue;
+        }
+
+        if (table.Control[target] == HASH_TABLE_EMPTY) {
+            hash_table_set_control(table, target, h2);
+            hash_table_set_control(table, index, HASH_TABLE_EMPTY);
+
+            table.Hashes[target] = table.Hashes[index];
+            copy_memory(table.Keys + target, table.Keys + index, sizeof(K));
+            copy_memory(table.Values + target, table.Values + index, sizeof(V));
+        } else {
+            // The target holds an element which hasn't been placed yet, swap and process this slot again
+            hash_table_set_control(table, target, h2);
+
+            swap(table.Hashes[target], table.Hashes[index]);
+
+            copy_memory(tempKey, table.Keys + target, sizeof(K));
+            copy_memory(table.Keys + target, table.Keys + index, sizeof(K));
+            copy_memory(table.Keys + index, tempKey, sizeof(K));
+
+            copy_memory(tempValue, table.Values + target, sizeof(V));
+            copy_memory(table.Values + target, table.Values + index, sizeof(V));
+            copy_memory(table.Values + index, tempValue, sizeof(V));
+
+            --index;
+        }
+    }
+
+    table.SlotsFilled = table.Count;
+}
+}  // namespace internal
+
+// Makes sure the hash table has reserved enough space for at least n more elements.
 // Note that it may reserve way more than required.
-// Reserves space equal to the next power of two bigger than _size_, starting at _MINIMUM_SIZE_.
+// Reserves a power of two number of slots, starting at _MINIMUM_SIZE_.
 //
 // Allocates a buffer if the hash table doesn't already point to allocated memory (using the Context's allocator).
 // If _BLOCK_ALLOC_ is true it ensures that the allocated arrays are next to each other.
@@ -159,85 +327,70 @@ concept any_hash_table = is_hash_table<T>::value;
 // The first time an element is added to the hash table, it reserves with _MINIMUM_SIZE_ and no specified alignment.
 // You can call this before using the hash table to initialize the arrays with a custom alignment (if that's required).
 //
-// This is also called when adding an element and the hash table is more than half full (SlotsFilled * 2 >= Allocated).
-// In that case the _target_ is exactly _SlotsFilled_.
+// This is also called when adding an element and 7/8 of the slots are used (valid + deleted).
+// If the table would be at most ~78% full without the deleted slots, they are dropped in place without allocating.
+// Otherwise the elements are moved to new arrays (twice as large, or more) which have no deleted slots.
 // You may want to call this manually if you are adding a bunch of items and causing the hash table to reallocate a lot.
 template <any_hash_table T>
 void reserve(T &table, s64 target, u32 alignment = 0) {
     using K = key_t<T>;
     using V = value_t<T>;
 
-    if (table.SlotsFilled + target < table.Allocated) return;
-    target = max<s64>(ceil_pow_of_2(target + table.SlotsFilled + 1), table.MINIMUM_SIZE);
+    if (table.Allocated && (table.SlotsFilled + target) * 8 <= table.Allocated * 7) return;
 
-    auto allocateNewBlock = [&]() {
-        if constexpr (table.BLOCK_ALLOC) {
-            s64 padding1 = 0, padding2 = 0;
-            if (alignment != 0) {
-                padding1 = (target * sizeof(u64)) % alignment;
-                padding2 = (target * sizeof(V)) % alignment;
-            }
-
-            s64 sizeInBytes = target * (sizeof(u64) + sizeof(K) + sizeof(V)) + padding1 + padding2;
+    // Mostly deleted slots, there is enough room if we get rid of them. No need to allocate.
+    if (table.Allocated && (table.Count + target) * 32 <= table.Allocated * 25 && (alignment == 0 || alignment == allocation_get_alignment(table.Control))) {
+        internal::hash_table_drop_deleted_in_place(table);
+        return;
+    }
 
-            byte *block = allocate_array<byte>(sizeInBytes, {.Alignment = alignment});
-            table.Hashes = (u64 *) block;
-            table.Keys = (K *) (block + target * sizeof(u64) + padding1);
-            table.Values = (V *) (block + target * (sizeof(u64) + sizeof(K)) + padding2);
-            zero_memory(table.Hashes, target * sizeof(u64));
-        } else {
-            table.Hashes = allocate_array<u64>(target, {.Alignment = alignment});
-            table.Keys = allocate_array<K>(target, {.Alignment = alignment});
-            table.Values = allocate_array<V>(target, {.Alignment = alignment});
-            zero_memory(table.Hashes, target * sizeof(u64));
-        }
-    };
+    s64 allocated = max<s64>(ceil_pow_of_2((table.Count + target) * 32 / 25 + 1), table.MINIMUM_SIZE);
+    allocated = max(allocated, table.Allocated);
 
     if (table.Allocated) {
-        auto oldAlignment = ((allocation_header *) table.Hashes - 1)->Alignment;
+        auto oldAlignment = allocation_get_alignment(table.Control);
         if (alignment == 0) {
             alignment = oldAlignment;
         } else {
             assert(alignment == oldAlignment && "Reserving with an alignment but the object already has arrays with a different alignment. Specify alignment 0 to automatically use the old one.");
         }
 
+        auto *oldControl = table.Control;
         auto *oldHashes = table.Hashes;
         auto *oldKeys = table.Keys;
         auto *oldValues = table.Values;
         auto oldAllocated = table.Allocated;
 
-        allocateNewBlock();
+        internal::hash_table_allocate(table, allocated, alignment);
 
-        // Add the old items
+        // Move the old items. We assume keys and values can be copied byte by byte (same as arrays do, see :BigPhilosophyTime: in context.h).
         For(range(oldAllocated)) {
-            if (oldHashes[it] >= table.FIRST_VALID_HASH) add_prehashed(table, oldHashes[it], oldKeys[it], oldValues[it]);
-        }
+            if (oldControl[it] & 0x80) continue;
 
-        free(oldHashes);
+            u64 mixed = hash_table_mix(oldHashes[it]);
+            s64 index = internal::hash_table_find_free_slot(table, mixed);
 
-        if constexpr (!table.BLOCK_ALLOC) {
-            free(oldKeys);
-            free(oldValues);
+            internal::hash_table_set_control(table, index, (u8) (mixed & 0x7F));
+            table.Hashes[index] = oldHashes[it];
+            copy_memory(table.Keys + index, oldKeys + it, sizeof(K));
+            copy_memory(table.Values + index, oldValues + it, sizeof(V));
         }
+
+        internal::hash_table_free_arrays(table, oldControl, oldHashes, oldKeys, oldValues);
     } else {
         // It's impossible to have a view into a hash table (currently).
         // So there were no previous elements.
         assert(!table.Count);
-        allocateNewBlock();
+        internal::hash_table_allocate(table, allocated, alignment);
     }
-    table.Allocated = target;
 }
 
 // Free any memory allocated by this object and reset count
 template <any_hash_table T>
 void free(T &table) {
-    if (table.Allocated) {
-        free(table.Hashes);
-        if constexpr (!table.BLOCK_ALLOC) {
-            free(table.Keys);
-            free(table.Values);
-        }
-    }
+    if (table.Allocated) internal::hash_table_free_arrays(table, table.Control, table.Hashes, table.Keys, table.Values);
+
+    table.Control = null;
     table.Hashes = null;
     table.Keys = null;
     table.Values = null;
@@ -249,42 +402,109 @@ template <any_hash_table T>
 void reset(T &table) {
     // PODs may have destructors, although the C++ standard's definition forbids them to have non-trivial ones.
     if (table.Allocated) {
-        // @TODO: Factor this into uninitialize_block() function and use it in free() as well
-        auto *p = table.Hashes, *end = table.Hashes + table.Allocated;
-        s64 index = 0;
-        while (p != end) {
-            if (*p) {
-                table.Keys[index].~key_t();
-                table.Values[index].~value_t();
-                *p = 0;
-            }
-            ++index, ++p;
+        For(range(table.Allocated)) {
+            if (table.Control[it] & 0x80) continue;
+            table.Keys[it].~key_t();
+            table.Values[it].~value_t();
         }
+        fill_memory(table.Control, (char) HASH_TABLE_EMPTY, table.Allocated + HASH_TABLE_GROUP_WIDTH);
     }
     table.Count = table.SlotsFilled = 0;
 }
 
+// Types which can be used to look up keys of type K without making a K (heterogeneous lookup).
+// Any array-like (bytes, array<utf8>, a stack_array, etc.) can look up keys which are array-likes of the same element size,
+// since array-likes hash their contents (see get_hash_bytes() in hash.h) and compare with each other.
+//
+// So text can be looked up in a hash_table<string, V> straight from a buffer, without making a string (which counts code points):
+//
+//    find(table, array<utf8>(token.Data, token.Count));
+//
+template <typename Q, typename K>
+concept hash_table_lookup_key = !types::is_same<Q, K> && is_array_like<Q> && is_array_like<K> && sizeof(array_data_t<Q>) == sizeof(array_data_t<K>);
+
+namespace internal {
+// Heterogeneous keys compare their bytes, the same way they are hashed. Comparing the elements would
+// mix types, e.g. utf8 (signed char) with byte, and then any key with a byte >= 0x80 would never match.
+template <typename K, typename Q>
+bool hash_table_keys_equal(const K &key, const Q &other) {
+    if constexpr (types::is_same<K, Q>) {
+        return key == other;
+    } else {
+        return key.Count == other.Count && compare_memory(key.Data, other.Data, key.Count * sizeof(*key.Data)) == -1;
+    }
+}
+
+// Returns the index of the slot with _key_, -1 if it's not in the table
+template <any_hash_table T, typename Q>
+s64 hash_table_find_index(const T &table, u64 hash, const Q &key) {
+    if (!table.Count) return -1;
+
+    u64 mixed = hash_table_mix(hash);
+    u8 h2 = mixed & 0x7F;
+
+    s64 mask = table.Allocated - 1;
+
+    s64 pos = (s64) (mixed >> 7) & mask;
+    for (s64 step = HASH_TABLE_GROUP_WIDTH;; step += HASH_TABLE_GROUP_WIDTH) {
+        hash_table_group group(table.Control + pos);
+
+        for (u32 m = group.match(h2); m; m &= m - 1) {
+            s64 index = (pos + lsb(m)) & mask;
+            if (table.Hashes[index] == hash && hash_table_keys_equal(table.Keys[index], key)) return index;
+        }
+
+        // The key would have been put in this group's empty slot
+        if (group.match_empty()) return -1;
+
+        pos = (pos + step) & mask;
+    }
+}
+
+template <any_hash_table T>
+void hash_table_remove_index(T &table, s64 index) {
+    s64 mask = table.Allocated - 1;
+
+    // If the slot has never been part of a run of HASH_TABLE_GROUP_WIDTH used slots, no probe sequence ever
+    // went past it (every group containing it had an empty slot), so it can go back to being empty.
+    // Otherwise we need a tombstone. That's the case only in crowded parts of the table, so most removes don't leave one.
+    u32 emptyAfter = hash_table_group(table.Control + index).match_empty();
+    u32 emptyBefore = hash_table_group(table.Control + ((index - HASH_TABLE_GROUP_WIDTH) & mask)).match_empty();
+
+    bool wasNeverFull = emptyAfter && emptyBefore && lsb(emptyAfter) + (HASH_TABLE_GROUP_WIDTH - 1 - msb(emptyBefore)) < HASH_TABLE_GROUP_WIDTH;
+    if (wasNeverFull) {
+        hash_table_set_control(table, index, HASH_TABLE_EMPTY);
+        --table.SlotsFilled;
+    } else {
+        hash_table_set_control(table, index, HASH_TABLE_DELETED);
+    }
+
+    --table.Count;
+}
+}  // namespace internal
+
 // Looks for key in the hash table using the given hash.
 // In normal _find_ we calculate the hash of the key using the global get_hash() specialized functions.
 // This method is useful if you have cached the hash.
 template <any_hash_table T>
 key_value_pair<T> find_prehashed(const T &table, u64 hash, const key_t<T> &key) {
-    if (!table.Count) return {null, null};
+    s64 index = internal::hash_table_find_index(table, hash, key);
+    if (index == -1) return {null, null};
+    return {table.Keys + index, table.Values + index};
+}
 
-    s64 index = hash & (table.Allocated - 1);
-    For(range(table.Allocated)) {
-        if (table.Hashes[index] == hash) {
-            if (table.Keys[index] == key) {
-                return {table.Keys + index, table.Values + index};
-            }
-        }
+// Heterogeneous version, see hash_table_lookup_key
+template <any_hash_table T, hash_table_lookup_key<key_t<T>> Q>
+key_value_pair<T> find_prehashed(const T &table, u64 hash, const Q &key) {
+    s64 index = internal::hash_table_find_index(table, hash, key);
+    if (index == -1) return {null, null};
+    return {table.Keys + index, table.Values + index};
+}
 
-        ++index;
-        if (index >= table.Allocated) {
-            index = 0;
-        }
-    }
-    return {null, null};
+// Heterogeneous version, see hash_table_lookup_key
+template <any_hash_table T, hash_table_lookup_key<key_t<T>> Q>
+key_value_pair<T> find(const T &table, const Q &key) {
+    return find_prehashed(table, get_hash(key), key);
 }
 
 // We calculate the hash of the key using the global get_hash() specialized functions.
@@ -299,22 +519,16 @@ key_value_pair<T> find(const T &table, const key_t<T> &key) {
 // Returns pointers to the added key and value.
 template <any_hash_table T>
 key_value_pair<T> add_prehashed(T &table, u64 hash, const key_t<T> &key, const value_t<T> &value) {
-    // The + 1 here handles the case when the hash table size is 1 and you add the first item.
-    if ((table.SlotsFilled + 1) * 2 >= table.Allocated) reserve(table, table.SlotsFilled);  // Make sure the hash table is never more than 50% full
+    reserve(table, 1);  // Makes sure the hash table is never more than 7/8 full
 
-    assert(table.SlotsFilled < table.Allocated);
-
-    if (hash < table.FIRST_VALID_HASH) hash += table.FIRST_VALID_HASH;
-
-    s64 index = hash & (table.Allocated - 1);
-    while (table.Hashes[index]) {
-        ++index;
-        if (index >= table.Allocated) index = 0;
-    }
+    u64 mixed = hash_table_mix(hash);
+    s64 index = internal::hash_table_find_free_slot(table, mixed);
 
+    // Reusing a deleted slot doesn't fill another slot
+    if (table.Control[index] == HASH_TABLE_EMPTY) ++table.SlotsFilled;
     ++table.Count;
-    ++table.SlotsFilled;
 
+    internal::hash_table_set_control(table, index, (u8) (mixed & 0x7F));
     table.Hashes[index] = hash;
     new (table.Keys + index) key_t<T>(key);
     new (table.Values + index) value_t<T>(value);
@@ -359,7 +573,7 @@ key_value_pair<T> set_prehashed(T &table, u64 hash, const key_t<T> &key, const v
         *vp = value;
         return {kp, vp};
     }
-    return add(table, key, value);
+    return add_prehashed(table, hash, key, value);
 }
 
 // We calculate the hash of the key using the global get_hash() specialized functions.
@@ -373,13 +587,21 @@ key_value_pair<T> set(T &table, const key_t<T> &key, const value_t<T> &value) {
 // This method is useful if you have cached the hash.
 template <any_hash_table T>
 bool remove_prehashed(T &table, u64 hash, const key_t<T> &key) {
-    auto *ptr = find(table, hash, key);
-    if (ptr) {
-        s64 index = ptr - table.Values;
-        table.Hashes[index] = 1;
-        return true;
-    }
-    return false;
+    s64 index = internal::hash_table_find_index(table, hash, key);
+    if (index == -1) return false;
+
+    internal::hash_table_remove_index(table, index);
+    return true;
+}
+
+// Heterogeneous version, see hash_table_lookup_key
+template <any_hash_table T, hash_table_lookup_key<key_t<T>> Q>
+bool remove_prehashed(T &table, u64 hash, const Q &key) {
+    s64 index = internal::hash_table_find_index(table, hash, key);
+    if (index == -1) return false;
+
+    internal::hash_table_remove_index(table, index);
+    return true;
 }
 
 // Returns true if the key was found and removed.
@@ -389,16 +611,26 @@ bool remove(T &table, const key_t<T> &key) {
     return remove_prehashed(table, get_hash(key), key);
 }
 
+// Heterogeneous version, see hash_table_lookup_key
+template <any_hash_table T, hash_table_lookup_key<key_t<T>> Q>
+bool remove(T &table, const Q &key) {
+    return remove_prehashed(table, get_hash(key), key);
+}
+
 // Returns true if the hash table has the given key.
 // We calculate the hash of the key using the global get_hash() specialized functions.
 template <any_hash_table T>
 bool has(const T &table, const key_t<T> &key) { return find(table, key).Key != null; }
 
+// Heterogeneous version, see hash_table_lookup_key
+template <any_hash_table T, hash_table_lookup_key<key_t<T>> Q>
+bool has(const T &table, const Q &key) { return find(table, key).Key != null; }
+
 // Returns true if the hash table has the given key.
 // In normal _hash_ we calculate the hash of the key using the global get_hash() specialized functions.
 // This method is useful if you have cached the hash.
 template <any_hash_table T>
-bool has_prehashed(const T &table, u64 hash, const key_t<T> &key) { return find_prehashed(table, hash, key) != null; }
+bool has_prehashed(const T &table, u64 hash, const key_t<T> &key) { return find_prehashed(table, hash, key).Key != null; }
 
 template <any_hash_table T>
 bool operator==(const T &t, const T &u) {
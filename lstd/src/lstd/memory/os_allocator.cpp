@@ -0,0 +1,37 @@
+#include "allocator.h"
+
+import os;
+
+LSTD_BEGIN_NAMESPACE
+
+void *os_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options) {
+    switch (mode) {
+        case allocator_mode::ADD_POOL:
+        case allocator_mode::REMOVE_POOL:
+            // We don't have pools, each block is its own mapping
+            return null;
+        case allocator_mode::ALLOCATE:
+            return os_allocate_block(size);
+        case allocator_mode::RESIZE:
+            // May return a different pointer, the contents are moved by the OS (see the note about RESIZE in allocator.h)
+            return os_remap_block(oldMemory, size);
+        case allocator_mode::FREE: {
+            os_free_block(oldMemory);
+
+            // null means success FREE
+            return null;
+        }
+        case allocator_mode::FREE_ALL:
+            // (void *) -1 means that the allocator doesn't support FREE_ALL (by design)
+            return (void *) -1;
+        case allocator_mode::ALLOCATE_BATCH:
+        case allocator_mode::FREE_BATCH:
+            // (void *) -1 means that the allocator doesn't support batches, we get one request per block instead
+            return (void *) -1;
+        default:
+            assert(false);
+    }
+    return null;
+}
+
+LSTD_END_NAMESPACE
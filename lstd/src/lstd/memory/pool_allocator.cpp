@@ -0,0 +1,174 @@
+#include "allocator.h"
+
+LSTD_BEGIN_NAMESPACE
+
+struct pool_allocator_free_slot {
+    pool_allocator_free_slot *Next;
+};
+
+file_scope bool pool_contains(allocator_pool *pool, void *p) {
+    return p >= (void *) (pool + 1) && p < (void *) ((byte *) (pool + 1) + pool->Size);
+}
+
+void *pool_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options) {
+    auto *data = (pool_allocator_data *) context;
+
+    switch (mode) {
+        case allocator_mode::ADD_POOL: {
+            assert(data->ElementSize >= POINTER_SIZE && "Set ElementSize before adding pools (see general_get_required_size)");
+
+            // Keep slots pointer-aligned so we can store the free list links in them
+            data->ElementSize = (data->ElementSize + POINTER_SIZE - 1) & ~(POINTER_SIZE - 1);
+
+            auto *pool = (allocator_pool *) oldMemory;  // _oldMemory_ is the parameter which should contain the block to be added
+                                                        // the _size_ parameter contains the size of the block
+
+            if (!allocator_pool_initialize(pool, size)) return null;
+            if (pool->Size < data->ElementSize) {
+                assert(false && "Pool is too small to hold even one element");
+                return null;
+            }
+
+            allocator_pool_add_to_linked_list(&data->Base, pool);
+            if (!data->Current) data->Current = pool;
+
+            ++data->PoolsCount;
+            return pool;
+        }
+        case allocator_mode::REMOVE_POOL: {
+            auto *pool = (allocator_pool *) oldMemory;
+
+            void *result = allocator_pool_remove_from_linked_list(&data->Base, pool);
+            if (!result) return null;
+
+            --data->PoolsCount;
+            assert(data->PoolsCount >= 0);
+
+            // Drop free slots which point into the removed pool. This walks the entire free list
+            // but removing pools should be rare (and is never on a hot path).
+            auto **link = (pool_allocator_free_slot **) &data->FreeList;
+            while (*link) {
+                if (pool_contains(pool, *link)) {
+                    *link = (*link)->Next;
+                } else {
+                    link = &(*link)->Next;
+                }
+            }
+
+            // Start from the beginning, ALLOCATE skips full pools
+            if (data->Current == pool) data->Current = data->Base;
+
+            if (!data->PoolsCount) allocator_registry_release(data);  // No pools, no live blocks
+            return result;
+        }
+        case allocator_mode::ALLOCATE: {
+            if (size > data->ElementSize) {
+                assert(false && "Allocation is larger than the element size of this pool allocator");
+                return null;
+            }
+
+            // First reuse freed slots
+            if (data->FreeList) {
+                auto *slot = (pool_allocator_free_slot *) data->FreeList;
+                data->FreeList = slot->Next;
+                return slot;
+            }
+
+            // Then carve new slots from the current pool. The pools before _Current_ are full.
+            auto *p = data->Current;
+            while (p && p->Used + data->ElementSize > p->Size) p = p->Next;
+
+            if (!p) return null;  // Not enough space
+            data->Current = p;
+
+            void *result = (byte *) (p + 1) + p->Used;
+            p->Used += data->ElementSize;
+            return result;
+        }
+        case allocator_mode::RESIZE: {
+            // All slots are the same size
+            return size <= data->ElementSize ? oldMemory : null;
+        }
+        case allocator_mode::FREE: {
+            auto *slot = (pool_allocator_free_slot *) oldMemory;
+            slot->Next = (pool_allocator_free_slot *) data->FreeList;
+            data->FreeList = slot;
+
+            // null means success FREE
+            return null;
+        }
+        case allocator_mode::FREE_ALL: {
+            auto *p = data->Base;
+            while (p) {
+                p->Used = 0;
+                p = p->Next;
+            }
+            data->Current = data->Base;
+            data->FreeList = null;
+
+            // null means successful FREE_ALL
+            // (void *) -1 means that the allocator doesn't support FREE_ALL (by design)
+            return null;
+        }
+        case allocator_mode::ALLOCATE_BATCH: {
+            auto *batch = (allocator_batch *) oldMemory;
+
+            // Unlike ALLOCATE we don't assert here, callers of batches already handle getting fewer blocks
+            // (general_allocate_batch returns how many it got). Every block is null, as if the pools were full.
+            if (size > data->ElementSize) {
+                For(range(batch->Count)) batch->Blocks[it] = null;
+                return null;
+            }
+
+            s64 i = 0;
+
+            // First reuse freed slots
+            while (i < batch->Count && data->FreeList) {
+                auto *slot = (pool_allocator_free_slot *) data->FreeList;
+                data->FreeList = slot->Next;
+                batch->Blocks[i++] = slot;
+            }
+
+            // Then carve runs of new slots from the pools
+            auto *p = data->Current;
+            while (i < batch->Count && p) {
+                s64 fit = (p->Size - p->Used) / data->ElementSize;
+                if (!fit) {
+                    p = p->Next;
+                    continue;
+                }
+                data->Current = p;
+
+                s64 n = min(fit, batch->Count - i);
+
+                auto *slot = (byte *) (p + 1) + p->Used;
+                For(range(n)) batch->Blocks[i++] = slot + it * data->ElementSize;
+                p->Used += n * data->ElementSize;
+            }
+
+            if (i == batch->Count) return batch;
+
+            while (i < batch->Count) batch->Blocks[i++] = null;
+            return null;  // Not enough space
+        }
+        case allocator_mode::FREE_BATCH: {
+            auto *batch = (allocator_batch *) oldMemory;
+            if (!batch->Count) return null;
+
+            // Chain the slots together and put the whole chain in front of the free list
+            For(range(batch->Count - 1)) {
+                ((pool_allocator_free_slot *) batch->Blocks[it])->Next = (pool_allocator_free_slot *) batch->Blocks[it + 1];
+            }
+            ((pool_allocator_free_slot *) batch->Blocks[batch->Count - 1])->Next = (pool_allocator_free_slot *) data->FreeList;
+            data->FreeList = batch->Blocks[0];
+
+            // null means success FREE
+            return null;
+        }
+        default:
+            assert(false);
+    }
+    return null;
+}
+
+LSTD_END_NAMESPACE
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "array.h"
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// A dynamic array which keeps up to _N_ elements inside the object and allocates only when it grows past that.
+// Use it for short lists which are usually small (components of an entity, arguments of a call, children of a node),
+// so the common case doesn't touch the allocator at all.
+//
+// Like array, this is :CodeReusability: array_like (see array_like.h) and the array_ functions work on it:
+//
+//     small_array<s32, 8> ids;
+//     array_append(ids, 42);             // Stored inline
+//     find(ids, 42);                     // array_like.h
+//     ...
+//     free(ids);                         // Only needed if it grew past 8 elements, but always safe to call
+//
+// When it grows past _N_ the elements are moved to a block from the Context's allocator (same growth as array).
+// It doesn't go back to the inline storage when it shrinks, only free() does that.
+//
+// While the elements are inline _Data_ points into the object itself, so don't copy small arrays byte by byte
+// (e.g. by storing them in an array<> which gets reallocated). Copy constructing one is fine, it points _Data_
+// to its own storage. Like arrays, copies of one which has grown share the allocated block (use clone() for a deep copy).
+//
+// Note: The inline storage is raw bytes, elements are constructed only when they are added (like in an allocated array).
+template <typename T_, s64 N>
+struct small_array {
+    using T = T_;
+
+    static_assert(N > 0, "Use array<T> if you don't want inline storage");
+
+    static constexpr s64 INLINE_COUNT = N;
+
+    alignas(T) byte StackData[N * sizeof(T)];
+
+    T *Data = (T *) StackData;
+    s64 Count = 0;
+    s64 Allocated = 0;  // 0 while the elements are inline
+
+    small_array() {}
+
+    small_array(const small_array &other) { *this = other; }
+
+    small_array &operator=(const small_array &other) {
+        if (this == &other) return *this;
+
+        Count = other.Count;
+        Allocated = other.Allocated;
+        if (other.Allocated) {
+            Data = other.Data;
+        } else {
+            Data = (T *) StackData;
+            copy_elements(Data, other.Data, other.Count);
+        }
+        return *this;
+    }
+
+    // We don't use destructors for freeing memory anymore.
+    // ~small_array() { free(); }
+
+    //
+    // Iterators:
+    //
+    using iterator = T *;
+    using const_iterator = const T *;
+
+    iterator begin() { return Data; }
+    iterator end() { return Data + Count; }
+    const_iterator begin() const { return Data; }
+    const_iterator end() const { return Data + Count; }
+
+    //
+    // Operators:
+    //
+    T &operator[](s64 index) { return Data[translate_index(index, Count)]; }
+    const T &operator[](s64 index) const { return Data[translate_index(index, Count)]; }
+
+    explicit operator bool() const { return Count; }
+
+    // A view, valid until the small array grows (or is freed)
+    operator array<T>() const { return array<T>(Data, Count); }
+};
+
+// The array_ functions take anything is_array, small arrays just need their own reserve, reset and free.
+// Those are more specialized than the generic ones in array.h, so they get picked (also inside other array_ functions).
+template <typename T, s64 N>
+struct is_array_helper<small_array<T, N>> : types::true_t {};
+
+// Makes sure the array has space for at least _n_ new elements.
+// Doesn't allocate while they fit inline. When they don't, the elements are moved to an allocated block of the
+// next power of two bigger than (_n_ + Count) (at least twice the inline count).
+template <typename T, s64 N>
+void array_reserve(small_array<T, N> &arr, s64 n) {
+    if (arr.Allocated) {
+        if (arr.Count + n < arr.Allocated) return;
+
+        s64 target = ceil_pow_of_2(n + arr.Count + 1);
+        arr.Data = reallocate_array(arr.Data, target);
+        arr.Allocated = target;
+        return;
+    }
+
+    arr.Data = (T *) arr.StackData;  // In case the object was copied byte by byte
+    if (arr.Count + n <= N) return;
+
+    s64 target = max(ceil_pow_of_2(n + arr.Count + 1), N * 2);
+
+    arr.Data = allocate_array<T>(target);
+    copy_elements(arr.Data, (T *) arr.StackData, arr.Count);
+    arr.Allocated = target;
+}
+
+// Call destructor on each element. Don't free the buffer, just move Count to 0.
+template <typename T, s64 N>
+void array_reset(small_array<T, N> &arr) {
+    // Unlike array we always own our elements, there are no small array views
+    while (arr.Count) {
+        destroy_at(arr.Data + arr.Count - 1);
+        --arr.Count;
+    }
+}
+
+// Call destructor on each element, free the allocated block (if any) and go back to the inline storage.
+template <typename T, s64 N>
+void free(small_array<T, N> &arr) {
+    array_reset(arr);
+    if (arr.Allocated) free(arr.Data);
+    arr.Data = (T *) arr.StackData;
+    arr.Allocated = 0;
+}
+
+// Be careful not to call this with _dest_ pointing to _src_!
+// Returns just _dest_.
+template <typename T, s64 N>
+small_array<T, N> *clone(small_array<T, N> *dest, const small_array<T, N> &src) {
+    array_reset(*dest);
+    array_append(*dest, src.Data, src.Count);
+    return dest;
+}
+
+LSTD_END_NAMESPACE
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "../math/simd.h"
+#include "../types/sequence.h"
+#include "array.h"
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// A dynamic array which stores its elements as a struct of arrays - every field gets its own contiguous column.
+// Use it when loops touch only one or two fields of many elements (particle positions, transform updates), so the
+// cache lines they load hold just the data they need instead of whole structs.
+//
+//     soa_array<v3, v3, f32> particles;  // Position, velocity, lifetime
+//     defer(free(particles));
+//
+//     append(particles, position, velocity, 5.0f);
+//
+//     auto positions = column<0>(particles);   // array<v3> views, valid until the soa_array grows
+//     auto velocities = column<1>(particles);
+//     For(range(particles.Count)) positions[it] += velocities[it] * dt;
+//
+// All columns live in a single allocation (like hash_table with BLOCK_ALLOC), one after the other.
+// Each column starts aligned to SOA_ARRAY_ALIGNMENT (or more, if its type needs it) and _Allocated_ is always a multiple
+// of 8, so a column of f32/f64/s32/s64 can be processed in whole simd registers. column_simd() returns that view:
+//
+//     auto lifetimes = column_simd<2, 4>(particles);  // array<simd<f32, 4>>, the last one may include lanes past Count
+//     For(lifetimes) it = simd<f32, 4>::sub(it, dt);
+//
+// Lanes past _Count_ hold garbage but are always inside the allocation, so it's safe to read and write them.
+//
+// Like array, elements are moved byte by byte when growing and removing (see :BigPhilosophyTime: in context.h).
+// Copies are shallow, use clone() for a deep copy.
+template <typename... Fields>
+struct soa_array {
+    static_assert(sizeof...(Fields) > 0, "soa_array needs at least one field");
+
+    static constexpr s64 FIELD_COUNT = sizeof...(Fields);
+    static constexpr s64 MINIMUM_SIZE = 16;
+
+    // The first column is the start of the allocated block
+    byte *Columns[FIELD_COUNT] = {};
+
+    s64 Count = 0;
+    s64 Allocated = 0;
+
+    soa_array() {}
+
+    // We don't use destructors for freeing memory anymore.
+    // ~soa_array() { free(); }
+};
+
+// Columns start at least at this alignment (enough for AVX loads)
+constexpr s64 SOA_ARRAY_ALIGNMENT = 32;
+
+template <typename T>
+struct is_soa_array_helper : types::false_t {};
+
+template <typename... Fields>
+struct is_soa_array_helper<soa_array<Fields...>> : types::true_t {};
+
+template <typename T>
+concept is_soa_array = is_soa_array_helper<types::remove_const_t<T>>::value;
+
+template <typename T, s64 Index>
+struct soa_array_field;
+
+template <typename... Fields, s64 Index>
+struct soa_array_field<soa_array<Fields...>, Index> {
+    using type = tuple_get_t<Index, tuple<Fields...>>;
+};
+
+// The type of the field at _Index_
+template <typename T, s64 Index>
+using soa_array_field_t = typename soa_array_field<types::remove_const_t<T>, Index>::type;
+
+namespace internal {
+template <typename T>
+constexpr s64 soa_array_column_alignment() { return max<s64>(SOA_ARRAY_ALIGNMENT, alignof(T)); }
+
+// Fills _offsets_ with where each column starts in a block for _allocated_ elements and returns the size of the block
+template <typename... Fields>
+s64 soa_array_layout(soa_array<Fields...> *, s64 allocated, s64 *offsets) {
+    s64 size = 0, i = 0;
+    ((size = (size + soa_array_column_alignment<Fields>() - 1) & -soa_array_column_alignment<Fields>(),
+      offsets[i++] = size,
+      size += allocated * (s64) sizeof(Fields)),
+     ...);
+    return size;
+}
+
+template <typename... Fields>
+constexpr u32 soa_array_block_alignment(soa_array<Fields...> *) { return (u32) max(soa_array_column_alignment<Fields>()...); }
+
+template <s64... Is, typename... Fields>
+void soa_array_copy_columns(soa_array<Fields...> &arr, byte **dest, s64 destIndex, byte *const *src, s64 srcIndex, s64 n, integer_sequence<Is...>) {
+    (copy_memory(dest[Is] + destIndex * sizeof(Fields), src[Is] + srcIndex * sizeof(Fields), n * sizeof(Fields)), ...);
+}
+
+template <s64... Is, typename... Fields>
+void soa_array_destroy(soa_array<Fields...> &arr, s64 index, integer_sequence<Is...>) {
+    (destroy_at((Fields *) arr.Columns[Is] + index), ...);
+}
+
+template <s64... Is, typename... Fields, typename... Args>
+void soa_array_construct(soa_array<Fields...> &arr, s64 index, integer_sequence<Is...>, const Args &...values) {
+    (new ((Fields *) arr.Columns[Is] + index) Fields(values), ...);
+}
+}  // namespace internal
+
+// Returns a view of a column (the field at _Index_ of every element), valid until the soa_array grows (or is freed)
+template <s64 Index, is_soa_array T>
+auto column(T &arr) {
+    static_assert(Index >= 0 && Index < T::FIELD_COUNT, "Field index out of range");
+
+    using F = soa_array_field_t<T, Index>;
+    return array<F>((F *) arr.Columns[Index], arr.Count);
+}
+
+// Returns a column as simd registers of _Dim_ lanes (ceil(Count / Dim) of them), for feeding it to the simd/vec math.
+// The lanes past _Count_ in the last register are not elements, see the comment at the top of the file.
+template <s64 Index, s64 Dim, is_soa_array T>
+auto column_simd(T &arr) {
+    using F = soa_array_field_t<T, Index>;
+    static_assert(types::is_same<F, f32> || types::is_same<F, f64> || types::is_same<F, s32> || types::is_same<F, s64>, "Only columns of f32, f64, s32 or s64 can be viewed as simd registers");
+    static_assert(8 % Dim == 0, "Allocated is a multiple of 8");
+    static_assert(alignof(simd<F, Dim>) <= SOA_ARRAY_ALIGNMENT);
+
+    return array<simd<F, Dim>>((simd<F, Dim> *) arr.Columns[Index], (arr.Count + Dim - 1) / Dim);
+}
+
+// Makes sure the soa_array has space for at least _n_ new elements.
+// Allocates a block for the next power of two bigger than (_n_ + Count) (at least _MINIMUM_SIZE_) and moves the columns there.
+template <is_soa_array T>
+void reserve(T &arr, s64 n) {
+    if (arr.Count + n <= arr.Allocated) return;
+
+    s64 target = max(ceil_pow_of_2(n + arr.Count + 1), T::MINIMUM_SIZE);
+
+    s64 offsets[T::FIELD_COUNT];
+    s64 size = internal::soa_array_layout((T *) null, target, offsets);
+
+    byte *block = allocate_array<byte>(size, {.Alignment = internal::soa_array_block_alignment((T *) null)});
+
+    byte *columns[T::FIELD_COUNT];
+    For(range(T::FIELD_COUNT)) columns[it] = block + offsets[it];
+
+    if (arr.Allocated) {
+        internal::soa_array_copy_columns(arr, columns, 0, arr.Columns, 0, arr.Count, make_integer_sequence<T::FIELD_COUNT>{});
+        free(arr.Columns[0]);
+    }
+
+    For(range(T::FIELD_COUNT)) arr.Columns[it] = columns[it];
+    arr.Allocated = target;
+}
+
+// Adds an element (one value for each field) and returns its index
+template <is_soa_array T, typename... Args>
+requires(sizeof...(Args) == T::FIELD_COUNT) s64 append(T &arr, const Args &...values) {
+    reserve(arr, 1);
+
+    s64 index = arr.Count;
+    internal::soa_array_construct(arr, index, make_integer_sequence<T::FIELD_COUNT>{}, values...);
+    ++arr.Count;
+    return index;
+}
+
+// Removes the element at the specified index and moves the last element to the empty slot (in every column).
+// Doesn't keep the order of the elements.
+template <is_soa_array T>
+void remove_unordered(T &arr, s64 index) {
+    s64 offset = translate_index(index, arr.Count);
+
+    internal::soa_array_destroy(arr, offset, make_integer_sequence<T::FIELD_COUNT>{});
+    if (offset != arr.Count - 1) {
+        internal::soa_array_copy_columns(arr, arr.Columns, offset, arr.Columns, arr.Count - 1, 1, make_integer_sequence<T::FIELD_COUNT>{});
+    }
+    --arr.Count;
+}
+
+// Call destructor on each element. Don't free the block, just move Count to 0.
+template <is_soa_array T>
+void reset(T &arr) {
+    while (arr.Count) {
+        internal::soa_array_destroy(arr, arr.Count - 1, make_integer_sequence<T::FIELD_COUNT>{});
+        --arr.Count;
+    }
+}
+
+// Call destructor on each element and free the block
+template <is_soa_array T>
+void free(T &arr) {
+    reset(arr);
+    if (arr.Allocated) free(arr.Columns[0]);
+
+    For(range(T::FIELD_COUNT)) arr.Columns[it] = null;
+    arr.Allocated = 0;
+}
+
+// Be careful not to call this with _dest_ pointing to _src_!
+// Returns just _dest_.
+template <typename... Fields>
+soa_array<Fields...> *clone(soa_array<Fields...> *dest, const soa_array<Fields...> &src) {
+    reset(*dest);
+    reserve(*dest, src.Count);
+    internal::soa_array_copy_columns(*dest, dest->Columns, 0, src.Columns, 0, src.Count, make_integer_sequence<sizeof...(Fields)>{});
+    dest->Count = src.Count;
+    return dest;
+}
+
+LSTD_END_NAMESPACE
@@ -0,0 +1,111 @@
+#include "allocator.h"
+
+LSTD_BEGIN_NAMESPACE
+
+file_scope s64 size_class(s64 size) {
+    s64 index = size > 0 ? msb((u64) size) : 0;
+    return index < ALLOCATOR_STATS_SIZE_CLASSES ? index : ALLOCATOR_STATS_SIZE_CLASSES - 1;
+}
+
+file_scope void add_live(allocator_stats *stats, s64 delta) {
+    s64 live = atomic_add(&stats->LiveBytes, delta) + delta;
+    if (delta <= 0) return;
+
+    // Raise the peak if we went over it. Another thread may have raised it in the meantime, so retry until it's at least _live_.
+    s64 peak = atomic_load(&stats->PeakBytes);
+    while (live > peak) {
+        s64 old = atomic_compare_and_swap(&stats->PeakBytes, live, peak);
+        if (old == peak) break;
+        peak = old;
+    }
+}
+
+file_scope void record_allocation(allocator_stats *stats, s64 size) {
+    atomic_inc(&stats->AllocationCount);
+    atomic_add(&stats->AllocatedBytes, size);
+    atomic_inc(&stats->SizeHistogram[size_class(size)]);
+    add_live(stats, size);
+}
+
+void *stats_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options) {
+    auto *data = (stats_allocator_data *) context;
+    auto *stats = &data->Stats;
+
+    auto parent = data->Parent;
+    assert(parent && "Set the allocator to wrap before using a stats_allocator");
+
+    void *result = parent.Function(mode, parent.Context, size, oldMemory, oldSize, options);
+
+    switch (mode) {
+        case allocator_mode::ADD_POOL:
+        case allocator_mode::REMOVE_POOL:
+            break;
+        case allocator_mode::ALLOCATE: {
+            if (result) {
+                record_allocation(stats, size);
+            } else {
+                atomic_inc(&stats->FailedCount);
+            }
+            break;
+        }
+        case allocator_mode::RESIZE: {
+            // Resized in place, the caller moves the block (ALLOCATE + FREE) otherwise
+            if (result) add_live(stats, size - oldSize);
+            break;
+        }
+        case allocator_mode::FREE: {
+            atomic_inc(&stats->FreeCount);
+            add_live(stats, -oldSize);
+            break;
+        }
+        case allocator_mode::FREE_ALL: {
+            if (!result) atomic_swap(&stats->LiveBytes, 0ll);
+            break;
+        }
+        case allocator_mode::ALLOCATE_BATCH: {
+            if (result == (void *) -1) break;  // Not supported, general_allocate_batch falls back to ALLOCATE through us
+
+            auto *batch = (allocator_batch *) oldMemory;
+            For(range(batch->Count)) {
+                if (batch->Blocks[it]) {
+                    record_allocation(stats, size);
+                } else {
+                    atomic_inc(&stats->FailedCount);
+                }
+            }
+            break;
+        }
+        case allocator_mode::FREE_BATCH: {
+            if (result == (void *) -1) break;
+
+            auto *batch = (allocator_batch *) oldMemory;
+            atomic_add(&stats->FreeCount, batch->Count);
+            add_live(stats, -oldSize * batch->Count);
+            break;
+        }
+        default:
+            assert(false);
+    }
+    return result;
+}
+
+allocator_stats stats_allocator_get_snapshot(stats_allocator_data *data) {
+    auto *stats = &data->Stats;
+
+    // Plain atomic loads, so we don't get torn values (and don't write to the counters' cache lines while reading them)
+    allocator_stats result;
+    result.AllocationCount = atomic_load(&stats->AllocationCount);
+    result.FreeCount = atomic_load(&stats->FreeCount);
+    result.FailedCount = atomic_load(&stats->FailedCount);
+    result.LiveBytes = atomic_load(&stats->LiveBytes);
+    result.PeakBytes = atomic_load(&stats->PeakBytes);
+    result.AllocatedBytes = atomic_load(&stats->AllocatedBytes);
+    For(range(ALLOCATOR_STATS_SIZE_CLASSES)) result.SizeHistogram[it] = atomic_load(&stats->SizeHistogram[it]);
+    return result;
+}
+
+void stats_allocator_reset_peak(stats_allocator_data *data) {
+    atomic_swap(&data->Stats.PeakBytes, atomic_load(&data->Stats.LiveBytes));
+}
+
+LSTD_END_NAMESPACE
@@ -2,6 +2,7 @@
 
 #include "../memory/allocator.h"
 #include "array.h"
+#include "hash.h"
 
 LSTD_BEGIN_NAMESPACE
 
@@ -24,7 +25,8 @@ struct string : array<utf8> {
     constexpr string(const utf8 *str) : array<utf8>((utf8 *) str, c_string_length(str)), Length(utf8_length(str, Count)) {}
 
     // This constructor allows constructing from the utf8 encoded u8"..." string literals.
-    constexpr string(const char8_t *str) : array<utf8>((utf8 *) str, c_string_length(str)), Length(utf8_length((utf8 *) str, Count)) {}
+    // Not constexpr, because casting between char8_t and utf8 pointers isn't allowed at compile time.
+    string(const char8_t *str) : array<utf8>((utf8 *) str, c_string_length(str)), Length(utf8_length((utf8 *) str, Count)) {}
 
     // Create a string from a buffer and a length.
     // Note that this constructor doesn't validate if the passed in string is valid utf8.
@@ -32,10 +34,10 @@ struct string : array<utf8> {
 
     // Create a string from a buffer and a length.
     // Note that this constructor doesn't validate if the passed in string is valid utf8.
-    constexpr string(const byte *str, s64 size) : array<utf8>((utf8 *) str, size), Length(utf8_length(Data, size)) {}
+    string(const byte *str, s64 size) : array<utf8>((utf8 *) str, size), Length(utf8_length(Data, size)) {}
 
     constexpr string(const array<utf8> &arr) : array<utf8>(arr), Length(utf8_length(Data, Count)) {}
-    constexpr string(const array<byte> &arr) : array<utf8>((utf8 *) arr.Data, arr.Count), Length(utf8_length(Data, Count)) {}
+    string(const array<byte> &arr) : array<utf8>((utf8 *) arr.Data, arr.Count), Length(utf8_length(Data, Count)) {}
 
     // Allocates a buffer (using the Context's allocator by default)
     string(utf32 codePoint, s64 repeat);
@@ -117,7 +119,7 @@ struct string : array<utf8> {
     constexpr explicit operator bool() const { return Length; }
 
     constexpr operator array<utf8>() const { return array<utf8>(Data, Count); }
-    constexpr operator array<byte>() const { return array<byte>((byte *) Data, Count); }
+    operator array<byte>() const { return array<byte>((byte *) Data, Count); }
 
     struct code_point_ref {
         string *Parent = null;
@@ -701,11 +703,7 @@ constexpr string string::operator[](substring_indices range) const { return subs
 // Returns just _dest_.
 string *clone(string *dest, const string &src);
 
-// Hash for strings
-inline u64 get_hash(const string &value) {
-    u64 hash = 5381;
-    For(value) hash = ((hash << 5) + hash) + it;
-    return hash;
-}
+// Hash for strings. Hashes the bytes (not the code points), so views of the same text hash the same (see get_hash_bytes).
+inline u64 get_hash(const string &value) { return get_hash_bytes((const byte *) value.Data, value.Count); }
 
 LSTD_END_NAMESPACE
@@ -0,0 +1,231 @@
+#include "allocator.h"
+
+LSTD_BEGIN_NAMESPACE
+
+// Blocks larger than this (the size requested from the allocator, which includes our header) bypass the caches.
+constexpr s64 THREAD_CACHE_MAX_BLOCK_SIZE = 4_KiB;
+
+// Size classes are spaced 16 bytes apart up to 256 bytes (16 classes),
+// after that we use powers of 2 up to THREAD_CACHE_MAX_BLOCK_SIZE (512, 1 KiB, 2 KiB, 4 KiB).
+constexpr s64 THREAD_CACHE_SIZE_CLASSES = 16 + 4;
+
+// How many thread_cache_allocators a single thread can have caches for.
+// If a thread uses more than that, allocations with the extra ones just go through the lock.
+constexpr s64 MAX_THREAD_CACHES_PER_THREAD = 4;
+
+struct thread_cache_free_block {
+    thread_cache_free_block *Next;
+};
+
+struct thread_cache {
+    thread_cache_allocator_data *Owner;
+
+    thread_cache_free_block *Lists[THREAD_CACHE_SIZE_CLASSES];
+    s64 Counts[THREAD_CACHE_SIZE_CLASSES];
+};
+
+// Zero-initialized for every thread, a slot is claimed the first time a thread uses a given allocator.
+file_scope thread_local thread_cache ThreadCaches[MAX_THREAD_CACHES_PER_THREAD];
+
+file_scope s64 size_class_index(s64 size) {
+    if (size <= 16) return 0;
+    if (size <= 256) return (size + 15) / 16 - 1;
+    return 16 + (msb((u64) (size - 1)) - 8);  // 257..512 -> 16, 513..1024 -> 17, etc.
+}
+
+file_scope s64 size_class_size(s64 index) {
+    if (index < 16) return (index + 1) * 16;
+    return 512ll << (index - 16);
+}
+
+// How many blocks we move between the thread cache and the shared state at once.
+// We aim for about 8 KiB worth of blocks per batch.
+file_scope s64 size_class_batch(s64 index) {
+    s64 batch = 8_KiB / size_class_size(index);
+    if (batch < 4) batch = 4;
+    if (batch > 64) batch = 64;
+    return batch;
+}
+
+file_scope thread_cache *get_thread_cache(thread_cache_allocator_data *data) {
+    thread_cache *empty = null;
+    For(range(MAX_THREAD_CACHES_PER_THREAD)) {
+        auto *c = ThreadCaches + it;
+        if (c->Owner == data) return c;
+        if (!c->Owner && !empty) empty = c;
+    }
+
+    if (empty) empty->Owner = data;
+    return empty;
+}
+
+// Grabs a batch of blocks from the shared state. Returns false if the shared state is out of memory.
+file_scope bool refill(thread_cache_allocator_data *data, thread_cache *cache, s64 index) {
+    s64 blockSize = size_class_size(index);
+    s64 batch = size_class_batch(index);
+
+    void *blocks[64];  // size_class_batch() is at most 64
+
+    data->Lock.lock();
+    s64 count = tlsf_malloc_batch(data->Shared.State, blockSize, blocks, batch);
+    data->Lock.unlock();
+
+    For(range(count)) {
+        auto *block = (thread_cache_free_block *) blocks[it];
+        block->Next = cache->Lists[index];
+        cache->Lists[index] = block;
+        ++cache->Counts[index];
+    }
+
+    return cache->Lists[index];
+}
+
+// Gives _count_ blocks back to the shared state.
+file_scope void spill(thread_cache_allocator_data *data, thread_cache *cache, s64 index, s64 count) {
+    data->Lock.lock();
+    while (count-- && cache->Lists[index]) {
+        auto *block = cache->Lists[index];
+        cache->Lists[index] = block->Next;
+        --cache->Counts[index];
+
+        tlsf_free(data->Shared.State, block);
+    }
+    data->Lock.unlock();
+}
+
+void thread_cache_allocator_flush(thread_cache_allocator_data *data) {
+    For(range(MAX_THREAD_CACHES_PER_THREAD)) {
+        auto *c = ThreadCaches + it;
+        if (c->Owner != data) continue;
+
+        For_as(index, range(THREAD_CACHE_SIZE_CLASSES)) {
+            if (c->Counts[index]) spill(data, c, index, c->Counts[index]);
+        }
+        c->Owner = null;
+        return;
+    }
+}
+
+// Calls the shared TLSF allocator while holding the lock
+file_scope void *locked_tlsf(thread_cache_allocator_data *data, allocator_mode mode, s64 size, void *oldMemory, s64 oldSize, u64 options) {
+    data->Lock.lock();
+    auto *result = tlsf_allocator(mode, &data->Shared, size, oldMemory, oldSize, options);
+    data->Lock.unlock();
+    return result;
+}
+
+void *thread_cache_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options) {
+    auto *data = (thread_cache_allocator_data *) context;
+
+    switch (mode) {
+        case allocator_mode::ADD_POOL:
+        case allocator_mode::REMOVE_POOL:
+            return locked_tlsf(data, mode, size, oldMemory, oldSize, options);
+        case allocator_mode::ALLOCATE: {
+            if (size > THREAD_CACHE_MAX_BLOCK_SIZE) return locked_tlsf(data, mode, size, null, 0, options);
+
+            s64 index = size_class_index(size);
+
+            auto *cache = get_thread_cache(data);
+            if (!cache) return locked_tlsf(data, mode, size_class_size(index), null, 0, options);
+
+            if (!cache->Lists[index]) {
+                if (!refill(data, cache, index)) return null;  // Out of memory
+            }
+
+            auto *block = cache->Lists[index];
+            cache->Lists[index] = block->Next;
+            --cache->Counts[index];
+            return block;
+        }
+        case allocator_mode::RESIZE: {
+            bool oldCached = oldSize && oldSize <= THREAD_CACHE_MAX_BLOCK_SIZE;
+            bool newCached = size <= THREAD_CACHE_MAX_BLOCK_SIZE;
+
+            if (oldCached && newCached) {
+                // Blocks in the same size class are interchangeable, so we can "resize" in place.
+                if (size_class_index(oldSize) == size_class_index(size)) return oldMemory;
+            }
+
+            // Resizing into a size class must produce a block which is at least as large as the class,
+            // otherwise a later in-place resize (the branch above) would hand out memory the block doesn't have.
+            s64 request = newCached ? size_class_size(size_class_index(size)) : size;
+            return locked_tlsf(data, mode, request, oldMemory, oldSize, options);
+        }
+        case allocator_mode::FREE: {
+            if (!oldSize || oldSize > THREAD_CACHE_MAX_BLOCK_SIZE) return locked_tlsf(data, mode, 0, oldMemory, oldSize, options);
+
+            s64 index = size_class_index(oldSize);
+
+            auto *cache = get_thread_cache(data);
+            if (!cache) return locked_tlsf(data, mode, 0, oldMemory, oldSize, options);
+
+            auto *block = (thread_cache_free_block *) oldMemory;
+            block->Next = cache->Lists[index];
+            cache->Lists[index] = block;
+            ++cache->Counts[index];
+
+            // Don't let a single thread hoard memory, e.g. a consumer thread which frees everything a producer allocates.
+            s64 batch = size_class_batch(index);
+            if (cache->Counts[index] > 2 * batch) spill(data, cache, index, batch);
+
+            return null;
+        }
+        case allocator_mode::FREE_ALL: {
+            // null means successful FREE_ALL
+            // (void *) -1 means that the allocator doesn't support FREE_ALL (by design)
+            return (void *) -1;
+        }
+        case allocator_mode::ALLOCATE_BATCH: {
+            auto *cache = size <= THREAD_CACHE_MAX_BLOCK_SIZE ? get_thread_cache(data) : null;
+            if (!cache) {
+                s64 request = size <= THREAD_CACHE_MAX_BLOCK_SIZE ? size_class_size(size_class_index(size)) : size;
+                return locked_tlsf(data, mode, request, oldMemory, 0, options);
+            }
+
+            s64 index = size_class_index(size);
+
+            auto *batch = (allocator_batch *) oldMemory;
+            s64 i = 0;
+
+            // First take what the cache has, the rest comes from the shared state under a single lock
+            while (i < batch->Count && cache->Lists[index]) {
+                auto *block = cache->Lists[index];
+                cache->Lists[index] = block->Next;
+                --cache->Counts[index];
+                batch->Blocks[i++] = block;
+            }
+
+            if (i < batch->Count) {
+                allocator_batch rest = {batch->Blocks + i, batch->Count - i};
+                if (!locked_tlsf(data, mode, size_class_size(index), &rest, 0, options)) return null;  // Out of memory
+            }
+            return batch;
+        }
+        case allocator_mode::FREE_BATCH: {
+            auto *cache = oldSize && oldSize <= THREAD_CACHE_MAX_BLOCK_SIZE ? get_thread_cache(data) : null;
+            if (!cache) return locked_tlsf(data, mode, 0, oldMemory, oldSize, options);
+
+            s64 index = size_class_index(oldSize);
+
+            auto *batch = (allocator_batch *) oldMemory;
+            For(range(batch->Count)) {
+                auto *block = (thread_cache_free_block *) batch->Blocks[it];
+                block->Next = cache->Lists[index];
+                cache->Lists[index] = block;
+            }
+            cache->Counts[index] += batch->Count;
+
+            // Same as FREE, but we spill everything over one batch under a single lock
+            s64 keep = size_class_batch(index);
+            if (cache->Counts[index] > 2 * keep) spill(data, cache, index, cache->Counts[index] - keep);
+
+            return null;
+        }
+        default:
+            assert(false);
+    }
+    return null;
+}
+
+LSTD_END_NAMESPACE
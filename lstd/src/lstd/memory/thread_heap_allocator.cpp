@@ -0,0 +1,296 @@
+#include "allocator.h"
+
+import os;
+
+LSTD_BEGIN_NAMESPACE
+
+// How many thread_heap_allocators a single thread can have heaps in
+constexpr s64 MAX_THREAD_HEAPS_PER_THREAD = 4;
+
+struct thread_heap_free_block {
+    thread_heap_free_block *Next;
+};
+
+// Lives at the start of the first segment of the heap, the rest of the segment is its first TLSF pool.
+struct thread_heap {
+    thread_heap *Next;
+    s64 InUse;  // 0 when the owning thread has exited, only touched while holding the allocator's lock
+
+    // Blocks freed by other threads. Any thread pushes (compare and swap), only the owner takes the list (swap with null),
+    // that's why we don't have the ABA problem.
+    thread_heap_free_block *volatile RemoteFrees;
+
+    tlsf_allocator_data Tlsf;  // Only the owner touches this
+};
+
+struct thread_heap_slot {
+    thread_heap_allocator_data *Owner;
+    thread_heap *Heap;
+    s64 Generation;  // _Owner->Generation_ when the slot was claimed, if it changed the heap is gone
+};
+
+// Every reserved range gets a new generation, so slots which point to a released (or reused) allocator data don't match
+file_scope s64 ThreadHeapGenerations = 0;
+
+// Zero-initialized for every thread, a slot is claimed the first time a thread uses a given allocator.
+file_scope thread_local thread_heap_slot ThreadHeaps[MAX_THREAD_HEAPS_PER_THREAD];
+
+file_scope s64 round_up(s64 size, s64 granularity) { return (size + granularity - 1) / granularity * granularity; }
+
+// Reserving and committing are system calls (and we may retry several times), so we don't hold the lock while doing them.
+// The range is published under the lock, if another thread published one first we give ours back.
+file_scope bool reserve(thread_heap_allocator_data *data) {
+    // If the OS doesn't let us reserve that much address space we try smaller ranges (like virtual_arena_allocator)
+    s64 size = round_up(data->Reserved, THREAD_HEAP_SEGMENT_SIZE);
+
+    byte *base = null;
+    while (size >= 2 * THREAD_HEAP_SEGMENT_SIZE) {
+        base = (byte *) os_reserve_memory(size);
+        if (base) break;
+        size = round_up(size / 2, THREAD_HEAP_SEGMENT_SIZE);
+    }
+    if (!base) return false;
+
+    s64 segmentsCount = size / THREAD_HEAP_SEGMENT_SIZE;
+
+    // The owner table takes the first segment(s)
+    s64 tableSize = round_up(segmentsCount * (s64) sizeof(thread_heap *), os_get_page_size());
+    if (!os_commit_memory(base, tableSize)) {
+        os_release_memory(base, size);
+        return false;
+    }
+
+    data->Lock.lock();
+    bool first = !data->Base;
+    if (first) {
+        data->SegmentOwners = (thread_heap **) base;
+        data->SegmentsCount = segmentsCount;
+        data->SegmentsUsed = round_up(tableSize, THREAD_HEAP_SEGMENT_SIZE) / THREAD_HEAP_SEGMENT_SIZE;
+        data->Reserved = size;
+        data->Generation = atomic_inc(&ThreadHeapGenerations);
+        atomic_swap((s64 *) &data->Base, (s64) base);  // Last, threads which see _Base_ without the lock also see the rest
+    }
+    data->Lock.unlock();
+
+    if (!first) os_release_memory(base, size);
+    return true;
+}
+
+// Returns the first segment of a run of _count_ committed segments which now belong to _heap_, null if we ran out
+file_scope byte *claim_segments(thread_heap_allocator_data *data, s64 count, thread_heap *heap) {
+    // Only take the run if it fits, so a request which is too big doesn't use up the segments left for smaller ones
+    s64 first = atomic_load(&data->SegmentsUsed);
+    while (true) {
+        if (first + count > data->SegmentsCount) return null;
+
+        s64 current = atomic_compare_and_swap(&data->SegmentsUsed, first + count, first);
+        if (current == first) break;
+        first = current;
+    }
+
+    byte *result = data->Base + first * THREAD_HEAP_SEGMENT_SIZE;
+    if (!os_commit_memory(result, count * THREAD_HEAP_SEGMENT_SIZE)) {
+        // Give the run back. If another thread claimed segments after ours in the meantime we can't, then the run
+        // stays unused, but it was never committed so we only lose address space.
+        atomic_compare_and_swap(&data->SegmentsUsed, first, first + count);
+        return null;
+    }
+
+    // _heap_ is null when we are creating the heap, it lives at the start of the run
+    if (!heap) heap = (thread_heap *) result;
+    For(range(count)) data->SegmentOwners[first + it] = heap;
+    return result;
+}
+
+file_scope thread_heap *segment_owner(thread_heap_allocator_data *data, void *block) {
+    return data->SegmentOwners[((byte *) block - data->Base) / THREAD_HEAP_SEGMENT_SIZE];
+}
+
+// Everything but adding the heap to the list happens without the lock (claim_segments is lock-free)
+file_scope thread_heap *create_heap(thread_heap_allocator_data *data) {
+    if (!atomic_load(&data->Base) && !reserve(data)) return null;
+
+    auto *heap = (thread_heap *) claim_segments(data, 1, null);
+    if (!heap) return null;
+
+    heap->InUse = 1;
+    heap->RemoteFrees = null;
+    heap->Tlsf.State = tlsf_create_with_pool(heap + 1, THREAD_HEAP_SEGMENT_SIZE - sizeof(thread_heap));
+
+    data->Lock.lock();
+    heap->Next = data->Heaps;
+    data->Heaps = heap;
+    data->Lock.unlock();
+
+    return heap;
+}
+
+file_scope thread_heap *find_thread_heap(thread_heap_allocator_data *data) {
+    For(range(MAX_THREAD_HEAPS_PER_THREAD)) {
+        auto *slot = ThreadHeaps + it;
+        if (slot->Owner != data) continue;
+
+        // The allocator was released since we got the heap (by any thread), free the slot
+        if (slot->Generation != data->Generation) {
+            *slot = {};
+            return null;
+        }
+        return slot->Heap;
+    }
+    return null;
+}
+
+file_scope thread_heap *get_thread_heap(thread_heap_allocator_data *data) {
+    auto *heap = find_thread_heap(data);
+    if (heap) return heap;
+
+    thread_heap_slot *slot = null;
+    For(range(MAX_THREAD_HEAPS_PER_THREAD)) {
+        if (!ThreadHeaps[it].Owner) {
+            slot = ThreadHeaps + it;
+            break;
+        }
+    }
+
+    if (!slot) {
+        assert(false && "Too many thread_heap_allocators used on one thread, see MAX_THREAD_HEAPS_PER_THREAD");
+        return null;
+    }
+
+    // Adopt a heap abandoned by a thread which has exited, otherwise create a new one
+    data->Lock.lock();
+    heap = data->Heaps;
+    while (heap && heap->InUse) heap = heap->Next;
+    if (heap) heap->InUse = 1;
+    data->Lock.unlock();
+
+    if (!heap) heap = create_heap(data);
+
+    if (heap) *slot = {data, heap, data->Generation};
+    return heap;
+}
+
+file_scope void push_remote_free(thread_heap *heap, void *block) {
+    auto *b = (thread_heap_free_block *) block;
+
+    auto *head = (s64 *) &heap->RemoteFrees;
+
+    s64 old = atomic_load(head);
+    while (true) {
+        b->Next = (thread_heap_free_block *) old;
+
+        s64 current = atomic_compare_and_swap(head, (s64) b, old);
+        if (current == old) break;
+        old = current;
+    }
+}
+
+file_scope void drain_remote_frees(thread_heap *heap) {
+    // A plain read first, so we don't do an atomic operation on every allocation. If we miss a push we get it next time.
+    if (!heap->RemoteFrees) return;
+
+    auto *b = (thread_heap_free_block *) atomic_swap((s64 *) &heap->RemoteFrees, 0ll);
+    while (b) {
+        auto *next = b->Next;
+        tlsf_free(heap->Tlsf.State, b);
+        b = next;
+    }
+}
+
+// Adds enough segments to the heap for a block of _size_ bytes
+file_scope bool grow_heap(thread_heap_allocator_data *data, thread_heap *heap, s64 size) {
+    s64 required = size + (s64) (tlsf_pool_overhead() + tlsf_alloc_overhead());
+    s64 count = round_up(required, THREAD_HEAP_SEGMENT_SIZE) / THREAD_HEAP_SEGMENT_SIZE;
+
+    byte *segments = claim_segments(data, count, heap);
+    if (!segments) return false;
+
+    return tlsf_add_pool(heap->Tlsf.State, segments, count * THREAD_HEAP_SEGMENT_SIZE) != null;
+}
+
+void *thread_heap_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options) {
+    auto *data = (thread_heap_allocator_data *) context;
+
+    switch (mode) {
+        case allocator_mode::ADD_POOL:
+        case allocator_mode::REMOVE_POOL:
+            // We don't have pools, heaps get segments on their own
+            return null;
+        case allocator_mode::ALLOCATE: {
+            auto *heap = get_thread_heap(data);
+            if (!heap) return null;
+
+            drain_remote_frees(heap);
+
+            void *result = tlsf_malloc(heap->Tlsf.State, size);
+            if (!result) {
+                if (!grow_heap(data, heap, size)) return null;  // Out of address space
+                result = tlsf_malloc(heap->Tlsf.State, size);
+            }
+            return result;
+        }
+        case allocator_mode::RESIZE: {
+            auto *owner = segment_owner(data, oldMemory);
+            if (owner != find_thread_heap(data)) return null;  // Another thread's heap, move the block to ours
+
+            return tlsf_resize(owner->Tlsf.State, oldMemory, size);
+        }
+        case allocator_mode::FREE: {
+            auto *owner = segment_owner(data, oldMemory);
+            if (owner == find_thread_heap(data)) {
+                tlsf_free(owner->Tlsf.State, oldMemory);
+            } else {
+                push_remote_free(owner, oldMemory);
+            }
+
+            // null means success FREE
+            return null;
+        }
+        case allocator_mode::FREE_ALL:
+            // (void *) -1 means that the allocator doesn't support FREE_ALL (by design)
+            return (void *) -1;
+        case allocator_mode::ALLOCATE_BATCH:
+        case allocator_mode::FREE_BATCH:
+            // (void *) -1 means that the allocator doesn't support batches, we get one request per block instead
+            return (void *) -1;
+        default:
+            assert(false);
+    }
+    return null;
+}
+
+void thread_heap_allocator_abandon() {
+    For(range(MAX_THREAD_HEAPS_PER_THREAD)) {
+        auto *slot = ThreadHeaps + it;
+        if (!slot->Owner) continue;
+
+        // If the allocator was released in the meantime the heap is unmapped, there is nothing to give up
+        if (slot->Generation == slot->Owner->Generation) {
+            slot->Owner->Lock.lock();
+            slot->Heap->InUse = 0;
+            slot->Owner->Lock.unlock();
+        }
+
+        *slot = {};
+    }
+}
+
+void thread_heap_allocator_release(thread_heap_allocator_data *data) {
+    // Forget the calling thread's heap, it's about to be unmapped.
+    // Other threads' slots are dropped the next time they look for a heap, because the generation changes below.
+    For(range(MAX_THREAD_HEAPS_PER_THREAD)) {
+        if (ThreadHeaps[it].Owner == data) ThreadHeaps[it] = {};
+    }
+
+    if (data->Base) os_release_memory(data->Base, data->Reserved);
+    allocator_registry_release(data);
+
+    data->Base = null;
+    data->SegmentOwners = null;
+    data->SegmentsCount = 0;
+    data->SegmentsUsed = 0;
+    data->Heaps = null;
+    data->Generation = 0;
+}
+
+LSTD_END_NAMESPACE
@@ -42,6 +42,21 @@ void *tlsf_allocator(allocator_mode mode, void *context, s64 size, void *oldMemo
             // (void *) -1 means that the allocator doesn't support FREE_ALL (by design)
             return (void *) -1;
         }
+        case allocator_mode::ALLOCATE_BATCH: {
+            auto *batch = (allocator_batch *) oldMemory;
+
+            // One search of the free lists for the whole batch (see tlsf_malloc_batch)
+            s64 allocated = tlsf_malloc_batch(data->State, size, batch->Blocks, batch->Count);
+            if (allocated == batch->Count) return batch;
+
+            for (s64 i = allocated; i < batch->Count; ++i) batch->Blocks[i] = null;
+            return null;  // Not enough space
+        }
+        case allocator_mode::FREE_BATCH: {
+            auto *batch = (allocator_batch *) oldMemory;
+            For(range(batch->Count)) tlsf_free(data->State, batch->Blocks[it]);
+            return null;
+        }
         default:
             assert(false);
     }
@@ -0,0 +1,125 @@
+#include "../internal/context.h"
+#include "allocator.h"
+
+import os;
+
+LSTD_BEGIN_NAMESPACE
+
+file_scope s64 round_up_to_granularity(s64 size) {
+    return (size + VIRTUAL_ARENA_COMMIT_GRANULARITY - 1) / VIRTUAL_ARENA_COMMIT_GRANULARITY * VIRTUAL_ARENA_COMMIT_GRANULARITY;
+}
+
+file_scope bool reserve(virtual_arena_allocator_data *data) {
+    // If the OS doesn't let us reserve that much address space (e.g. limits on virtual memory), we try smaller ranges.
+    s64 size = round_up_to_granularity(data->Reserved);
+    while (size >= VIRTUAL_ARENA_COMMIT_GRANULARITY) {
+        data->Base = (byte *) os_reserve_memory(size);
+        if (data->Base) break;
+        size = round_up_to_granularity(size / 2);
+    }
+
+    if (!data->Base) return false;
+
+    data->Reserved = size;
+    data->Committed = 0;
+    data->TotalUsed = 0;
+    return true;
+}
+
+// Makes sure the first _end_ bytes are committed
+file_scope bool commit_until(virtual_arena_allocator_data *data, s64 end) {
+    if (end <= data->Committed) return true;
+    if (end > data->Reserved) return false;  // Out of address space
+
+    s64 newCommitted = round_up_to_granularity(end);
+    if (newCommitted > data->Reserved) newCommitted = data->Reserved;
+
+    if (!os_commit_memory(data->Base + data->Committed, newCommitted - data->Committed)) return false;
+    data->Committed = newCommitted;
+    return true;
+}
+
+void *virtual_arena_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options) {
+    auto *data = (virtual_arena_allocator_data *) context;
+
+    switch (mode) {
+        case allocator_mode::ADD_POOL:
+        case allocator_mode::REMOVE_POOL:
+            // We don't have pools, the reserved range grows on its own
+            return null;
+        case allocator_mode::ALLOCATE: {
+            if (!data->Base && !reserve(data)) return null;
+
+            s64 end = data->TotalUsed + size;
+            if (end > data->Committed && !commit_until(data, end)) return null;
+
+            void *result = data->Base + data->TotalUsed;
+            data->TotalUsed = end;
+            return result;
+        }
+        case allocator_mode::RESIZE: {
+            // Like the arena allocator, only the most recent allocation can be resized in place.
+            // But here that always succeeds (unless the reservation is used up).
+            if ((byte *) oldMemory + oldSize != data->Base + data->TotalUsed) return null;
+
+            s64 end = data->TotalUsed - oldSize + size;
+            if (end > data->Committed && !commit_until(data, end)) return null;
+
+            data->TotalUsed = end;
+            return oldMemory;
+        }
+        case allocator_mode::FREE: {
+            // We don't free individual allocations in the arena allocator
+
+            // null means success FREE
+            return null;
+        }
+        case allocator_mode::FREE_ALL: {
+            data->TotalUsed = 0;
+
+            s64 keep = round_up_to_granularity(data->KeepCommitted);
+            if (data->Committed > keep) {
+                os_decommit_memory(data->Base + keep, data->Committed - keep);
+                data->Committed = keep;
+            }
+
+            // null means successful FREE_ALL
+            // (void *) -1 means that the allocator doesn't support FREE_ALL (by design)
+            return null;
+        }
+        case allocator_mode::ALLOCATE_BATCH:
+            // (void *) -1 means that the allocator doesn't support batches, we get one request per block instead
+            return (void *) -1;
+        case allocator_mode::FREE_BATCH:
+            // Like FREE, nothing to do
+            return null;
+        default:
+            assert(false);
+    }
+    return null;
+}
+
+void virtual_arena_allocator_rollback(virtual_arena_allocator_data *data, s64 savepoint) {
+    assert(savepoint <= data->TotalUsed && "Rolling back to a savepoint which is no longer valid (out of order or after free_all?)");
+
+#if defined DEBUG_MEMORY
+    if (DEBUG_memory) DEBUG_memory->unlink_headers_in_range(data->Base + savepoint, data->Base + data->TotalUsed);
+#endif
+
+    data->TotalUsed = savepoint;
+}
+
+void virtual_arena_allocator_release(virtual_arena_allocator_data *data) {
+    if (data->Base) os_release_memory(data->Base, data->Reserved);
+    allocator_registry_release(data);
+
+    data->Base = null;
+    data->Committed = 0;
+    data->TotalUsed = 0;
+}
+
+void *default_temp_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options) {
+    return virtual_arena_allocator(mode, context, size, oldMemory, oldSize, options);
+}
+
+LSTD_END_NAMESPACE
@@ -16,6 +16,9 @@ export module os;
 export import os.win64.common;
 export import os.win64.memory;
 export import os.win64.dynamic_library;
+#elif OS == LINUX
+// @TODO: Only the memory functions are implemented on Linux so far
+export import os.posix.memory;
 #else
 #error Implement.
 #endif
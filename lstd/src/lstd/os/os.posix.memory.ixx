@@ -0,0 +1,246 @@
+module;
+
+#include "lstd/memory/string.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+//
+// Platform specific memory functions (Linux).
+//
+// Every block we hand out is its own mapping, so large blocks (pools) don't fragment a shared heap and
+// pages are only backed by memory once they are touched. The first bytes of the mapping hold a small header
+// with the size, so os_get_block_size() and os_resize_block() don't need a side table.
+//
+
+export module os.posix.memory;
+
+LSTD_BEGIN_NAMESPACE
+
+export {
+    // Allocates memory by calling the OS directly.
+    // Blocks at least OS_HUGE_PAGE_SIZE large are marked as eligible for transparent huge pages.
+    [[nodiscard("Leak")]] void *os_allocate_block(s64 size);
+
+    // Expands/shrinks a memory block allocated by os_allocate_block().
+    // This is NOT realloc. When this fails it returns null instead of allocating a new block and copying the contents of the old one.
+    // That's why it's not called realloc.
+    [[nodiscard("Leak")]] void *os_resize_block(void *ptr, s64 newSize);
+
+    // Like os_resize_block() but the block may move (contents included) if it can't grow in place.
+    // The pages are remapped with mremap, so nothing is copied. Returns null on failure (the old block is still valid).
+    // The new block has the same offset from a page boundary as the old one.
+    // Blocks from os_allocate_huge_block() which got explicit huge pages can't be remapped, growing those returns null.
+    [[nodiscard("Leak")]] void *os_remap_block(void *ptr, s64 newSize);
+
+    // Returns the size of a memory block allocated by os_allocate_block() in bytes
+    s64 os_get_block_size(void *ptr);
+
+    // Frees a memory block allocated by os_allocate_block()
+    void os_free_block(void *ptr);
+
+    // Like os_allocate_block() but asks the OS to back the block with huge pages (fewer TLB misses for large pools).
+    // Tries explicit huge pages first (MAP_HUGETLB, needs pages reserved in /proc/sys/vm/nr_hugepages),
+    // then falls back to normal pages marked for transparent huge pages. Either way the mapping starts on an
+    // OS_HUGE_PAGE_SIZE boundary (the returned pointer is just past the block header). Free with os_free_block().
+    [[nodiscard("Leak")]] void *os_allocate_huge_block(s64 size);
+
+    //
+    // Reserve-then-commit. Reserving takes a range of addresses without using any memory,
+    // pages in that range are backed by memory only after they are committed.
+    // Useful for allocators which want a large contiguous range but only pay for what they touch.
+    //
+    // Addresses and sizes passed to these must be multiples of os_get_page_size().
+    //
+
+    s64 os_get_page_size();
+
+    // Returns null on failure. With _hugePages_ the range starts on an OS_HUGE_PAGE_SIZE boundary and is marked for transparent huge pages.
+    [[nodiscard("Leak")]] void *os_reserve_memory(s64 size, bool hugePages = false);
+
+    // Committed pages are zeroed. Returns false if the OS is out of memory.
+    bool os_commit_memory(void *address, s64 size);
+
+    // Gives the memory back to the OS, the range stays reserved and can be committed again.
+    void os_decommit_memory(void *address, s64 size);
+
+    // Releases a range returned by os_reserve_memory(), _size_ must be the size that was reserved.
+    void os_release_memory(void *address, s64 size);
+
+    // The size of a (transparent) huge page on x86-64
+    constexpr s64 OS_HUGE_PAGE_SIZE = 2_MiB;
+}
+
+// Stored at the start of each mapping. 64 bytes so the returned pointer is cache line aligned.
+struct posix_block_header {
+    s64 Size;        // The size requested by the user
+    s64 MappedSize;  // The size of the whole mapping (including this header), a multiple of the page size
+    bool HugeTLB;    // Mapped with MAP_HUGETLB, which can't be resized with mremap
+    byte Reserved[64 - 2 * sizeof(s64) - sizeof(bool)];
+};
+static_assert(sizeof(posix_block_header) == 64);
+
+file_scope s64 round_up(s64 size, s64 granularity) { return (size + granularity - 1) / granularity * granularity; }
+
+file_scope posix_block_header *get_header(void *ptr) { return (posix_block_header *) ptr - 1; }
+
+// mmap only guarantees page alignment, but the kernel backs a range with transparent huge pages only where
+// a whole aligned huge page fits in it. So we map OS_HUGE_PAGE_SIZE more, keep the aligned part and unmap the slack.
+// _size_ must be a multiple of the page size. Returns MAP_FAILED on failure, like mmap.
+file_scope void *map_huge_aligned(s64 size, s32 prot, s32 flags) {
+    s64 mappedSize = size + OS_HUGE_PAGE_SIZE;
+
+    void *mapping = mmap(null, mappedSize, prot, flags, -1, 0);
+    if (mapping == MAP_FAILED) return MAP_FAILED;
+
+    byte *start = (byte *) mapping;
+    byte *aligned = (byte *) (((u64) start + OS_HUGE_PAGE_SIZE - 1) & ~(u64) (OS_HUGE_PAGE_SIZE - 1));
+    byte *end = aligned + size;
+
+    if (aligned != start) munmap(start, aligned - start);
+    if (end != start + mappedSize) munmap(end, start + mappedSize - end);
+
+    madvise(aligned, size, MADV_HUGEPAGE);
+    return aligned;
+}
+
+// With _hugeTLB_ the block is mapped with explicit huge pages, with _hugeAligned_ it starts on a huge page
+// boundary and is marked for transparent huge pages.
+file_scope void *map_block(s64 size, bool hugeTLB, bool hugeAligned = false) {
+    s64 granularity = hugeTLB || hugeAligned ? OS_HUGE_PAGE_SIZE : os_get_page_size();
+    s64 mappedSize = round_up(size + sizeof(posix_block_header), granularity);
+
+    s32 flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    void *mapping;
+    if (hugeTLB) {
+        // The kernel aligns MAP_HUGETLB mappings to the huge page size on its own
+        mapping = mmap(null, mappedSize, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+    } else if (hugeAligned) {
+        mapping = map_huge_aligned(mappedSize, PROT_READ | PROT_WRITE, flags);
+    } else {
+        mapping = mmap(null, mappedSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (mapping != MAP_FAILED && mappedSize >= OS_HUGE_PAGE_SIZE) madvise(mapping, mappedSize, MADV_HUGEPAGE);
+    }
+    if (mapping == MAP_FAILED) return null;
+
+    auto *header = (posix_block_header *) mapping;
+    header->Size = size;
+    header->MappedSize = mappedSize;
+    header->HugeTLB = hugeTLB;
+    return header + 1;
+}
+
+export {
+    void *os_allocate_block(s64 size) {
+        assert(size < MAX_ALLOCATION_REQUEST);
+        return map_block(size, false);
+    }
+
+    void *os_allocate_huge_block(s64 size) {
+        assert(size < MAX_ALLOCATION_REQUEST);
+
+        void *result = map_block(size, true);
+        if (!result) result = map_block(size, false, true);  // No huge pages reserved, fall back to transparent huge pages
+        return result;
+    }
+
+    void *os_resize_block(void *ptr, s64 newSize) {
+        assert(ptr);
+        assert(newSize < MAX_ALLOCATION_REQUEST);
+
+        auto *header = get_header(ptr);
+
+        s64 granularity = header->HugeTLB ? OS_HUGE_PAGE_SIZE : os_get_page_size();
+        s64 mappedSize = round_up(newSize + sizeof(posix_block_header), granularity);
+
+        // Still fits in the pages we have (or in fewer pages, in that case we keep them to avoid remapping back and forth)
+        if (mappedSize <= header->MappedSize) {
+            header->Size = newSize;
+            return ptr;
+        }
+
+        if (header->HugeTLB) return null;
+
+        // Without MREMAP_MAYMOVE the kernel only grows the mapping if the addresses after it are free
+        if (mremap(header, header->MappedSize, mappedSize, 0) == MAP_FAILED) return null;
+
+        header->Size = newSize;
+        header->MappedSize = mappedSize;
+        return ptr;
+    }
+
+    void *os_remap_block(void *ptr, s64 newSize) {
+        assert(ptr);
+        assert(newSize < MAX_ALLOCATION_REQUEST);
+
+        auto *header = get_header(ptr);
+
+        s64 granularity = header->HugeTLB ? OS_HUGE_PAGE_SIZE : os_get_page_size();
+        s64 mappedSize = round_up(newSize + sizeof(posix_block_header), granularity);
+
+        if (mappedSize <= header->MappedSize) {
+            header->Size = newSize;
+            return ptr;
+        }
+
+        // mremap doesn't work on MAP_HUGETLB mappings, the caller moves the block by copying instead
+        if (header->HugeTLB) return null;
+
+        void *mapping = mremap(header, header->MappedSize, mappedSize, MREMAP_MAYMOVE);
+        if (mapping == MAP_FAILED) return null;
+
+        header = (posix_block_header *) mapping;
+        header->Size = newSize;
+        header->MappedSize = mappedSize;
+        return header + 1;
+    }
+
+    s64 os_get_block_size(void *ptr) {
+        return get_header(ptr)->Size;
+    }
+
+    void os_free_block(void *ptr) {
+        if (!ptr) return;
+
+        auto *header = get_header(ptr);
+        munmap(header, header->MappedSize);
+    }
+
+    s64 os_get_page_size() {
+        // The page size can't change while the program is running
+        static s64 pageSize = 0;
+        if (!pageSize) pageSize = sysconf(_SC_PAGESIZE);
+        return pageSize;
+    }
+
+    void *os_reserve_memory(s64 size, bool hugePages) {
+        assert(size % os_get_page_size() == 0);
+
+        // MAP_NORESERVE so large reservations don't count against overcommit limits
+        s32 flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+
+        void *result = hugePages ? map_huge_aligned(size, PROT_NONE, flags) : mmap(null, size, PROT_NONE, flags, -1, 0);
+        if (result == MAP_FAILED) return null;
+        return result;
+    }
+
+    bool os_commit_memory(void *address, s64 size) {
+        assert((u64) address % os_get_page_size() == 0 && size % os_get_page_size() == 0);
+        return mprotect(address, size, PROT_READ | PROT_WRITE) == 0;
+    }
+
+    void os_decommit_memory(void *address, s64 size) {
+        assert((u64) address % os_get_page_size() == 0 && size % os_get_page_size() == 0);
+
+        // Drop the pages first (the next commit gets zeroed pages), then make the range inaccessible again
+        madvise(address, size, MADV_DONTNEED);
+        mprotect(address, size, PROT_NONE);
+    }
+
+    void os_release_memory(void *address, s64 size) {
+        munmap(address, size);
+    }
+}
+
+LSTD_END_NAMESPACE
@@ -1,5 +1,6 @@
 module;
 
+#include "lstd/internal/os_function_call.h"
 #include "lstd/io.h"
 #include "lstd/memory/array.h"
 #include "lstd/memory/delegate.h"
@@ -112,6 +113,16 @@ export {
 
     // Sets the clipboard content (expects a utf8 string).
     void os_set_clipboard_content(const string &content);
+
+    // Writes the return addresses of the calling thread's stack (innermost first) to _frames_, skipping the first _skip_ frames
+    // (not counting this function). Returns the number of frames written.
+    // This doesn't resolve symbols, so it's cheap enough to call at runtime (e.g. the allocation profiler does that).
+    s64 os_capture_call_stack(void **frames, s64 maxFrames, s64 skip = 0);
+
+    // Resolves function names, files and line numbers of addresses returned by os_capture_call_stack().
+    // _result_ must have space for _count_ elements. Strings are allocated with the Context's allocator, the caller is responsible for freeing them.
+    // This is slow (loads debug symbols), don't call it often.
+    void os_resolve_call_stack(os_function_call *result, void **frames, s64 count);
 }
 
 struct win64_common_state {
@@ -134,6 +145,8 @@ struct win64_common_state {
     string WorkingDir;  // Caches the working dir (query/modify this with os_get_working_dir(), os_set_working_dir())
     thread::mutex WorkingDirMutex;
 
+    thread::mutex SymbolsMutex;  // DbgHelp functions are not thread-safe
+
     array<string> Argv;
 };
 
@@ -180,12 +193,12 @@ void init_global_vars() {
     S->CoutMutex.init();
     S->ExitScheduleMutex.init();
     S->WorkingDirMutex.init();
+    S->SymbolsMutex.init();
 #if defined DEBUG_MEMORY
     // @Cleanup
     if (lstd_init_global()) {
         DEBUG_memory = allocate<debug_memory>({.Alloc = PERSISTENT});  // @Leak This is ok
         new (DEBUG_memory) debug_memory;
-        DEBUG_memory->Mutex.init();
     } else {
         DEBUG_memory = null;
     }
@@ -322,11 +335,7 @@ void platform_uninit_state() {
     S->CoutMutex.release();
     S->ExitScheduleMutex.release();
     S->WorkingDirMutex.release();
-#if defined DEBUG_MEMORY
-    if (lstd_init_global()) {
-        DEBUG_memory->Mutex.release();
-    }
-#endif
+    S->SymbolsMutex.release();
 }
 }  // namespace internal
 
@@ -503,6 +512,54 @@ export {
 
     u32 os_get_pid() { return (u32) GetCurrentProcessId(); }
 
+    s64 os_capture_call_stack(void **frames, s64 maxFrames, s64 skip) {
+        // + 1 to skip this function
+        return RtlCaptureStackBackTrace((DWORD) (skip + 1), (DWORD) maxFrames, frames, null);
+    }
+
+    void os_resolve_call_stack(os_function_call *result, void **frames, s64 count) {
+        thread::scoped_lock _(&S->SymbolsMutex);
+
+        HANDLE process = GetCurrentProcess();
+
+        bool symbols = SymInitialize(process, null, true);
+        defer({
+            if (symbols) SymCleanup(process);
+        });
+
+        For(range(count)) {
+            auto *call = result + it;
+            new (call) os_function_call;
+
+            auto address = (DWORD64) frames[it];
+
+            if (symbols) {
+                constexpr auto s = (sizeof(SYMBOL_INFO) + MAX_SYM_NAME * sizeof(TCHAR) + sizeof(ULONG64) - 1) / sizeof(ULONG64);
+                ULONG64 symbolBuffer[s];
+
+                PSYMBOL_INFO symbol = (PSYMBOL_INFO) symbolBuffer;
+                symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+                symbol->MaxNameLen = MAX_SYM_NAME;
+
+                DWORD64 symDisplacement = 0;
+                if (SymFromAddr(process, address, &symDisplacement, symbol)) {
+                    clone(&call->Name, string(symbol->Name));  // _symbol_ is on the stack
+                }
+
+                IMAGEHLP_LINEW64 lineInfo = {sizeof(IMAGEHLP_LINEW64)};
+
+                DWORD lineDisplacement = 0;
+                if (SymGetLineFromAddrW64(process, address, &lineDisplacement, &lineInfo)) {
+                    call->File = utf16_to_utf8(lineInfo.FileName);
+                    call->LineNumber = lineInfo.LineNumber;
+                }
+            }
+
+            if (!call->Name.Length) call->Name = sprint("{:#x}", address);
+            if (!call->File.Length) call->File = "UnknownFile";
+        }
+    }
+
     bytes os_read_from_console() {
         DWORD read;
         ReadFile(S->CinHandle, S->CinBuffer, (DWORD) S->CONSOLE_BUFFER_SIZE, &read, null);
@@ -22,12 +22,45 @@ export {
     // That's why it's not called realloc.
     [[nodiscard("Leak")]] void *os_resize_block(void *ptr, s64 newSize);
 
+    // Like os_resize_block() but the block may move (contents included) if it can't grow in place.
+    // On Linux the pages are remapped without copying. Returns null on failure (the old block is still valid).
+    // The new block has the same offset from a page boundary as the old one.
+    [[nodiscard("Leak")]] void *os_remap_block(void *ptr, s64 newSize);
+
     // Returns the size of a memory block allocated by os_allocate_block() in bytes
     s64 os_get_block_size(void *ptr);
 
     // Frees a memory block allocated by os_allocate_block()
     void os_free_block(void *ptr);
 
+    // Like os_allocate_block() but asks the OS to back the block with huge pages (fewer TLB misses for large pools).
+    // Large pages on Windows need the SeLockMemoryPrivilege ("Lock pages in memory" in the local security policy),
+    // we try to enable it the first time this is called. Falls back to normal pages if huge pages aren't available.
+    // Free with os_free_block().
+    [[nodiscard("Leak")]] void *os_allocate_huge_block(s64 size);
+
+    //
+    // Reserve-then-commit. Reserving takes a range of addresses without using any memory,
+    // pages in that range are backed by memory only after they are committed.
+    // Useful for allocators which want a large contiguous range but only pay for what they touch.
+    //
+    // Addresses and sizes passed to these must be multiples of os_get_page_size().
+    //
+
+    s64 os_get_page_size();
+
+    // Returns null on failure. _hugePages_ is a hint, see os_allocate_huge_block().
+    [[nodiscard("Leak")]] void *os_reserve_memory(s64 size, bool hugePages = false);
+
+    // Committed pages are zeroed. Returns false if the OS is out of memory.
+    bool os_commit_memory(void *address, s64 size);
+
+    // Gives the memory back to the OS, the range stays reserved and can be committed again.
+    void os_decommit_memory(void *address, s64 size);
+
+    // Releases a range returned by os_reserve_memory(), _size_ must be the size that was reserved.
+    void os_release_memory(void *address, s64 size);
+
     // Creates/opens a shared memory block and writes data to it (use this for communication between processes)
     void os_write_shared_block(const string &name, void *data, s64 size);
 
@@ -85,8 +118,8 @@ export {
 }
 
 struct win64_memory_state {
-    allocator PersistentAlloc;  // Used to store global state, a tlsf allocator
-    thread::mutex PersistentAllocMutex;
+    allocator PersistentAlloc;  // Used to store global state, a tlsf allocator with per-thread caches in front (see thread_cache_allocator)
+    thread::mutex PersistentAllocMutex;  // The thread caches do their own locking, this is held only while adding a new pool
 
     // We don't use the temporary allocator bundled with the Context because we don't want to mess with the user's memory.
     allocator TempAlloc;  // Used for temporary storage (e.g. converting strings from utf8 to utf16 for windows calls).
@@ -105,6 +138,7 @@ byte State[sizeof(win64_memory_state)];
 
 void create_temp_storage_block(s64);
 void create_persistent_alloc_block(s64);
+void add_persistent_alloc_pool(s64);
 
 export namespace internal {
 // @TODO: Add option to print call stack?
@@ -158,35 +192,58 @@ void create_temp_storage_block(s64 size) {
     S->TempStorageSize = size;
 }
 
+// An extension to the thread-caching TLSF allocator. Adds a pool when out of memory.
+// Small allocations are served from the calling thread's cache without taking any lock.
 void *win64_persistent_alloc(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options) {
-    auto *data = (tlsf_allocator_data *) context;
+    auto *result = thread_cache_allocator(mode, context, size, oldMemory, oldSize, options);
+    if (mode == allocator_mode::ALLOCATE_BATCH && !result) {
+        // Fill the blocks we didn't get one by one, that adds pools as needed (below)
+        auto *batch = (allocator_batch *) oldMemory;
+        For(range(batch->Count)) {
+            if (!batch->Blocks[it]) batch->Blocks[it] = win64_persistent_alloc(allocator_mode::ALLOCATE, context, size, null, 0, options);
+        }
+        return batch;
+    }
 
-    thread::scoped_lock _(&S->PersistentAllocMutex);
+    if (mode == allocator_mode::ALLOCATE && !result) {
+        thread::scoped_lock _(&S->PersistentAllocMutex);
 
-    auto *result = tlsf_allocator(mode, context, size, oldMemory, oldSize, options);
-    if (mode == allocator_mode::ALLOCATE) {
+        // Another thread might have added a pool while we were waiting on the lock
+        result = thread_cache_allocator(allocator_mode::ALLOCATE, context, size, null, 0, options);
         if (!result) {
             internal::platform_report_warning("Not enough memory in the persistent allocator; adding a pool");
 
-            create_persistent_alloc_block(size * 3);
+            add_persistent_alloc_pool(size * 3);
+            result = thread_cache_allocator(allocator_mode::ALLOCATE, context, size, null, 0, options);
         }
-        result = tlsf_allocator(allocator_mode::ALLOCATE, context, size, null, 0, options);
     }
     return result;
 }
 
 void create_persistent_alloc_block(s64 size) {
-    // We allocate the arena allocator data and the starting pool in one big block in order to reduce fragmentation.
-    auto [data, pool] = os_allocate_packed<tlsf_allocator_data>(size);
+    // We allocate the allocator data and the starting pool in one big block in order to reduce fragmentation.
+    auto [data, pool] = os_allocate_packed<thread_cache_allocator_data>(size);
     S->PersistentAlloc = {win64_persistent_alloc, data};
     allocator_add_pool(S->PersistentAlloc, pool, size);
 }
 
+void add_persistent_alloc_pool(s64 size) {
+    // Pools are added to the same shared TLSF state, so blocks cached by other threads stay valid.
+    if (size < PLATFORM_PERSISTENT_STORAGE_STARTING_SIZE) size = PLATFORM_PERSISTENT_STORAGE_STARTING_SIZE;
+    allocator_add_pool(S->PersistentAlloc, os_allocate_block(size), size);
+}
+
 export namespace internal {
 // These functions are used by other windows platform files.
 allocator platform_get_persistent_allocator() { return S->PersistentAlloc; }
 allocator platform_get_temporary_allocator() { return S->TempAlloc; }
 
+// Returns the blocks the calling thread has cached for the persistent allocator.
+// Our thread wrapper calls this before the thread exits (see windows_thread.cpp).
+void platform_flush_thread_caches() {
+    thread_cache_allocator_flush((thread_cache_allocator_data *) S->PersistentAlloc.Context);
+}
+
 void platform_init_allocators() {
     S->TempAllocMutex.init();
     S->PersistentAllocMutex.init();
@@ -261,6 +318,74 @@ void *try_heap_realloc(void *ptr, s64 newSize, bool *reportError) {
     return result;
 }
 
+// Stored at the start of blocks from os_allocate_huge_block() which got large pages.
+// 64 bytes so the returned pointer is cache line aligned.
+struct win64_large_page_header {
+    u64 Magic;
+    s64 Size;        // The size requested by the user
+    s64 MappedSize;  // The size of the whole range (including this header), a multiple of the large page size
+    byte Reserved[64 - sizeof(u64) - 2 * sizeof(s64)];
+};
+static_assert(sizeof(win64_large_page_header) == 64);
+
+constexpr u64 LARGE_PAGE_BLOCK_MAGIC = 0x4C41524745504147ull;  // "LARGEPAG"
+
+// Large pages can only be allocated by a process which holds SeLockMemoryPrivilege. Users don't have it by default,
+// but if an administrator granted it, it still needs to be enabled in the process token.
+bool enable_lock_memory_privilege() {
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+    defer(CloseHandle(token));
+
+    TOKEN_PRIVILEGES privileges;
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    if (!LookupPrivilegeValueW(null, L"SeLockMemoryPrivilege", &privileges.Privileges[0].Luid)) return false;
+
+    // This succeeds even if the privilege wasn't granted, in that case GetLastError() returns ERROR_NOT_ALL_ASSIGNED
+    if (!AdjustTokenPrivileges(token, false, &privileges, 0, null, null)) return false;
+    return GetLastError() == ERROR_SUCCESS;
+}
+
+// -1 until the first os_allocate_huge_block() call, then 0 if we can't use large pages
+// (the processor doesn't support them or we don't have the privilege), otherwise the large page size.
+s64 LargePageSize = -1;
+
+// The number of blocks with large pages which haven't been freed yet.
+// While it's 0 (the common case) freeing or resizing a heap block doesn't look for a large page header at all.
+s32 LargePageBlockCount = 0;
+
+// Only called when allocating a huge block, so programs which never ask for one don't touch their process token.
+s64 get_large_page_size() {
+    s64 result = atomic_load(&LargePageSize);
+    if (result == -1) {
+        // Racing threads compute the same value (enabling the privilege twice is harmless)
+        s64 minimum = GetLargePageMinimum();
+        result = minimum && enable_lock_memory_privilege() ? minimum : 0;
+        atomic_swap(&LargePageSize, result);
+    }
+    return result;
+}
+
+// Returns null if _ptr_ wasn't returned by os_allocate_huge_block() with large pages (i.e. it's from the heap)
+win64_large_page_header *get_large_page_header(void *ptr) {
+    if (!atomic_load(&LargePageBlockCount)) return null;
+
+    // Set before the first large page block was counted
+    s64 largePageSize = atomic_load(&LargePageSize);
+
+    // Large page blocks start on a large page boundary. Check the offset first since VirtualQuery is a system call.
+    if (((u64) ptr & (largePageSize - 1)) != sizeof(win64_large_page_header)) return null;
+
+    auto *header = (win64_large_page_header *) ptr - 1;
+
+    MEMORY_BASIC_INFORMATION info;
+    if (!VirtualQuery(header, &info, sizeof(info))) return null;
+    if (info.AllocationBase != header || info.Type != MEM_PRIVATE) return null;
+
+    return header->Magic == LARGE_PAGE_BLOCK_MAGIC ? header : null;
+}
+
 export {
     void *os_allocate_block(s64 size) {
         assert(size < MAX_ALLOCATION_REQUEST);
@@ -271,6 +396,13 @@ export {
         assert(ptr);
         assert(newSize < MAX_ALLOCATION_REQUEST);
 
+        // Large pages can't be remapped, so we can only resize within the pages we already have
+        if (auto *header = get_large_page_header(ptr)) {
+            if (newSize + (s64) sizeof(win64_large_page_header) > header->MappedSize) return null;
+            header->Size = newSize;
+            return ptr;
+        }
+
         s64 oldSize = os_get_block_size(ptr);
         if (newSize == 0) newSize = 1;
 
@@ -288,7 +420,15 @@ export {
         return null;
     }
 
+    // @TODO: Windows doesn't have mremap. HeapReAlloc would copy (like the caller does when this fails) and
+    // doesn't keep the offset from a page boundary, so we only resize in place.
+    void *os_remap_block(void *ptr, s64 newSize) {
+        return os_resize_block(ptr, newSize);
+    }
+
     s64 os_get_block_size(void *ptr) {
+        if (auto *header = get_large_page_header(ptr)) return header->Size;
+
         s64 result = HeapSize(GetProcessHeap(), 0, ptr);
         if (result == -1) {
             windows_report_hresult_error(HRESULT_FROM_WIN32(GetLastError()), "HeapSize");
@@ -342,8 +482,68 @@ export {
     }
 
     void os_free_block(void *ptr) {
+        if (auto *header = get_large_page_header(ptr)) {
+            WIN_CHECKBOOL(VirtualFree(header, 0, MEM_RELEASE));
+            atomic_add(&LargePageBlockCount, -1);
+            return;
+        }
         WIN_CHECKBOOL(HeapFree(GetProcessHeap(), 0, ptr));
     }
+
+    void *os_allocate_huge_block(s64 size) {
+        assert(size < MAX_ALLOCATION_REQUEST);
+
+        s64 largePageSize = get_large_page_size();
+        if (largePageSize) {
+            // Large pages must be reserved and committed at once, the size must be a multiple of the large page size
+            s64 mappedSize = (size + sizeof(win64_large_page_header) + largePageSize - 1) / largePageSize * largePageSize;
+
+            void *mapping = VirtualAlloc(null, mappedSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (mapping) {
+                auto *header = (win64_large_page_header *) mapping;
+                header->Magic = LARGE_PAGE_BLOCK_MAGIC;
+                header->Size = size;
+                header->MappedSize = mappedSize;
+
+                atomic_inc(&LargePageBlockCount);
+                return header + 1;
+            }
+            // Not enough contiguous physical memory, fall back to normal pages
+        }
+        return os_allocate_block(size);
+    }
+
+    s64 os_get_page_size() {
+        // The page size can't change while the program is running
+        static s64 pageSize = 0;
+        if (!pageSize) {
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            pageSize = info.dwPageSize;
+        }
+        return pageSize;
+    }
+
+    // Large pages can't be committed separately from reserving on Windows, so _hugePages_ is ignored.
+    void *os_reserve_memory(s64 size, bool hugePages) {
+        assert(size % os_get_page_size() == 0);
+
+        return VirtualAlloc(null, size, MEM_RESERVE, PAGE_NOACCESS);
+    }
+
+    bool os_commit_memory(void *address, s64 size) {
+        assert((u64) address % os_get_page_size() == 0 && size % os_get_page_size() == 0);
+        return VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE) != null;
+    }
+
+    void os_decommit_memory(void *address, s64 size) {
+        assert((u64) address % os_get_page_size() == 0 && size % os_get_page_size() == 0);
+        WIN_CHECKBOOL(VirtualFree(address, size, MEM_DECOMMIT));
+    }
+
+    void os_release_memory(void *address, s64 size) {
+        WIN_CHECKBOOL(VirtualFree(address, 0, MEM_RELEASE));  // MEM_RELEASE requires a size of 0 and releases the whole reservation
+    }
 }
 
 LSTD_END_NAMESPACE
@@ -105,6 +105,15 @@
 #endif
 #endif
 
+// GCC and Clang tell us directly (the glibc check above only works if a libc header was included before us)
+#if !defined ENDIAN && defined __BYTE_ORDER__
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ENDIAN LITTLE_ENDIAN
+#elif __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define ENDIAN BIG_ENDIAN
+#endif
+#endif
+
 // Windows is always little-endian.
 #if !defined ENDIAN
 #if OS == WINDOWS
@@ -149,6 +158,9 @@
 #define no_alias __declspec(noalias)
 #define restrict __declspec(restrict)
 #else
-#define always_inline inline
-#error Defines
+#define always_inline inline __attribute__((always_inline))
+#define never_inline __attribute__((noinline))
+#define no_vtable
+#define no_alias
+#define restrict __restrict
 #endif
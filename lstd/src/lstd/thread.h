@@ -147,12 +147,10 @@ inline scoped_lock<T> *clone(scoped_lock<T> *dest, const scoped_lock<T> &src) {
 //       }
 struct condition_variable : non_assignable {
    private:
-#if OS == WINDOWS
-    // Implement platform specific Windows code for wait() in these functions,
+    // Implement platform specific code for wait() in these functions,
     // because wait() is templated
     void pre_wait();
     void do_wait();
-#endif
    public:
     char Handle[64] = {0};  // pthread_cond_t
 
@@ -281,6 +279,40 @@ inline fast_mutex *clone(fast_mutex *dest, const fast_mutex &src) {
     return null;
 }
 
+// A reader-writer version of fast_mutex (also a spin lock).
+// Any number of threads can hold it shared (for reading), or a single thread can hold it exclusively (for writing).
+//
+// A writer sets the WRITER bit before waiting for the readers to leave, so new readers back off and
+// a steady stream of them can't keep the writer out forever.
+struct fast_shared_mutex : non_assignable {
+    static constexpr s32 WRITER = 1 << 30;
+
+    s32 State = 0;  // The number of readers inside, plus WRITER if a writer holds the lock or is waiting for it
+
+    // Defined in *platform*_thread.cpp, see fast_mutex::lock()
+    void lock();
+    void lock_shared();
+
+    // Returns true if the lock was acquired
+    bool try_lock() { return atomic_compare_and_swap(&State, WRITER, 0) == 0; }
+
+    // Returns true if the lock was acquired
+    bool try_lock_shared() {
+        if (!(atomic_add(&State, 1) & WRITER)) return true;
+        atomic_add(&State, -1);
+        return false;
+    }
+
+    void unlock() { atomic_add(&State, -WRITER); }
+    void unlock_shared() { atomic_add(&State, -1); }
+};
+
+// @Pedantic We want to make sure the user doesn't clone things that don't make sense.
+inline fast_shared_mutex *clone(fast_shared_mutex *dest, const fast_shared_mutex &src) {
+    assert(false && "We don't deep copy mutexes");
+    return null;
+}
+
 // Blocks the calling thread for at least a given period of time in ms.
 // sleep(0) supposedly tells the os to yield execution to another thread.
 void sleep(u32 ms);
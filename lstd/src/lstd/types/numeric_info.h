@@ -268,11 +268,13 @@ struct numeric_info<u32> : public numeric_info_int_base {
     static constexpr s32 digits10   = 9;
 };
 
+// long is 32 bits on Windows but 64 bits on Linux and MacOS (LP64)
 template <>
 struct numeric_info<long> : public numeric_info_int_base {
-    static_assert(sizeof(s32) == sizeof(long));
-    static constexpr long min() { return S32_MIN; }
-    static constexpr long max() { return S32_MAX; }
+    static constexpr bool IS_32 = sizeof(long) == sizeof(s32);
+
+    static constexpr long min() { return IS_32 ? S32_MIN : S64_MIN; }
+    static constexpr long max() { return IS_32 ? S32_MAX : S64_MAX; }
     static constexpr long lowest() { return min(); }
     static constexpr long epsilon() { return 0; }
     static constexpr long round_error() { return 0; }
@@ -282,15 +284,16 @@ struct numeric_info<long> : public numeric_info_int_base {
     static constexpr long signaling_NaN() { return 0; }
 
     static constexpr bool is_signed = true;
-    static constexpr s32 digits     = 31;
-    static constexpr s32 digits10   = 9;
+    static constexpr s32 digits     = IS_32 ? 31 : 63;
+    static constexpr s32 digits10   = IS_32 ? 9 : 18;
 };
 
 template <>
 struct numeric_info<unsigned long> : public numeric_info_int_base {
-    static_assert(sizeof(u32) == sizeof(unsigned long));
+    static constexpr bool IS_32 = sizeof(unsigned long) == sizeof(u32);
+
     static constexpr unsigned long min() { return 0; }
-    static constexpr unsigned long max() { return U32_MAX; }
+    static constexpr unsigned long max() { return IS_32 ? U32_MAX : U64_MAX; }
     static constexpr unsigned long lowest() { return min(); }
     static constexpr unsigned long epsilon() { return 0; }
     static constexpr unsigned long round_error() { return 0; }
@@ -300,8 +303,8 @@ struct numeric_info<unsigned long> : public numeric_info_int_base {
     static constexpr unsigned long signaling_NaN() { return 0; }
 
     static constexpr bool is_modulo = true;
-    static constexpr s32 digits     = 32;
-    static constexpr s32 digits10   = 9;
+    static constexpr s32 digits     = IS_32 ? 32 : 64;
+    static constexpr s32 digits10   = IS_32 ? 9 : 19;
 };
 
 template <>
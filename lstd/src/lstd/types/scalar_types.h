@@ -4,12 +4,8 @@
 #include "../platform.h"
 
 LSTD_BEGIN_NAMESPACE
-// Replacement for the std::is_constant_evaluated
-#if COMPILER == MSVC
+// Replacement for the std::is_constant_evaluated (MSVC, GCC and Clang all have the builtin)
 [[nodiscard]] constexpr bool is_constant_evaluated() noexcept { return __builtin_is_constant_evaluated(); }
-#else
-#error Implement.
-#endif
 LSTD_END_NAMESPACE
 
 //
@@ -44,6 +40,9 @@ using utf32 = char32_t;
 
 using byte = unsigned char;
 
+// The type of sizeof. MSVC has it built in, GCC and Clang only define it in the C headers (as unsigned long, not u64).
+using size_t = decltype(sizeof(0));
+
 #define S64_C(c) c##L
 #define U64_C(c) c##UL
 
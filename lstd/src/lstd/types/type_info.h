@@ -64,6 +64,11 @@ struct integral_constant {
 using true_t = integral_constant<bool, true>;    // == to std::true_type
 using false_t = integral_constant<bool, false>;  // == to std::false_type
 
+// Use in static_assert in a template branch which must not be instantiated.
+// static_assert(false) is checked when the template is parsed (by GCC and Clang), this waits until it's instantiated.
+template <typename...>
+constexpr bool always_false = false;
+
 // Used to denote a special template argument that means it's an unused argument
 struct unused {};
 
@@ -119,11 +124,6 @@ struct same_helper<T, T> : true_t {};
 template <typename T, typename U>
 concept is_same = same_helper<T, U>::value;
 
-// Are the decayed versions of "T" and "U" the same basic type?
-// Gets around the fact that is_same will treat, say "bool" and "bool&" as different types.
-template <typename T, typename U>
-concept is_same_decayed = same_helper<decay_t<T>, decay_t<U>>::value;
-
 // Checks if T has const-qualification
 template <typename T>
 struct is_const_helper_1 : false_t {};
@@ -194,12 +194,6 @@ struct is_void_helper : false_t {};
 template <>
 struct is_void_helper<void> : true_t {};
 
-template <typename T>
-concept is_void = is_void_helper<remove_cv_t<T>>::value;
-
-template <typename T>
-concept is_null = is_same<remove_cv_t<T>, decltype(null)>;
-
 // The remove_const transformation trait removes top-level const
 // qualification (if any) from the type to which it is applied.
 // For a given type T, remove_const<T const>::type is equivalent to the type T.
@@ -271,6 +265,12 @@ struct remove_cv {
 template <typename T>
 using remove_cv_t = typename remove_cv<T>::type;
 
+template <typename T>
+concept is_void = is_void_helper<remove_cv_t<T>>::value;
+
+template <typename T>
+concept is_null = is_same<remove_cv_t<T>, decltype(null)>;
+
 // The remove_reference transformation trait removes top-level of
 // indirection by reference (if any) from the type to which it is applied.
 // For a given type T, remove_reference<T&>::type is equivalent to T.
@@ -516,7 +516,7 @@ concept is_enum = __is_enum(remove_cv_t<T>);
 // An object considered to be any type that is not a function a reference or void
 //
 template <typename T>
-concept is_object = !is_reference_v<T> && !is_void_v<T> && !is_function_v<T>;
+concept is_object = !is_reference<T> && !is_void<T> && !is_function<T>;
 
 //
 // True if T is a pointer to a member function AND NOT a member object
@@ -565,8 +565,17 @@ concept is_pointer = is_pointer_helper<remove_cv_t<T>>::value;
 template <typename T>
 concept is_scalar = is_arithmetic<T> || is_enum<T> || is_pointer<T> || is_member_pointer<T> || is_null<T>;
 
+#if COMPILER == GCC
+// GCC doesn't have the builtin (before 13), so we check if a function returning _From_ can be passed as a _To_ argument
+template <typename To>
+void is_convertible_helper(To) noexcept;
+
+template <typename From, typename To>
+concept is_convertible = (is_void<From> && is_void<To>) || requires(From (&f)()) { is_convertible_helper<To>(f()); };
+#else
 template <typename From, typename To>
 concept is_convertible = __is_convertible_to(From, To);
+#endif
 
 template <typename T, typename... Args>
 concept is_constructible = __is_constructible(T, Args...);
@@ -595,7 +604,7 @@ template <typename T, s64 N>
 struct rank_helper<T[N]> : integral_constant<s64, rank_helper<T>::value + 1> {};
 
 template <typename T>
-constexpr s64 rank = rank<T>::value;
+constexpr s64 rank = rank_helper<T>::value;
 
 // An integral type representing the number of elements in the Ith dimension of array type T.
 //
@@ -834,6 +843,11 @@ struct decay {
 template <typename T>
 using decay_t = typename decay<T>::type;
 
+// Are the decayed versions of "T" and "U" the same basic type?
+// Gets around the fact that is_same will treat, say "bool" and "bool&" as different types.
+template <typename T, typename U>
+concept is_same_decayed = same_helper<decay_t<T>, decay_t<U>>::value;
+
 // Determines the common type among all types T..., that is the type all T... can be implicitly converted to.
 //
 // It is intended that this be specialized by the user for cases where it
@@ -978,7 +992,7 @@ requires(types::is_scalar<T> &&types::is_scalar<U>) constexpr T cast_numeric_saf
     } else if constexpr (types::is_integral<T> && types::is_integral<U>) {
         static_assert(sizeof(T) > sizeof(U) || (sizeof(T) == sizeof(U) && are_same_signage<T, U>), "Both T and U are integers. T must be larger than U, or if they have the same size, they must have the same signage. Otherwise information may be lost when casting.");
     } else {
-        static_assert(false, "T was an integer, but U was a floating point. Information may be lost when casting.");
+        static_assert(types::always_false<T, U>, "T was an integer, but U was a floating point. Information may be lost when casting.");
     }
     return (T) y;
 }
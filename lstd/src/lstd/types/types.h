@@ -20,6 +20,7 @@
 // You probably need to define it globally, because not all headers from this library see the macro.
 
 namespace std {
+#if COMPILER == MSVC
 template <typename T>
 struct initializer_list {
     const T *First = null;
@@ -41,6 +42,33 @@ struct initializer_list {
 
     constexpr size_t size() const noexcept { return static_cast<size_t>(Last - First); }
 };
+#else
+// GCC (and Clang) build initializer lists by calling a private (pointer, length) constructor
+// and check that the members match libstdc++'s, so the names here are not ours.
+template <typename T>
+class initializer_list {
+    const T *_M_array;
+    size_t _M_len;
+
+    constexpr initializer_list(const T *a, size_t l) noexcept : _M_array(a), _M_len(l) {}
+
+   public:
+    using value_type = T;
+    using reference = const T &;
+    using const_reference = const T &;
+    using size_type = size_t;
+
+    constexpr initializer_list() noexcept : _M_array(nullptr), _M_len(0) {}
+
+    using iterator = const T *;
+    using const_iterator = const T *;
+
+    constexpr const T *begin() const noexcept { return _M_array; }
+    constexpr const T *end() const noexcept { return _M_array + _M_len; }
+
+    constexpr size_t size() const noexcept { return _M_len; }
+};
+#endif
 }  // namespace std
 
 #define va_start __crt_va_start
@@ -1086,6 +1086,19 @@ HDEVNOTIFY RegisterDeviceNotificationW(
 
 HANDLE GetProcessHeap();
 
+LPVOID VirtualAlloc(
+    LPVOID lpAddress,
+    SIZE_T dwSize,
+    DWORD flAllocationType,
+    DWORD flProtect);
+
+BOOL VirtualFree(
+    LPVOID lpAddress,
+    SIZE_T dwSize,
+    DWORD dwFreeType);
+
+SIZE_T GetLargePageMinimum();
+
 LPVOID HeapAlloc(
     HANDLE hHeap,
     DWORD dwFlags,
@@ -1230,8 +1243,75 @@ DWORD GetCurrentProcessId();
 #define FILE_MAP_WRITE 0x0002
 #define FILE_MAP_READ 0x0004
 
+#define PAGE_NOACCESS 0x01
 #define PAGE_READWRITE 0x04
 
+#define MEM_COMMIT 0x00001000
+#define MEM_RESERVE 0x00002000
+#define MEM_DECOMMIT 0x00004000
+#define MEM_RELEASE 0x00008000
+#define MEM_LARGE_PAGES 0x20000000
+#define MEM_PRIVATE 0x00020000
+
+typedef struct _MEMORY_BASIC_INFORMATION {
+    PVOID BaseAddress;
+    PVOID AllocationBase;
+    DWORD AllocationProtect;
+    WORD PartitionId;
+    SIZE_T RegionSize;
+    DWORD State;
+    DWORD Protect;
+    DWORD Type;
+} MEMORY_BASIC_INFORMATION, *PMEMORY_BASIC_INFORMATION;
+
+typedef struct _LUID {
+    DWORD LowPart;
+    LONG HighPart;
+} LUID, *PLUID;
+
+typedef struct _LUID_AND_ATTRIBUTES {
+    LUID Luid;
+    DWORD Attributes;
+} LUID_AND_ATTRIBUTES, *PLUID_AND_ATTRIBUTES;
+
+typedef struct _TOKEN_PRIVILEGES {
+    DWORD PrivilegeCount;
+    LUID_AND_ATTRIBUTES Privileges[1];
+} TOKEN_PRIVILEGES, *PTOKEN_PRIVILEGES;
+
+extern "C" {
+SIZE_T VirtualQuery(
+    LPCVOID lpAddress,
+    PMEMORY_BASIC_INFORMATION lpBuffer,
+    SIZE_T dwLength);
+
+// These are in advapi32.lib
+BOOL OpenProcessToken(
+    HANDLE ProcessHandle,
+    DWORD DesiredAccess,
+    HANDLE *TokenHandle);
+
+BOOL LookupPrivilegeValueW(
+    LPCWSTR lpSystemName,
+    LPCWSTR lpName,
+    PLUID lpLuid);
+
+BOOL AdjustTokenPrivileges(
+    HANDLE TokenHandle,
+    BOOL DisableAllPrivileges,
+    PTOKEN_PRIVILEGES NewState,
+    DWORD BufferLength,
+    PTOKEN_PRIVILEGES PreviousState,
+    PDWORD ReturnLength);
+}
+
+#define TOKEN_QUERY 0x0008
+#define TOKEN_ADJUST_PRIVILEGES 0x0020
+#define SE_PRIVILEGE_ENABLED 0x00000002
+
+#define ERROR_SUCCESS 0
+#define ERROR_NOT_ALL_ASSIGNED 1300
+
 #define CF_UNICODETEXT 13
 
 #define GHND 0x0042
@@ -1550,6 +1630,12 @@ BOOL IMAGEAPI SymGetLineFromAddrW64(
     PDWORD pdwDisplacement,
     PIMAGEHLP_LINEW64 Line);
 
+WORD NTAPI RtlCaptureStackBackTrace(
+    DWORD FramesToSkip,
+    DWORD FramesToCapture,
+    PVOID *BackTrace,
+    PDWORD BackTraceHash);
+
 LPTOP_LEVEL_EXCEPTION_FILTER SetUnhandledExceptionFilter(
     LPTOP_LEVEL_EXCEPTION_FILTER lpTopLevelExceptionFilter);
 }
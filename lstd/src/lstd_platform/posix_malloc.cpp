@@ -0,0 +1,270 @@
+#include "lstd/internal/common.h"
+
+#if OS == LINUX && !defined LSTD_DONT_REPLACE_MALLOC
+
+#include "lstd/memory/allocator.h"
+
+#include <errno.h>
+#include <pthread.h>
+
+import os;
+
+//
+// Replaces the C library's malloc family on Linux.
+//
+// We only override operator new/delete, so libraries which call malloc directly would otherwise use glibc's heap
+// (outside our pools, with its own fragmentation). Defining malloc, free, etc. in the executable makes the dynamic
+// linker resolve every call in the process to these - including the ones from libc itself and from shared libraries.
+//
+// Small and medium blocks go to a thread-caching TLSF allocator (see thread_cache_allocator), which gets more pools
+// when it runs out. Large blocks get their own mapping (like glibc's mmap threshold), so they go back to the OS when
+// freed and realloc can grow them with mremap instead of copying.
+//
+// malloc can be called before anything in lstd is initialized (by the dynamic linker, by static constructors of other
+// libraries, by libc before main). So this doesn't touch the Context at all, the state below is constant-initialized
+// and the first pool is mapped on the first call.
+//
+// Threads cache freed blocks (see thread_cache_allocator). The first time a thread uses the pools we register a
+// pthread key destructor for it, which gives its cached blocks back to the shared pool when it exits. Key destructors
+// run for every thread, including ones which weren't created by lstd, so nothing is left behind in dead threads.
+//
+// lstd is a static library, so this object only gets linked if something references it. Executables are linked
+// with -Wl,--undefined=malloc (see premake5.lua), which makes the linker take malloc from us (lstd comes before libc
+// on the link line) and so pulls in the whole family below. Shared libraries don't get the flag, they use whatever
+// malloc the executable which loads them provides.
+//
+// fork() only copies the calling thread, so a lock another thread held at that moment would stay locked in the child
+// forever. We register pthread_atfork handlers (together with the thread exit key) which take both locks before the
+// fork and release them on both sides. Blocks cached by the other threads are lost in the child, like their stacks.
+//
+// Define LSTD_DONT_REPLACE_MALLOC to keep the C library's malloc (and drop the linker flag).
+//
+
+LSTD_BEGIN_NAMESPACE
+
+// Blocks larger than this get their own mapping
+constexpr s64 MALLOC_MMAP_THRESHOLD = 256_KiB;
+
+// The size of the first pool, later pools are at least this large too
+constexpr s64 MALLOC_POOL_SIZE = 64_MiB;
+
+// What malloc guarantees (alignof(max_align_t)).
+constexpr s64 MALLOC_ALIGNMENT = 16;
+
+// Stored right before every pointer we return
+struct malloc_header {
+    s64 BlockSize;  // The size we requested from the TLSF allocator, 0 if the block is its own mapping
+    u32 Offset;     // From the start of the block to the pointer we returned
+    u32 Alignment;
+};
+static_assert(sizeof(malloc_header) == MALLOC_ALIGNMENT);
+
+// :GlobalStateNoConstructors: Both are constant-initialized, so they are valid before any static constructor has run.
+file_scope thread_cache_allocator_data MallocData;
+file_scope thread::fast_mutex MallocPoolLock;  // Held only while mapping a new pool
+
+file_scope pthread_key_t MallocThreadExitKey;
+file_scope pthread_once_t MallocThreadExitKeyOnce = PTHREAD_ONCE_INIT;
+file_scope thread_local bool MallocThreadExitRegistered;
+
+file_scope void flush_thread_cache(void *) {
+    thread_cache_allocator_flush(&MallocData);
+
+    // Destructors of other keys may still allocate after us, that registers the thread again (pthreads then calls us again)
+    MallocThreadExitRegistered = false;
+}
+
+// Takes the locks in the same order as allocate_from_pools(), so no thread can hold one of them during the fork
+file_scope void lock_before_fork() {
+    MallocPoolLock.lock();
+    MallocData.Lock.lock();
+}
+
+// Runs in both the parent and the child, in the child the forking thread is the only one left and it owns both locks
+file_scope void unlock_after_fork() {
+    MallocData.Lock.unlock();
+    MallocPoolLock.unlock();
+}
+
+file_scope void create_thread_exit_key() {
+    pthread_key_create(&MallocThreadExitKey, flush_thread_cache);
+    pthread_atfork(lock_before_fork, unlock_after_fork, unlock_after_fork);
+}
+
+// Makes sure the calling thread's cached blocks get flushed when it exits
+file_scope void register_thread_exit() {
+    if (MallocThreadExitRegistered) return;
+    MallocThreadExitRegistered = true;  // Set first, pthread_once and pthread_setspecific may call malloc
+
+    pthread_once(&MallocThreadExitKeyOnce, create_thread_exit_key);
+    pthread_setspecific(MallocThreadExitKey, (void *) 1);  // The destructor only runs for non-null values
+}
+
+file_scope malloc_header *get_header(void *ptr) { return (malloc_header *) ptr - 1; }
+file_scope byte *get_block(void *ptr) { return (byte *) ptr - get_header(ptr)->Offset; }
+
+file_scope void *allocate_from_pools(s64 size) {
+    register_thread_exit();
+
+    if (MallocData.Shared.State) {
+        void *result = thread_cache_allocator(allocator_mode::ALLOCATE, &MallocData, size, null, 0, 0);
+        if (result) return result;
+    }
+
+    MallocPoolLock.lock();
+    defer(MallocPoolLock.unlock());
+
+    // Another thread might have added a pool while we were waiting on the lock
+    if (MallocData.Shared.State) {
+        void *result = thread_cache_allocator(allocator_mode::ALLOCATE, &MallocData, size, null, 0, 0);
+        if (result) return result;
+    }
+
+    s64 poolSize = max(MALLOC_POOL_SIZE, size * 3);
+
+    void *pool = os_allocate_block(poolSize);
+    if (!pool) return null;
+
+    thread_cache_allocator(allocator_mode::ADD_POOL, &MallocData, poolSize, pool, 0, 0);
+    return thread_cache_allocator(allocator_mode::ALLOCATE, &MallocData, size, null, 0, 0);
+}
+
+file_scope void *allocate_aligned(u64 size, s64 alignment) {
+    if (alignment < MALLOC_ALIGNMENT) alignment = MALLOC_ALIGNMENT;
+    if (alignment > 32768 || size > MAX_ALLOCATION_REQUEST / 2) return null;
+
+    // Room for the header and to move the pointer to the alignment (both TLSF and the OS give us at least 8 byte aligned blocks)
+    s64 required = (s64) size + sizeof(malloc_header) + alignment - 8;
+
+    bool mapped = required > MALLOC_MMAP_THRESHOLD;
+
+    auto *block = (byte *) (mapped ? os_allocate_block(required) : allocate_from_pools(required));
+    if (!block) return null;
+
+    u32 offset = calculate_padding_for_pointer_with_header(block, (s32) alignment, sizeof(malloc_header));
+
+    auto *header = (malloc_header *) (block + offset) - 1;
+    header->BlockSize = mapped ? 0 : required;
+    header->Offset = offset;
+    header->Alignment = (u32) alignment;
+    return block + offset;
+}
+
+file_scope s64 usable_size(void *ptr) {
+    auto *header = get_header(ptr);
+    s64 blockSize = header->BlockSize ? header->BlockSize : os_get_block_size(get_block(ptr));
+    return blockSize - header->Offset;
+}
+
+file_scope void free_block(void *ptr) {
+    auto *header = get_header(ptr);
+    if (header->BlockSize) {
+        register_thread_exit();  // Freed blocks go to this thread's cache, even if another thread allocated them
+
+        // Passing the size lets the thread cache find the size class without looking at the block
+        thread_cache_allocator(allocator_mode::FREE, &MallocData, 0, get_block(ptr), header->BlockSize, 0);
+    } else {
+        os_free_block(get_block(ptr));
+    }
+}
+
+file_scope void *reallocate(void *ptr, u64 newSize) {
+    auto *header = get_header(ptr);
+    s64 offset = header->Offset;
+    s64 required = (s64) newSize + offset;
+
+    if (newSize <= MAX_ALLOCATION_REQUEST / 2) {
+        if (!header->BlockSize) {
+            // mremap keeps the offset from the page boundary, so the pointer stays aligned unless the alignment is larger than a page
+            if (required > MALLOC_MMAP_THRESHOLD && header->Alignment <= os_get_page_size()) {
+                auto *block = (byte *) os_remap_block(get_block(ptr), required);
+                if (block) return block + offset;
+            }
+        } else if (required <= MALLOC_MMAP_THRESHOLD) {
+            if (thread_cache_allocator(allocator_mode::RESIZE, &MallocData, required, get_block(ptr), header->BlockSize, 0)) {
+                header->BlockSize = required;
+                return ptr;
+            }
+        }
+    }
+
+    void *result = allocate_aligned(newSize, header->Alignment);
+    if (!result) return null;  // The old block is still valid
+
+    copy_memory(result, ptr, min((s64) newSize, usable_size(ptr)));
+    free_block(ptr);
+    return result;
+}
+
+LSTD_END_NAMESPACE
+
+LSTD_USING_NAMESPACE;
+
+extern "C" {
+
+void *malloc(size_t size) noexcept {
+    void *result = allocate_aligned(size, MALLOC_ALIGNMENT);
+    if (!result) errno = ENOMEM;
+    return result;
+}
+
+void free(void *ptr) noexcept {
+    if (ptr) free_block(ptr);
+}
+
+void *calloc(size_t count, size_t size) noexcept {
+    size_t total;
+    if (__builtin_mul_overflow(count, size, &total)) {
+        errno = ENOMEM;
+        return null;
+    }
+
+    void *result = malloc(total);
+
+    // Fresh mappings are already zeroed
+    if (result && get_header(result)->BlockSize) zero_memory(result, total);
+    return result;
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+    if (!ptr) return malloc(size);
+
+    if (!size) {
+        free_block(ptr);
+        return null;
+    }
+
+    void *result = reallocate(ptr, size);
+    if (!result) errno = ENOMEM;
+    return result;
+}
+
+int posix_memalign(void **result, size_t alignment, size_t size) noexcept {
+    if (!alignment || !is_pow_of_2(alignment) || alignment % sizeof(void *)) return EINVAL;
+
+    void *p = allocate_aligned(size, alignment);
+    if (!p) return ENOMEM;
+
+    *result = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+    if (!alignment || !is_pow_of_2(alignment)) {
+        errno = EINVAL;
+        return null;
+    }
+
+    void *result = allocate_aligned(size, alignment);
+    if (!result) errno = ENOMEM;
+    return result;
+}
+
+// Obsolete, but still called by older code
+void *memalign(size_t alignment, size_t size) noexcept { return aligned_alloc(alignment, size); }
+void *valloc(size_t size) noexcept { return aligned_alloc(os_get_page_size(), size); }
+
+size_t malloc_usable_size(void *ptr) noexcept { return ptr ? usable_size(ptr) : 0; }
+}
+
+#endif
@@ -1,15 +1,44 @@
-#include "lstd/common.hpp"
+#include "lstd/internal/common.h"
 
-// @Platform
-// UNMAINTAINED
-// UNMAINTAINED
-// UNMAINTAINED
+#if OS == LINUX
 
-#if IS_OS_POSIX
+#include "lstd/thread.h"
 
-#include <pthread.h>
-#include <signal.h>
 #include <sched.h>
-#include <unistd.h>
 
-#endif
\ No newline at end of file
+// @Platform
+// Only the spin locks are implemented on Linux (the rest of the thread API is still Windows-only).
+// The allocators use them - including posix_malloc.cpp, which may run before anything in lstd is initialized,
+// so these must not allocate or touch the Context.
+
+LSTD_BEGIN_NAMESPACE
+
+namespace thread {
+
+// Block the calling thread until a lock on the mutex can
+// be obtained. The mutex remains locked until unlock() is called.
+void fast_mutex::lock() {
+    while (!try_lock()) sched_yield();
+}
+
+void fast_shared_mutex::lock() {
+    // Claim the writer bit, then wait for the readers which got in before us to leave
+    while (true) {
+        s32 state = atomic_load(&State);
+        if (!(state & WRITER) && atomic_compare_and_swap(&State, state | WRITER, state) == state) break;
+        sched_yield();
+    }
+    while (atomic_load(&State) != WRITER) sched_yield();
+}
+
+void fast_shared_mutex::lock_shared() {
+    while (!try_lock_shared()) {
+        while (atomic_load(&State) & WRITER) sched_yield();
+    }
+}
+
+}  // namespace thread
+
+LSTD_END_NAMESPACE
+
+#endif
@@ -16,7 +16,8 @@ import os;
 // which means that allocations done in different modules are incompatible. If you provide a symbol lstd_dont_initialize_global_state_stub
 // with the value "true" we don't initialize that global state (instead we leave it as null). That means that YOU MUST initialize it yourself!
 // You must initialize the following global variables by passing the values from the "host" to the "guest" module:
-//  - DEBUG_memory     (a global pointer, by default we allocate it)
+//  - DEBUG_memory       (a global pointer, by default we allocate it)
+//  - AllocatorRegistry  (a global pointer, compact allocation headers store indices into it, see allocator.h)
 //
 // @Volatile: As we add more global state.
 //
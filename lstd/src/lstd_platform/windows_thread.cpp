@@ -17,6 +17,22 @@ void fast_mutex::lock() {
     while (!try_lock()) sleep(0);
 }
 
+void fast_shared_mutex::lock() {
+    // Claim the writer bit, then wait for the readers which got in before us to leave
+    while (true) {
+        s32 state = atomic_load(&State);
+        if (!(state & WRITER) && atomic_compare_and_swap(&State, state | WRITER, state) == state) break;
+        sleep(0);
+    }
+    while (atomic_load(&State) != WRITER) sleep(0);
+}
+
+void fast_shared_mutex::lock_shared() {
+    while (!try_lock_shared()) {
+        while (atomic_load(&State) & WRITER) sleep(0);
+    }
+}
+
 //
 // Mutexes:
 //
@@ -171,6 +187,25 @@ u32 __stdcall thread::wrapper_function(void *data) {
 
     free(ti);
 
+    // Give back any memory this thread has cached for the persistent allocator, otherwise it would be lost.
+    internal::platform_flush_thread_caches();
+
+    // Let other threads adopt our heaps (and the blocks still allocated in them)
+    thread_heap_allocator_abandon();
+
+    // Give back the address space reserved by this thread's temporary allocator.
+    // free_all first, so with DEBUG_MEMORY we don't leave headers of temporary allocations in the lists.
+    auto *tempData = (virtual_arena_allocator_data *) &__TempAllocData;
+    if (tempData->Base) {
+        free_all({default_temp_allocator, tempData});
+        virtual_arena_allocator_release(tempData);
+    }
+
+#if defined DEBUG_MEMORY
+    // Let the next thread adopt our list of allocations
+    if (DEBUG_memory) DEBUG_memory->release_thread_shard();
+#endif
+
 #if defined LSTD_NO_CRT
     ExitThread(0);
     if (ti->Module) FreeLibrary(ti->Module);
@@ -29,6 +29,9 @@ function common_settings()
 	
 	-- Uncomment this to use a custom namespace name for the library
 	-- defines { "LSTD_NAMESPACE=my_lstd" }
+
+	-- Uncomment this to keep the C library's malloc on Linux (by default we replace it, see posix_malloc.cpp)
+	-- defines { "LSTD_DONT_REPLACE_MALLOC" }
 	
     
     includedirs { "%{prj.name}/src" }
@@ -36,15 +39,22 @@ function common_settings()
         systemversion "latest"
         buildoptions { "/utf-8" }
         
-        excludes "%{prj.name}/**/posix_*.cpp"
+        excludes { "%{prj.name}/**/posix_*.cpp", "%{prj.name}/**/os.posix.*.ixx" }
 
         -- We need _CRT_SUPPRESS_RESTRICT for some dumb reason
         defines { "LSTD_NO_CRT", "NOMINMAX", "WIN32_LEAN_AND_MEAN", "_CRT_SUPPRESS_RESTRICT" } 
     
         buildoptions { "/Gs9999999" }
         
-        links { "dwmapi.lib", "dbghelp.lib" }
+        links { "dwmapi.lib", "dbghelp.lib", "advapi32.lib" }
         flags { "OmitDefaultLibrary", "NoRuntimeChecks", "NoBufferSecurityCheck" }
+    filter "system:not windows"
+        excludes "%{prj.name}/**/os.win64.*.ixx"
+    filter { "system:not windows", "kind:ConsoleApp or WindowedApp" }
+        -- lstd is a static library and nothing references posix_malloc.o directly, so without this the linker
+        -- may resolve malloc from libc and never pull our replacement in. Remove this if you define LSTD_DONT_REPLACE_MALLOC.
+        -- Only for executables: a shared library with its own malloc would fight with the one the executable uses.
+        linkoptions { "-Wl,--undefined=malloc" }
     filter { "system:windows", "not kind:StaticLib" }
         linkoptions { "/nodefaultlib", "/subsystem:windows", "/stack:\"0x100000\",\"0x100000\"" }
         links { "kernel32", "shell32", "winmm", "ole32" }
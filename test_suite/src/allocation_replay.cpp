@@ -0,0 +1,162 @@
+#include "allocation_replay.h"
+
+replay_result replay_allocation_trace(const array<allocation_trace_event> &events, allocator alloc) {
+    replay_result result;
+
+    s64 blocksCount = 0;
+    For(events) if (it.Op == allocation_trace_op::ALLOCATE) ++blocksCount;
+
+    auto *blocks = allocate_array<void *>(blocksCount);  // Indexed by ID
+    auto *blockSizes = allocate_array<s64>(blocksCount);
+    auto *alignments = allocate_array<u32>(blocksCount);
+    auto *requests = allocate_array<s64>(events.Count);  // The block size each event asks for
+    defer(free(blocks));
+    defer(free(blockSizes));
+    defer(free(alignments));
+    defer(free(requests));
+
+    // Work out the block sizes up front so we don't time that
+    For_as(index, range(events.Count)) {
+        auto &e = events[index];
+        if (e.Op == allocation_trace_op::ALLOCATE) alignments[e.ID] = e.Alignment;
+        if (e.Op != allocation_trace_op::FREE) requests[index] = general_get_required_size(alloc, e.Size, alignments[e.ID]);
+    }
+
+    byte *lowest = (byte *) -1, *highest = null;
+    s64 live = 0;
+
+    auto touched = [&](void *block, s64 size) {
+        if ((byte *) block < lowest) lowest = (byte *) block;
+        if ((byte *) block + size > highest) highest = (byte *) block + size;
+    };
+
+    time_t start = os_get_time();
+    For_as(index, range(events.Count)) {
+        auto &e = events[index];
+        s64 size = requests[index];
+
+        if (e.Op == allocation_trace_op::ALLOCATE) {
+            void *block = alloc.Function(allocator_mode::ALLOCATE, alloc.Context, size, null, 0, 0);
+            if (!block) {
+                result.OutOfMemory = true;
+                break;
+            }
+
+            blocks[e.ID] = block;
+            blockSizes[e.ID] = size;
+            live += size;
+            touched(block, size);
+        } else if (e.Op == allocation_trace_op::RESIZE) {
+            void *old = blocks[e.ID];
+            s64 oldSize = blockSizes[e.ID];
+
+            // Same as general_reallocate: try in place, otherwise move
+            void *block = alloc.Function(allocator_mode::RESIZE, alloc.Context, size, old, oldSize, 0);
+            if (!block) {
+                block = alloc.Function(allocator_mode::ALLOCATE, alloc.Context, size, null, 0, 0);
+                if (!block) {
+                    result.OutOfMemory = true;
+                    break;
+                }
+                copy_memory(block, old, min(size, oldSize));
+                alloc.Function(allocator_mode::FREE, alloc.Context, 0, old, oldSize, 0);
+            }
+
+            blocks[e.ID] = block;
+            blockSizes[e.ID] = size;
+            live += size - oldSize;
+            touched(block, size);
+        } else {
+            alloc.Function(allocator_mode::FREE, alloc.Context, 0, blocks[e.ID], blockSizes[e.ID], 0);
+            live -= blockSizes[e.ID];
+        }
+
+        ++result.Operations;
+        if (live > result.PeakLiveBytes) result.PeakLiveBytes = live;
+    }
+    f64 seconds = os_time_to_seconds(os_get_time() - start);
+
+    if (result.Operations) result.NanosecondsPerOp = seconds * 1e9 / result.Operations;
+    if (highest) result.PeakFootprint = highest - lowest;
+    if (result.PeakFootprint) result.Fragmentation = 1.0 - (f64) result.PeakLiveBytes / result.PeakFootprint;
+
+    return result;
+}
+
+file_scope void print_result(const string &name, const replay_result &r) {
+    print("    {:<20} {:>10.1f} {:>14} {:>14} {:>13.1f}%{}\n", name, r.NanosecondsPerOp, r.PeakLiveBytes, r.PeakFootprint, r.Fragmentation * 100,
+          r.OutOfMemory ? " (out of memory)" : "");
+}
+
+// Replays against an allocator which takes pools, with one pool of _poolSize_ bytes
+file_scope void replay_with_pool(const string &name, const array<allocation_trace_event> &events, allocator alloc, s64 poolSize) {
+    void *pool = os_allocate_block(poolSize);
+    defer(os_free_block(pool));
+
+    allocator_add_pool(alloc, pool, poolSize);
+    print_result(name, replay_allocation_trace(events, alloc));
+}
+
+void replay_allocation_trace_against_all(const array<allocation_trace_event> &events) {
+    // Size the pools from the trace: the highest live bytes (for allocators which free) and the total (for arenas)
+    s64 live = 0, peakLive = 0, total = 0;
+    {
+        s64 blocksCount = 0;
+        For(events) if (it.Op == allocation_trace_op::ALLOCATE) ++blocksCount;
+
+        auto *sizes = allocate_array<s64>(blocksCount);
+        defer(free(sizes));
+
+        For(events) {
+            s64 size = it.Op == allocation_trace_op::FREE ? 0 : it.Size + 64;  // Roughly our header and padding
+            s64 old = it.Op == allocation_trace_op::ALLOCATE ? 0 : sizes[it.ID];
+
+            live += size - old;
+            total += size;
+            sizes[it.ID] = size;
+
+            if (live > peakLive) peakLive = live;
+        }
+    }
+
+    s64 poolSize = max<s64>(ceil_pow_of_2(4 * peakLive), 1_MiB);
+    s64 arenaSize = max<s64>(total, 1_MiB);
+
+    print("\n    {} events, peak live ~{} bytes\n", events.Count, peakLive);
+    print("    {:<20} {:>10} {:>14} {:>14} {:>14}\n", "allocator", "ns/op", "peak live", "footprint", "fragmentation");
+
+    {
+        tlsf_allocator_data data;
+        replay_with_pool("tlsf", events, {tlsf_allocator, &data}, poolSize);
+    }
+    {
+        thread_cache_allocator_data data;
+
+        void *pool = os_allocate_block(poolSize);
+        allocator_add_pool({thread_cache_allocator, &data}, pool, poolSize);
+
+        print_result("thread_cache", replay_allocation_trace(events, {thread_cache_allocator, &data}));
+
+        // The cache holds blocks from the pool, give them back before the pool goes away
+        thread_cache_allocator_flush(&data);
+        os_free_block(pool);
+    }
+    {
+        buddy_allocator_data data;
+        replay_with_pool("buddy", events, {buddy_allocator, &data}, poolSize);
+    }
+    {
+        arena_allocator_data data;
+        replay_with_pool("arena", events, {arena_allocator, &data}, arenaSize);
+    }
+    {
+        virtual_arena_allocator_data data;
+        print_result("virtual_arena", replay_allocation_trace(events, {virtual_arena_allocator, &data}));
+        virtual_arena_allocator_release(&data);
+    }
+    {
+        thread_heap_allocator_data data;
+        print_result("thread_heap", replay_allocation_trace(events, {thread_heap_allocator, &data}));
+        thread_heap_allocator_release(&data);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "test.h"
+
+#include <lstd/memory/allocation_trace.h>
+
+//
+// Replays allocation traces recorded with allocation_trace_start() (see allocation_trace.h) against our allocators.
+// Run the test suite with "--replay <trace file>" to compare all allocators on a trace recorded from a real program.
+//
+
+struct replay_result {
+    s64 Operations = 0;
+    f64 NanosecondsPerOp = 0;
+
+    s64 PeakLiveBytes = 0;  // Highest sum of the sizes of the live blocks (including our headers)
+    s64 PeakFootprint = 0;  // Span of addresses the allocator handed out (that's what would be resident)
+    f64 Fragmentation = 0;  // 1 - PeakLiveBytes / PeakFootprint
+
+    bool OutOfMemory = false;  // The allocator failed an allocation, the numbers are for the part of the trace before that
+};
+
+// Calls the allocator function directly (like general_allocate would, with the same block sizes) for every event.
+// Blocks the trace doesn't free are left allocated, so use an allocator you can throw away afterwards.
+replay_result replay_allocation_trace(const array<allocation_trace_event> &events, allocator alloc);
+
+// Replays the trace against every allocator we have (each one gets pools large enough for the trace) and prints a table.
+void replay_allocation_trace_against_all(const array<allocation_trace_event> &events);
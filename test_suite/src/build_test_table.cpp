@@ -1,6 +1,42 @@
 #include "test.h"
 
 void build_test_table() {
+    extern void test_thread_cache_allocator();
+    array_append(*g_TestTable[string("allocator.cpp")], {"thread_cache_allocator", test_thread_cache_allocator});
+    extern void test_allocation_header_overhead();
+    array_append(*g_TestTable[string("allocator.cpp")], {"allocation_header_overhead", test_allocation_header_overhead});
+    extern void test_allocator_registry();
+    array_append(*g_TestTable[string("allocator.cpp")], {"allocator_registry", test_allocator_registry});
+    extern void test_pool_allocator();
+    array_append(*g_TestTable[string("allocator.cpp")], {"pool_allocator", test_pool_allocator});
+    extern void test_arena_allocator_resize();
+    array_append(*g_TestTable[string("allocator.cpp")], {"arena_allocator_resize", test_arena_allocator_resize});
+    extern void test_temp_savepoint();
+    array_append(*g_TestTable[string("allocator.cpp")], {"temp_savepoint", test_temp_savepoint});
+    extern void test_cross_thread_free();
+    array_append(*g_TestTable[string("allocator.cpp")], {"cross_thread_free", test_cross_thread_free});
+    extern void test_incremental_heap_verification();
+    array_append(*g_TestTable[string("allocator.cpp")], {"incremental_heap_verification", test_incremental_heap_verification});
+    extern void test_allocation_profiler();
+    array_append(*g_TestTable[string("allocator.cpp")], {"allocation_profiler", test_allocation_profiler});
+    extern void test_stats_allocator();
+    array_append(*g_TestTable[string("allocator.cpp")], {"stats_allocator", test_stats_allocator});
+    extern void test_os_reserve_commit();
+    array_append(*g_TestTable[string("allocator.cpp")], {"os_reserve_commit", test_os_reserve_commit});
+    extern void test_virtual_arena_allocator();
+    array_append(*g_TestTable[string("allocator.cpp")], {"virtual_arena_allocator", test_virtual_arena_allocator});
+    extern void test_buddy_allocator();
+    array_append(*g_TestTable[string("allocator.cpp")], {"buddy_allocator", test_buddy_allocator});
+    extern void test_large_allocation_threshold();
+    array_append(*g_TestTable[string("allocator.cpp")], {"large_allocation_threshold", test_large_allocation_threshold});
+    extern void test_allocate_batch();
+    array_append(*g_TestTable[string("allocator.cpp")], {"allocate_batch", test_allocate_batch});
+    extern void test_thread_heap_allocator();
+    array_append(*g_TestTable[string("allocator.cpp")], {"thread_heap_allocator", test_thread_heap_allocator});
+    extern void test_allocation_trace();
+    array_append(*g_TestTable[string("allocator.cpp")], {"allocation_trace", test_allocation_trace});
+    extern void test_posix_malloc();
+    array_append(*g_TestTable[string("allocator.cpp")], {"posix_malloc", test_posix_malloc});
     // extern void test_msb();
     // array_append(*g_TestTable[string("bits.cpp")], {"msb", test_msb});
     // extern void test_lsb();
@@ -228,12 +264,28 @@ void build_test_table() {
     array_append(*g_TestTable[string("storage.cpp")], {"stack_array", test_stack_array});
     extern void test_array();
     array_append(*g_TestTable[string("storage.cpp")], {"array", test_array});
+    extern void test_small_array();
+    array_append(*g_TestTable[string("storage.cpp")], {"small_array", test_small_array});
+    extern void test_soa_array();
+    array_append(*g_TestTable[string("storage.cpp")], {"soa_array", test_soa_array});
     extern void test_hash_table();
     array_append(*g_TestTable[string("storage.cpp")], {"hash_table", test_hash_table});
     extern void test_hash_table_clone();
     array_append(*g_TestTable[string("storage.cpp")], {"hash_table_clone", test_hash_table_clone});
     extern void test_hash_table_alignment();
     array_append(*g_TestTable[string("storage.cpp")], {"hash_table_alignment", test_hash_table_alignment});
+    extern void test_hash_table_many();
+    array_append(*g_TestTable[string("storage.cpp")], {"hash_table_many", test_hash_table_many});
+    extern void test_hash_table_churn();
+    array_append(*g_TestTable[string("storage.cpp")], {"hash_table_churn", test_hash_table_churn});
+    extern void test_hash_table_heterogeneous_lookup();
+    array_append(*g_TestTable[string("storage.cpp")], {"hash_table_heterogeneous_lookup", test_hash_table_heterogeneous_lookup});
+    extern void test_btree();
+    array_append(*g_TestTable[string("storage.cpp")], {"btree", test_btree});
+    extern void test_btree_bulk_load();
+    array_append(*g_TestTable[string("storage.cpp")], {"btree_bulk_load", test_btree_bulk_load});
+    extern void test_btree_vs_hash_table_and_sort();
+    array_append(*g_TestTable[string("storage.cpp")], {"btree_vs_hash_table_and_sort", test_btree_vs_hash_table_and_sort});
     extern void test_code_point_size();
     array_append(*g_TestTable[string("string.cpp")], {"code_point_size", test_code_point_size});
     extern void test_substring();
@@ -268,6 +320,10 @@ void build_test_table() {
     array_append(*g_TestTable[string("string.cpp")], {"replace_all", test_replace_all});
     extern void test_find();
     array_append(*g_TestTable[string("string.cpp")], {"find", test_find});
+    extern void test_atom_table();
+    array_append(*g_TestTable[string("string.cpp")], {"atom_table", test_atom_table});
+    extern void test_atom_table_threads();
+    array_append(*g_TestTable[string("string.cpp")], {"atom_table_threads", test_atom_table_threads});
     extern void test_hardware_concurrency();
     array_append(*g_TestTable[string("thread.cpp")], {"hardware_concurrency", test_hardware_concurrency});
     extern void test_ids();
@@ -284,6 +340,10 @@ void build_test_table() {
     array_append(*g_TestTable[string("thread.cpp")], {"condition_variable", test_condition_variable});
     extern void test_context();
     array_append(*g_TestTable[string("thread.cpp")], {"context", test_context});
+    extern void test_concurrent_hash_table();
+    array_append(*g_TestTable[string("thread.cpp")], {"concurrent_hash_table", test_concurrent_hash_table});
+    extern void test_concurrent_hash_table_throughput();
+    array_append(*g_TestTable[string("thread.cpp")], {"concurrent_hash_table_throughput", test_concurrent_hash_table_throughput});
     extern void test_vec_ctor();
     array_append(*g_TestTable[string("vec.cpp")], {"vec_ctor", test_vec_ctor});
     extern void test_ctor_array();
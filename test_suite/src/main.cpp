@@ -1,3 +1,4 @@
+#include "allocation_replay.h"
 #include "test.h"
 
 import lstd.big_integer;
@@ -88,9 +89,28 @@ void write_output_to_file() {
     path_write_to_file("output.txt", string_builder_combine(g_Logger.Builder), Overwrite_Entire);
 }
 
+// "--replay <trace file>" replays an allocation trace (see allocation_trace.h) against all allocators instead of running the tests
+bool maybe_replay_allocation_trace() {
+    auto args = os_get_command_line_arguments();
+    if (args.Count < 2 || args[0] != "--replay") return false;
+
+    array<allocation_trace_event> events;
+    defer(free(events));
+
+    if (!allocation_trace_load(&events, args[1])) {
+        print("{!RED}Couldn't load allocation trace \"{}\"{!}\n", args[1]);
+        return true;
+    }
+
+    replay_allocation_trace_against_all(events);
+    return true;
+}
+
 s32 main() {
     time_t start = os_get_time();
 
+    if (maybe_replay_allocation_trace()) return 0;
+
 #if defined DEBUG_MEMORY
     DEBUG_memory->MemoryVerifyHeapFrequency = 1;
 #endif
@@ -106,15 +126,13 @@ s32 main() {
         newContext.FmtDisableAnsiCodes = true;
     }
 
-    allocator_add_pool(Context.TempAlloc, os_allocate_block(1_MiB), 1_MiB);
-
     OVERRIDE_CONTEXT(newContext);
 
     PUSH_CONTEXT(newContext) {
         build_test_table();
         run_tests();
     }
-    print("\nFinished tests, time taken: {:f} seconds, bytes used: {}, pools used: {}\n\n", os_time_to_seconds(os_get_time() - start), __TempAllocData.TotalUsed, __TempAllocData.PoolsCount);
+    print("\nFinished tests, time taken: {:f} seconds, bytes used: {}, bytes committed: {}\n\n", os_time_to_seconds(os_get_time() - start), __TempAllocData.TotalUsed, __TempAllocData.Committed);
 
     if (LOG_TO_FILE) {
         write_output_to_file();
@@ -3,4 +3,8 @@
 #include <lstd/io.h>
 #include <lstd/math.h>
 #include <lstd/memory/array.h>
+#include <lstd/memory/btree.h>
 #include <lstd/memory/hash_table.h>
+#include <lstd/memory/small_array.h>
+#include <lstd/memory/soa_array.h>
+#include <lstd/memory/concurrent_hash_table.h>
@@ -0,0 +1,1160 @@
+#include "../test.h"
+
+#include <lstd/memory/allocation_profiler.h>
+
+#include "../allocation_replay.h"
+
+file_scope thread_cache_allocator_data ThreadCacheData;
+
+file_scope void thread_cache_worker(void *) {
+    allocator alloc = {thread_cache_allocator, &ThreadCacheData};
+
+    byte *blocks[64];
+    For(range(200)) {
+        For_as(i, range(64)) {
+            blocks[i] = allocate_array<byte>(16 + i * 8, {.Alloc = alloc});
+            fill_memory(blocks[i], (char) i, 16 + i * 8);
+        }
+        For_as(i, range(64)) {
+            assert_eq(blocks[i][0], (byte) i);
+            free(blocks[i]);
+        }
+    }
+
+    thread_cache_allocator_flush(&ThreadCacheData);
+}
+
+TEST(thread_cache_allocator) {
+    s64 poolSize = 4_MiB;
+    void *pool = os_allocate_block(poolSize);
+    defer(os_free_block(pool));
+
+    allocator alloc = {thread_cache_allocator, &ThreadCacheData};
+    allocator_add_pool(alloc, pool, poolSize);
+
+    time_t start = os_get_time();
+
+    array<thread::thread> threads;
+    defer(free(threads));
+
+    For(range(8)) {
+        array_append(threads)->init_and_launch(thread_cache_worker);
+    }
+
+    For(threads) {
+        it.wait();
+    }
+
+    print("\n\t\t8 threads, 102400 allocations in {:f} seconds.\n", os_time_to_seconds(os_get_time() - start));
+    For(range(45)) print(" ");
+
+    // All blocks were returned to the shared state, so it shouldn't be corrupted
+    assert_eq(tlsf_check(ThreadCacheData.Shared.State), 0);
+
+    ThreadCacheData.Shared.State = null;
+}
+
+TEST(allocation_header_overhead) {
+    s64 poolSize = 4_MiB;
+    void *pool = os_allocate_block(poolSize);
+    defer(os_free_block(pool));
+    void *fullPool = os_allocate_block(poolSize);
+    defer(os_free_block(fullPool));
+
+    arena_allocator_data data, fullData;
+    allocator alloc = {arena_allocator, &data};
+    allocator fullAlloc = {arena_allocator, &fullData};
+    allocator_add_pool(alloc, pool, poolSize);
+    allocator_add_pool(fullAlloc, fullPool, poolSize);
+
+    // Register _alloc_, then fill the rest of the registry so _fullAlloc_ can't be registered and gets FULL headers
+    // (what every allocation had before compact headers). Both arenas do the same allocations, so we can compare them.
+    assert_true(allocator_registry_get_index(alloc) != -1);
+
+    byte fillers[MAX_REGISTERED_ALLOCATORS];  // Only their addresses are used, as contexts
+    For(range(MAX_REGISTERED_ALLOCATORS)) allocator_registry_get_index({arena_allocator, fillers + it});
+    assert_eq(allocator_registry_get_index(fullAlloc), -1);
+
+    constexpr s64 COUNT = 10000;
+
+    s64 userBytes = 0;
+
+    time_t start = os_get_time();
+    For(range(COUNT)) {
+        s64 size = 8 + (it % 16) * 8;  // 8 to 128 bytes, typical small objects
+
+        auto *p = allocate_array<byte>(size, {.Alloc = alloc});
+        assert_eq(allocation_get_size(p), size);
+        assert_true(allocation_get_allocator(p) == alloc);
+
+        userBytes += size;
+    }
+    f64 elapsed = os_time_to_seconds(os_get_time() - start);
+
+    For(range(COUNT)) {
+        s64 size = 8 + (it % 16) * 8;
+
+        auto *p = allocate_array<byte>(size, {.Alloc = fullAlloc});
+        assert_eq(allocation_get_size(p), size);
+        assert_true(allocation_get_allocator(p) == fullAlloc);
+        assert_true(allocation_get_header_kind(p) == allocation_header_kind::FULL);
+    }
+
+    For(range(MAX_REGISTERED_ALLOCATORS)) allocator_registry_release(fillers + it);
+
+    s64 overhead = (data.TotalUsed - userBytes) / COUNT;
+    s64 fullOverhead = (fullData.TotalUsed - userBytes) / COUNT;
+
+    print("\n\t\t{} allocations in {:f} seconds, overhead per allocation: {} bytes (with FULL headers: {} bytes).\n", COUNT, elapsed,
+          overhead, fullOverhead);
+    For(range(45)) print(" ");
+
+#if defined DEBUG_MEMORY
+    // Every allocation gets the FULL header (the debug info needs the space)
+    assert_eq(overhead, fullOverhead);
+#else
+    assert_lt(overhead, fullOverhead);
+    assert_eq(fullOverhead - overhead, (s64) (sizeof(allocation_header) - sizeof(allocation_header_small)));
+#endif
+
+    // A large block should get the medium header and still decode properly
+    auto *large = allocate_array<byte>(100_KiB, {.Alloc = alloc, .Alignment = 64});
+    assert_eq(allocation_get_size(large), 100_KiB);
+    assert_eq(allocation_get_alignment(large), 64);
+    assert_eq((u64) large % 64, 0);
+#if not defined DEBUG_MEMORY
+    assert_true(allocation_get_header_kind(large) == allocation_header_kind::MEDIUM);
+#endif
+}
+
+TEST(allocator_registry) {
+    s64 poolSize = 4_KiB;
+    void *pool = os_allocate_block(poolSize);
+    defer(os_free_block(pool));
+
+    s64 registered = AllocatorRegistry->Count;
+
+    // More short-lived arenas than the registry holds. Each one releases its entry when its last pool is removed,
+    // so the later ones still get registered (and compact headers).
+    constexpr s64 COUNT = MAX_REGISTERED_ALLOCATORS * 3;
+
+    auto *arenas = allocate_array<arena_allocator_data>(COUNT);
+    defer(free(arenas));
+
+    For(range(COUNT)) {
+        allocator alloc = {arena_allocator, arenas + it};
+        allocator_add_pool(alloc, pool, poolSize);
+
+        auto *p = allocate<s64>({.Alloc = alloc});
+        assert_true(allocation_get_allocator(p) == alloc);
+        assert_eq(AllocatorRegistry->Count, registered + 1);
+#if not defined DEBUG_MEMORY
+        assert_true(allocation_get_header_kind(p) == allocation_header_kind::SMALL);
+#endif
+        free(p);
+
+        allocator_remove_pool(alloc, pool);
+    }
+    assert_eq(AllocatorRegistry->Count, registered);
+}
+
+TEST(pool_allocator) {
+    struct node {
+        s64 A, B, C;
+    };
+
+    pool_allocator_data data;
+    allocator alloc = {pool_allocator, &data};
+    data.ElementSize = general_get_required_size(alloc, sizeof(node));
+
+    s64 poolSize = 4_KiB;
+    void *pool1 = os_allocate_block(poolSize);
+    void *pool2 = os_allocate_block(poolSize);
+    defer(os_free_block(pool1));
+    defer(os_free_block(pool2));
+
+    allocator_add_pool(alloc, pool1, poolSize);
+    allocator_add_pool(alloc, pool2, poolSize);
+
+    // Fill both pools
+    array<node *> nodes;
+    defer(free(nodes));
+
+    while (true) {
+        auto *n = (node *) alloc.Function(allocator_mode::ALLOCATE, alloc.Context, data.ElementSize, null, 0, 0);
+        if (!n) break;
+        array_append(nodes, n);
+    }
+    assert_true(nodes.Count >= 2 * (poolSize - (s64) sizeof(allocator_pool)) / data.ElementSize - 2);
+
+    // Freed slots are reused first
+    alloc.Function(allocator_mode::FREE, alloc.Context, 0, nodes[5], data.ElementSize, 0);
+    assert_eq(alloc.Function(allocator_mode::ALLOCATE, alloc.Context, data.ElementSize, null, 0, 0), (void *) nodes[5]);
+
+    free_all(alloc);
+
+    // Through the general allocation functions
+    auto *a = allocate<node>({.Alloc = alloc});
+    auto *b = allocate<node>({.Alloc = alloc});
+    assert_eq((byte *) b - (byte *) a, data.ElementSize);  // Contiguous after FREE_ALL
+
+    a->A = 1, a->B = 2, a->C = 3;
+    free(b);
+
+    auto *c = allocate<node>({.Alloc = alloc});
+    assert_eq(c, b);
+    assert_eq(a->C, 3);
+
+    free(a);
+    free(c);
+}
+
+TEST(arena_allocator_resize) {
+    s64 poolSize = 64_KiB;
+    void *pool = os_allocate_block(poolSize);
+    defer(os_free_block(pool));
+
+    arena_allocator_data data;
+    allocator alloc = {arena_allocator, &data};
+    allocator_add_pool(alloc, pool, poolSize);
+
+    PUSH_ALLOC(alloc) {
+        array<s64> arr;
+
+        array_reserve(arr, 0);
+        auto *first = arr.Data;
+
+        For(range(1000)) array_append(arr, it);
+
+        // The array was the only thing being allocated, so it was grown in place every time
+        assert_eq(arr.Data, first);
+        For(range(1000)) assert_eq(arr[it], it);
+
+        // Another allocation on top means the array can no longer grow in place
+        auto *other = allocate<s64>();
+        *other = 42;
+        assert_true((byte *) other > (byte *) first);
+
+        array_reserve(arr, arr.Allocated);
+        assert_true(arr.Data != first);
+        assert_true((byte *) arr.Data > (byte *) other);  // Moved past the other allocation, which is left alone
+        assert_eq(*other, 42);
+        For(range(1000)) assert_eq(arr[it], it);
+
+        // free_all() below gives back both (and the old array block)
+
+        s64 used = data.TotalUsed;
+        free_all(alloc);
+        assert_eq(data.TotalUsed, 0);
+        assert_true(used > 0);
+    }
+}
+
+TEST(temp_savepoint) {
+    auto *before = allocate_array<byte>(64, {.Alloc = Context.TempAlloc});
+    s64 usedBefore = __TempAllocData.TotalUsed;
+
+    PUSH_TEMP_SAVEPOINT() {
+        For(range(100)) allocate_array<byte>(100, {.Alloc = Context.TempAlloc});
+
+        PUSH_TEMP_SAVEPOINT() {
+            allocate_array<byte>(1_KiB, {.Alloc = Context.TempAlloc});
+        }
+        assert_eq(__TempAllocData.TotalUsed, usedBefore + 100 * general_get_required_size(Context.TempAlloc, 100));
+    }
+    assert_eq(__TempAllocData.TotalUsed, usedBefore);
+
+    // The next allocation starts right where the rolled back ones did
+    auto savepoint = temp_get_savepoint();
+    auto *after = allocate_array<byte>(64, {.Alloc = Context.TempAlloc});
+    assert_true(after > before);
+    temp_rollback(savepoint);
+
+    auto *again = allocate_array<byte>(64, {.Alloc = Context.TempAlloc});
+    assert_eq(again, after);
+}
+
+file_scope s64 *CrossThreadBlocks[8][256];
+file_scope thread_cache_allocator_data CrossThreadData;
+
+file_scope void cross_thread_producer(void *data) {
+    auto **blocks = (s64 **) data;
+    For(range(256)) {
+        // Not the temporary allocator, its memory is released when the thread exits
+        blocks[it] = allocate<s64>({.Alloc = {thread_cache_allocator, &CrossThreadData}});
+        *blocks[it] = it;
+    }
+    thread_cache_allocator_flush(&CrossThreadData);
+}
+
+TEST(cross_thread_free) {
+    s64 poolSize = 1_MiB;
+    void *pool = os_allocate_block(poolSize);
+    defer(os_free_block(pool));
+
+    allocator_add_pool({thread_cache_allocator, &CrossThreadData}, pool, poolSize);
+    defer(CrossThreadData.Shared.State = null);
+
+    array<thread::thread> threads;
+    defer(free(threads));
+
+    For(range(8)) {
+        array_append(threads)->init_and_launch(cross_thread_producer, CrossThreadBlocks[it]);
+    }
+
+    For(threads) {
+        it.wait();
+    }
+
+    // Free everything on this thread. With DEBUG_MEMORY the headers live in the lists of the (now exited) producer threads.
+    For_as(t, range(8)) {
+        For(range(256)) {
+            assert_eq(*CrossThreadBlocks[t][it], it);
+            free(CrossThreadBlocks[t][it]);
+        }
+    }
+    thread_cache_allocator_flush(&CrossThreadData);
+
+#if defined DEBUG_MEMORY
+    // Walks all shards
+    DEBUG_memory->verify_heap();
+#endif
+}
+
+#if defined DEBUG_MEMORY
+file_scope allocation_header *CorruptedHeader;
+file_scope s64 CorruptionReports;
+
+file_scope void record_corruption(allocation_header *header, const char *) {
+    CorruptedHeader = header;
+    ++CorruptionReports;
+}
+
+file_scope s64 count_live_headers() {
+    s64 result = 0;
+
+    auto *shard = DEBUG_memory->Shards;
+    while (shard) {
+        shard->Lock.lock();
+        auto *it = shard->Head;
+        while (it) {
+            ++result;
+            it = it->DEBUG_Next;
+        }
+        shard->Lock.unlock();
+
+        shard = shard->Next;
+    }
+    return result;
+}
+
+// Makes the next incremental check start at _header_ (assumed to be clean)
+file_scope void point_verification_at(allocation_header *header) {
+    auto *shard = header->DEBUG_Shard;
+
+    shard->Lock.lock();
+    DEBUG_memory->VerifyShard = shard;
+    shard->VerifyCursor = header;
+    shard->Lock.unlock();
+}
+#endif
+
+TEST(incremental_heap_verification) {
+#if defined DEBUG_MEMORY
+    auto oldBudget = DEBUG_memory->VerifyHeapBudget;
+    defer(DEBUG_memory->VerifyHeapBudget = oldBudget);
+
+    DEBUG_memory->VerifyHeapBudget = 3;
+
+    array<s64 *> blocks;
+    defer(free(blocks));
+
+    For(range(200)) array_append(blocks, allocate<s64>());
+
+    // Free in an order which keeps hitting the header the verification cursor points to
+    while (blocks.Count) {
+        DEBUG_memory->maybe_verify_heap();
+
+        s64 index = (blocks.Count * 37 % 101) % blocks.Count;
+
+        free(blocks[index]);
+        array_remove_at(blocks, index);
+    }
+
+    //
+    // Overwrite a guard byte of a live block and check that the verification catches it
+    //
+    DEBUG_memory->CorruptionHandler = record_corruption;
+    defer(DEBUG_memory->CorruptionHandler = null);
+
+    auto oldFrequency = DEBUG_memory->MemoryVerifyHeapFrequency;
+    defer(DEBUG_memory->MemoryVerifyHeapFrequency = oldFrequency);
+
+    DEBUG_memory->MemoryVerifyHeapFrequency = 1;
+
+    s64 *a = allocate<s64>();
+    s64 *b = allocate<s64>();
+    s64 *c = allocate<s64>();
+
+    auto *bHeader = (allocation_header *) b - 1;
+    auto *guard = (byte *) (b + 1);  // The first byte of no man's land after _b_
+
+    array<s64 *> extra;
+    defer(free(extra));
+
+    // Each allocation verifies _VerifyHeapBudget_ headers. The ones allocated while we wait are added to the list too,
+    // so in the worst case we get through one less old header per allocation.
+    array_reserve(extra, count_live_headers() + 1);  // So appending doesn't allocate
+    s64 maxAllocations = count_live_headers() / (DEBUG_memory->VerifyHeapBudget - 1) + 1;
+
+    byte oldGuard = *guard;
+    *guard = (byte) ~oldGuard;
+
+    CorruptionReports = 0;
+    while (!CorruptionReports && extra.Count < maxAllocations) array_append(extra, allocate<s64>());
+
+    assert_true(CorruptionReports > 0);
+    assert_true(CorruptedHeader == bHeader);
+
+    // Freeing or resizing a block checks its neighbours in the list right away, _b_ is between _c_ and _a_.
+    // The incremental check (one header per call) looks at _a_, which is clean, so only the neighbour check can see _b_.
+    DEBUG_memory->VerifyHeapBudget = 1;
+
+    point_verification_at((allocation_header *) a - 1);
+    CorruptionReports = 0;
+    free(c);
+    assert_eq(CorruptionReports, 1);
+    assert_true(CorruptedHeader == bHeader);
+
+    point_verification_at((allocation_header *) a - 1);
+    CorruptionReports = 0;
+    a = reallocate_array(a, 20);
+    assert_eq(CorruptionReports, 1);
+    assert_true(CorruptedHeader == bHeader);
+
+    *guard = oldGuard;
+
+    free(a);
+    free(b);
+    For(extra) free(it);
+
+    DEBUG_memory->verify_heap();
+#endif
+}
+
+TEST(allocation_profiler) {
+    array<s64 *> blocks;
+    array_reserve(blocks, 2000);  // So the array itself doesn't get sampled
+    defer(free(blocks));
+
+    allocation_profiler_reset();
+    allocation_profiler_start(1_KiB);
+
+    For(range(2000)) array_append(blocks, allocate_array<s64>(32));  // 256 bytes each, about one sample every 4 allocations
+
+    allocation_profiler_stop();
+
+    assert_true(AllocationProfiler->Sites.Count > 0);
+    assert_true(AllocationProfiler->Samples.Count > 0);
+
+    s64 live = 0, allocated = 0;
+    for (auto [k, v] : AllocationProfiler->Sites) live += v->LiveBytes, allocated += v->AllocatedBytes;
+    assert_true(live > 0);
+    assert_eq(live, allocated);
+
+    string report = allocation_profiler_report(3);
+    defer(free(report));
+    assert_true(report.Length > 0);
+
+    // Frees are still recorded after stopping
+    For(blocks) free(it);
+    blocks.Count = 0;
+
+    assert_eq(AllocationProfiler->Samples.Count, 0);
+
+    live = 0;
+    for (auto [k, v] : AllocationProfiler->Sites) live += v->LiveBytes;
+    assert_eq(live, 0);
+
+    allocation_profiler_reset();
+}
+
+TEST(stats_allocator) {
+    s64 poolSize = 64_KiB;
+    void *pool = os_allocate_block(poolSize);
+    defer(os_free_block(pool));
+
+    arena_allocator_data arenaData;
+    allocator arena = {arena_allocator, &arenaData};
+    allocator_add_pool(arena, pool, poolSize);
+
+    stats_allocator_data data;
+    data.Parent = arena;
+    allocator alloc = {stats_allocator, &data};
+
+    auto *a = allocate_array<byte>(100, {.Alloc = alloc});
+    auto *b = allocate_array<byte>(1000, {.Alloc = alloc});
+
+    s64 sizeA = general_get_required_size(alloc, 100), sizeB = general_get_required_size(alloc, 1000);
+
+    auto stats = stats_allocator_get_snapshot(&data);
+    assert_eq(stats.AllocationCount, 2);
+    assert_eq(stats.LiveBytes, sizeA + sizeB);
+    assert_eq(stats.LiveBytes, arenaData.TotalUsed);
+    assert_eq(stats.SizeHistogram[msb((u64) sizeA)] + stats.SizeHistogram[msb((u64) sizeB)], 2);
+
+    free(a);
+    stats = stats_allocator_get_snapshot(&data);
+    assert_eq(stats.FreeCount, 1);
+    assert_eq(stats.LiveBytes, sizeB);
+    assert_eq(stats.PeakBytes, sizeA + sizeB);
+
+    stats_allocator_reset_peak(&data);
+    assert_eq(stats_allocator_get_snapshot(&data).PeakBytes, sizeB);
+
+    // _b_ is at the top of the arena, so this resizes in place
+    b = reallocate_array(b, 2000);
+    stats = stats_allocator_get_snapshot(&data);
+    assert_eq(stats.AllocationCount, 2);
+    assert_eq(stats.LiveBytes, general_get_required_size(alloc, 2000));
+
+    string formatted = sprint("{}", stats);
+    defer(free(formatted));
+    assert_true(find_substring(formatted, "AllocationCount: 2") != -1);
+
+    free_all(alloc);
+    assert_eq(stats_allocator_get_snapshot(&data).LiveBytes, 0);
+}
+
+TEST(os_reserve_commit) {
+    s64 pageSize = os_get_page_size();
+    assert_true(pageSize > 0);
+
+    s64 size = 1024 * pageSize;
+    auto *base = (byte *) os_reserve_memory(size);
+    assert_true(base != null);
+    defer(os_release_memory(base, size));
+
+    // Only the committed pages are usable
+    assert_true(os_commit_memory(base, 2 * pageSize));
+    fill_memory(base, 0xAB, 2 * pageSize);
+    assert_eq(base[2 * pageSize - 1], 0xAB);
+
+    assert_true(os_commit_memory(base + 100 * pageSize, pageSize));
+    base[100 * pageSize] = 1;
+
+    // Recommitting gives zeroed pages
+    os_decommit_memory(base, 2 * pageSize);
+    assert_true(os_commit_memory(base, pageSize));
+    assert_eq(base[0], 0);
+
+    auto *huge = (byte *) os_allocate_huge_block(4_MiB);
+    assert_true(huge != null);
+    huge[4_MiB - 1] = 1;
+    assert_true(os_get_block_size(huge) >= 4_MiB);
+#if OS == LINUX
+    // The mapping (which starts with the block header) is huge page aligned, otherwise the first and last huge pages can't be used
+    assert_lt((u64) huge % OS_HUGE_PAGE_SIZE, (u64) pageSize);
+#endif
+    os_free_block(huge);
+
+#if OS == LINUX
+    auto *hugeRange = (byte *) os_reserve_memory(4_MiB, true);
+    assert_true(hugeRange != null);
+    assert_eq((u64) hugeRange % OS_HUGE_PAGE_SIZE, 0);
+    os_release_memory(hugeRange, 4_MiB);
+#endif
+}
+
+TEST(virtual_arena_allocator) {
+    virtual_arena_allocator_data data;
+    data.Reserved = 1_GiB;
+    defer(virtual_arena_allocator_release(&data));
+
+    allocator alloc = {virtual_arena_allocator, &data};
+
+    PUSH_ALLOC(alloc) {
+        array<s64> arr;
+
+        array_reserve(arr, 64_KiB);  // Large enough to start with the medium header, so the header kind doesn't change while growing
+        auto *first = arr.Data;
+
+        // Grows way past the commit granularity and never moves
+        For(range(1_MiB)) array_append(arr, it);
+        assert_eq(arr.Data, first);
+        assert_eq(arr[1_MiB - 1], 1_MiB - 1);
+        assert_true(data.Committed >= 8_MiB);
+    }
+
+    // Allocations larger than what's committed just commit more
+    auto *big = allocate_array<byte>(32_MiB, {.Alloc = alloc});
+    big[32_MiB - 1] = 1;
+
+    s64 savepoint = virtual_arena_allocator_get_savepoint(&data);
+    allocate_array<byte>(100, {.Alloc = alloc});
+    virtual_arena_allocator_rollback(&data, savepoint);
+    assert_eq(data.TotalUsed, savepoint);
+
+    free_all(alloc);
+    assert_eq(data.TotalUsed, 0);
+    assert_true(data.Committed <= data.KeepCommitted);
+
+    // The memory which stayed committed is still usable
+    auto *again = allocate_array<byte>(1_KiB, {.Alloc = alloc});
+    assert_true(again > data.Base && again + 1_KiB <= data.Base + data.Committed);
+    again[0] = 1;
+}
+
+// Random allocations (mostly small, sometimes large) with a random half of them freed along the way, until the allocator runs out of memory.
+// Returns the fraction of the pool that was live when the first allocation failed (higher means less fragmentation).
+file_scope f64 fragmentation_workload(allocator alloc, s64 poolSize, s64 *operations) {
+    u64 rng = 0x2545F4914F6CDD1Dull;
+    auto next = [&]() {
+        rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17;
+        return rng;
+    };
+
+    array<byte *> live;
+    defer(free(live));
+    array_reserve(live, poolSize / 16);
+
+    s64 liveBytes = 0;
+    *operations = 0;
+    while (true) {
+        if (live.Count && next() % 2 == 0) {
+            s64 index = next() % live.Count;
+            liveBytes -= general_get_required_size(alloc, allocation_get_size(live[index]));
+            free(live[index]);
+            live[index] = live[live.Count - 1];
+            --live.Count;
+        } else {
+            s64 size = next() % 8 == 0 ? 512 + next() % 8_KiB : 16 + next() % 240;
+
+            // Don't trip the assert in general_allocate, ask the allocator directly first
+            s64 required = general_get_required_size(alloc, size);
+            void *probe = alloc.Function(allocator_mode::ALLOCATE, alloc.Context, required, null, 0, 0);
+            if (!probe) break;
+            alloc.Function(allocator_mode::FREE, alloc.Context, 0, probe, required, 0);
+
+            array_append(live, allocate_array<byte>(size, {.Alloc = alloc}));
+            liveBytes += required;
+        }
+        ++*operations;
+    }
+
+    For(live) free(it);
+    return (f64) liveBytes / poolSize;
+}
+
+TEST(buddy_allocator) {
+    s64 poolSize = 4_MiB;
+    void *pool = os_allocate_block(poolSize);
+    defer(os_free_block(pool));
+
+    buddy_allocator_data data;
+    allocator alloc = {buddy_allocator, &data};
+    allocator_add_pool(alloc, pool, poolSize);
+
+    // Growing a block into its free buddies doesn't move it
+    PUSH_ALLOC(alloc) {
+        array<byte> buffer;
+        array_reserve(buffer, 64_KiB);
+        auto *first = buffer.Data;
+
+        For(range(1_MiB)) array_append(buffer, (byte) it);
+        assert_eq(buffer.Data, first);
+        assert_eq(buffer[1_MiB - 1], (byte) (1_MiB - 1));
+
+        free(buffer);
+    }
+
+    // Everything was freed, so the whole pool merged back (the largest block is available again)
+    void *large = alloc.Function(allocator_mode::ALLOCATE, alloc.Context, 2_MiB, null, 0, 0);
+    assert_true(large != null);
+    alloc.Function(allocator_mode::FREE, alloc.Context, 0, large, 2_MiB, 0);
+
+    // Comparison with TLSF on the same workload
+    void *tlsfPool = os_allocate_block(poolSize);
+    defer(os_free_block(tlsfPool));
+
+    tlsf_allocator_data tlsfData;
+    allocator tlsf = {tlsf_allocator, &tlsfData};
+    allocator_add_pool(tlsf, tlsfPool, poolSize);
+
+    s64 buddyOps, tlsfOps;
+
+    time_t start = os_get_time();
+    f64 buddyUsage = fragmentation_workload(alloc, poolSize, &buddyOps);
+    f64 buddyTime = os_time_to_seconds(os_get_time() - start);
+
+    start = os_get_time();
+    f64 tlsfUsage = fragmentation_workload(tlsf, poolSize, &tlsfOps);
+    f64 tlsfTime = os_time_to_seconds(os_get_time() - start);
+
+    print("\n\t\tbuddy: {:.1f}% of the pool live when full, {} ops in {:f} seconds\n", buddyUsage * 100, buddyOps, buddyTime);
+    print("\t\ttlsf:  {:.1f}% of the pool live when full, {} ops in {:f} seconds\n", tlsfUsage * 100, tlsfOps, tlsfTime);
+    For(range(45)) print(" ");
+
+    assert_true(buddyUsage > 0.3);
+}
+
+TEST(large_allocation_threshold) {
+    allocator osAlloc = {os_allocator, null};
+
+    auto newContext = Context;
+    newContext.LargeAllocThreshold = 256_KiB;
+
+    PUSH_CONTEXT(newContext) {
+        // Below the threshold we still use the context allocator
+        auto *small = allocate_array<byte>(1_KiB);
+        assert_true(allocation_get_allocator(small) == Context.Alloc);
+        free(small);
+
+        auto *large = allocate_array<byte>(1_MiB);
+        assert_true(allocation_get_allocator(large) == osAlloc);
+        large[1_MiB - 1] = 1;
+        free(large);
+
+        // An array which grows over the threshold moves to its own pages, after that growing it remaps them
+        array<s64> arr;
+        For(range(1_MiB)) array_append(arr, it);
+        assert_true(allocation_get_allocator(arr.Data) == osAlloc);
+        For(range(1_MiB)) assert_eq(arr[it], it);
+
+        free(arr);
+
+        // Shrinking below the threshold doesn't send the block back to the context allocator
+        auto *data = allocate_array<s64>(64_KiB);
+        data[1_KiB - 1] = 42;
+        data = reallocate_array(data, 1_KiB);
+        assert_true(allocation_get_allocator(data) == osAlloc);
+        assert_eq(data[1_KiB - 1], 42);
+        free(data);
+
+        // Arenas and the temporary allocator free their blocks with free_all(), so large blocks must stay in them
+        auto *temp = allocate_array<byte>(1_MiB, {.Alloc = Context.TempAlloc});
+        assert_true(allocation_get_allocator(temp) == Context.TempAlloc);
+        free_all(Context.TempAlloc);
+
+        PUSH_ALLOC(Context.TempAlloc) {
+            auto *pushed = allocate_array<byte>(1_MiB);
+            assert_true(allocation_get_allocator(pushed) == Context.TempAlloc);
+        }
+        free_all(Context.TempAlloc);
+    }
+}
+
+TEST(allocate_batch) {
+    struct node {
+        s64 A, B, C;
+    };
+
+    // Pool allocator (native batches): the slots come in one request and are carved in order
+    {
+        pool_allocator_data poolData;
+        allocator pool = {pool_allocator, &poolData};
+        poolData.ElementSize = general_get_required_size(pool, sizeof(node));
+
+        s64 poolSize = 64_KiB;
+        void *block = os_allocate_block(poolSize);
+        defer(os_free_block(block));
+        allocator_add_pool(pool, block, poolSize);
+
+        stats_allocator_data statsData;
+        statsData.Parent = pool;
+        allocator alloc = {stats_allocator, &statsData};
+
+        node *nodes[100];
+        allocate_batch(nodes, 100, {.Alloc = alloc});
+
+        For(range(100)) {
+            nodes[it]->A = it;
+            assert_true(allocation_get_allocator(nodes[it]) == alloc);
+            if (it) assert_eq((byte *) nodes[it] - (byte *) nodes[it - 1], poolData.ElementSize);
+        }
+
+        auto stats = stats_allocator_get_snapshot(&statsData);
+        assert_eq(stats.AllocationCount, 100);
+
+        // Each block can still be freed on its own
+        free(nodes[50]);
+        nodes[50] = null;
+        For(range(100)) if (nodes[it]) assert_eq(nodes[it]->A, it);
+
+        free_batch(nodes, 100);
+
+        stats = stats_allocator_get_snapshot(&statsData);
+        assert_eq(stats.FreeCount, 100);
+        assert_eq(stats.LiveBytes, 0);
+    }
+
+    // Out of memory in the middle of a batch: we get the blocks which fit, the rest are null
+    {
+        pool_allocator_data poolData;
+        allocator pool = {pool_allocator, &poolData};
+        poolData.ElementSize = general_get_required_size(pool, sizeof(node));
+
+        s64 poolSize = 4_KiB;
+        void *block = os_allocate_block(poolSize);
+        defer(os_free_block(block));
+        allocator_add_pool(pool, block, poolSize);
+
+        node *nodes[1000];
+        s64 allocated = allocate_batch(nodes, 1000, {.Alloc = pool});
+        assert_true(allocated > 0);
+        assert_lt(allocated, 1000);
+
+        For(range(1000)) assert_eq(nodes[it] != null, it < allocated);
+
+        free_batch(nodes, 1000);
+    }
+
+    // Blocks larger than the pool's element size: nothing is allocated and every block is null
+    {
+        pool_allocator_data poolData;
+        allocator pool = {pool_allocator, &poolData};
+        poolData.ElementSize = general_get_required_size(pool, sizeof(node));
+
+        s64 poolSize = 4_KiB;
+        void *block = os_allocate_block(poolSize);
+        defer(os_free_block(block));
+        allocator_add_pool(pool, block, poolSize);
+
+        struct big_node {
+            node Nodes[4];
+        };
+
+        big_node *nodes[10];
+        fill_memory(nodes, 0xCD, sizeof(nodes));  // Garbage, like an uninitialized array
+
+        assert_eq(allocate_batch(nodes, 10, {.Alloc = pool}), 0);
+        For(range(10)) assert_true(!nodes[it]);
+    }
+
+    // Thread-cached TLSF: one lock per batch instead of one per block
+    {
+        s64 poolSize = 4_MiB;
+        void *block = os_allocate_block(poolSize);
+        defer(os_free_block(block));
+
+        thread_cache_allocator_data data;
+        allocator alloc = {thread_cache_allocator, &data};
+        allocator_add_pool(alloc, block, poolSize);
+
+        constexpr s64 COUNT = 20000;
+
+        auto **nodes = allocate_array<node *>(COUNT);
+        defer(free(nodes));
+
+        time_t start = os_get_time();
+        For(range(COUNT)) nodes[it] = allocate<node>({.Alloc = alloc});
+        For(range(COUNT)) free(nodes[it]);
+        f64 oneByOne = os_time_to_seconds(os_get_time() - start);
+
+        start = os_get_time();
+        allocate_batch(nodes, COUNT, {.Alloc = alloc});
+        For(range(COUNT)) nodes[it]->C = it;
+        For(range(COUNT)) assert_eq(nodes[it]->C, it);
+        free_batch(nodes, COUNT);
+        f64 batched = os_time_to_seconds(os_get_time() - start);
+
+        print("\n\t\t{} nodes one by one: {:f} seconds, batched: {:f} seconds\n", COUNT, oneByOne, batched);
+        For(range(45)) print(" ");
+
+        thread_cache_allocator_flush(&data);
+        assert_eq(tlsf_check(data.Shared.State), 0);
+    }
+}
+
+file_scope thread_heap_allocator_data ThreadHeapData;
+file_scope s64 *ThreadHeapBlocks[8][1024];
+
+file_scope void thread_heap_producer(void *blocks) {
+    allocator alloc = {thread_heap_allocator, &ThreadHeapData};
+
+    auto **b = (s64 **) blocks;
+    For(range(1024)) {
+        b[it] = allocate<s64>({.Alloc = alloc});
+        *b[it] = it;
+    }
+}
+
+file_scope void thread_heap_consumer(void *blocks) {
+    // These are remote frees, the blocks go on their heap's lock-free list
+    auto **b = (s64 **) blocks;
+    For(range(1024)) {
+        assert_eq(*b[it], it);
+        free(b[it]);
+    }
+}
+
+file_scope void run_threads(void (*function)(void *)) {
+    array<thread::thread> threads;
+    defer(free(threads));
+
+    For(range(8)) {
+        array_append(threads)->init_and_launch(function, ThreadHeapBlocks[it]);
+    }
+
+    For(threads) {
+        it.wait();
+    }
+}
+
+TEST(thread_heap_allocator) {
+    allocator alloc = {thread_heap_allocator, &ThreadHeapData};
+    defer(thread_heap_allocator_release(&ThreadHeapData));
+
+    // Blocks freed on the owning thread go straight back to its heap
+    auto *a = allocate<s64>({.Alloc = alloc});
+    free(a);
+    auto *b = allocate<s64>({.Alloc = alloc});
+    assert_eq(a, b);
+    free(b);
+
+    run_threads(thread_heap_producer);
+    s64 segments = ThreadHeapData.SegmentsUsed;
+
+    time_t start = os_get_time();
+    run_threads(thread_heap_consumer);
+    print("\n\t\t8 threads, 8192 remote frees in {:f} seconds.\n", os_time_to_seconds(os_get_time() - start));
+    For(range(45)) print(" ");
+
+    // The producers have exited, new threads adopt their heaps and get the remotely freed blocks back (no new segments)
+    run_threads(thread_heap_producer);
+    assert_eq(ThreadHeapData.SegmentsUsed, segments);
+
+    For_as(t, range(8)) {
+        For(range(1024)) {
+            assert_eq(*ThreadHeapBlocks[t][it], it);
+            free(ThreadHeapBlocks[t][it]);
+        }
+    }
+
+    // A block larger than a segment gets a run of segments
+    auto *large = allocate_array<byte>(THREAD_HEAP_SEGMENT_SIZE * 2, {.Alloc = alloc});
+    large[THREAD_HEAP_SEGMENT_SIZE * 2 - 1] = 1;
+    free(large);
+}
+
+TEST(allocation_trace) {
+    allocation_trace_reset();
+
+    auto *before = allocate<s64>();  // Allocated before recording, freeing it shouldn't show up
+
+    allocation_trace_start();
+    auto *a = allocate_array<byte>(100);
+    auto *b = allocate_array<byte>(3000, {.Alignment = 64});
+    a = reallocate_array(a, 200);
+    free(b);
+    free(before);
+    allocation_trace_stop();
+
+    free(a);  // Not recording anymore
+
+    assert_eq(AllocationTrace->EventsCount, 4);
+
+    string file = "allocation_trace_test.trace";
+    assert_true(allocation_trace_save(file));
+    defer(path_delete_file(file));
+
+    array<allocation_trace_event> events;
+    defer(free(events));
+    assert_true(allocation_trace_load(&events, file));
+
+    assert_eq(events.Count, 4);
+    assert_true(events[0].Op == allocation_trace_op::ALLOCATE);
+    assert_eq(events[0].ID, 0);
+    assert_eq(events[0].Size, 100);
+    assert_true(events[1].Op == allocation_trace_op::ALLOCATE);
+    assert_eq(events[1].ID, 1);
+    assert_eq(events[1].Size, 3000);
+    assert_eq(events[1].Alignment, 64);
+    assert_true(events[2].Op == allocation_trace_op::RESIZE);
+    assert_eq(events[2].ID, 0);
+    assert_eq(events[2].Size, 200);
+    assert_true(events[3].Op == allocation_trace_op::FREE);
+    assert_eq(events[3].ID, 1);
+
+    // A truncated trace is rejected
+    array<allocation_trace_event> truncated;
+    defer(free(truncated));
+    assert_false(allocation_trace_decode(&truncated, (const byte *) "LSTRACE1\0\x80", 10));
+
+    // So is one with an alignment we would never allocate with (2^40)
+    array<allocation_trace_event> badAlignment;
+    defer(free(badAlignment));
+    assert_false(allocation_trace_decode(&badAlignment, (const byte *) "LSTRACE1\0\x10\x28", 11));
+
+    // Record something with more going on and replay it against all allocators
+    allocation_trace_reset();
+    allocation_trace_start();
+    {
+        array<s64> numbers;
+        hash_table<s64, s64> table;
+        For(range(2000)) {
+            array_append(numbers, it);
+            set(table, it, it * 2);
+            if (it % 3 == 0) free(allocate_array<byte>(16 + it % 500));
+        }
+        free(numbers);
+        free(table);
+    }
+    allocation_trace_stop();
+
+    array<allocation_trace_event> recorded;
+    defer(free(recorded));
+
+    assert_true(allocation_trace_save(file));
+    assert_true(allocation_trace_load(&recorded, file));
+    assert_eq(recorded.Count, AllocationTrace->EventsCount);
+
+    // Every block is freed, so nothing should be live after replaying against the general purpose allocator
+    tlsf_allocator_data data;
+    void *pool = os_allocate_block(8_MiB);
+    defer(os_free_block(pool));
+    allocator_add_pool({tlsf_allocator, &data}, pool, 8_MiB);
+
+    auto result = replay_allocation_trace(recorded, {tlsf_allocator, &data});
+    assert_false(result.OutOfMemory);
+    assert_eq(result.Operations, recorded.Count);
+    assert_gt(result.PeakFootprint, 0);
+
+    replay_allocation_trace_against_all(recorded);
+    For(range(45)) print(" ");
+
+    allocation_trace_reset();
+}
+
+#if OS == LINUX && !defined LSTD_DONT_REPLACE_MALLOC
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Frees a block the main thread allocated (it goes to this thread's cache, which is flushed when the thread exits)
+// and hands back one allocated here for the main thread to free.
+file_scope void *posix_malloc_cross_thread_worker(void *block) {
+    assert_eq(*(s64 *) block, 42);
+    ::free(block);
+
+    auto *result = (s64 *) ::malloc(sizeof(s64));
+    *result = 43;
+    return result;
+}
+
+// Keeps the shared pool locks busy (the blocks are larger than the thread cache classes) until _stop_ is set
+file_scope void *posix_malloc_fork_worker(void *stop) {
+    while (!atomic_load((s32 *) stop)) {
+        void *p = ::malloc(8000);
+        ::free(p);
+    }
+    return null;
+}
+#endif
+
+TEST(posix_malloc) {
+#if OS == LINUX && !defined LSTD_DONT_REPLACE_MALLOC
+    // Small blocks come from the pools, the large ones get their own mapping
+    For(to_stack_array<s64>(1, 16, 100, 4000, 300_KiB, 4_MiB)) {
+        auto *p = (byte *) ::malloc(it);
+        assert_true(p);
+        assert_eq((u64) p % 16, 0);
+        assert_true((s64) malloc_usable_size(p) >= it);
+        fill_memory(p, 0xAB, malloc_usable_size(p));
+        ::free(p);
+    }
+    assert_eq((s64) malloc_usable_size(null), 0);
+
+    // calloc zeroes, even memory which was dirty before
+    auto *dirty = (byte *) ::malloc(256);
+    fill_memory(dirty, 0xCD, 256);
+    ::free(dirty);
+
+    auto *zeroed = (byte *) ::calloc(16, 16);
+    assert_true(zeroed);
+    For(range(256)) assert_eq(zeroed[it], 0);
+    ::free(zeroed);
+
+    // ... and checks for overflow of count * size
+    errno = 0;
+    assert_true(!::calloc((size_t) -1 / 2, 4));
+    assert_eq(errno, ENOMEM);
+
+    // realloc(null, n) is malloc, realloc(p, 0) frees
+    auto *r = (byte *) ::realloc(null, 64);
+    assert_true(r);
+    assert_true(malloc_usable_size(r) >= 64);
+    assert_true(!::realloc(r, 0));
+
+    // Growing keeps the contents, in the pools, across the mapping threshold and between mappings
+    r = (byte *) ::malloc(100);
+    For(range(100)) r[it] = (byte) it;
+    For(to_stack_array<s64>(200, 1_MiB, 8_MiB, 50)) {
+        r = (byte *) ::realloc(r, it);
+        assert_true(r);
+        assert_true((s64) malloc_usable_size(r) >= it);
+        For_as(i, range(50)) assert_eq(r[i], (byte) i);
+    }
+    ::free(r);
+
+    // Alignment
+    For(to_stack_array<s64>(8, 64, 4096, 32768)) {
+        void *p = null;
+        assert_eq(posix_memalign(&p, it, 1000), 0);
+        assert_eq((u64) p % it, 0);
+        assert_true(malloc_usable_size(p) >= 1000);
+        ::free(p);
+
+        auto *q = ::aligned_alloc(it, 300_KiB);
+        assert_eq((u64) q % it, 0);
+        assert_true(malloc_usable_size(q) >= 300_KiB);
+        ::free(q);
+    }
+
+    void *invalid = null;
+    assert_eq(posix_memalign(&invalid, 3, 16), EINVAL);
+    assert_eq(posix_memalign(&invalid, 4, 16), EINVAL);  // Must be a multiple of sizeof(void *)
+    assert_true(!invalid);
+
+    // Aligned blocks keep their alignment when reallocated
+    auto *aligned = (byte *) ::aligned_alloc(256, 100);
+    aligned = (byte *) ::realloc(aligned, 5000);
+    assert_eq((u64) aligned % 256, 0);
+    ::free(aligned);
+
+    // Blocks freed on a different thread than the one which allocated them
+    auto *block = (s64 *) ::malloc(sizeof(s64));
+    *block = 42;
+
+    pthread_t thread;
+    assert_eq(pthread_create(&thread, null, posix_malloc_cross_thread_worker, block), 0);
+
+    void *fromThread = null;
+    pthread_join(thread, &fromThread);
+    assert_eq(*(s64 *) fromThread, 43);
+    ::free(fromThread);
+
+    // Forking while another thread is inside the allocator mustn't leave its locks held in the child
+    s32 stop = 0;
+    assert_eq(pthread_create(&thread, null, posix_malloc_fork_worker, &stop), 0);
+
+    For(range(50)) {
+        pid_t child = fork();
+        if (child == 0) {
+            void *p = ::malloc(8000);
+            ::free(p);
+            _exit(p ? 0 : 1);
+        }
+
+        s32 status = -1;
+        assert_eq(waitpid(child, &status, 0), child);
+        assert_true(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    atomic_swap(&stop, 1);
+    pthread_join(thread, null);
+#endif
+}
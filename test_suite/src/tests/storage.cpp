@@ -59,6 +59,89 @@ TEST(array) {
     assert_eq(f, 3);
 }
 
+TEST(small_array) {
+    small_array<s64, 4> a;
+    defer(free(a));
+
+    // Fits inline, no allocation
+    For(range(4)) array_append(a, it);
+    assert_eq(a.Allocated, 0);
+    assert_true(a.Data == (s64 *) a.StackData);
+
+    // array_like.h works on it
+    assert_eq(find(a, 2), 2);
+    assert_true(has(a, 3));
+    assert_true(a == to_stack_array<s64>(0, 1, 2, 3));
+
+    // Copies point to their own inline storage
+    small_array<s64, 4> copy = a;
+    a[0] = 100;
+    assert_eq(copy[0], 0);
+    assert_true(copy.Data == (s64 *) copy.StackData);
+
+    // Spills to the heap
+    array_append(a, 4);
+    assert_gt(a.Allocated, 4);
+    assert_true(a == to_stack_array<s64>(100, 1, 2, 3, 4));
+
+    array_insert_at(a, 1, -1);
+    array_remove_at(a, 0);
+    array_remove_unordered(a, 0);
+    assert_true(a == to_stack_array<s64>(4, 1, 2, 3));
+
+    free(a);
+    assert_eq(a.Count, 0);
+    assert_true(a.Data == (s64 *) a.StackData);
+
+    array_append(a, 7);
+    assert_eq(a[-1], 7);
+    assert_eq(a.Allocated, 0);
+}
+
+TEST(soa_array) {
+    // Position, velocity, lifetime
+    soa_array<v3, v3, f32> particles;
+    defer(free(particles));
+
+    For(range(100)) append(particles, v3((f32) it, 0, 0), v3(1, 2, 3), (f32) it);
+    assert_eq(particles.Count, 100);
+
+    // Every column starts aligned, all of them in one block
+    For(range(particles.FIELD_COUNT)) assert_eq((u64) particles.Columns[it] % SOA_ARRAY_ALIGNMENT, 0);
+    assert_true(particles.Columns[0] < particles.Columns[1] && particles.Columns[1] < particles.Columns[2]);
+
+    auto positions = column<0>(particles);
+    auto velocities = column<1>(particles);
+    For(range(particles.Count)) positions[it] += velocities[it];
+
+    // The lanes past Count are inside the block too
+    auto lifetimes = column_simd<2, 4>(particles);
+    assert_eq(lifetimes.Count, 25);
+    For(lifetimes) it = simd<f32, 4>::sub(it, 0.5f);
+
+    For(range(particles.Count)) {
+        auto p = column<0>(particles)[it];
+        assert_eq(p.x, (f32) it + 1);
+        assert_eq(p.z, 3);
+        assert_eq(column<2>(particles)[it], (f32) it - 0.5f);
+    }
+
+    // The last element moves to the removed slot, in every column
+    remove_unordered(particles, 10);
+    assert_eq(particles.Count, 99);
+    assert_eq(column<0>(particles)[10].x, 100);
+    assert_eq(column<2>(particles)[10], 98.5f);
+
+    soa_array<v3, v3, f32> copy;
+    clone(&copy, particles);
+    defer(free(copy));
+
+    reset(particles);
+    assert_eq(particles.Count, 0);
+    assert_eq(copy.Count, 99);
+    assert_eq(column<2>(copy)[10], 98.5f);
+}
+
 TEST(hash_table) {
     hash_table<string, s32> t;
     defer(free(t));
@@ -133,4 +216,252 @@ TEST(hash_table_alignment) {
 
     add(simdTable, {1, 2}, {1, 2, 3});
     add(simdTable, {1, 3}, {4, 7, 9});
-}
\ No newline at end of file
+}
+
+TEST(hash_table_many) {
+    hash_table<s64, s64> t;
+    defer(free(t));
+
+    For(range(10000)) add(t, it, it * 2);
+    assert_eq(t.Count, 10000);
+
+    // Grows at 7/8 full instead of at half
+    assert_le(t.Allocated, 16384);
+
+    For(range(10000)) {
+        auto [k, v] = find(t, it);
+        assert_true(v && *v == it * 2);
+    }
+    assert_false(has(t, 10000));
+    assert_false(has(t, -1));
+
+    // Remove the odd ones, lookups must still get past the removed slots
+    For(range(10000)) if (it % 2) assert_true(remove(t, it));
+    assert_eq(t.Count, 5000);
+
+    For(range(10000)) assert_eq(has(t, it), it % 2 == 0);
+
+    // Removed slots get reused
+    For(range(10000)) if (it % 2) add(t, it, it * 2);
+    assert_eq(t.Count, 10000);
+    For(range(10000)) assert_true(has(t, it));
+
+    s64 iterated = 0;
+    for (auto [k, v] : t) {
+        assert_eq(*v, *k * 2);
+        ++iterated;
+    }
+    assert_eq(iterated, 10000);
+}
+
+TEST(hash_table_churn) {
+    hash_table<s64, s64> t;
+    defer(free(t));
+
+    // Keep ~1000 live keys while inserting and removing a lot of different ones (like a cache).
+    // Deleted slots must be reclaimed, otherwise the table would keep growing (or lookups would scan most of it).
+    For(range(1000)) add(t, it, it);
+
+    s64 allocated = t.Allocated;
+    For(range(1000, 200000)) {
+        add(t, it, it);
+        assert_true(remove(t, it - 1000));
+    }
+
+    assert_eq(t.Count, 1000);
+    assert_le(t.Allocated, allocated * 2);
+    assert_le(t.SlotsFilled * 8, t.Allocated * 7);
+
+    For(range(199000, 200000)) assert_eq(*find(t, it).Value, it);
+    assert_false(has(t, 198999));
+}
+
+TEST(hash_table_heterogeneous_lookup) {
+    hash_table<string, s32> t;
+    defer(free(t));
+
+    set(t, "hello", 1);
+    set(t, "world", 2);
+
+    // Look up from a buffer, e.g. a token in a file we are parsing, without making a string
+    const char *text = "hello world";
+    array<utf8> first((utf8 *) text, 5);
+    bytes second((byte *) text + 6, 5);
+
+    assert_eq(get_hash(first), get_hash(string("hello")));
+    assert_eq(*find(t, first).Value, 1);
+    assert_eq(*find(t, second).Value, 2);
+    assert_false(has(t, array<utf8>((utf8 *) text, 4)));
+
+    assert_true(remove(t, second));
+    assert_false(has(t, "world"));
+    assert_eq(t.Count, 1);
+
+    // Keys which aren't ASCII (utf8 is signed, so these bytes compare as negative) are found from both kinds of views.
+    // The views point to a copy, views of the same memory compare equal without looking at the bytes.
+    string greeting = u8"grüße";
+    set(t, greeting, 3);
+
+    stack_array<byte, 16> copy;
+    copy_memory(copy.Data, greeting.Data, greeting.Count);
+
+    assert_eq(*find(t, array<utf8>((utf8 *) copy.Data, greeting.Count)).Value, 3);
+    assert_eq(*find(t, bytes(copy.Data, greeting.Count)).Value, 3);
+    assert_false(has(t, bytes(copy.Data, greeting.Count - 1)));
+
+    // Keys which carry their hash
+    hash_table<hashed<string>, s32> cached;
+    defer(free(cached));
+
+    hashed<string> key = string("player_spawn");
+    assert_eq(key.Hash, get_hash(string("player_spawn")));
+
+    set(cached, key, 42);
+    assert_eq(*find(cached, key).Value, 42);
+    assert_false(has(cached, hashed<string>(string("player_spawn"), key.Hash + 1)));
+}
+
+TEST(btree) {
+    btree<s64, s64> t;
+    defer(free(t));
+
+    // Added out of order, a permutation of [0, 10000)
+    For(range(10000)) assert_true(add(t, (it * 7919) % 10000, it));
+    assert_false(add(t, 5, 0));
+    assert_eq(t.Count, 10000);
+
+    For(range(10000)) assert_eq(*find(t, (it * 7919) % 10000).Value, it);
+    assert_false(has(t, 10000));
+
+    set(t, 5, -5);
+    assert_eq(*find(t, 5).Value, -5);
+
+    s64 expected = 0;
+    for (auto [k, v] : t) {
+        assert_eq(*k, expected);
+        ++expected;
+    }
+    assert_eq(expected, 10000);
+
+    // Remove the odd ones, nodes merge and borrow on the way
+    For(range(10000)) if (it % 2) assert_true(remove(t, it));
+    assert_false(remove(t, 1));
+    assert_eq(t.Count, 5000);
+
+    assert_eq(*(*lower_bound(t, 101)).Key, 102);
+    assert_eq(*(*lower_bound(t, 102)).Key, 102);
+    assert_eq(*(*upper_bound(t, 102)).Key, 104);
+    assert_true(lower_bound(t, 9999) == t.end());
+
+    s64 inRange = 0;
+    For(btree_range(t, 1000, 2000)) {
+        assert_eq(*it.Key, 1000 + inRange * 2);
+        ++inRange;
+    }
+    assert_eq(inRange, 500);
+
+    For(range(10000)) remove(t, it);
+    assert_eq(t.Count, 0);
+    assert_true(t.begin() == t.end());
+
+    btree_set<string> names;
+    defer(free(names));
+
+    add(names, string("beta"));
+    add(names, string("alpha"));
+    add(names, string("gamma"));
+    assert_eq(*(*names.begin()).Key, string("alpha"));
+    assert_true(has(names, string("gamma")));
+}
+
+TEST(btree_bulk_load) {
+    array<s64> keys;
+    defer(free(keys));
+    For(range(100000)) array_append(keys, it * 3);
+
+    btree<s64, s64> t;
+    defer(free(t));
+    bulk_load(t, keys.Data, keys.Data, keys.Count);
+    assert_eq(t.Count, 100000);
+
+    For(range(100000)) assert_eq(*find(t, it * 3).Value, it * 3);
+    assert_false(has(t, 1));
+
+    // Full leaves split on the first add
+    add(t, 1, 1);
+    add(t, 299998, 1);
+    assert_eq(*(*upper_bound(t, 0)).Key, 1);
+    assert_eq(*(*lower_bound(t, 299998)).Key, 299998);
+    assert_eq(t.Count, 100002);
+}
+
+TEST(btree_vs_hash_table_and_sort) {
+    constexpr s64 N = 100000;
+
+    // A permutation of [0, N) so every key is unique
+    auto key = [](s64 i) { return (i * 7919) % N; };
+
+    // Sorted iteration: add to a B-tree and walk it, vs. add to a hash table, copy the keys out and sort them
+    time_t start = os_get_time();
+    btree<s64, s64> t;
+    defer(free(t));
+    For(range(N)) add(t, key(it), it);
+
+    s64 previous = -1;
+    for (auto [k, v] : t) {
+        assert_true(*k > previous);
+        previous = *k;
+    }
+    f64 treeTime = os_time_to_seconds(os_get_time() - start);
+
+    start = os_get_time();
+    hash_table<s64, s64> table;
+    defer(free(table));
+    For(range(N)) add(table, key(it), it);
+
+    array<s64> sorted;
+    defer(free(sorted));
+    array_reserve(sorted, table.Count);
+    for (auto [k, v] : table) array_append(sorted, *k);
+    quick_sort(sorted.Data, sorted.Data + sorted.Count);
+
+    previous = -1;
+    For(sorted) {
+        assert_true(it > previous);
+        previous = it;
+    }
+    f64 sortTime = os_time_to_seconds(os_get_time() - start);
+
+    // Range queries: a B-tree descends once and walks the leaves, the sorted array needs a binary search
+    start = os_get_time();
+    s64 treeFound = 0;
+    For(range(10000)) {
+        For_as(x, btree_range(t, key(it), key(it) + 100)) ++treeFound;
+    }
+    f64 treeRangeTime = os_time_to_seconds(os_get_time() - start);
+
+    start = os_get_time();
+    s64 sortedFound = 0;
+    For(range(10000)) {
+        s64 lo = key(it);
+
+        s64 first = 0, count = sorted.Count;
+        while (count > 0) {
+            s64 half = count / 2;
+            if (sorted[first + half] < lo) {
+                first += half + 1;
+                count -= half + 1;
+            } else {
+                count = half;
+            }
+        }
+        for (; first < sorted.Count && sorted[first] < lo + 100; ++first) ++sortedFound;
+    }
+    f64 sortedRangeTime = os_time_to_seconds(os_get_time() - start);
+
+    assert_eq(treeFound, sortedFound);
+
+    print("\n\t\t{} keys, add + sorted walk: btree {:f}s, hash_table + quick_sort {:f}s.\n", N, treeTime, sortTime);
+    print("\t\t10000 range queries: btree {:f}s, sorted array {:f}s.\n", treeRangeTime, sortedRangeTime);
+    For(range(45)) print(" ");
+}
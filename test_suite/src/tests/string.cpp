@@ -1,3 +1,4 @@
+#include <lstd/memory/atom_table.h>
 #include <lstd/memory/string_builder.h>
 
 #include "../test.h"
@@ -374,3 +375,81 @@ TEST(find) {
 
     assert_eq(-1, find_any_of(a, "QRT"));
 }
+
+TEST(atom_table) {
+    atom_table table;
+    defer(atom_table_release(&table));
+
+    assert_eq(atom_table_find(&table, "hello").ID, 0);
+
+    atom a = atom_table_intern(&table, "hello");
+    atom b = atom_table_intern(&table, string("world"));
+    assert_true(a.ID);
+    assert_true(a != b);
+
+    // Same contents, same atom - from a string, a literal or a view into some other buffer
+    const char *text = "say hello";
+    assert_true(atom_table_intern(&table, bytes((byte *) text + 4, 5)) == a);
+    assert_true(atom_table_find(&table, string("world")) == b);
+    assert_eq(table.Count, 2);
+
+    assert_eq(atom_table_get_string(&table, a), string("hello"));
+    assert_eq(atom_table_get_hash(&table, a), get_hash(string("hello")));
+
+    string unicode = u8"Хеллоу";
+    atom c = atom_table_intern(&table, unicode);
+    assert_eq(atom_table_get_string(&table, c).Length, unicode.Length);
+
+    // Enough to grow the index a few times, atoms and their strings stay the same
+    For(range(10000)) {
+        string name = sprint("name_{}", it);
+        defer(free(name));
+
+        atom x = atom_table_intern(&table, name);
+        assert_eq(x.ID, (u32) it + 4);
+    }
+    assert_eq(atom_table_get_string(&table, a), string("hello"));
+    assert_true(atom_table_find(&table, "name_5000") == atom{5004});
+}
+
+file_scope atom_table SharedAtoms;
+file_scope atom AtomsByThread[8][1000];
+
+file_scope void atom_table_worker(void *data) {
+    s64 id = (s64) data;
+
+    // All threads intern the same names, each starting at a different one
+    For(range(1000)) {
+        s64 name = (it + id * 125) % 1000;
+        string str = sprint("name_{}", name);
+        defer(free(str));
+
+        AtomsByThread[id][name] = atom_table_intern(&SharedAtoms, str);
+    }
+}
+
+TEST(atom_table_threads) {
+    defer(atom_table_release(&SharedAtoms));
+
+    array<thread::thread> threads;
+    defer(free(threads));
+
+    For(range(8)) {
+        array_append(threads)->init_and_launch(atom_table_worker, (void *) it);
+    }
+
+    For(threads) {
+        it.wait();
+    }
+
+    assert_eq(SharedAtoms.Count, 1000);
+    For(range(1000)) {
+        For_as(t, range(1, 8)) {
+            assert_true(AtomsByThread[t][it] == AtomsByThread[0][it]);
+        }
+
+        string name = sprint("name_{}", it);
+        defer(free(name));
+        assert_eq(atom_table_get_string(&SharedAtoms, AtomsByThread[0][it]), name);
+    }
+}
@@ -182,3 +182,118 @@ TEST(context) {
     }
     assert_eq((void *) Context.Alloc.Function, (void *) old);
 }
+
+file_scope concurrent_hash_table<s64, s64> SharedTable;
+file_scope s32 RaceWinners = 0;
+
+file_scope void concurrent_hash_table_worker(void *data) {
+    s64 id = (s64) data;
+    s64 first = (id + 1) * 100000;
+
+    For(range(5000)) {
+        // Every thread tries to add the same keys, exactly one of them should win each
+        s64 existing = -1;
+        if (add_if_absent(SharedTable, (s64) it, id, &existing)) {
+            atomic_inc(&RaceWinners);
+        } else {
+            assert_true(existing >= 0 && existing < 8);
+        }
+
+        // Keys only this thread touches
+        add(SharedTable, first + it, (s64) it);
+        set(SharedTable, first + it, (s64) it * 2);
+
+        s64 value;
+        assert_true(find(SharedTable, first + it, &value));
+        assert_eq(value, it * 2);
+
+        if (it % 2) {
+            assert_true(remove(SharedTable, first + it, &value));
+            assert_eq(value, it * 2);
+            assert_false(has(SharedTable, first + it));
+        }
+    }
+}
+
+TEST(concurrent_hash_table) {
+    RaceWinners = 0;
+    defer(free(SharedTable));
+
+    array<thread::thread> threads;
+    defer(free(threads));
+
+    For(range(8)) {
+        array_append(threads)->init_and_launch(concurrent_hash_table_worker, (void *) it);
+    }
+
+    For(threads) {
+        it.wait();
+    }
+
+    assert_eq(RaceWinners, 5000);
+    assert_eq(count(SharedTable), 5000 + 8 * 2500);
+
+    For(range(8)) {
+        s64 first = (it + 1) * 100000;
+        assert_true(has(SharedTable, first + 2));
+        assert_false(has(SharedTable, first + 3));
+    }
+}
+
+constexpr s64 THROUGHPUT_KEYS = 1 << 16;
+constexpr s64 THROUGHPUT_LOOKUPS = 1000000;
+
+file_scope hash_table<s64, s64> LockedTable;
+
+file_scope void sharded_lookups(void *) {
+    s64 found = 0;
+    For(range(THROUGHPUT_LOOKUPS)) found += find(SharedTable, (it * 7919) & (THROUGHPUT_KEYS - 1));
+    assert_eq(found, THROUGHPUT_LOOKUPS);
+}
+
+file_scope void locked_lookups(void *) {
+    s64 found = 0;
+    For(range(THROUGHPUT_LOOKUPS)) {
+        Mutex.lock();
+        found += find(LockedTable, (it * 7919) & (THROUGHPUT_KEYS - 1)).Value != null;
+        Mutex.unlock();
+    }
+    assert_eq(found, THROUGHPUT_LOOKUPS);
+}
+
+// Returns millions of lookups per second
+file_scope f64 run_lookups(void (*function)(void *), s64 threadCount) {
+    array<thread::thread> threads;
+    defer(free(threads));
+
+    time_t start = os_get_time();
+    For(range(threadCount)) {
+        array_append(threads)->init_and_launch(function);
+    }
+
+    For(threads) {
+        it.wait();
+    }
+    return (f64) (threadCount * THROUGHPUT_LOOKUPS) / os_time_to_seconds(os_get_time() - start) / 1000000.0;
+}
+
+TEST(concurrent_hash_table_throughput) {
+    Mutex.init();
+    defer(Mutex.release());
+
+    defer(free(SharedTable));
+    defer(free(LockedTable));
+
+    For(range(THROUGHPUT_KEYS)) {
+        add(SharedTable, (s64) it, (s64) it);
+        add(LockedTable, (s64) it, (s64) it);
+    }
+
+    print("\n\t\t{:<8} {:>20} {:>20}\n", "threads", "sharded (Mlookups/s)", "mutex (Mlookups/s)");
+    for (s64 threadCount = 1; threadCount <= 8; threadCount *= 2) {
+        f64 sharded = run_lookups(sharded_lookups, threadCount);
+        f64 locked = run_lookups(locked_lookups, threadCount);
+        print("\t\t{:<8} {:>20.1f} {:>20.1f}\n", threadCount, sharded, locked);
+    }
+    For(range(45)) print(" ");
+}